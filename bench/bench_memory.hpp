@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "yq_stack.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fstream>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace bench
+{
+
+// 当前进程的常驻内存(字节), 不支持的平台返回0
+inline auto resident_bytes() -> std::size_t {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize;
+#elif defined(__linux__)
+	// /proc/self/statm: 总页数 常驻页数 ...
+	std::ifstream statm{ "/proc/self/statm" };
+	std::size_t total = 0;
+	std::size_t resident = 0;
+	if (!(statm >> total >> resident)) {
+		return 0;
+	}
+	return resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+#else
+	return 0;
+#endif
+}
+
+// 把空闲的堆内存交还系统, 避免之前的基准测试留下的页面被计入或漏算
+inline void trim_heap() noexcept {
+#if defined(__GLIBC__)
+	::malloc_trim(0);
+#endif
+}
+
+
+#if defined(__unix__)
+/**
+ * 从一整块按需提交的映射中依次切出固定大小的栈, 析构时整体释放
+ * 常驻内存只包含协程实际访问过的页面, 释放后立即归还系统;
+ * 每个栈单独mmap时十万个协程会超过vm.max_map_count
+ */
+class ArenaStackAllocator final : public yq::StackAllocator {
+public:
+	ArenaStackAllocator(std::size_t count, std::size_t stack_size):
+		m_length{ count * stack_size }
+	{
+		void* mapping = ::mmap(nullptr, m_length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mapping == MAP_FAILED) {
+			throw std::bad_alloc{};
+		}
+		m_base = static_cast<char*>(mapping);
+	}
+
+	~ArenaStackAllocator() override {
+		::munmap(m_base, m_length);
+	}
+
+	ArenaStackAllocator(const ArenaStackAllocator&) = delete;
+	ArenaStackAllocator& operator=(const ArenaStackAllocator&) = delete;
+
+	auto allocate(std::size_t size) -> yq::Stack override {
+		if (m_used + size > m_length) {
+			throw std::bad_alloc{};
+		}
+		yq::Stack stack{ m_base + m_used, size };
+		m_used += size;
+		return stack;
+	}
+
+	// 整块映射在析构时释放
+	void deallocate(yq::Stack) noexcept override {}
+
+private:
+	char* m_base{ nullptr };
+	std::size_t m_length;
+	std::size_t m_used{ 0 };
+};
+#endif
+
+} // namespace bench
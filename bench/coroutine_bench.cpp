@@ -0,0 +1,149 @@
+/**
+ * 各种协程实现的切换, 创建和内存开销对比
+ * 本文件是无栈协程Task的部分, 有栈协程的部分见coroutine_bench_stackful.cpp
+ * 对应的测试名相同, 后缀区分实现, 例如BM_RoundTrip/task与BM_RoundTrip/asm
+ * 构建目录中的coroutine_bench_json目标以JSON格式输出到coroutine_bench.json
+ */
+#include <benchmark/benchmark.h>
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "bench_memory.hpp"
+#include "yq_task.hpp"
+
+namespace {
+
+using yq::Task;
+
+constexpr std::size_t parked_count = 100000;
+
+// 记录句柄后挂起, 由基准测试直接resume
+struct Park {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> coroutine) noexcept {
+		m_slot = coroutine;
+	}
+
+	void await_resume() const noexcept {}
+
+	std::coroutine_handle<>& m_slot;
+};
+
+auto yielding(bool& stop, std::coroutine_handle<>& slot) -> Task<> {
+	while (!stop) {
+		co_await Park{ slot };
+	}
+}
+
+// 与BM_RoundTrip/asm相同, 两个协程交替恢复, 每次迭代两次往返
+void BM_RoundTrip(benchmark::State& state) {
+	bool stop = false;
+	std::coroutine_handle<> first_slot;
+	std::coroutine_handle<> second_slot;
+	auto first = yielding(stop, first_slot);
+	auto second = yielding(stop, second_slot);
+	first.m_coroutine.resume();
+	second.m_coroutine.resume();
+	for (auto _ : state) {
+		first_slot.resume();
+		second_slot.resume();
+	}
+	stop = true;
+	first_slot.resume();
+	second_slot.resume();
+	state.SetItemsProcessed(state.iterations() * 2);
+}
+
+auto empty() -> Task<> {
+	co_return;
+}
+
+// 帧来自FramePool
+void BM_CreateDestroy(benchmark::State& state) {
+	for (auto _ : state) {
+		auto task = empty();
+		task.m_coroutine.resume();
+		benchmark::DoNotOptimize(task.done());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// 创建后没有运行就销毁
+void BM_CreateCancel(benchmark::State& state) {
+	for (auto _ : state) {
+		auto task = empty();
+		benchmark::DoNotOptimize(task.m_coroutine.address());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+auto parked(std::coroutine_handle<>& slot) -> Task<> {
+	co_await Park{ slot };
+}
+
+// 十万个挂起的Task, 内存只有协程帧和Task对象
+void BM_Parked(benchmark::State& state) {
+	for (auto _ : state) {
+		std::vector<Task<>> tasks;
+		std::vector<std::coroutine_handle<>> slots(parked_count);
+		tasks.reserve(parked_count);
+		bench::trim_heap();
+		const auto before = bench::resident_bytes();
+		for (std::size_t i = 0; i < parked_count; ++i) {
+			tasks.push_back(parked(slots[i]));
+			tasks.back().m_coroutine.resume();
+		}
+		const auto after = bench::resident_bytes();
+		if (before == 0 || after < before) {
+			state.SkipWithError("resident memory is not available");
+		} else {
+			const auto bytes = static_cast<double>(after - before);
+			state.counters["rss_per_coroutine"] = bytes / static_cast<double>(parked_count);
+			state.counters["rss_mib_per_100k"] = bytes / (1024.0 * 1024.0);
+		}
+		state.PauseTiming();
+		tasks.clear();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(parked_count));
+}
+
+auto parked_chain(int depth, std::coroutine_handle<>& leaf) -> Task<int> {
+	if (depth == 0) {
+		co_await Park{ leaf };
+		co_return 0;
+	}
+	co_return 1 + co_await parked_chain(depth - 1, leaf);
+}
+
+/**
+ * 每层一个Task, 在最深处挂起后恢复, 结束时逐层返回
+ * 与有栈协程的BM_NestedCall对照, 这里每层都要分配和释放一个帧
+ * range(0) 调用深度
+ */
+void BM_NestedCall(benchmark::State& state) {
+	const auto depth = static_cast<int>(state.range(0));
+	std::coroutine_handle<> leaf;
+	for (auto _ : state) {
+		auto task = parked_chain(depth, leaf);
+		task.m_coroutine.resume();
+		leaf.resume();
+		benchmark::DoNotOptimize(task.result());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_RoundTrip)->Name("BM_RoundTrip/task");
+BENCHMARK(BM_CreateDestroy)->Name("BM_CreateDestroy/task");
+BENCHMARK(BM_CreateCancel)->Name("BM_CreateCancel/task");
+BENCHMARK(BM_NestedCall)->Name("BM_NestedCall/task")->Arg(1)->Arg(16)->Arg(256);
+BENCHMARK(BM_Parked)->Name("BM_Parked/task")->Iterations(1)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,190 @@
+/**
+ * 有栈协程的基准测试
+ * 本文件以不同的切换方式各编译一次(见CMakeLists.txt), 测试名带有切换方式的后缀, 例如BM_RoundTrip/asm
+ * 协程类位于按切换方式命名的内联命名空间中, 多份可以链接进同一个程序
+ */
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bench_memory.hpp"
+#include "yq_coroutine.hpp"
+
+namespace {
+
+using yq::Coroutine;
+
+#if defined(CO_USE_FIBER)
+constexpr const char* backend = "fiber";
+#elif defined(CO_USE_ASM)
+constexpr const char* backend = "asm";
+#else
+constexpr const char* backend = "ucontext";
+#endif
+
+constexpr std::size_t stack_size = 64 * 1024;
+constexpr std::size_t parked_count = 100000;
+
+/**
+ * 两个协程交替resume, 各自立即yield
+ * 每次迭代包含两次切入/切出, items_per_second即每秒的往返次数
+ * 共享栈上两个协程交替运行, 每次切入都需要换出另一个的栈内容
+ */
+template <typename Make>
+void run_round_trip(benchmark::State& state, Make make) {
+	bool stop = false;
+	auto body = [&stop]() {
+		while (!stop) {
+			Coroutine::yield();
+		}
+	};
+	auto first = make(body);
+	auto second = make(body);
+	for (auto _ : state) {
+		first->resume();
+		second->resume();
+	}
+	stop = true;
+	first->resume();
+	second->resume();
+	state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// 创建, 运行到结束, 销毁; 栈来自默认的栈池
+template <typename Make>
+void run_create_destroy(benchmark::State& state, Make make) {
+	for (auto _ : state) {
+		auto co = make([]() {});
+		co->resume();
+		benchmark::DoNotOptimize(co->is_finished());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// 创建后没有运行就销毁, 例如取消的预创建任务; 栈和上下文都不会构造
+template <typename Make>
+void run_create_cancel(benchmark::State& state, Make make) {
+	for (auto _ : state) {
+		auto co = make([]() {});
+		benchmark::DoNotOptimize(co.get());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * 十万个协程各自yield一次后挂起, 统计常驻内存的增量
+ * 协程对象本身也计入结果
+ */
+template <typename Make>
+void run_parked(benchmark::State& state, Make make) {
+	for (auto _ : state) {
+		std::vector<std::unique_ptr<Coroutine>> parked;
+		parked.reserve(parked_count);
+		bench::trim_heap();
+		const auto before = bench::resident_bytes();
+		for (std::size_t i = 0; i < parked_count; ++i) {
+			parked.push_back(make([]() { Coroutine::yield(); }));
+			parked.back()->resume();
+		}
+		const auto after = bench::resident_bytes();
+		if (before == 0 || after < before) {
+			state.SkipWithError("resident memory is not available");
+		} else {
+			const auto bytes = static_cast<double>(after - before);
+			state.counters["rss_per_coroutine"] = bytes / static_cast<double>(parked_count);
+			state.counters["rss_mib_per_100k"] = bytes / (1024.0 * 1024.0);
+		}
+		// 未结束的协程直接销毁, 栈上没有需要析构的对象
+		state.PauseTiming();
+		parked.clear();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(parked_count));
+}
+
+// 深度为depth的普通函数调用链, 在最深处yield
+void descend(int depth) {
+	if (depth == 0) {
+		Coroutine::yield();
+		return;
+	}
+	descend(depth - 1);
+	// 调用之后还有操作, 不会被优化成循环
+	benchmark::ClobberMemory();
+}
+
+/**
+ * 协程内的调用链不需要额外的帧分配, 每次迭代是一次往返加上depth层调用与返回
+ * 与无栈协程的BM_NestedCall/task对照, 后者每层都是一个Task
+ * range(0) 调用深度
+ */
+template <typename Make>
+void run_nested_call(benchmark::State& state, Make make) {
+	const auto depth = static_cast<int>(state.range(0));
+	bool stop = false;
+	auto co = make([&stop, depth]() {
+		while (!stop) {
+			descend(depth);
+		}
+	});
+	for (auto _ : state) {
+		co->resume();
+	}
+	stop = true;
+	co->resume();
+	state.SetItemsProcessed(state.iterations());
+}
+
+auto make_separate(std::size_t size) {
+	return [size](auto body) { return std::make_unique<Coroutine>(size, std::move(body)); };
+}
+
+template <typename Fn>
+void register_all(const std::string& suffix, Fn make) {
+	benchmark::RegisterBenchmark(("BM_RoundTrip/" + suffix).c_str(),
+		[make](benchmark::State& state) { run_round_trip(state, make); });
+	benchmark::RegisterBenchmark(("BM_CreateDestroy/" + suffix).c_str(),
+		[make](benchmark::State& state) { run_create_destroy(state, make); });
+	benchmark::RegisterBenchmark(("BM_CreateCancel/" + suffix).c_str(),
+		[make](benchmark::State& state) { run_create_cancel(state, make); });
+	benchmark::RegisterBenchmark(("BM_NestedCall/" + suffix).c_str(),
+		[make](benchmark::State& state) { run_nested_call(state, make); })
+		->Arg(1)->Arg(16)->Arg(256);
+}
+
+const bool registered = []() {
+	register_all(backend, make_separate(stack_size));
+#if defined(__unix__)
+	benchmark::RegisterBenchmark((std::string{ "BM_Parked/" } + backend).c_str(),
+		[](benchmark::State& state) {
+			bench::ArenaStackAllocator arena{ parked_count, stack_size };
+			run_parked(state, [&arena](auto body) {
+				return std::make_unique<Coroutine>(arena, stack_size, std::move(body));
+			});
+		})->Iterations(1)->Unit(benchmark::kMillisecond);
+#else
+	// Fiber的栈由系统分配
+	benchmark::RegisterBenchmark((std::string{ "BM_Parked/" } + backend).c_str(),
+		[](benchmark::State& state) { run_parked(state, make_separate(stack_size)); })
+		->Iterations(1)->Unit(benchmark::kMillisecond);
+#endif
+
+#ifdef CO_USE_ASM
+	// 共享栈需要比协程活得更久; 它在静态对象析构时释放, 此时线程局部的栈池已经析构
+	static yq::HeapStackAllocator heap;
+	static yq::SharedStack shared{ 256 * 1024, heap };
+	auto make_shared_stack = [](auto body) {
+		return std::make_unique<Coroutine>(shared, std::move(body));
+	};
+	register_all("shared_stack", make_shared_stack);
+	benchmark::RegisterBenchmark("BM_Parked/shared_stack",
+		[make_shared_stack](benchmark::State& state) { run_parked(state, make_shared_stack); })
+		->Iterations(1)->Unit(benchmark::kMillisecond);
+#endif
+	return true;
+}();
+
+} // namespace
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include "yq_task.hpp"
+
+namespace {
+
+// 统计全局operator new的调用次数
+std::atomic<std::int64_t> g_allocations{ 0 };
+
+} // namespace
+
+// 替换的operator new/delete内联后GCC会看到malloc与operator delete(或operator new与free)配对,
+// 报-Wmismatched-new-delete, 禁止内联让它们保持成对出现
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+BENCH_NOINLINE auto operator new(std::size_t size) -> void* {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+
+BENCH_NOINLINE void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	::operator delete(ptr);
+}
+
+namespace {
+
+using yq::Task;
+
+auto pooled_chain(int depth) -> Task<int> {
+	if (depth == 0) {
+		co_return 0;
+	}
+	co_return 1 + co_await pooled_chain(depth - 1);
+}
+
+// 对照组: std::allocator每个帧都调用一次全局operator new
+auto allocator_chain(std::allocator_arg_t, const std::allocator<std::byte>& alloc, int depth)
+	-> Task<int> {
+	if (depth == 0) {
+		co_return 0;
+	}
+	co_return 1 + co_await allocator_chain(std::allocator_arg, alloc, depth - 1);
+}
+
+template <typename Chain>
+void run_chain(benchmark::State& state, Chain chain) {
+	const auto depth = static_cast<int>(state.range(0));
+	// 预热, 让帧缓存进入稳定状态
+	{
+		auto task = chain(depth);
+		task.m_coroutine.resume();
+	}
+	const auto before = g_allocations.load(std::memory_order_relaxed);
+	for (auto _ : state) {
+		auto task = chain(depth);
+		task.m_coroutine.resume();
+		int value = task.result();
+		benchmark::DoNotOptimize(value);
+	}
+	const auto allocations = g_allocations.load(std::memory_order_relaxed) - before;
+	state.SetItemsProcessed(state.iterations() * (depth + 1));
+	state.counters["allocs_per_chain"] = benchmark::Counter(
+		static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+}
+
+/**
+ * 一次请求处理中嵌套co_await的任务链
+ * range(0) 链的深度, 每层一个协程帧
+ */
+void BM_PooledChain(benchmark::State& state) {
+	run_chain(state, [](int depth) { return pooled_chain(depth); });
+}
+
+void BM_AllocatorChain(benchmark::State& state) {
+	run_chain(state, [](int depth) {
+		return allocator_chain(std::allocator_arg, std::allocator<std::byte>{}, depth);
+	});
+}
+
+} // namespace
+
+BENCHMARK(BM_PooledChain)->Arg(1)->Arg(12)->Arg(100);
+BENCHMARK(BM_AllocatorChain)->Arg(1)->Arg(12)->Arg(100);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,89 @@
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "yq_timer.hpp"
+
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+template <typename Queue>
+auto make_queue(clock_type::time_point origin) -> Queue {
+	if constexpr (std::is_same_v<Queue, yq::TimingWheel>) {
+		return Queue{ 1ms, origin };
+	} else {
+		return Queue{};
+	}
+}
+
+/**
+ * 模拟大量连接的空闲超时: 每个连接一个定时器, 每收到一个包就取消并重新设置
+ * 每1000个包时间前进1ms并处理到期的定时器
+ * range(0) 连接数
+ */
+template <typename Queue>
+void BM_Rearm(benchmark::State& state) {
+	const auto connections = static_cast<std::size_t>(state.range(0));
+	const auto origin = clock_type::now();
+	auto queue = make_queue<Queue>(origin);
+	auto handle = std::noop_coroutine();
+	std::mt19937_64 rng{ 42 };
+	auto now = origin;
+	auto timeout = [&rng]() { return 30s + std::chrono::milliseconds{ rng() % 1000 }; };
+
+	std::vector<yq::TimerHandle> timers(connections);
+	for (auto& timer : timers) {
+		timer = queue.add(now + timeout(), handle);
+	}
+	std::int64_t expired = 0;
+	std::uint64_t packets = 0;
+	for (auto _ : state) {
+		auto& timer = timers[rng() % connections];
+		queue.cancel(timer);
+		timer = queue.add(now + timeout(), handle);
+		if (++packets % 1000 == 0) {
+			now += 1ms;
+			queue.expire(now, [&expired](std::coroutine_handle<>) { ++expired; });
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["expired"] = static_cast<double>(expired);
+}
+
+/**
+ * 按批插入随后全部到期
+ * range(0) 每批的定时器数量
+ */
+template <typename Queue>
+void BM_InsertExpire(benchmark::State& state) {
+	const auto batch = static_cast<std::size_t>(state.range(0));
+	const auto origin = clock_type::now();
+	auto queue = make_queue<Queue>(origin);
+	auto handle = std::noop_coroutine();
+	std::mt19937_64 rng{ 42 };
+	auto now = origin;
+	for (auto _ : state) {
+		for (std::size_t i = 0; i < batch; ++i) {
+			queue.add(now + std::chrono::milliseconds{ rng() % 10'000 }, handle);
+		}
+		now += 10s;
+		std::size_t expired = 0;
+		queue.expire(now, [&expired](std::coroutine_handle<>) { ++expired; });
+		benchmark::DoNotOptimize(expired);
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(batch));
+}
+
+} // namespace
+
+BENCHMARK(BM_Rearm<yq::HeapTimerQueue>)->RangeMultiplier(10)->Range(10'000, 500'000);
+BENCHMARK(BM_Rearm<yq::TimingWheel>)->RangeMultiplier(10)->Range(10'000, 500'000);
+BENCHMARK(BM_InsertExpire<yq::HeapTimerQueue>)->Arg(100'000);
+BENCHMARK(BM_InsertExpire<yq::TimingWheel>)->Arg(100'000);
+
+BENCHMARK_MAIN();
@@ -9,7 +9,7 @@ struct PreviousAwaiter {
 		return false;
 	}
 
-	auto await_suspend(std::coroutine_handle<> ) const -> std::coroutine_handle<> {
+	auto await_suspend(std::coroutine_handle<> ) const noexcept -> std::coroutine_handle<> {
 		std::print("PreviousAwaiter await_suspend ");
 		if (m_previous) {
 			std::println("previous");
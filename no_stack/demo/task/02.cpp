@@ -1,105 +1,59 @@
 #include <print>
 #include <coroutine>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "yq_generator.hpp"
+#include "yq_task.hpp"
 
-template<typename PromiseType>
-struct BasePromise {
-	auto initial_suspend() {
-		return std::suspend_always{};
-	}
-
-	auto final_suspend() noexcept {
-		return std::suspend_always{};
-	}
-
-	void unhandled_exception() {
-		throw;
-	}
-
-	auto get_return_object() -> std::coroutine_handle<PromiseType> {
-		return std::coroutine_handle<PromiseType>::from_promise(*static_cast<PromiseType*>(this));
-	};
-};
+using yq::Task;
 
 
-template<typename Ty = void>
-struct Promise: public BasePromise<Promise<Ty>> {
-	Promise(): m_value{} {
-	}
-
-	template<typename TyRef>
-	auto yield_value(TyRef&& value) {
-		m_value = std::forward<TyRef>(value);
-		return std::suspend_always{};
-	}
-
-	template<typename TyRef>
-	void return_value(TyRef&& value) {
-		m_value = std::forward<TyRef>(value);
-	}
-
-	Ty m_value;
-};
-
-
-template <>
-struct Promise<void> : public BasePromise<Promise<void>> {
-	void return_void() {}
-};
+auto hello() -> yq::Generator<double> {
+	std::println("hello start");
+	co_yield 1.1;
+	co_yield 2.2;
+	std::println("hello end");
+}
 
+auto answer() -> Task<double> {
+	co_return 3.3;
+}
 
-template<typename TaskType, typename PromiseType>
-struct BaseTask {
-	BaseTask(std::coroutine_handle<PromiseType> handle):
-		m_handle { handle }
+// 没有默认构造函数, 以前的Promise<Ty>无法保存它
+struct Record {
+	Record(std::string_view name, int value):
+		m_name{ name }, m_value{ value }
 	{}
 
-	auto done() const -> bool {
-		return m_handle.done();
-	}
-
-	void resume() const {
-		m_handle.resume();
-	}
-
-	~BaseTask() {
-		m_handle.destroy();
-	}
-
-	std::coroutine_handle<PromiseType> m_handle;
+	std::string m_name;
+	int m_value;
 };
 
-
-template <typename Ty = void>
-struct Task: public BaseTask<Task<Ty>, Promise<Ty>> {
-	using promise_type = Promise<Ty>;
-
-	Task(std::coroutine_handle<promise_type> handle):
-		BaseTask<Task<Ty>, Promise<Ty>> { handle }
-	{}
-	
-	auto get_value() const -> const Ty& {
-		return this->m_handle.promise().m_value;
+// 按行解析 "name=value", 每次只产生一条记录, 不构造中间容器
+auto parse_records(std::string_view text) -> yq::Generator<const Record&> {
+	while (!text.empty()) {
+		auto line_end = text.find('\n');
+		auto line = text.substr(0, line_end);
+		text = line_end == std::string_view::npos ? std::string_view{} : text.substr(line_end + 1);
+		auto eq = line.find('=');
+		if (eq == std::string_view::npos) {
+			continue;
+		}
+		co_yield Record{ line.substr(0, eq), std::stoi(std::string{ line.substr(eq + 1) }) };
 	}
-};
-
-
-template <>
-struct Task<void>: public BaseTask<Task<void>, Promise<void>> {
-	using promise_type = Promise<void>;
-	Task(std::coroutine_handle<promise_type> handle):
-		BaseTask<Task<void>, Promise<void>> { handle }
-	{}
-};
-
+}
 
-auto hello() -> Task<double> {
-	std::println("hello start");
-	co_yield 1.1;
-	co_yield 2.2;
-	std::println("hello end");
-	co_return 3.3;
+auto iota(int first) -> yq::Generator<int> {
+	for (int i = first;; ++i) {
+		co_yield i;
+	}
 }
 
+static_assert(std::ranges::input_range<yq::Generator<int>>);
+static_assert(std::ranges::view<yq::Generator<const Record&>>);
+
 auto world() -> Task<void> {
 	std::println("world");
 	co_return;
@@ -107,16 +61,35 @@ auto world() -> Task<void> {
 
 
 auto main() -> int {
-	auto t1 = hello();
 	auto t2 = world();
 
-	while(!t1.done()) {
-		std::println("t1 resume");
-		t1.resume();
+	for (double value : hello()) {
+		std::println("hello yield {}", value);
 	}
 
+	auto t3 = answer();
+	while(!t3.done()) {
+		t3.m_coroutine.resume();
+	}
+	std::println("answer {}", t3.result());
+
 	while(!t2.done()) {
 		std::println("t2 resume");
-		t2.resume();
+		t2.m_coroutine.resume();
+	}
+
+	constexpr std::string_view text = "alpha=1\nbeta=20\ninvalid\ngamma=300\ndelta=4";
+	for (const Record& record : parse_records(text)
+			| std::views::filter([](const Record& r) { return r.m_value >= 10; })) {
+		std::println("record {} {}", record.m_name, record.m_value);
+	}
+
+	// 无限生成器与管道组合, 只计算需要的部分
+	std::vector<int> squares;
+	for (int value : iota(1)
+			| std::views::transform([](int i) { return i * i; })
+			| std::views::take(5)) {
+		squares.push_back(value);
 	}
+	std::println("squares {}", squares);
 }
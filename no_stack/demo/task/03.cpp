@@ -1,130 +1,489 @@
+#include <cassert>
+#include <chrono>
 #include <coroutine>
-#include <deque>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <print>
-#include <chrono>
-#include <deque>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "yq_frame_pool.hpp"
+#include "yq_loop.hpp"
+#include "yq_numa.hpp"
+#include "yq_task.hpp"
+#include "yq_timer.hpp"
 using namespace std::chrono_literals;
 
-struct PreviousAwaiter {
-	PreviousAwaiter(std::coroutine_handle<> handle): m_previous{ handle } {
+using yq::Loop;
+using yq::Task;
+
+auto sleeper(Loop& loop, std::chrono::milliseconds delay, int id, std::vector<int>& order)
+	-> Task<> {
+	co_await loop.sleep_for(delay);
+	order.push_back(id);
+}
+
+auto delayed_value(Loop& loop, int value) -> Task<int> {
+	co_await loop.sleep_for(1ms);
+	co_return value * 2;
+}
+
+auto sum_values(Loop& loop, int& result) -> Task<> {
+	int a = co_await delayed_value(loop, 1);
+	int b = co_await delayed_value(loop, 20);
+	result = a + b;
+}
+
+auto tick(Loop& loop, Loop::clock::time_point tp, int& count) -> Task<> {
+	co_await loop.sleep_until(tp);
+	++count;
+}
+
+// 按到期时间恢复, 与加入顺序无关
+void test_timer_order() {
+	std::println("=== Test 1: timer order ===");
+	Loop loop;
+	std::vector<int> order;
+	std::vector<Task<>> tasks;
+	tasks.push_back(sleeper(loop, 30ms, 3, order));
+	tasks.push_back(sleeper(loop, 10ms, 1, order));
+	tasks.push_back(sleeper(loop, 20ms, 2, order));
+	tasks.push_back(sleeper(loop, 0ms, 0, order));
+	for (auto& task : tasks) {
+		loop.schedule(task);
 	}
+	auto begin = Loop::clock::now();
+	loop.run();
+	auto elapsed = Loop::clock::now() - begin;
+	assert((order == std::vector<int>{ 0, 1, 2, 3 }));
+	assert(elapsed >= 30ms);
+	std::println("Test 1 passed!\n");
+}
 
-	auto await_ready()  const noexcept -> bool {
-		return false;
+// 嵌套的任务在定时器恢复后把结果交给等待者
+void test_nested_task() {
+	std::println("=== Test 2: nested task with timers ===");
+	Loop loop;
+	int result = 0;
+	auto task = sum_values(loop, result);
+	loop.schedule(task);
+	loop.run();
+	assert(result == 42);
+	std::println("Test 2 passed!\n");
+}
+
+// 同一时刻到期的定时器在一轮中全部恢复, 并保持加入顺序
+void test_timer_batch() {
+	std::println("=== Test 3: batched expiry ===");
+	constexpr int count = 1'000'000;
+	Loop loop;
+	int fired = 0;
+	std::vector<Task<>> tasks;
+	tasks.reserve(count);
+	auto deadline = Loop::clock::now() + 5ms;
+	for (int i = 0; i < count; ++i) {
+		tasks.push_back(tick(loop, deadline + std::chrono::microseconds{ i % 1000 }, fired));
+		loop.schedule(tasks.back());
+	}
+	auto begin = Loop::clock::now();
+	loop.run();
+	auto seconds = std::chrono::duration<double>(Loop::clock::now() - begin).count();
+	assert(fired == count);
+	assert(loop.pending_timers() == 0);
+	std::println("{} timers in {:.3f}s, {:.2f}M timer ops/s", count, seconds, count / seconds / 1e6);
+	std::println("Test 3 passed!\n");
+}
+
+auto noop_task() -> Task<> {
+	co_return;
+}
+
+/**
+ * 用假时间驱动定时器队列, 随机插入和取消
+ * 检查未取消的定时器全部到期, 不提前, 最多晚slack, 取消的不会到期
+ */
+template <typename Queue>
+void check_timer_queue(Queue& queue, Loop::clock::time_point origin, Loop::clock::duration slack) {
+	using namespace std::chrono;
+	constexpr int count = 100'000;
+	std::mt19937_64 rng{ 42 };
+	std::vector<Task<>> tasks;
+	std::unordered_map<void*, int> ids;
+	std::vector<Loop::clock::time_point> deadlines(count);
+	std::vector<yq::TimerHandle> handles(count);
+	std::vector<int> state(count, 0);
+	tasks.reserve(count);
+	for (int i = 0; i < count; ++i) {
+		tasks.push_back(noop_task());
+		ids.emplace(tasks.back().m_coroutine.address(), i);
 	}
 
-	auto await_suspend(std::coroutine_handle<>) const noexcept
-		-> std::coroutine_handle<>
-	{
-		if (m_previous) {
-			return m_previous;
-		} else {
-			return std::noop_coroutine();
+	auto now = origin;
+	int next = 0;
+	auto on_expire = [&](std::coroutine_handle<> coroutine) {
+		int id = ids.at(coroutine.address());
+		assert(state[id] == 1);
+		assert(deadlines[id] <= now);
+		assert(now - deadlines[id] <= slack);
+		state[id] = 2;
+	};
+	while (next < count || !queue.empty()) {
+		// 分布在2^22ms内, 覆盖时间轮的前三层
+		for (int i = 0; i < 1000 && next < count; ++i, ++next) {
+			deadlines[next] = now + microseconds{ rng() % (std::uint64_t{ 1 } << 32) };
+			handles[next] = queue.add(deadlines[next], tasks[next].m_coroutine);
+			state[next] = 1;
+			if (rng() % 4 == 0) {
+				int victim = static_cast<int>(rng() % (next + 1));
+				bool pending = state[victim] == 1;
+				assert(queue.cancel(handles[victim]) == pending);
+				if (pending) {
+					state[victim] = 3;
+				}
+			}
 		}
+		// 时间步长不超过slack, 保证按时处理
+		auto step = duration_cast<Loop::clock::duration>(microseconds{ rng() % 1000 });
+		now += step;
+		queue.expire(now, on_expire);
+		if (next == count && !queue.empty()) {
+			now = std::max(now, *queue.next_expiry());
+			queue.expire(now, on_expire);
+		}
+	}
+	for (int i = 0; i < count; ++i) {
+		assert(state[i] == 2 || state[i] == 3);
+		assert(!queue.cancel(handles[i]));
 	}
+}
 
-	void await_resume() const noexcept {}
+// 最小堆与时间轮使用相同的接口, 时间轮按tick向上取整
+void test_timer_queues() {
+	std::println("=== Test 4: timer queues with cancel ===");
+	auto origin = Loop::clock::now();
+	yq::HeapTimerQueue heap;
+	check_timer_queue(heap, origin, std::chrono::milliseconds{ 1 });
+	yq::TimingWheel wheel{ std::chrono::milliseconds{ 1 }, origin };
+	check_timer_queue(wheel, origin, std::chrono::milliseconds{ 2 });
+	std::println("Test 4 passed!\n");
+}
 
-	std::coroutine_handle<> m_previous;
-};
+// 记录分配次数, 检查分配器副本随帧保存并用于释放
+template <typename Ty>
+struct CountingAllocator {
+	using value_type = Ty;
+
+	CountingAllocator(int& allocations, int& deallocations) noexcept:
+		m_allocations{ &allocations }, m_deallocations{ &deallocations } {}
+
+	template <typename Other>
+	CountingAllocator(const CountingAllocator<Other>& other) noexcept:
+		m_allocations{ other.m_allocations }, m_deallocations{ other.m_deallocations } {}
 
+	auto allocate(std::size_t count) -> Ty* {
+		++*m_allocations;
+		return std::allocator<Ty>{}.allocate(count);
+	}
+
+	void deallocate(Ty* ptr, std::size_t count) noexcept {
+		++*m_deallocations;
+		std::allocator<Ty>{}.deallocate(ptr, count);
+	}
 
-template<typename PromiseType>
-struct BasePromise {
-	auto initial_suspend() {
-		return std::suspend_always{};
+	int* m_allocations;
+	int* m_deallocations;
+};
+
+auto pooled_chain(int depth) -> Task<int> {
+	if (depth == 0) {
+		co_return 0;
 	}
+	co_return 1 + co_await pooled_chain(depth - 1);
+}
 
-	auto final_suspend() noexcept {
-		return PreviousAwaiter(m_previous);
+auto allocator_chain(std::allocator_arg_t, const CountingAllocator<int>& alloc, int depth)
+	-> Task<int> {
+	if (depth == 0) {
+		co_return 0;
 	}
+	co_return 1 + co_await allocator_chain(std::allocator_arg, alloc, depth - 1);
+}
 
-	void unhandled_exception() {
-		throw;
+struct Handler {
+	auto handle(std::allocator_arg_t, const CountingAllocator<char>&, int value) -> Task<int> {
+		co_return value + m_base;
 	}
 
-	auto get_return_object() -> std::coroutine_handle<PromiseType> {
-		return std::coroutine_handle<PromiseType>::from_promise(*static_cast<PromiseType*>(this));
+	int m_base;
+};
+
+// 稳定后任务链不再调用全局operator new; allocator_arg的帧由传入的分配器分配和释放
+void test_frame_pool() {
+	std::println("=== Test 5: frame pool and allocator_arg ===");
+	auto run_chain = [](auto make) {
+		auto task = make();
+		task.m_coroutine.resume();
+		return task.result();
 	};
+	yq::FramePool& pool = *yq::FramePool::local();
+	assert(run_chain([] { return pooled_chain(12); }) == 12);
+	auto warm = pool.stats();
+	for (int i = 0; i < 100; ++i) {
+		assert(run_chain([] { return pooled_chain(12); }) == 12);
+	}
+	auto steady = pool.stats();
+	assert(steady.upstream_allocations == warm.upstream_allocations);
+	assert(steady.reused - warm.reused == 100 * 13);
+
+	int allocations = 0;
+	int deallocations = 0;
+	CountingAllocator<int> alloc{ allocations, deallocations };
+	assert(run_chain([&] { return allocator_chain(std::allocator_arg, alloc, 12); }) == 12);
+	assert(allocations == 13 && deallocations == 13);
+	Handler handler{ 40 };
+	assert(run_chain([&] { return handler.handle(std::allocator_arg, alloc, 2); }) == 42);
+	assert(allocations == 14 && deallocations == 14);
+	assert(pool.stats().upstream_allocations == warm.upstream_allocations);
+	std::println("Test 5 passed!\n");
+}
 
-	std::coroutine_handle<> m_previous;
+// 只能移动, 也没有默认构造
+struct Token {
+	explicit Token(std::string name): m_name{ std::make_unique<std::string>(std::move(name)) } {}
+
+	std::unique_ptr<std::string> m_name;
 };
 
+auto make_token(std::string name) -> Task<Token> {
+	co_return Token{ std::move(name) };
+}
+
+auto forward_token() -> Task<Token> {
+	Token token = co_await make_token("token");
+	*token.m_name += "!";
+	co_return token;
+}
+
+auto select(int& a, int& b, bool first) -> Task<int&> {
+	co_return first ? a : b;
+}
 
-template<typename Ty = void>
-struct Promise: public BasePromise<Promise<Ty>> {
-	Promise(): m_value{} {
+auto failing_chain(int depth) -> Task<int> {
+	if (depth == 0) {
+		throw std::runtime_error{ "bottom" };
 	}
+	co_return 1 + co_await failing_chain(depth - 1);
+}
 
-	template<typename TyRef>
-	auto yield_value(TyRef&& value) {
-		m_value = std::forward<TyRef>(value);
-		return std::suspend_always{};
+auto catching(int depth, std::string& message) -> Task<> {
+	try {
+		co_await failing_chain(depth);
+	} catch (const std::runtime_error& e) {
+		message = e.what();
 	}
+}
 
-	template<typename TyRef>
-	void return_value(TyRef&& value) {
-		m_value = std::forward<TyRef>(value);
+// 结果按值移动, 支持引用; 异常逐层传给等待者; 一百万层的链不会耗尽原生栈
+void test_task_results() {
+	std::println("=== Test 6: task results, exceptions and deep chains ===");
+	auto token_task = forward_token();
+	token_task.m_coroutine.resume();
+	assert(token_task.done());
+	assert(*token_task.result().m_name == "token!");
+
+	int a = 1;
+	int b = 2;
+	auto ref_task = select(a, b, false);
+	ref_task.m_coroutine.resume();
+	ref_task.result() = 20;
+	assert(b == 20);
+
+	std::string message;
+	auto catch_task = catching(1000, message);
+	catch_task.m_coroutine.resume();
+	assert(message == "bottom");
+
+	auto failed = failing_chain(3);
+	failed.m_coroutine.resume();
+	bool thrown = false;
+	try {
+		failed.result();
+	} catch (const std::runtime_error&) {
+		thrown = true;
 	}
+	assert(thrown);
 
-	Ty m_value;
-};
+	constexpr int depth = 1'000'000;
+	auto begin = Loop::clock::now();
+	auto deep = pooled_chain(depth);
+	deep.m_coroutine.resume();
+	assert(deep.result() == depth);
+	auto seconds = std::chrono::duration<double>(Loop::clock::now() - begin).count();
+	std::println("{} nested co_await in {:.3f}s", depth, seconds);
+	std::println("Test 6 passed!\n");
+}
 
+auto seven() -> Task<int> {
+	co_return 7;
+}
 
-template <>
-struct Promise<void> : public BasePromise<Promise<void>> {
-	void return_void() {}
-};
+auto refuse() -> Task<int> {
+	co_await yq::fail(std::make_error_code(std::errc::connection_refused));
+	co_return 0;
+}
 
+auto checked(std::error_code& error) -> Task<int> {
+	// try_await只转换std::system_error, 其他异常照常传给等待者
+	auto refused = co_await yq::try_await(refuse());
+	error = refused.error();
+	auto value = co_await yq::try_await(seven());
+	co_return *value;
+}
 
-template<typename Ty = void>
-struct Task {
-	using promise_type = Promise<Ty>;
+// 有异常时fail抛出std::system_error, try_await把它转换为Expected
+void test_fail_and_try_await() {
+	std::println("=== Test 7: fail and try_await with exceptions ===");
+	std::error_code error;
+	auto task = checked(error);
+	task.m_coroutine.resume();
+	assert(task.done());
+	assert(error == std::errc::connection_refused);
+	assert(task.result() == 7);
 
-	Task(std::coroutine_handle<promise_type> coroutine) noexcept:
-		m_coroutine { coroutine } {}
-	
-	~Task() {
-		m_coroutine.destroy();
+	auto other = failing_chain(1);
+	auto wrapped = [](Task<int> inner) -> Task<> {
+		co_await yq::try_await(std::move(inner));
+	}(std::move(other));
+	wrapped.m_coroutine.resume();
+	bool thrown = false;
+	try {
+		wrapped.result();
+	} catch (const std::runtime_error&) {
+		thrown = true;
 	}
+	assert(thrown);
+	std::println("Test 7 passed!\n");
+}
 
-	struct Awaiter {
-		auto await_ready() const noexcept -> bool {
-			return false;
-		}
-		
-		auto await_suspend(std::coroutine_handle<> coroutine) const noexcept
-			-> std::coroutine_handle<promise_type>
-		{
-			m_coroutine.promise().m_previous = coroutine;
+// 生产者线程创建任务, 另一个线程销毁; 释放线程每个级别最多缓存max_cached块, 其余还给operator delete
+void test_cross_thread_frames() {
+	std::println("=== Test 8: frames freed on another thread ===");
+	constexpr std::size_t count = 1000;
+	constexpr int rounds = 5;
+	std::vector<Task<int>> tasks;
+	std::thread consumer;
+	yq::FramePool::Stats before{};
+	yq::FramePool::Stats after{};
+	for (int round = 0; round < rounds; ++round) {
+		// 没有开始运行的任务只持有帧, 都在同一个级别
+		for (std::size_t i = 0; i < count; ++i) {
+			tasks.push_back(pooled_chain(0));
 		}
+		consumer = std::thread([&tasks, &before, &after, round] {
+			yq::FramePool& pool = *yq::FramePool::local();
+			before = pool.stats();
+			tasks.clear();
+			after = pool.stats();
+			assert(after.cached <= yq::FramePool::max_cached);
+			if (round == 0) {
+				assert(after.upstream_deallocations == count - yq::FramePool::max_cached);
+			}
+		});
+		consumer.join();
+		assert(after.cached == yq::FramePool::max_cached);
+		assert(after.upstream_deallocations - before.upstream_deallocations
+			== count - yq::FramePool::max_cached);
+	}
 
-		auto await_resume() const -> Ty {
-			return m_coroutine.promise().m_value;
-		}
-		
-		std::coroutine_handle<promise_type> m_coroutine;
-	};
+	// 释放线程绑定到另一个节点时不缓存这些帧
+	for (std::size_t i = 0; i < count; ++i) {
+		tasks.push_back(pooled_chain(0));
+	}
+	consumer = std::thread([&tasks, &before, &after] {
+		const auto& cpus = yq::numa::Topology::system().cpus_of(0);
+		yq::numa::bind_current_thread(yq::numa::Topology{ { cpus } }, 0);
+		yq::FramePool& pool = *yq::FramePool::local();
+		before = pool.stats();
+		tasks.clear();
+		after = pool.stats();
+	});
+	consumer.join();
+	assert(after.cached == 0);
+	assert(after.remote - before.remote == count);
+	assert(after.upstream_deallocations - before.upstream_deallocations == count);
+	std::println("Test 8 passed!\n");
+}
 
-	auto operator co_await() const noexcept {
-		return Awaiter { m_coroutine };
+// 把当前协程重新放入就绪队列
+struct Requeue {
+	auto await_ready() const noexcept -> bool {
+		return false;
 	}
 
-	operator std::coroutine_handle<>() const noexcept {
-		return m_coroutine;
+	void await_suspend(std::coroutine_handle<> coroutine) const {
+		m_loop.schedule(coroutine);
 	}
 
-	std::coroutine_handle<promise_type> m_coroutine;
+	void await_resume() const noexcept {}
+
+	Loop& m_loop;
 };
 
+auto spin_until(Loop& loop, const bool& timer_fired, const bool& posted, int& spins) -> Task<> {
+	while (!timer_fired || !posted) {
+		++spins;
+		co_await Requeue{ loop };
+	}
+}
 
-class Loop {
-public:
-	std::deque<std::coroutine_handle<>> m_ready_queue;
-	struct TimerEntry {
-		std::chrono::system_clock::time_point expire_tp;
-		std::coroutine_handle<> coroutine;
-	};
+auto fire_after(Loop& loop, std::chrono::milliseconds delay, bool& fired) -> Task<> {
+	co_await loop.sleep_for(delay);
+	fired = true;
+}
 
-private:
-};
+auto set_flag(bool& flag) -> Task<> {
+	flag = true;
+	co_return;
+}
+
+// 不停schedule自己的协程不会让定时器和post的协程饿死
+void test_ready_batch() {
+	std::println("=== Test 9: ready queue runs one batch per tick ===");
+	Loop loop;
+	bool timer_fired = false;
+	bool posted = false;
+	int spins = 0;
+	auto spinner = spin_until(loop, timer_fired, posted, spins);
+	auto timer = fire_after(loop, 2ms, timer_fired);
+	auto post_target = set_flag(posted);
+	loop.schedule(spinner);
+	loop.schedule(timer);
+	std::thread poster([&loop, &post_target]() {
+		std::this_thread::sleep_for(1ms);
+		loop.post(post_target.m_coroutine);
+	});
+	// 协程在poster提交之前不会结束, run不会提前返回
+	loop.run();
+	poster.join();
+	assert(timer_fired && posted);
+	assert(spinner.done() && spins > 0);
+	std::println("Test 9 passed!\n");
+}
+
+auto main() -> int {
+	test_timer_order();
+	test_nested_task();
+	test_timer_batch();
+	test_timer_queues();
+	test_frame_pool();
+	test_task_results();
+	test_fail_and_try_await();
+	test_cross_thread_frames();
+	test_ready_batch();
+	std::println("=== All tests passed! ===");
+}
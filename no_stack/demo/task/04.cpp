@@ -0,0 +1,320 @@
+#include <arpa/inet.h>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <print>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "yq_io.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::IoBackendKind;
+using yq::IoLoop;
+using yq::Task;
+
+namespace
+{
+
+auto write_all(yq::IoContext& io, yq::FileRef file, std::string_view data) -> Task<int> {
+	std::size_t done = 0;
+	while (done < data.size()) {
+		int n = co_await io.write(file, data.data() + done, data.size() - done);
+		if (n < 0) {
+			co_return n;
+		}
+		done += static_cast<std::size_t>(n);
+	}
+	co_return static_cast<int>(done);
+}
+
+auto read_exact(yq::IoContext& io, yq::FileRef file, std::string& out, std::size_t length)
+	-> Task<int> {
+	out.resize(length);
+	std::size_t done = 0;
+	while (done < length) {
+		int n = co_await io.read(file, out.data() + done, length - done);
+		if (n <= 0) {
+			co_return n;
+		}
+		done += static_cast<std::size_t>(n);
+	}
+	co_return static_cast<int>(done);
+}
+
+auto pipe_writer(IoLoop& loop, int fd, std::string_view data) -> Task<> {
+	// 让读者先挂起, 检查等待路径
+	co_await loop.sleep_for(5ms);
+	int n = co_await write_all(loop.poller(), fd, data);
+	assert(n == static_cast<int>(data.size()));
+	loop.poller().close(fd);
+}
+
+auto pipe_reader(IoLoop& loop, int fd, std::string& out, std::size_t length) -> Task<> {
+	int n = co_await read_exact(loop.poller(), fd, out, length);
+	assert(n == static_cast<int>(length));
+	// 写端关闭后读到EOF
+	char extra;
+	int eof = co_await loop.poller().read(fd, &extra, 1);
+	assert(eof == 0);
+	loop.poller().close(fd);
+}
+
+} // namespace
+
+// 管道两端由两个协程读写, 大于管道容量的数据需要多次挂起
+void test_pipe(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 1: pipe read/write ({}) ===", loop.poller().backend_name());
+	int fds[2];
+	int ret = ::pipe2(fds, O_NONBLOCK | O_CLOEXEC);
+	assert(ret == 0);
+	std::string data(256 * 1024, '\0');
+	for (std::size_t i = 0; i < data.size(); ++i) {
+		data[i] = static_cast<char>('a' + i % 26);
+	}
+	std::string received;
+	auto reader = pipe_reader(loop, fds[0], received, data.size());
+	auto writer = pipe_writer(loop, fds[1], data);
+	loop.schedule(reader);
+	loop.schedule(writer);
+	loop.run();
+	assert(received == data);
+	assert(!loop.poller().pending());
+	std::println("Test 1 passed!\n");
+}
+
+auto echo_server(yq::IoContext& io, int fd, int rounds) -> Task<> {
+	char buffer[64];
+	for (int i = 0; i < rounds; ++i) {
+		int n = co_await io.recv(fd, buffer, sizeof(buffer));
+		assert(n > 0);
+		int sent = co_await io.send(fd, buffer, static_cast<std::size_t>(n));
+		assert(sent == n);
+	}
+}
+
+auto echo_client(yq::IoContext& io, int fd, int rounds, int& matched) -> Task<> {
+	char buffer[64];
+	for (int i = 0; i < rounds; ++i) {
+		auto message = std::to_string(i);
+		int sent = co_await io.send(fd, message.data(), message.size());
+		assert(sent == static_cast<int>(message.size()));
+		int n = co_await io.recv(fd, buffer, sizeof(buffer));
+		assert(n == static_cast<int>(message.size()));
+		matched += std::string_view{ buffer, static_cast<std::size_t>(n) } == message;
+	}
+}
+
+// socketpair上一问一答, 每次recv都需要等待对端
+void test_socketpair(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 2: socketpair recv/send ({}) ===", loop.poller().backend_name());
+	int fds[2];
+	int ret = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+	assert(ret == 0);
+	constexpr int rounds = 1000;
+	int matched = 0;
+	auto server = echo_server(loop.poller(), fds[0], rounds);
+	auto client = echo_client(loop.poller(), fds[1], rounds, matched);
+	loop.schedule(server);
+	loop.schedule(client);
+	loop.run();
+	assert(matched == rounds);
+	loop.poller().close(fds[0]);
+	loop.poller().close(fds[1]);
+	std::println("Test 2 passed!\n");
+}
+
+auto tcp_acceptor(yq::IoContext& io, int listener, int clients, int& served) -> Task<> {
+	for (int i = 0; i < clients; ++i) {
+		sockaddr_in peer{};
+		socklen_t length = sizeof(peer);
+		int fd = co_await io.accept(listener, reinterpret_cast<sockaddr*>(&peer), &length);
+		assert(fd >= 0);
+		assert(peer.sin_family == AF_INET);
+		char byte;
+		int n = co_await io.recv(fd, &byte, 1);
+		assert(n == 1);
+		n = co_await io.send(fd, &byte, 1);
+		assert(n == 1);
+		io.close(fd);
+		++served;
+	}
+}
+
+auto tcp_client(yq::IoContext& io, sockaddr_in address, char byte, int& done) -> Task<> {
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(fd >= 0);
+	int ret = co_await io.connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+	assert(ret == 0);
+	ret = co_await io.send(fd, &byte, 1);
+	assert(ret == 1);
+	char reply = 0;
+	ret = co_await io.recv(fd, &reply, 1);
+	assert(ret == 1);
+	assert(reply == byte);
+	io.close(fd);
+	++done;
+}
+
+// 本地回环上的accept/connect, 端口由内核分配
+void test_tcp(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 3: tcp accept/connect ({}) ===", loop.poller().backend_name());
+	int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(listener >= 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	int ret = ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+	assert(ret == 0);
+	ret = ::listen(listener, 16);
+	assert(ret == 0);
+	ret = ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+	assert(ret == 0);
+
+	constexpr int clients = 8;
+	int served = 0;
+	int done = 0;
+	std::vector<Task<>> tasks;
+	tasks.push_back(tcp_acceptor(loop.poller(), listener, clients, served));
+	for (int i = 0; i < clients; ++i) {
+		tasks.push_back(tcp_client(loop.poller(), address, static_cast<char>('A' + i), done));
+	}
+	for (auto& task : tasks) {
+		loop.schedule(task);
+	}
+	loop.run();
+	assert(served == clients);
+	assert(done == clients);
+	loop.poller().close(listener);
+	std::println("Test 3 passed!\n");
+}
+
+auto fixed_copy(yq::IoContext& io, std::span<char> buffer, std::size_t length, int& result)
+	-> Task<> {
+	// 第0个注册文件是源文件, 第1个是目标文件
+	int n = co_await io.read_fixed(yq::FixedFile{ 0 }, buffer.data(), length, 0, 0);
+	assert(n == static_cast<int>(length));
+	result = co_await io.write_fixed(yq::FixedFile{ 1 }, buffer.data(), length, 0, 0);
+}
+
+// 注册的缓冲区和文件, 使用文件偏移读写
+void test_fixed(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 4: registered buffer and files ({}) ===", loop.poller().backend_name());
+	char source_path[] = "/tmp/yq_io_srcXXXXXX";
+	char target_path[] = "/tmp/yq_io_dstXXXXXX";
+	int source = ::mkstemp(source_path);
+	int target = ::mkstemp(target_path);
+	assert(source >= 0 && target >= 0);
+	::unlink(source_path);
+	::unlink(target_path);
+	std::string content = "registered buffers skip the per-request page pinning";
+	ssize_t written = ::pwrite(source, content.data(), content.size(), 0);
+	assert(written == static_cast<ssize_t>(content.size()));
+
+	std::vector<char> buffer(4096);
+	iovec iov{ buffer.data(), buffer.size() };
+	loop.poller().register_buffers({ &iov, 1 });
+	int files[] = { source, target };
+	loop.poller().register_files(files);
+
+	int result = -1;
+	auto task = fixed_copy(loop.poller(), buffer, content.size(), result);
+	loop.schedule(task);
+	loop.run();
+	assert(result == static_cast<int>(content.size()));
+	std::string copied(content.size(), '\0');
+	ssize_t read = ::pread(target, copied.data(), copied.size(), 0);
+	assert(read == static_cast<ssize_t>(copied.size()));
+	assert(copied == content);
+	::close(source);
+	::close(target);
+	std::println("Test 4 passed!\n");
+}
+
+// reader一直阻塞在read上, 定时器照常到期
+auto ticker(IoLoop& loop, int& ticks, const bool& received) -> Task<> {
+	for (int i = 0; i < 5; ++i) {
+		co_await loop.sleep_for(2ms);
+		assert(!received);
+		++ticks;
+	}
+}
+
+// ticker全部到期后才写入, 不依赖两组定时器谁先到期
+auto late_writer(IoLoop& loop, int fd, const int& ticks) -> Task<> {
+	co_await loop.sleep_for(20ms);
+	while (ticks < 5) {
+		co_await loop.sleep_for(2ms);
+	}
+	char byte = 'x';
+	int n = co_await loop.poller().write(fd, &byte, 1);
+	assert(n == 1);
+}
+
+auto waiting_reader(IoLoop& loop, int fd, bool& received) -> Task<> {
+	char byte = 0;
+	int n = co_await loop.poller().read(fd, &byte, 1);
+	assert(n == 1);
+	received = byte == 'x';
+}
+
+// 定时器的到期时间作为等待IO的超时
+void test_timers_with_io(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 5: timers mixed with io ({}) ===", loop.poller().backend_name());
+	int fds[2];
+	int ret = ::pipe2(fds, O_NONBLOCK | O_CLOEXEC);
+	assert(ret == 0);
+	int ticks = 0;
+	bool received = false;
+	auto reader = waiting_reader(loop, fds[0], received);
+	auto timer = ticker(loop, ticks, received);
+	auto writer = late_writer(loop, fds[1], ticks);
+	loop.schedule(reader);
+	loop.schedule(timer);
+	loop.schedule(writer);
+	auto begin = IoLoop::clock::now();
+	loop.run();
+	assert(received);
+	assert(ticks == 5);
+	assert(IoLoop::clock::now() - begin >= 20ms);
+	loop.poller().close(fds[0]);
+	loop.poller().close(fds[1]);
+	std::println("Test 5 passed!\n");
+}
+
+void run_all_tests(IoBackendKind kind) {
+	test_pipe(kind);
+	test_socketpair(kind);
+	test_tcp(kind);
+	test_fixed(kind);
+	test_timers_with_io(kind);
+}
+
+auto main() -> int {
+	// 内核不支持io_uring时只测试epoll
+	bool has_io_uring = true;
+	try {
+		yq::IoUringBackend probe;
+	} catch (const std::system_error& e) {
+		std::println("io_uring unavailable: {}", e.what());
+		has_io_uring = false;
+	}
+	if (has_io_uring) {
+		run_all_tests(IoBackendKind::io_uring);
+	}
+	run_all_tests(IoBackendKind::epoll);
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,154 @@
+#include <cassert>
+#include <chrono>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+#include "yq_loop.hpp"
+#include "yq_task.hpp"
+#include "yq_when.hpp"
+using namespace std::chrono_literals;
+
+using yq::Loop;
+using yq::Task;
+
+auto delayed(Loop& loop, std::chrono::milliseconds delay, int value) -> Task<int> {
+	co_await loop.sleep_for(delay);
+	co_return value;
+}
+
+auto delayed_name(Loop& loop, std::chrono::milliseconds delay, std::string name)
+	-> Task<std::string> {
+	co_await loop.sleep_for(delay);
+	co_return name;
+}
+
+auto delayed_void(Loop& loop, std::chrono::milliseconds delay, int& done) -> Task<> {
+	co_await loop.sleep_for(delay);
+	++done;
+}
+
+auto failing(Loop& loop, std::chrono::milliseconds delay) -> Task<int> {
+	co_await loop.sleep_for(delay);
+	throw std::runtime_error{ "backend down" };
+}
+
+auto immediate(int value) -> Task<int> {
+	co_return value;
+}
+
+// 子任务在Loop上交替运行, 总时间取最长的一个
+auto join_tuple(Loop& loop, bool& checked) -> Task<> {
+	int done = 0;
+	auto begin = Loop::clock::now();
+	auto [a, name, unit] = co_await yq::when_all(
+		delayed(loop, 30ms, 1), delayed_name(loop, 20ms, "beta"), delayed_void(loop, 10ms, done));
+	auto elapsed = Loop::clock::now() - begin;
+	assert(a == 1 && name == "beta" && done == 1);
+	static_assert(std::is_same_v<decltype(unit), std::monostate>);
+	assert(elapsed >= 30ms && elapsed < 55ms);
+	checked = true;
+}
+
+auto join_vector(Loop& loop, bool& checked) -> Task<> {
+	std::vector<Task<int>> tasks;
+	for (int i = 0; i < 100; ++i) {
+		tasks.push_back(delayed(loop, std::chrono::milliseconds{ (i * 7) % 10 }, i));
+	}
+	// 同步结束的子任务不会提前恢复等待者
+	tasks.push_back(immediate(100));
+	auto results = co_await yq::when_all(std::move(tasks));
+	assert(results.size() == 101);
+	for (int i = 0; i <= 100; ++i) {
+		assert(results[i] == i);
+	}
+	auto empty = co_await yq::when_all(std::vector<Task<int>>{});
+	assert(empty.empty());
+	checked = true;
+}
+
+auto join_failure(Loop& loop, bool& checked) -> Task<> {
+	try {
+		co_await yq::when_all(delayed(loop, 5ms, 1), failing(loop, 1ms));
+		assert(false);
+	} catch (const std::runtime_error& e) {
+		assert(std::string{ e.what() } == "backend down");
+	}
+	checked = true;
+}
+
+void test_when_all() {
+	std::println("=== Test 1: when_all ===");
+	Loop loop;
+	bool tuple_checked = false;
+	bool vector_checked = false;
+	bool failure_checked = false;
+	auto t1 = join_tuple(loop, tuple_checked);
+	auto t2 = join_vector(loop, vector_checked);
+	auto t3 = join_failure(loop, failure_checked);
+	loop.schedule(t1);
+	loop.schedule(t2);
+	loop.schedule(t3);
+	loop.run();
+	assert(tuple_checked && vector_checked && failure_checked);
+	std::println("Test 1 passed!\n");
+}
+
+// 第一个成功的胜出, 失败的被跳过; 其余任务继续运行到结束
+auto race(Loop& loop, bool& checked) -> Task<> {
+	auto begin = Loop::clock::now();
+	std::vector<Task<int>> tasks;
+	tasks.push_back(delayed(loop, 30ms, 0));
+	tasks.push_back(failing(loop, 1ms));
+	tasks.push_back(delayed(loop, 10ms, 2));
+	tasks.push_back(delayed(loop, 20ms, 3));
+	auto [index, value] = co_await yq::when_any(std::move(tasks));
+	assert(index == 2 && value == 2);
+	assert(Loop::clock::now() - begin < 25ms);
+
+	auto first = co_await yq::when_any(delayed_name(loop, 15ms, "slow"), delayed(loop, 5ms, 7));
+	assert(first.index() == 1 && std::get<1>(first) == 7);
+
+	// 同步结束的胜出后, 之后的任务不再启动
+	auto sync = co_await yq::when_any(immediate(1), delayed(loop, 1h, 2));
+	assert(sync.index() == 0 && std::get<0>(sync) == 1);
+	checked = true;
+}
+
+auto race_failure(Loop& loop, bool& checked) -> Task<> {
+	try {
+		co_await yq::when_any(failing(loop, 1ms), failing(loop, 2ms));
+		assert(false);
+	} catch (const std::runtime_error&) {
+	}
+	try {
+		co_await yq::when_any(std::vector<Task<int>>{});
+		assert(false);
+	} catch (const std::invalid_argument&) {
+	}
+	checked = true;
+}
+
+void test_when_any() {
+	std::println("=== Test 2: when_any ===");
+	Loop loop;
+	bool race_checked = false;
+	bool failure_checked = false;
+	auto t1 = race(loop, race_checked);
+	auto t2 = race_failure(loop, failure_checked);
+	loop.schedule(t1);
+	loop.schedule(t2);
+	loop.run();
+	assert(race_checked && failure_checked);
+	// 落后的任务结束后共享状态才释放
+	assert(loop.pending_timers() == 0);
+	std::println("Test 2 passed!\n");
+}
+
+auto main() -> int {
+	test_when_all();
+	test_when_any();
+	std::println("=== All tests passed! ===");
+}
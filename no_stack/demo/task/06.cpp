@@ -0,0 +1,279 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <print>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "yq_executor.hpp"
+#include "yq_task.hpp"
+#include "yq_when.hpp"
+
+using yq::Task;
+using yq::ThreadPoolExecutor;
+
+struct ThreadSet {
+	void insert(std::thread::id id) {
+		std::lock_guard lock{ m_mutex };
+		m_ids.insert(id);
+	}
+
+	auto size() -> std::size_t {
+		std::lock_guard lock{ m_mutex };
+		return m_ids.size();
+	}
+
+	std::mutex m_mutex;
+	std::set<std::thread::id> m_ids;
+};
+
+// 外部线程co_await schedule()后在工作线程中继续
+auto hop(ThreadPoolExecutor& executor, std::thread::id caller, std::atomic<int>& hopped) -> Task<> {
+	assert(!executor.running_in_this_thread());
+	co_await executor.schedule();
+	assert(executor.running_in_this_thread());
+	assert(std::this_thread::get_id() != caller);
+	hopped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void test_schedule() {
+	std::println("=== Test 1: schedule onto workers ===");
+	std::atomic<int> hopped{ 0 };
+	std::vector<Task<>> tasks;
+	auto caller = std::this_thread::get_id();
+	{
+		ThreadPoolExecutor executor{ 4 };
+		for (int i = 0; i < 100; ++i) {
+			tasks.push_back(hop(executor, caller, hopped));
+		}
+		// 在主线程启动, 到schedule()时切换到工作线程
+		for (auto& task : tasks) {
+			task.m_coroutine.resume();
+		}
+		while (hopped.load() != 100) {
+			std::this_thread::yield();
+		}
+	}
+	// 工作线程已经退出, 协程帧不再被其他线程访问
+	for (auto& task : tasks) {
+		assert(task.done());
+	}
+	std::println("Test 1 passed!\n");
+}
+
+auto worker_task(ThreadPoolExecutor& executor, int rounds, std::atomic<long>& sum, ThreadSet& threads)
+	-> Task<> {
+	for (int i = 0; i < rounds; ++i) {
+		threads.insert(std::this_thread::get_id());
+		sum.fetch_add(i, std::memory_order_relaxed);
+		// 让出, 其他线程可以窃取
+		co_await executor.schedule();
+	}
+}
+
+// 大量任务在工作线程间让出和窃取
+void test_spawn_many() {
+	std::println("=== Test 2: spawn and work stealing ===");
+	constexpr int tasks = 10'000;
+	constexpr int rounds = 20;
+	std::atomic<long> sum{ 0 };
+	ThreadSet threads;
+	auto begin = std::chrono::steady_clock::now();
+	{
+		ThreadPoolExecutor executor{ 4 };
+		for (int i = 0; i < tasks; ++i) {
+			executor.spawn(worker_task(executor, rounds, sum, threads));
+		}
+		executor.wait();
+	}
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	assert(sum.load() == static_cast<long>(tasks) * (rounds * (rounds - 1) / 2));
+	std::println("{} resumes on {} threads in {:.3f}s", tasks * rounds, threads.size(), seconds);
+	std::println("Test 2 passed!\n");
+}
+
+auto parallel_square(ThreadPoolExecutor& executor, int value) -> Task<int> {
+	co_await executor.schedule();
+	co_return value * value;
+}
+
+auto fan_out(ThreadPoolExecutor& executor, long& total) -> Task<> {
+	std::vector<Task<int>> children;
+	for (int i = 0; i < 1000; ++i) {
+		children.push_back(parallel_square(executor, i));
+	}
+	// 子任务在不同线程结束, 最后一个结束的线程恢复fan_out
+	auto results = co_await yq::when_all(std::move(children));
+	total = 0;
+	for (int value : results) {
+		total += value;
+	}
+}
+
+void test_when_all_across_threads() {
+	std::println("=== Test 3: when_all across workers ===");
+	ThreadPoolExecutor executor{ 4 };
+	for (int round = 0; round < 20; ++round) {
+		long total = -1;
+		executor.spawn(fan_out(executor, total));
+		executor.wait();
+		assert(total == 332'833'500);
+	}
+	std::println("Test 3 passed!\n");
+}
+
+auto ping(ThreadPoolExecutor& executor, std::atomic<int>& other, std::atomic<bool>& stop) -> Task<> {
+	while (!stop.load(std::memory_order_relaxed)) {
+		other.fetch_add(1, std::memory_order_relaxed);
+		co_await executor.schedule();
+	}
+}
+
+auto starved(std::atomic<bool>& ran) -> Task<> {
+	ran.store(true);
+	co_return;
+}
+
+// 在工作线程中提交starved, 之后不停让出直到它运行
+auto spin_until_ran(ThreadPoolExecutor& executor, std::atomic<bool>& ran) -> Task<> {
+	executor.spawn(starved(ran));
+	while (!ran.load(std::memory_order_relaxed)) {
+		co_await executor.schedule();
+	}
+}
+
+// 不停让出的任务不会饿死本地队列和注入队列中的其他任务
+void test_fairness() {
+	std::println("=== Test 4: fairness between yielding tasks ===");
+	ThreadPoolExecutor executor{ 1 };
+	std::atomic<int> counter{ 0 };
+	std::atomic<bool> stop{ false };
+	std::atomic<bool> ran{ false };
+	executor.spawn(ping(executor, counter, stop));
+	executor.spawn(ping(executor, counter, stop));
+	executor.spawn(starved(ran));
+	while (!ran.load()) {
+		std::this_thread::yield();
+	}
+	stop.store(true);
+	executor.wait();
+
+	// 让出的任务排到让出队列, 本地队列中的任务先运行
+	ran.store(false);
+	executor.spawn(spin_until_ran(executor, ran));
+	executor.wait();
+	assert(ran.load());
+	std::println("Test 4 passed!\n");
+}
+
+auto failing(ThreadPoolExecutor& executor) -> Task<> {
+	co_await executor.schedule();
+	throw std::runtime_error{ "failed on worker" };
+}
+
+void test_exception_and_pinning() {
+	std::println("=== Test 5: exceptions and pinned workers ===");
+	ThreadPoolExecutor executor{ 2, true };
+	executor.spawn(failing(executor));
+	bool thrown = false;
+	try {
+		executor.wait();
+	} catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	assert(thrown);
+	std::println("Test 5 passed!\n");
+}
+
+auto add_index(int index, std::atomic<long>& sum) -> Task<> {
+	sum.fetch_add(index, std::memory_order_relaxed);
+	co_return;
+}
+
+auto spawn_children(ThreadPoolExecutor& executor, std::atomic<long>& sum) -> Task<> {
+	std::vector<Task<>> children;
+	for (int i = 0; i < 1000; ++i) {
+		children.push_back(add_index(i, sum));
+	}
+	// 在工作线程中提交时放入本地队列, 由其他线程窃取
+	executor.spawn_all(children);
+	co_return;
+}
+
+void test_spawn_all() {
+	std::println("=== Test 6: spawn_all submits a batch at once ===");
+	ThreadPoolExecutor executor{ 4 };
+	std::atomic<long> sum{ 0 };
+	std::vector<Task<>> tasks;
+	for (int i = 0; i < 10000; ++i) {
+		tasks.push_back(add_index(i, sum));
+	}
+	executor.spawn_all(tasks);
+	executor.wait();
+	assert(sum.load() == 10000L * 9999 / 2);
+	// 执行器接管了协程帧
+	assert(tasks.front().m_coroutine == nullptr);
+
+	sum = 0;
+	executor.spawn(spawn_children(executor, sum));
+	executor.wait();
+	assert(sum.load() == 1000L * 999 / 2);
+
+	// 已被移走的Task被跳过, wait不会等待它们
+	sum = 0;
+	executor.spawn_all(tasks);
+	std::vector<Task<>> mixed;
+	for (int i = 0; i < 4; ++i) {
+		mixed.push_back(add_index(i, sum));
+		mixed.push_back(std::move(tasks[i]));
+	}
+	executor.spawn_all(mixed);
+	executor.spawn(std::move(tasks.back()));
+	executor.wait();
+	assert(sum.load() == 6);
+	std::println("Test 6 passed!\n");
+}
+
+// 工作线程分到两个节点, 协程在哪个工作线程上恢复都能看到所在的节点
+auto node_hops(ThreadPoolExecutor& executor, std::atomic<int>& unbound, std::atomic<long>& sum)
+	-> Task<> {
+	for (int i = 0; i < 5; ++i) {
+		co_await executor.schedule();
+		if (yq::numa::current_thread_node() > 1) {
+			unbound.fetch_add(1, std::memory_order_relaxed);
+		}
+		sum.fetch_add(i, std::memory_order_relaxed);
+	}
+}
+
+void test_numa_workers() {
+	std::println("=== Test 7: workers placed on NUMA nodes ===");
+	// 用同一组CPU模拟两个节点
+	const auto& cpus = yq::numa::Topology::system().cpus_of(0);
+	ThreadPoolExecutor executor{ 4, yq::numa::Topology{ { cpus, cpus } } };
+	std::atomic<int> unbound{ 0 };
+	std::atomic<long> sum{ 0 };
+	for (int i = 0; i < 1000; ++i) {
+		executor.spawn(node_hops(executor, unbound, sum));
+	}
+	executor.wait();
+	assert(unbound.load() == 0);
+	assert(sum.load() == 1000L * 10);
+	// 外部线程没有绑定
+	assert(yq::numa::current_thread_node() == yq::numa::unknown_node);
+	std::println("Test 7 passed!\n");
+}
+
+auto main() -> int {
+	test_schedule();
+	test_spawn_many();
+	test_when_all_across_threads();
+	test_fairness();
+	test_exception_and_pinning();
+	test_spawn_all();
+	test_numa_workers();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,229 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <print>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "yq_executor.hpp"
+#include "yq_io.hpp"
+#include "yq_loop.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::IoBackendKind;
+using yq::IoLoop;
+using yq::Loop;
+using yq::Task;
+using yq::ThreadPoolExecutor;
+
+namespace
+{
+
+void test_queue() {
+	std::println("=== Test 1: PostQueue batches ===");
+	yq::PostQueue queue;
+	yq::PostNode nodes[3];
+	assert(queue.empty());
+	// 只有一批中的第一个需要唤醒
+	assert(queue.push(&nodes[0]));
+	assert(!queue.push(&nodes[1]));
+	assert(!queue.push(&nodes[2]));
+	yq::PostNode* node = queue.take_all();
+	assert(queue.empty());
+	for (auto& expected : nodes) {
+		assert(node == &expected);
+		node = node->next;
+	}
+	assert(node == nullptr);
+	assert(queue.push(&nodes[0]));
+	assert(queue.take_all() == &nodes[0]);
+	std::println("Test 1 passed!\n");
+}
+
+// 由其他线程post, 在loop线程上恢复
+struct Counter {
+	std::thread::id m_loop_thread;
+	int m_resumed{ 0 };
+	bool m_wrong_thread{ false };
+};
+
+auto counted(Counter& counter) -> Task<> {
+	for (;;) {
+		if (std::this_thread::get_id() != counter.m_loop_thread) {
+			counter.m_wrong_thread = true;
+		}
+		++counter.m_resumed;
+		co_await std::suspend_always{};
+	}
+}
+
+void test_foreign_post() {
+	std::println("=== Test 2: post from foreign threads ===");
+	constexpr int producers = 4;
+	constexpr int per_producer = 10000;
+	Loop loop;
+	Counter counter{ std::this_thread::get_id() };
+	auto task = counted(counter);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < producers; ++i) {
+		// 先post再释放guard, loop不会在恢复之前退出
+		threads.emplace_back([&loop, &task, guard = loop.work_guard()]() mutable {
+			for (int n = 0; n < per_producer; ++n) {
+				loop.post(task.m_coroutine);
+				if (n % 1000 == 0) {
+					std::this_thread::yield();
+				}
+			}
+			guard.reset();
+		});
+	}
+	loop.run();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	assert(counter.m_resumed == producers * per_producer);
+	assert(!counter.m_wrong_thread);
+	std::println("Test 2 passed!\n");
+}
+
+// 在执行器上计算, 再切换回loop
+auto offload(Loop& loop, ThreadPoolExecutor& executor, int value, std::atomic<int>& wrong_thread)
+	-> Task<int> {
+	const auto loop_thread = std::this_thread::get_id();
+	co_await executor.schedule();
+	if (!executor.running_in_this_thread()) {
+		++wrong_thread;
+	}
+	int result = value * value;
+	co_await loop.post();
+	if (std::this_thread::get_id() != loop_thread) {
+		++wrong_thread;
+	}
+	co_return result;
+}
+
+auto offload_all(Loop& loop, ThreadPoolExecutor& executor, int count, long long& sum,
+				 std::atomic<int>& wrong_thread) -> Task<> {
+	// 协程在执行器上时loop没有其他工作, 由guard保持运行
+	auto guard = loop.work_guard();
+	for (int i = 1; i <= count; ++i) {
+		sum += co_await offload(loop, executor, i, wrong_thread);
+	}
+}
+
+void test_executor_round_trip() {
+	std::println("=== Test 3: executor -> loop round trip ===");
+	ThreadPoolExecutor executor{ 2 };
+	Loop loop;
+	long long sum = 0;
+	long long expected = 0;
+	std::atomic<int> wrong_thread{ 0 };
+	std::vector<Task<>> tasks;
+	for (int i = 0; i < 8; ++i) {
+		tasks.push_back(offload_all(loop, executor, 200, sum, wrong_thread));
+		expected += 200LL * 201 * 401 / 6;
+	}
+	for (auto& task : tasks) {
+		loop.schedule(task);
+	}
+	loop.run();
+	for (auto& task : tasks) {
+		assert(task.done());
+	}
+	assert(sum == expected);
+	assert(wrong_thread == 0);
+	std::println("Test 3 passed!\n");
+}
+
+// 模拟其他线程上完成的操作, 完成后post回loop
+struct ResumeFromThread {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> coroutine) {
+		m_thread = std::thread([&loop = m_loop, coroutine, delay = m_delay]() {
+			std::this_thread::sleep_for(delay);
+			loop.post(coroutine);
+		});
+	}
+
+	void await_resume() const noexcept {}
+
+	IoLoop& m_loop;
+	std::thread& m_thread;
+	std::chrono::milliseconds m_delay;
+};
+
+auto wait_foreign(IoLoop& loop, std::thread& thread, int& resumed) -> Task<> {
+	auto guard = loop.work_guard();
+	for (int i = 0; i < 3; ++i) {
+		// 没有定时器和IO, loop阻塞在poll中直到被唤醒
+		co_await ResumeFromThread{ loop, thread, 10ms };
+		thread.join();
+		++resumed;
+	}
+}
+
+void test_io_loop_wakeup(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 4: wake a blocked IoLoop ({}) ===", loop.poller().backend_name());
+	std::thread thread;
+	int resumed = 0;
+	auto task = wait_foreign(loop, thread, resumed);
+	loop.schedule(task);
+	auto begin = IoLoop::clock::now();
+	loop.run();
+	assert(task.done());
+	assert(resumed == 3);
+	assert(IoLoop::clock::now() - begin >= 30ms);
+	std::println("Test 4 passed!\n");
+}
+
+void test_timer_with_post() {
+	std::println("=== Test 5: post while sleeping on a timer ===");
+	Loop loop;
+	std::atomic<bool> posted{ false };
+	Counter counter{ std::this_thread::get_id() };
+	auto task = counted(counter);
+	auto sleeper = [](Loop& loop) -> Task<> {
+		co_await loop.sleep_for(200ms);
+	}(loop);
+	loop.schedule(sleeper);
+	std::thread poster([&]() {
+		std::this_thread::sleep_for(10ms);
+		loop.post(task.m_coroutine);
+		posted = true;
+	});
+	auto begin = Loop::clock::now();
+	// 被post唤醒后恢复task, 然后继续睡到定时器到期
+	loop.run();
+	poster.join();
+	assert(posted);
+	assert(counter.m_resumed == 1);
+	assert(Loop::clock::now() - begin >= 200ms);
+	std::println("Test 5 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_queue();
+	test_foreign_post();
+	test_executor_round_trip();
+	bool has_io_uring = true;
+	try {
+		yq::IoUringBackend probe;
+	} catch (const std::system_error& e) {
+		std::println("io_uring unavailable: {}", e.what());
+		has_io_uring = false;
+	}
+	if (has_io_uring) {
+		test_io_loop_wakeup(IoBackendKind::io_uring);
+	}
+	test_io_loop_wakeup(IoBackendKind::epoll);
+	test_timer_with_post();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <memory>
+#include <print>
+#include <string>
+#include <vector>
+#include "yq_executor.hpp"
+#include "yq_loop.hpp"
+#include "yq_sync.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::AsyncMutex;
+using yq::AsyncSemaphore;
+using yq::Channel;
+using yq::Loop;
+using yq::Task;
+using yq::ThreadPoolExecutor;
+
+namespace
+{
+
+struct Section {
+	int m_inside{ 0 };
+	int m_max_inside{ 0 };
+	std::vector<int> m_order;
+
+	void enter(int id) {
+		m_max_inside = std::max(m_max_inside, ++m_inside);
+		m_order.push_back(id);
+	}
+
+	void leave() {
+		--m_inside;
+	}
+};
+
+// 持有锁时挂起在定时器上, 其他协程只能排队
+auto locked_sleep(Loop& loop, AsyncMutex& mutex, Section& section, int id) -> Task<> {
+	auto lock = co_await mutex.scoped_lock();
+	section.enter(id);
+	co_await loop.sleep_for(1ms);
+	section.leave();
+}
+
+void test_mutex_on_loop() {
+	std::println("=== Test 1: AsyncMutex on Loop ===");
+	Loop loop;
+	AsyncMutex mutex;
+	Section section;
+	std::vector<Task<>> tasks;
+	for (int i = 0; i < 10; ++i) {
+		tasks.push_back(locked_sleep(loop, mutex, section, i));
+	}
+	for (auto& task : tasks) {
+		loop.schedule(task);
+	}
+	loop.run();
+	assert(section.m_max_inside == 1);
+	// 等待者按FIFO得到锁
+	for (int i = 0; i < 10; ++i) {
+		assert(section.m_order[static_cast<std::size_t>(i)] == i);
+	}
+	assert(mutex.try_lock());
+	mutex.unlock();
+	std::println("Test 1 passed!\n");
+}
+
+auto limited(Loop& loop, AsyncSemaphore& semaphore, Section& section, int id) -> Task<> {
+	co_await semaphore.acquire();
+	section.enter(id);
+	co_await loop.sleep_for(2ms);
+	section.leave();
+	semaphore.release();
+}
+
+void test_semaphore() {
+	std::println("=== Test 2: AsyncSemaphore limits concurrency ===");
+	Loop loop;
+	AsyncSemaphore semaphore{ 3 };
+	Section section;
+	std::vector<Task<>> tasks;
+	for (int i = 0; i < 12; ++i) {
+		tasks.push_back(limited(loop, semaphore, section, i));
+	}
+	for (auto& task : tasks) {
+		loop.schedule(task);
+	}
+	auto begin = Loop::clock::now();
+	loop.run();
+	assert(section.m_max_inside == 3);
+	assert(section.m_order.size() == 12);
+	// 12个任务分4批
+	assert(Loop::clock::now() - begin >= 8ms);
+	assert(semaphore.available() == 3);
+	std::println("Test 2 passed!\n");
+}
+
+auto producer(Channel<std::unique_ptr<int>>& channel, int count) -> Task<> {
+	for (int i = 0; i < count; ++i) {
+		co_await channel.send(std::make_unique<int>(i));
+	}
+}
+
+auto consumer(Channel<std::unique_ptr<int>>& channel, int count, std::vector<int>& out) -> Task<> {
+	for (int i = 0; i < count; ++i) {
+		auto value = co_await channel.recv();
+		out.push_back(*value);
+	}
+}
+
+void test_channel_on_loop() {
+	std::println("=== Test 3: Channel on Loop ===");
+	Loop loop;
+	Channel<std::unique_ptr<int>> channel{ 4 };
+	std::vector<int> received;
+	// 先启动消费者, 在空通道上挂起; 生产者每写满4个挂起一次
+	auto receiving = consumer(channel, 1000, received);
+	auto sending = producer(channel, 1000);
+	loop.schedule(receiving);
+	loop.schedule(sending);
+	loop.run();
+	assert(receiving.done() && sending.done());
+	assert(received.size() == 1000);
+	for (int i = 0; i < 1000; ++i) {
+		assert(received[static_cast<std::size_t>(i)] == i);
+	}
+	// 剩下的元素随通道析构
+	Channel<std::string> leftover{ 2 };
+	auto partial = [](Channel<std::string>& channel) -> Task<> {
+		co_await channel.send("a");
+		co_await channel.send("b");
+	}(leftover);
+	loop.schedule(partial);
+	loop.run();
+	assert(partial.done());
+	std::println("Test 3 passed!\n");
+}
+
+auto contended(ThreadPoolExecutor& executor, AsyncMutex& mutex, long& counter, int rounds)
+	-> Task<> {
+	for (int i = 0; i < rounds; ++i) {
+		{
+			auto lock = co_await mutex.scoped_lock();
+			++counter;
+		}
+		if (i % 10 == 0) {
+			co_await executor.schedule();
+		}
+	}
+}
+
+void test_mutex_on_executor() {
+	std::println("=== Test 4: AsyncMutex across threads ===");
+	AsyncMutex mutex;
+	long counter = 0;
+	{
+		ThreadPoolExecutor executor{ 4 };
+		for (int i = 0; i < 1000; ++i) {
+			executor.spawn(contended(executor, mutex, counter, 100));
+		}
+		executor.wait();
+	}
+	assert(counter == 100000);
+	std::println("Test 4 passed!\n");
+}
+
+auto sum_producer(Channel<long>& channel, long begin, long end) -> Task<> {
+	for (long i = begin; i < end; ++i) {
+		co_await channel.send(i);
+	}
+}
+
+auto sum_consumer(Channel<long>& channel, long count, std::atomic<long>& sum) -> Task<> {
+	long local = 0;
+	for (long i = 0; i < count; ++i) {
+		local += co_await channel.recv();
+	}
+	sum += local;
+}
+
+void test_channel_on_executor() {
+	std::println("=== Test 5: Channel with 4 producers and 4 consumers ===");
+	Channel<long> channel{ 8 };
+	std::atomic<long> sum{ 0 };
+	constexpr long per_task = 20000;
+	{
+		ThreadPoolExecutor executor{ 4 };
+		for (long i = 0; i < 4; ++i) {
+			executor.spawn(sum_consumer(channel, per_task, sum));
+			executor.spawn(sum_producer(channel, i * per_task, (i + 1) * per_task));
+		}
+		executor.wait();
+	}
+	constexpr long total = 4 * per_task;
+	assert(sum == total * (total - 1) / 2);
+	std::println("Test 5 passed!\n");
+}
+
+auto chained(AsyncMutex& mutex, int& counter) -> Task<> {
+	co_await mutex.lock();
+	++counter;
+	mutex.unlock();
+}
+
+void test_long_handoff_chain() {
+	std::println("=== Test 6: 100k waiters handed off without deep recursion ===");
+	AsyncMutex mutex;
+	int counter = 0;
+	std::vector<Task<>> tasks;
+	assert(mutex.try_lock());
+	for (int i = 0; i < 100000; ++i) {
+		tasks.push_back(chained(mutex, counter));
+		tasks.back().m_coroutine.resume();
+	}
+	assert(counter == 0);
+	// 每个等待者unlock时唤醒下一个, 由最外层的unlock依次恢复
+	mutex.unlock();
+	assert(counter == 100000);
+	for (auto& task : tasks) {
+		assert(task.done());
+	}
+	std::println("Test 6 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_mutex_on_loop();
+	test_semaphore();
+	test_channel_on_loop();
+	test_mutex_on_executor();
+	test_channel_on_executor();
+	test_long_handoff_chain();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,224 @@
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "yq_bridge.hpp"
+#include "yq_co_sync.hpp"
+#include "yq_loop.hpp"
+#include "yq_sync.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::AsyncSemaphore;
+using yq::Coroutine;
+using yq::Loop;
+using yq::Task;
+
+namespace
+{
+
+auto delayed(Loop& loop, std::chrono::milliseconds delay, int value) -> Task<int> {
+	co_await loop.sleep_for(delay);
+	co_return value;
+}
+
+// 每次tick释放一个许可, 等待者按许可数而不是时间判断ticker运行到了哪里
+auto ticker(Loop& loop, int count, int& ticks, AsyncSemaphore& tick) -> Task<> {
+	for (int i = 0; i < count; ++i) {
+		co_await loop.sleep_for(1ms);
+		++ticks;
+		tick.release();
+	}
+}
+
+// 等到第count次tick之后返回
+auto after_ticks(AsyncSemaphore& tick, int count, int value) -> Task<int> {
+	for (int i = 0; i < count; ++i) {
+		co_await tick.acquire();
+	}
+	co_return value;
+}
+
+void test_stackful_awaits_task() {
+	std::println("=== Test 1: stackful code awaits a Task ===");
+	Loop loop;
+	int ticks = 0;
+	int ticks_seen = -1;
+	AsyncSemaphore tick{ 0 };
+	auto legacy = yq::run_stackful(loop, [&]() {
+		int value = yq::await(after_ticks(tick, 3, 42));
+		// 等待期间Loop继续运行其他无栈协程
+		ticks_seen = ticks;
+		// 其他awaitable包装成Task
+		yq::await(loop.sleep_for(1ms));
+		return value + 1;
+	});
+	auto background = ticker(loop, 5, ticks, tick);
+	loop.schedule(legacy);
+	loop.schedule(background);
+	loop.run();
+	assert(legacy.result() == 43);
+	assert(ticks_seen == 3);
+	assert(ticks == 5);
+	std::println("Test 1 passed!\n");
+}
+
+auto outer(Loop& loop, std::thread::id loop_thread) -> Task<std::string> {
+	std::string result = co_await yq::run_stackful(loop, [&]() {
+		assert(std::this_thread::get_id() == loop_thread);
+		// 有栈 -> 无栈 -> 有栈
+		auto inner = [&]() -> Task<int> {
+			int value = co_await yq::run_stackful(loop, [&]() {
+				return yq::await(delayed(loop, 2ms, 20)) + 1;
+			});
+			co_return value * 2;
+		};
+		return std::to_string(yq::await(inner()));
+	});
+	co_return result + "!";
+}
+
+void test_task_awaits_stackful() {
+	std::println("=== Test 2: Task awaits stackful completion ===");
+	Loop loop;
+	auto task = outer(loop, std::this_thread::get_id());
+	loop.schedule(task);
+	loop.run();
+	assert(task.result() == "42!");
+	std::println("Test 2 passed!\n");
+}
+
+auto failing(Loop& loop) -> Task<int> {
+	co_await loop.sleep_for(1ms);
+	throw std::runtime_error{ "task failed" };
+}
+
+auto catch_stackful(Loop& loop, bool& caught) -> Task<> {
+	try {
+		co_await yq::run_stackful(loop, []() { throw std::logic_error{ "stackful failed" }; });
+	} catch (const std::logic_error& e) {
+		caught = std::string{ e.what() } == "stackful failed";
+	}
+}
+
+void test_exceptions() {
+	std::println("=== Test 3: exceptions cross the bridge ===");
+	Loop loop;
+	bool task_error_caught = false;
+	auto legacy = yq::run_stackful(loop, [&]() {
+		try {
+			yq::await(failing(loop));
+		} catch (const std::runtime_error&) {
+			task_error_caught = true;
+		}
+	});
+	bool stackful_error_caught = false;
+	auto modern = catch_stackful(loop, stackful_error_caught);
+	loop.schedule(legacy);
+	loop.schedule(modern);
+	loop.run();
+	assert(task_error_caught);
+	assert(stackful_error_caught);
+	legacy.result();
+	// 不在run_stackful中调用await
+	bool rejected = false;
+	try {
+		yq::await(delayed(loop, 1ms, 0));
+	} catch (const std::logic_error&) {
+		rejected = true;
+	}
+	assert(rejected);
+	std::println("Test 3 passed!\n");
+}
+
+void test_yield_based_code() {
+	std::println("=== Test 4: yield-based code shares the Loop ===");
+	Loop loop;
+	yq::CoMutex mutex;
+	std::vector<std::string> log;
+	AsyncSemaphore tick{ 0 };
+	auto worker = [&](std::string name) {
+		return yq::run_stackful(loop, [&, name]() {
+			for (int i = 0; i < 3; ++i) {
+				std::lock_guard lock{ mutex };
+				log.push_back(name);
+				// 持有锁时让出, 另一个协程在CoMutex上yield等待
+				Coroutine::yield();
+				// 每一轮消耗一次tick, 等待期间ticker在同一个Loop上运行
+				yq::await(tick.acquire());
+			}
+		});
+	};
+	int ticks = 0;
+	auto a = worker("a");
+	auto b = worker("b");
+	auto background = ticker(loop, 6, ticks, tick);
+	loop.schedule(a);
+	loop.schedule(b);
+	loop.schedule(background);
+	loop.run();
+	assert(a.done() && b.done());
+	assert((log == std::vector<std::string>{ "a", "b", "a", "b", "a", "b" }));
+	assert(ticks == 6 && tick.available() == 0);
+	std::println("Test 4 passed!\n");
+}
+
+// 模拟第三方库: 深层的同步回调
+auto deep_callback(int depth, const std::function<int()>& leaf) -> int {
+	if (depth == 0) {
+		return leaf();
+	}
+	volatile char frame[64] = {};
+	return deep_callback(depth - 1, leaf) + frame[0];
+}
+
+void test_deep_stack() {
+	std::println("=== Test 5: await at the bottom of a deep callback stack ===");
+	Loop loop;
+	auto legacy = yq::run_stackful(loop, [&]() {
+		return deep_callback(2000, [&]() { return yq::await(delayed(loop, 1ms, 7)); });
+	}, 1024 * 1024);
+	loop.schedule(legacy);
+	loop.run();
+	assert(legacy.result() == 7);
+	std::println("Test 5 passed!\n");
+}
+
+auto ready(int value) -> Task<int> {
+	co_return value;
+}
+
+// 大量await同步完成的Task, 每次都经过驱动任务切换, 结果逐个累加
+void test_many_awaits() {
+	std::println("=== Test 6: many awaits of ready tasks ===");
+	Loop loop;
+	constexpr int rounds = 100000;
+	auto legacy = yq::run_stackful(loop, [&]() {
+		long sum = 0;
+		for (int i = 0; i < rounds; ++i) {
+			sum += yq::await(ready(i));
+		}
+		return sum;
+	});
+	loop.schedule(legacy);
+	loop.run();
+	assert(legacy.result() == static_cast<long>(rounds) * (rounds - 1) / 2);
+	std::println("Test 6 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_stackful_awaits_task();
+	test_task_awaits_stackful();
+	test_exceptions();
+	test_yield_based_code();
+	test_deep_stack();
+	test_many_awaits();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,275 @@
+// 需要定义CO_ENABLE_STATS, 见CMakeLists.txt
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <print>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "yq_coroutine.hpp"
+#include "yq_loop.hpp"
+#include "yq_scheduler.hpp"
+#include "yq_stats.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::Coroutine;
+using yq::Loop;
+using yq::Task;
+
+namespace
+{
+
+void spin(std::chrono::microseconds duration) {
+	const auto end = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < end) {
+	}
+}
+
+void test_stackful_counters() {
+	std::println("=== Test 1: stackful resume counts and run slices ===");
+	Coroutine quick([]() {
+		for (int i = 0; i < 3; ++i) {
+			Coroutine::yield();
+		}
+	});
+	Coroutine hog([]() {
+		spin(2ms);
+		Coroutine::yield();
+	});
+	quick.set_name("quick");
+	hog.set_name("hog");
+	while (!quick.is_finished() || !hog.is_finished()) {
+		if (!quick.is_finished()) {
+			quick.resume();
+		}
+		if (!hog.is_finished()) {
+			hog.resume();
+		}
+	}
+	auto quick_stats = quick.stats();
+	auto hog_stats = hog.stats();
+	assert(std::strcmp(hog_stats.name, "hog") == 0);
+	assert(quick_stats.resumes == 4);
+	assert(hog_stats.resumes == 2);
+	assert(hog_stats.max_slice_ticks <= hog_stats.busy_ticks);
+	// 占用线程的协程一眼可见
+	assert(yq::stats::ticks_to_ns(hog_stats.max_slice_ticks) >= 2e6);
+	assert(hog_stats.max_slice_ticks > 10 * quick_stats.max_slice_ticks);
+	std::println("hog max slice {:.0f} us, quick max slice {:.0f} ns",
+				 yq::stats::ticks_to_ns(hog_stats.max_slice_ticks) / 1e3,
+				 yq::stats::ticks_to_ns(quick_stats.max_slice_ticks));
+	std::println("Test 1 passed!\n");
+}
+
+auto deep(int depth) -> int {
+	volatile char frame[256] = {};
+	if (depth > 0) {
+		return deep(depth - 1) + frame[0];
+	}
+	return frame[0];
+}
+
+void test_stack_watermark() {
+	std::println("=== Test 2: peak stack depth from the watermark ===");
+	constexpr std::size_t stack_size = 256 * 1024;
+	Coroutine shallow(stack_size, []() { Coroutine::yield(); });
+	Coroutine heavy(stack_size, []() {
+		deep(200);
+		Coroutine::yield();
+	});
+	shallow.resume();
+	heavy.resume();
+	auto shallow_peak = shallow.stats().peak_stack;
+	auto heavy_peak = heavy.stats().peak_stack;
+	assert(shallow_peak > 0 && shallow_peak < 16 * 1024);
+	assert(heavy_peak >= 200 * 256 && heavy_peak < stack_size);
+	// 结束后栈已经归还, 深度仍然保留
+	heavy.resume();
+	assert(heavy.is_finished());
+	assert(heavy.stats().peak_stack == heavy_peak);
+	shallow.resume();
+	std::println("shallow {} bytes, heavy {} bytes", shallow_peak, heavy_peak);
+	std::println("Test 2 passed!\n");
+}
+
+auto busy_child() -> Task<int> {
+	spin(2ms);
+	co_return 1;
+}
+
+auto parent(Loop& loop) -> Task<int> {
+	co_await loop.sleep_for(1ms);
+	int value = co_await busy_child();
+	co_await loop.sleep_for(1ms);
+	co_return value;
+}
+
+void test_task_counters() {
+	std::println("=== Test 3: Task slices exclude awaited children ===");
+	Loop loop;
+	auto task = parent(loop);
+	task.set_name("parent");
+	loop.schedule(task);
+	loop.run();
+	assert(task.result() == 1);
+	auto stats = task.stats();
+	// 开始, 两次sleep之后, busy_child结束之后
+	assert(stats.resumes == 4);
+	assert(yq::stats::ticks_to_ns(stats.busy_ticks) < 1e6);
+	// 不挂起的co_await不产生新的时间片
+	auto ready = []() -> Task<> {
+		co_await std::suspend_never{};
+		co_await std::suspend_never{};
+	}();
+	ready.m_coroutine.resume();
+	assert(ready.done());
+	assert(ready.stats().resumes == 1);
+	std::println("Test 3 passed!\n");
+}
+
+void test_thread_snapshot() {
+	std::println("=== Test 4: per-thread counters ===");
+	// 其他线程上运行的协程计入各自线程
+	yq::Scheduler scheduler{ 2 };
+	for (int i = 0; i < 100; ++i) {
+		scheduler.spawn([]() {
+			for (int j = 0; j < 10; ++j) {
+				Coroutine::yield();
+			}
+		});
+	}
+	scheduler.wait();
+	auto threads = yq::stats::snapshot();
+	std::uint64_t total = 0;
+	for (const auto& thread : threads) {
+		assert(thread.max_slice_ticks <= thread.busy_ticks);
+		total += thread.resumes;
+	}
+	assert(threads.size() >= 3);
+	// 前面的测试和这里的100 * 11次
+	assert(total >= 1100);
+	std::println("{} threads, {} slices", threads.size(), total);
+	std::println("Test 4 passed!\n");
+}
+
+void test_chrome_trace() {
+	std::println("=== Test 5: Chrome trace export ===");
+	Coroutine named([]() { Coroutine::yield(); });
+	named.set_name("traced \"co\"");
+	named.resume();
+	named.resume();
+	std::ostringstream out;
+	yq::stats::write_chrome_trace(out);
+	const std::string trace = out.str();
+	assert(trace.starts_with("{\"traceEvents\":["));
+	assert(trace.find("\"ph\":\"X\"") != std::string::npos);
+	assert(trace.find("\"ph\":\"M\"") != std::string::npos);
+	assert(trace.find("\"name\":\"traced \\\"co\\\"\"") != std::string::npos);
+	assert(trace.find("\"name\":\"hog\"") != std::string::npos);
+	assert(trace.ends_with("]}\n"));
+	std::println("Test 5 passed!\n");
+}
+
+// 每次resume都计入统计, 包括最后运行到结束的一次
+void test_resume_count() {
+	std::println("=== Test 6: counters over many round trips ===");
+	constexpr int rounds = 100000;
+	Coroutine co([]() {
+		for (int i = 0; i < rounds; ++i) {
+			Coroutine::yield();
+		}
+	});
+	while (!co.is_finished()) {
+		co.resume();
+	}
+	assert(co.stats().resumes == rounds + 1);
+	std::println("Test 6 passed!\n");
+}
+
+// 记录每次分配的大小
+class RecordingAllocator final : public yq::StackAllocator {
+public:
+	auto allocate(std::size_t size) -> yq::Stack override {
+		m_sizes.push_back(size);
+		return m_heap.allocate(size);
+	}
+
+	void deallocate(yq::Stack stack) noexcept override {
+		m_heap.deallocate(stack);
+	}
+
+	std::vector<std::size_t> m_sizes;
+
+private:
+	yq::HeapStackAllocator m_heap;
+};
+
+// 每个函数中的lambda是一个创建位置
+auto run_light(yq::StackAllocator& allocator) -> std::size_t {
+	Coroutine co(allocator, 2 * 1024 * 1024, []() {
+		deep(8);
+		Coroutine::yield();
+	});
+	co.resume();
+	co.resume();
+	assert(co.is_finished());
+	return co.stack_high_water();
+}
+
+auto run_heavy(yq::StackAllocator& allocator) -> std::size_t {
+	Coroutine co(allocator, 2 * 1024 * 1024, []() { deep(200); });
+	co.resume();
+	return co.stack_high_water();
+}
+
+auto run_saturated(yq::StackAllocator& allocator) -> std::size_t {
+	Coroutine co(allocator, 2 * 1024 * 1024, []() { deep(1200); });
+	co.resume();
+	return co.stack_high_water();
+}
+
+void test_adaptive_stacks() {
+	std::println("=== Test 7: stack sizes adapt to observed watermarks ===");
+	RecordingAllocator upstream;
+	yq::AdaptiveStackAllocator adaptive{ upstream, 16 * 1024, 4 };
+	std::size_t light = 0;
+	std::size_t heavy = 0;
+	for (int i = 0; i < 8; ++i) {
+		light = std::max(light, run_light(adaptive));
+		heavy = std::max(heavy, run_heavy(adaptive));
+		run_saturated(adaptive);
+	}
+	assert(light > 0 && light < 8 * 1024);
+	assert(heavy >= 200 * 256 && heavy < CO_STACK_PAINT_BYTES);
+	// 水位的两倍向上取整到2的幂, 不小于16 KiB; 不开启ASan时分别为16 KiB和128 KiB
+	const std::size_t light_size = std::max<std::size_t>(std::bit_ceil(light * 2), 16 * 1024);
+	const std::size_t heavy_size = std::bit_ceil(heavy * 2);
+	assert(upstream.m_sizes.size() == 24);
+	for (std::size_t i = 0; i < 24; i += 3) {
+		// 前4轮使用请求的大小
+		const std::size_t requested = 2 * 1024 * 1024;
+		assert(upstream.m_sizes[i] == (i < 12 ? requested : light_size));
+		assert(upstream.m_sizes[i + 1] == (i < 12 ? requested : heavy_size));
+		// 超过填充范围, 不知道实际的使用量
+		assert(upstream.m_sizes[i + 2] == requested);
+	}
+	std::println("light {} -> {} bytes, heavy {} -> {} bytes", light, light_size, heavy, heavy_size);
+	std::println("Test 7 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_stackful_counters();
+	test_stack_watermark();
+	test_task_counters();
+	test_thread_snapshot();
+	test_chrome_trace();
+	test_resume_count();
+	test_adaptive_stacks();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,304 @@
+// 以-fno-exceptions -fno-rtti编译, 见CMakeLists.txt
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <print>
+#include <stop_token>
+#include <system_error>
+#include <vector>
+#include "yq_async_generator.hpp"
+#include "yq_coroutine.hpp"
+#include "yq_executor.hpp"
+#include "yq_loop.hpp"
+#include "yq_scheduler.hpp"
+#include "yq_task.hpp"
+#include "yq_when.hpp"
+using namespace std::chrono_literals;
+
+#ifndef CO_NO_EXCEPTIONS
+#error "11.cpp must be compiled without exceptions"
+#endif
+
+using yq::Coroutine;
+using yq::Loop;
+using yq::Task;
+
+namespace
+{
+
+const auto timed_out = std::make_error_code(std::errc::timed_out);
+const auto refused = std::make_error_code(std::errc::connection_refused);
+
+void test_stackful_error() {
+	std::println("=== Test 1: stackful coroutines report std::error_code ===");
+	int steps = 0;
+	Coroutine co([&steps]() -> std::error_code {
+		++steps;
+		Coroutine::yield();
+		++steps;
+		return timed_out;
+	});
+	co.resume();
+	assert(!co.is_finished() && !co.error());
+	co.resume();
+	assert(co.is_finished());
+	assert(co.error() == timed_out);
+	assert(steps == 2);
+
+	// 返回其他类型时没有错误
+	Coroutine plain([]() { return 42; });
+	plain.resume();
+	assert(plain.is_finished() && !plain.error());
+
+	// 带值通道的协程通过返回值传递错误
+	using Doubler = yq::VarCoroutine<int(int)>;
+	Doubler doubler([](int x) {
+		x = Doubler::yield(x * 2);
+		return x * 2;
+	});
+	assert(doubler.resume(1) == 2);
+	assert(doubler.resume(5) == 10);
+	assert(doubler.is_finished() && !doubler.error());
+	std::println("Test 1 passed!\n");
+}
+
+void test_scheduler_error() {
+	std::println("=== Test 2: Scheduler keeps the first failure ===");
+	yq::Scheduler scheduler{ 2 };
+	std::atomic<int> finished{ 0 };
+	for (int i = 0; i < 50; ++i) {
+		scheduler.spawn([i, &finished]() -> std::error_code {
+			Coroutine::yield();
+			finished.fetch_add(1);
+			return i == 17 ? refused : std::error_code{};
+		});
+	}
+	scheduler.wait();
+	assert(finished.load() == 50);
+	assert(scheduler.error() == refused);
+	// 取出后清空
+	assert(!scheduler.error());
+	std::println("Test 2 passed!\n");
+}
+
+struct Counted {
+	~Counted() {
+		++*m_destroyed;
+	}
+
+	int* m_destroyed;
+};
+
+auto leaf(Loop& loop, int& destroyed) -> Task<int> {
+	Counted guard{ &destroyed };
+	co_await loop.sleep_for(1ms);
+	co_await yq::fail(timed_out);
+	co_return 1;
+}
+
+auto middle(Loop& loop, int& destroyed, bool& resumed) -> Task<int> {
+	Counted guard{ &destroyed };
+	int value = co_await leaf(loop, destroyed);
+	// 失败沿着co_await链向上传递, 这里不会执行
+	resumed = true;
+	co_return value + 1;
+}
+
+auto top(Loop& loop, int& destroyed, bool& resumed) -> Task<int> {
+	auto result = co_await yq::try_await(middle(loop, destroyed, resumed));
+	assert(!result);
+	co_return result.error() == timed_out ? 7 : 0;
+}
+
+void test_task_failure() {
+	std::println("=== Test 3: Task failures propagate to try_await ===");
+	Loop loop;
+	int destroyed = 0;
+	bool resumed = false;
+	auto task = top(loop, destroyed, resumed);
+	loop.schedule(task);
+	loop.run();
+	assert(task.done());
+	assert(!task.error());
+	assert(task.result() == 7);
+	assert(!resumed);
+	// 停在挂起点上的任务在try_await结束时销毁, 局部变量照常析构
+	assert(destroyed == 2);
+
+	// 没有处理的失败到达顶层
+	{
+		Loop other;
+		int count = 0;
+		bool reached = false;
+		auto failed = middle(other, count, reached);
+		other.schedule(failed);
+		other.run();
+		assert(failed.done());
+		assert(failed.error() == timed_out);
+		assert(!reached);
+	}
+	std::println("Test 3 passed!\n");
+}
+
+auto value_after(Loop& loop, std::chrono::milliseconds delay, int value) -> Task<int> {
+	co_await loop.sleep_for(delay);
+	co_return value;
+}
+
+auto error_after(Loop& loop, std::chrono::milliseconds delay, std::error_code error) -> Task<int> {
+	co_await loop.sleep_for(delay);
+	co_await yq::fail(error);
+	co_return 0;
+}
+
+auto gather(Loop& loop) -> Task<int> {
+	// 第一个失败的子任务
+	auto all = co_await yq::try_await(yq::when_all(value_after(loop, 1ms, 1),
+												   error_after(loop, 3ms, refused),
+												   error_after(loop, 2ms, timed_out)));
+	assert(!all && all.error() == refused);
+
+	std::vector<Task<int>> tasks;
+	tasks.push_back(value_after(loop, 1ms, 1));
+	tasks.push_back(error_after(loop, 1ms, timed_out));
+	auto list = co_await yq::try_await(yq::when_all(std::move(tasks)));
+	assert(!list && list.error() == timed_out);
+
+	// 成功的任务胜出; 全部失败时得到最后一个失败的错误
+	auto any = co_await yq::try_await(yq::when_any(error_after(loop, 1ms, refused),
+												   value_after(loop, 2ms, 5)));
+	assert(any && std::get<1>(*any) == 5);
+	auto none = co_await yq::try_await(yq::when_any(error_after(loop, 1ms, refused),
+													error_after(loop, 2ms, timed_out)));
+	assert(!none && none.error() == timed_out);
+
+	auto ok = co_await yq::when_all(value_after(loop, 1ms, 2), value_after(loop, 1ms, 3));
+	co_return std::get<0>(ok) + std::get<1>(ok);
+}
+
+void test_when_failure() {
+	std::println("=== Test 4: when_all/when_any without exceptions ===");
+	Loop loop;
+	auto task = gather(loop);
+	loop.schedule(task);
+	loop.run();
+	assert(task.result() == 5);
+	std::println("Test 4 passed!\n");
+}
+
+auto worker_job(int i, std::atomic<int>& count) -> Task<> {
+	count.fetch_add(1);
+	if (i == 3) {
+		co_await yq::fail(refused);
+	}
+}
+
+void test_executor_error() {
+	std::println("=== Test 5: ThreadPoolExecutor keeps the first failure ===");
+	yq::ThreadPoolExecutor executor{ 2 };
+	std::atomic<int> count{ 0 };
+	for (int i = 0; i < 10; ++i) {
+		executor.spawn(worker_job(i, count));
+	}
+	executor.wait();
+	assert(count.load() == 10);
+	assert(executor.error() == refused);
+	std::println("Test 5 passed!\n");
+}
+
+auto sleeper(Loop& loop, std::stop_token token, int& destroyed) -> Task<int> {
+	Counted guard{ &destroyed };
+	co_await loop.sleep_for(10s, token);
+	co_return 1;
+}
+
+auto sleep_or_cancel(Loop& loop, std::stop_token token, int& destroyed) -> Task<std::error_code> {
+	auto result = co_await yq::try_await(sleeper(loop, token, destroyed));
+	co_return result ? std::error_code{} : result.error();
+}
+
+void test_cancellation() {
+	std::println("=== Test 6: cancellation without exceptions ===");
+	Loop loop;
+	std::stop_source source;
+	int destroyed = 0;
+	auto task = sleep_or_cancel(loop, source.get_token(), destroyed);
+	auto stopper = [](Loop& loop, std::stop_source& source) -> Task<> {
+		co_await loop.sleep_for(1ms);
+		source.request_stop();
+	}(loop, source);
+	loop.schedule(task);
+	loop.schedule(stopper);
+	loop.run();
+	// 被取消的sleep以operation_canceled失败, 沿co_await链传递
+	assert(task.result() == std::errc::operation_canceled);
+	assert(destroyed == 1);
+	assert(loop.pending_timers() == 0);
+
+	// 有栈协程中yield照常返回, 协程自行检查后返回
+	std::stop_source stackful;
+	int rounds = 0;
+	Coroutine co([&rounds]() {
+		while (!Coroutine::stop_requested()) {
+			++rounds;
+			Coroutine::yield();
+		}
+	});
+	co.set_stop_token(stackful.get_token());
+	co.resume();
+	co.resume();
+	stackful.request_stop();
+	co.resume();
+	assert(co.is_finished() && co.cancelled() && !co.error());
+	assert(rounds == 2);
+	std::println("Test 6 passed!\n");
+}
+
+auto numbers(Loop& loop, int& destroyed) -> yq::AsyncGenerator<int> {
+	Counted guard{ &destroyed };
+	co_yield 1;
+	co_await loop.sleep_for(1ms);
+	co_yield 2;
+	co_await yq::fail(refused);
+}
+
+auto sum_numbers(Loop& loop, int& destroyed, int& sum) -> Task<int> {
+	auto gen = numbers(loop, destroyed);
+	for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+		sum += *it;
+	}
+	// 生成器失败时消费者同样不再恢复
+	co_return -1;
+}
+
+auto stream_or_error(Loop& loop, int& destroyed, int& sum) -> Task<std::error_code> {
+	auto result = co_await yq::try_await(sum_numbers(loop, destroyed, sum));
+	co_return result ? std::error_code{} : result.error();
+}
+
+void test_generator_failure() {
+	std::println("=== Test 7: AsyncGenerator failure without exceptions ===");
+	Loop loop;
+	int destroyed = 0;
+	int sum = 0;
+	auto task = stream_or_error(loop, destroyed, sum);
+	loop.schedule(task);
+	loop.run();
+	assert(task.result() == refused);
+	assert(sum == 3);
+	assert(destroyed == 1);
+	std::println("Test 7 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_stackful_error();
+	test_scheduler_error();
+	test_task_failure();
+	test_when_failure();
+	test_executor_error();
+	test_cancellation();
+	test_generator_failure();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,304 @@
+#include <cassert>
+#include <chrono>
+#include <fcntl.h>
+#include <print>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "yq_io.hpp"
+#include "yq_loop.hpp"
+#include "yq_sync.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::AsyncMutex;
+using yq::AsyncSemaphore;
+using yq::Channel;
+using yq::IoBackendKind;
+using yq::IoLoop;
+using yq::Loop;
+using yq::Task;
+
+namespace
+{
+
+auto is_cancelled(const std::system_error& e) -> bool {
+	return e.code() == std::errc::operation_canceled;
+}
+
+// 返回协程是否被取消
+auto long_sleep(Loop& loop, std::stop_token token) -> Task<bool> {
+	try {
+		co_await loop.sleep_for(10s, token);
+	} catch (const std::system_error& e) {
+		co_return is_cancelled(e);
+	}
+	co_return false;
+}
+
+auto stop_after(Loop& loop, std::chrono::milliseconds delay, std::stop_source& source) -> Task<> {
+	co_await loop.sleep_for(delay);
+	source.request_stop();
+}
+
+void test_cancel_sleep() {
+	std::println("=== Test 1: cancelled sleep leaves the timer queue ===");
+	Loop loop;
+	std::stop_source source;
+	auto sleeper = long_sleep(loop, source.get_token());
+	auto stopper = stop_after(loop, 2ms, source);
+	loop.schedule(sleeper);
+	loop.schedule(stopper);
+	const auto begin = std::chrono::steady_clock::now();
+	loop.run();
+	// 定时器已经移除, run不需要等到10秒后
+	assert(std::chrono::steady_clock::now() - begin < 1s);
+	assert(sleeper.result());
+	assert(loop.pending_timers() == 0);
+
+	// 已经请求停止时不挂起
+	auto stopped = long_sleep(loop, source.get_token());
+	loop.schedule(stopped);
+	loop.run();
+	assert(stopped.result());
+
+	// 没有取消的sleep照常结束
+	std::stop_source idle;
+	auto quick = [](Loop& loop, std::stop_token token) -> Task<int> {
+		co_await loop.sleep_for(1ms, token);
+		co_return 1;
+	}(loop, idle.get_token());
+	loop.schedule(quick);
+	loop.run();
+	assert(quick.result() == 1);
+	std::println("Test 1 passed!\n");
+}
+
+void test_cancel_from_thread() {
+	std::println("=== Test 2: stop requested from another thread ===");
+	Loop loop;
+	std::stop_source source;
+	std::vector<Task<bool>> sleepers;
+	for (int i = 0; i < 100; ++i) {
+		sleepers.push_back(long_sleep(loop, source.get_token()));
+		loop.schedule(sleepers.back());
+	}
+	std::jthread canceller([&source]() {
+		std::this_thread::sleep_for(5ms);
+		source.request_stop();
+	});
+	const auto begin = std::chrono::steady_clock::now();
+	loop.run();
+	assert(std::chrono::steady_clock::now() - begin < 1s);
+	for (auto& sleeper : sleepers) {
+		assert(sleeper.result());
+	}
+	assert(loop.pending_timers() == 0);
+	std::println("Test 2 passed!\n");
+}
+
+auto acquire_or_cancel(AsyncSemaphore& semaphore, std::stop_token token, int& acquired,
+					   int& cancelled) -> Task<> {
+	try {
+		co_await semaphore.acquire(token);
+		++acquired;
+	} catch (const std::system_error& e) {
+		assert(is_cancelled(e));
+		++cancelled;
+	}
+}
+
+void test_cancel_semaphore() {
+	std::println("=== Test 3: cancelled acquire returns its slot ===");
+	AsyncSemaphore semaphore{ 0 };
+	std::stop_source first;
+	std::stop_source second;
+	std::stop_source third;
+	int acquired = 0;
+	int cancelled = 0;
+	auto a = acquire_or_cancel(semaphore, first.get_token(), acquired, cancelled);
+	auto b = acquire_or_cancel(semaphore, second.get_token(), acquired, cancelled);
+	auto c = acquire_or_cancel(semaphore, third.get_token(), acquired, cancelled);
+	a.m_coroutine.resume();
+	b.m_coroutine.resume();
+	c.m_coroutine.resume();
+	// 在请求停止的线程上立即恢复
+	second.request_stop();
+	assert(b.done() && cancelled == 1);
+	semaphore.release(2);
+	assert(a.done() && c.done() && acquired == 2);
+	// 取消的等待者占用的计数被抵消, 之后的许可照常可用
+	semaphore.release();
+	assert(semaphore.available() == 1);
+	assert(semaphore.try_acquire());
+	assert(semaphore.available() == 0);
+
+	// 已经请求停止时不等待, 也不占用许可
+	semaphore.release();
+	auto late = acquire_or_cancel(semaphore, second.get_token(), acquired, cancelled);
+	late.m_coroutine.resume();
+	assert(late.done() && cancelled == 2);
+	assert(semaphore.available() == 1);
+	std::println("Test 3 passed!\n");
+}
+
+auto send_or_cancel(Channel<int>& channel, int value, std::stop_token token) -> Task<bool> {
+	try {
+		co_await channel.send(value, token);
+	} catch (const std::system_error& e) {
+		co_return !is_cancelled(e);
+	}
+	co_return true;
+}
+
+auto recv_or_cancel(Channel<int>& channel, std::stop_token token) -> Task<int> {
+	try {
+		co_return co_await channel.recv(token);
+	} catch (const std::system_error& e) {
+		assert(is_cancelled(e));
+	}
+	co_return -1;
+}
+
+auto lock_or_cancel(AsyncMutex& mutex, std::stop_token token) -> Task<bool> {
+	try {
+		auto lock = co_await mutex.scoped_lock(token);
+	} catch (const std::system_error& e) {
+		co_return !is_cancelled(e);
+	}
+	co_return true;
+}
+
+void test_cancel_channel_and_mutex() {
+	std::println("=== Test 4: cancelled channel and mutex waiters ===");
+	Channel<int> channel{ 1 };
+	std::stop_source source;
+	auto full = send_or_cancel(channel, 1, source.get_token());
+	auto blocked = send_or_cancel(channel, 2, source.get_token());
+	full.m_coroutine.resume();
+	blocked.m_coroutine.resume();
+	assert(full.result());
+	assert(!blocked.done());
+	source.request_stop();
+	assert(blocked.done() && !blocked.result());
+
+	// 缓冲区中只有第一个值, 取消的send没有留下元素
+	std::stop_source other;
+	auto first = recv_or_cancel(channel, other.get_token());
+	first.m_coroutine.resume();
+	assert(first.result() == 1);
+	auto empty = recv_or_cancel(channel, other.get_token());
+	empty.m_coroutine.resume();
+	assert(!empty.done());
+	other.request_stop();
+	assert(empty.result() == -1);
+	std::stop_source fresh;
+	auto resend = send_or_cancel(channel, 3, fresh.get_token());
+	auto received = recv_or_cancel(channel, fresh.get_token());
+	resend.m_coroutine.resume();
+	received.m_coroutine.resume();
+	assert(received.result() == 3);
+
+	AsyncMutex mutex;
+	assert(mutex.try_lock());
+	std::stop_source lock_source;
+	auto waiter = lock_or_cancel(mutex, lock_source.get_token());
+	waiter.m_coroutine.resume();
+	assert(!waiter.done());
+	lock_source.request_stop();
+	assert(waiter.done() && !waiter.result());
+	mutex.unlock();
+	// 锁没有交给取消的等待者
+	assert(mutex.try_lock());
+	mutex.unlock();
+	std::println("Test 4 passed!\n");
+}
+
+auto read_or_cancel(yq::IoContext& io, int fd, std::stop_token token) -> Task<int> {
+	char buffer[16];
+	co_return co_await io.cancellable(io.read(fd, buffer, sizeof(buffer)), token);
+}
+
+void test_cancel_io(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 5: cancelled read ({}) ===", loop.poller().backend_name());
+	int fds[2];
+	int ret = ::pipe2(fds, O_NONBLOCK | O_CLOEXEC);
+	assert(ret == 0);
+	std::stop_source source;
+	auto reader = read_or_cancel(loop.poller(), fds[0], source.get_token());
+	loop.schedule(reader);
+	std::jthread canceller([&source]() {
+		std::this_thread::sleep_for(5ms);
+		source.request_stop();
+	});
+	loop.run();
+	assert(reader.result() == -ECANCELED);
+	assert(!loop.poller().pending());
+
+	// 之后的读写不受影响
+	ret = static_cast<int>(::write(fds[1], "ok", 2));
+	assert(ret == 2);
+	std::stop_source idle;
+	auto next = read_or_cancel(loop.poller(), fds[0], idle.get_token());
+	loop.schedule(next);
+	loop.run();
+	assert(next.result() == 2);
+	loop.poller().close(fds[0]);
+	loop.poller().close(fds[1]);
+	std::println("Test 5 passed!\n");
+}
+
+struct Counted {
+	~Counted() {
+		++*m_destroyed;
+	}
+
+	int* m_destroyed;
+};
+
+// 等待一个永远不会到达的消息
+auto handler(Channel<int>& requests, std::stop_token token, int& destroyed) -> Task<int> {
+	Counted guard{ &destroyed };
+	co_return co_await requests.recv(token);
+}
+
+// 请求超时后取消处理中的任务
+auto with_timeout(Loop& loop, Channel<int>& requests, int& destroyed) -> Task<std::error_code> {
+	std::stop_source source;
+	auto timer = stop_after(loop, 2ms, source);
+	loop.schedule(timer);
+	auto result = co_await yq::try_await(handler(requests, source.get_token(), destroyed));
+	assert(!result);
+	co_return result.error();
+}
+
+void test_request_timeout() {
+	std::println("=== Test 6: request timeout reclaims the handler ===");
+	Loop loop;
+	Channel<int> requests{ 4 };
+	int destroyed = 0;
+	auto task = with_timeout(loop, requests, destroyed);
+	loop.schedule(task);
+	loop.run();
+	assert(task.result() == std::errc::operation_canceled);
+	assert(destroyed == 1);
+	std::println("Test 6 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_cancel_sleep();
+	test_cancel_from_thread();
+	test_cancel_semaphore();
+	test_cancel_channel_and_mutex();
+	if (yq::IoUringBackend::supported()) {
+		test_cancel_io(IoBackendKind::io_uring);
+	}
+	test_cancel_io(IoBackendKind::epoll);
+	test_request_timeout();
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <fcntl.h>
+#include <print>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "yq_async_generator.hpp"
+#include "yq_io.hpp"
+#include "yq_loop.hpp"
+#include "yq_task.hpp"
+using namespace std::chrono_literals;
+
+using yq::AsyncGenerator;
+using yq::IoBackendKind;
+using yq::IoLoop;
+using yq::Loop;
+using yq::Task;
+
+namespace
+{
+
+// 每个值之前等待定时器, produced记录生成器已经运行到第几个co_yield
+auto ticks(Loop& loop, int count, int& produced) -> AsyncGenerator<int> {
+	for (int i = 0; i < count; ++i) {
+		co_await loop.sleep_for(1ms);
+		++produced;
+		co_yield i;
+	}
+}
+
+auto collect_ticks(Loop& loop, int& produced) -> Task<std::vector<int>> {
+	std::vector<int> values;
+	auto gen = ticks(loop, 5, produced);
+	for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+		// 消费者没有请求下一个值时生成器不会继续运行
+		assert(produced == static_cast<int>(values.size()) + 1);
+		values.push_back(*it);
+	}
+	co_return values;
+}
+
+void test_timer_values() {
+	std::println("=== Test 1: values produced between timer waits ===");
+	Loop loop;
+	int produced = 0;
+	auto task = collect_ticks(loop, produced);
+	loop.schedule(task);
+	loop.run();
+	assert((task.result() == std::vector<int>{ 0, 1, 2, 3, 4 }));
+	assert(produced == 5);
+	std::println("Test 1 passed!\n");
+}
+
+auto doubled(Loop& loop, int value) -> Task<int> {
+	co_await loop.sleep_for(1ms);
+	co_return value * 2;
+}
+
+// 生成器中的co_await可以等待Task, 也可以消费另一个AsyncGenerator
+auto doubled_ticks(Loop& loop, int& produced) -> AsyncGenerator<int> {
+	auto source = ticks(loop, 4, produced);
+	for (auto it = co_await source.begin(); it != source.end(); co_await ++it) {
+		if (*it % 2 == 0) {
+			co_yield co_await doubled(loop, *it);
+		}
+	}
+}
+
+auto sum_all(AsyncGenerator<int> gen) -> Task<int> {
+	int sum = 0;
+	for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+		sum += *it;
+	}
+	co_return sum;
+}
+
+void test_pipeline() {
+	std::println("=== Test 2: generator stages chained into a pipeline ===");
+	Loop loop;
+	int produced = 0;
+	auto task = sum_all(doubled_ticks(loop, produced));
+	loop.schedule(task);
+	loop.run();
+	// 0和2通过过滤, 翻倍后为0和4
+	assert(task.result() == 4);
+	assert(produced == 4);
+
+	// 没有任何值的生成器
+	auto empty = sum_all([](Loop& loop) -> AsyncGenerator<int> {
+		co_await loop.sleep_for(1ms);
+		co_return;
+	}(loop));
+	loop.schedule(empty);
+	loop.run();
+	assert(empty.result() == 0);
+
+	// co_yield const左值时消费者得到副本
+	auto names = [](Loop& loop) -> Task<std::string> {
+		auto gen = [](Loop& loop) -> AsyncGenerator<std::string> {
+			const std::string name = "alpha";
+			co_await loop.sleep_for(1ms);
+			co_yield name;
+			co_yield name;
+		}(loop);
+		std::string joined;
+		for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+			// 修改的是副本, 下一个值不受影响
+			joined += std::exchange(*it, "");
+		}
+		co_return joined;
+	}(loop);
+	loop.schedule(names);
+	loop.run();
+	assert(names.result() == "alphaalpha");
+	std::println("Test 2 passed!\n");
+}
+
+struct Counted {
+	~Counted() {
+		++*m_destroyed;
+	}
+
+	int* m_destroyed;
+};
+
+auto failing(Loop& loop, int& destroyed) -> AsyncGenerator<const std::string&> {
+	Counted guard{ &destroyed };
+	co_yield "first";
+	co_await loop.sleep_for(1ms);
+	co_yield std::string{ "second" };
+	throw std::runtime_error{ "broken stream" };
+}
+
+auto read_until_error(Loop& loop, int& destroyed, std::vector<std::string>& seen) -> Task<bool> {
+	auto gen = failing(loop, destroyed);
+	try {
+		for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+			seen.push_back(*it);
+		}
+	} catch (const std::runtime_error&) {
+		co_return true;
+	}
+	co_return false;
+}
+
+// 只取前两个值, 生成器在co_yield处被销毁
+auto take_two(Loop& loop, int& destroyed) -> Task<int> {
+	int produced = 0;
+	auto gen = ticks(loop, 100, produced);
+	int taken = 0;
+	for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+		if (++taken == 2) {
+			break;
+		}
+	}
+	// 停在第一个co_yield上, 持有guard
+	auto guarded = failing(loop, destroyed);
+	co_await guarded.begin();
+	co_return produced;
+}
+
+void test_exception_and_early_exit() {
+	std::println("=== Test 3: exception rethrown and early exit ===");
+	Loop loop;
+	int destroyed = 0;
+	std::vector<std::string> seen;
+	auto task = read_until_error(loop, destroyed, seen);
+	loop.schedule(task);
+	loop.run();
+	assert(task.result());
+	assert((seen == std::vector<std::string>{ "first", "second" }));
+	assert(destroyed == 1);
+
+	auto early = take_two(loop, destroyed);
+	loop.schedule(early);
+	loop.run();
+	// 停在第二个co_yield上, 第三个值没有生成
+	assert(early.result() == 2);
+	// 停在co_yield上的生成器随所有者销毁, 局部变量照常析构
+	assert(destroyed == 2);
+	std::println("Test 3 passed!\n");
+}
+
+struct Record {
+	int id;
+	int value;
+};
+
+/**
+ * 从fd中流式解析"id:value\n"记录, 每次读取解析出的完整记录作为一批交给消费者
+ * 不完整的行留到下一次读取, 不需要缓冲整个响应
+ */
+auto read_records(yq::IoContext& io, int fd, std::size_t& batches)
+	-> AsyncGenerator<std::span<const Record>> {
+	char buffer[64];
+	std::string partial;
+	std::vector<Record> records;
+	for (;;) {
+		int n = co_await io.read(fd, buffer, sizeof(buffer));
+		if (n <= 0) {
+			assert(n == 0 && partial.empty());
+			co_return;
+		}
+		partial.append(buffer, static_cast<std::size_t>(n));
+		records.clear();
+		std::size_t begin = 0;
+		for (std::size_t end; (end = partial.find('\n', begin)) != std::string::npos;
+			 begin = end + 1) {
+			const std::string line = partial.substr(begin, end - begin);
+			const std::size_t colon = line.find(':');
+			records.push_back({ std::stoi(line.substr(0, colon)), std::stoi(line.substr(colon + 1)) });
+		}
+		partial.erase(0, begin);
+		if (!records.empty()) {
+			++batches;
+			co_yield std::span<const Record>{ records };
+		}
+	}
+}
+
+auto sum_records(yq::IoContext& io, int fd, std::size_t& batches, int& count) -> Task<long> {
+	long sum = 0;
+	auto gen = read_records(io, fd, batches);
+	for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) {
+		for (const Record& record : *it) {
+			assert(record.id == count);
+			sum += record.value;
+			++count;
+		}
+	}
+	co_return sum;
+}
+
+// 分多次写入, 记录的边界与写入的边界不对齐
+auto write_records(IoLoop& loop, int fd, int count) -> Task<> {
+	std::string text;
+	for (int i = 0; i < count; ++i) {
+		text += std::to_string(i) + ":" + std::to_string(i * 10) + "\n";
+	}
+	std::size_t offset = 0;
+	while (offset < text.size()) {
+		const std::size_t length = std::min<std::size_t>(37, text.size() - offset);
+		int n = co_await loop.poller().write(fd, text.data() + offset, length);
+		assert(n > 0);
+		offset += static_cast<std::size_t>(n);
+		co_await loop.sleep_for(1ms);
+	}
+	loop.poller().close(fd);
+}
+
+void test_record_stream(IoBackendKind kind) {
+	IoLoop loop{ kind };
+	std::println("=== Test 4: record batches streamed from a pipe ({}) ===",
+				 loop.poller().backend_name());
+	int fds[2];
+	int ret = ::pipe2(fds, O_NONBLOCK | O_CLOEXEC);
+	assert(ret == 0);
+	constexpr int count = 200;
+	std::size_t batches = 0;
+	int received = 0;
+	auto reader = sum_records(loop.poller(), fds[0], batches, received);
+	auto writer = write_records(loop, fds[1], count);
+	loop.schedule(reader);
+	loop.schedule(writer);
+	loop.run();
+	assert(received == count);
+	assert(reader.result() == 10L * count * (count - 1) / 2);
+	// 每次读取一批, 而不是每条记录切换一次
+	assert(batches > 1 && batches < static_cast<std::size_t>(count));
+	loop.poller().close(fds[0]);
+	std::println("Test 4 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_timer_values();
+	test_pipeline();
+	test_exception_and_early_exit();
+	if (yq::IoUringBackend::supported()) {
+		test_record_stream(IoBackendKind::io_uring);
+	}
+	test_record_stream(IoBackendKind::epoll);
+	std::println("=== All tests passed! ===");
+}
@@ -0,0 +1,155 @@
+#include <cassert>
+#include <print>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "yq_generator.hpp"
+
+using yq::Generator;
+
+namespace
+{
+
+// trace记录生成器运行到的位置, 用来检查它只在调用者请求下一个值时运行
+auto counted(int count, std::vector<std::string>& trace) -> Generator<int> {
+	trace.push_back("start");
+	for (int i = 0; i < count; ++i) {
+		trace.push_back("yield " + std::to_string(i));
+		co_yield i;
+	}
+	trace.push_back("end");
+}
+
+void test_iteration_order() {
+	std::println("=== Test 1: values in order, resumed lazily ===");
+	std::vector<std::string> trace;
+	auto gen = counted(3, trace);
+	// 创建时不运行
+	assert(trace.empty());
+	auto it = gen.begin();
+	assert((trace == std::vector<std::string>{ "start", "yield 0" }));
+	assert(*it == 0);
+	++it;
+	assert(trace.back() == "yield 1" && *it == 1);
+	++it;
+	++it;
+	assert(it == gen.end());
+	assert(trace.back() == "end");
+
+	std::vector<int> values;
+	for (int value : counted(4, trace)) {
+		values.push_back(value);
+	}
+	assert((values == std::vector<int>{ 0, 1, 2, 3 }));
+
+	// 没有任何值
+	auto empty = counted(0, trace);
+	assert(empty.begin() == empty.end());
+	std::println("Test 1 passed!\n");
+}
+
+auto throw_at(int index) -> Generator<int> {
+	for (int i = 0;; ++i) {
+		if (i == index) {
+			throw std::runtime_error{ "generator failed" };
+		}
+		co_yield i;
+	}
+}
+
+void test_exception() {
+	std::println("=== Test 2: exceptions rethrown from begin and ++ ===");
+	// 第一个co_yield之前抛出, 在begin中重新抛出
+	{
+		auto gen = throw_at(0);
+		bool thrown = false;
+		try {
+			gen.begin();
+		} catch (const std::runtime_error&) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+
+	// 之后抛出, 在++中重新抛出, 之前的值照常产生
+	{
+		auto gen = throw_at(2);
+		std::vector<int> values;
+		bool thrown = false;
+		try {
+			for (int value : gen) {
+				values.push_back(value);
+			}
+		} catch (const std::runtime_error&) {
+			thrown = true;
+		}
+		assert(thrown);
+		assert((values == std::vector<int>{ 0, 1 }));
+	}
+	std::println("Test 2 passed!\n");
+}
+
+auto iota(int first) -> Generator<int> {
+	for (int i = first;; ++i) {
+		co_yield i;
+	}
+}
+
+void test_views_pipeline() {
+	std::println("=== Test 3: std::views pipeline ===");
+	static_assert(std::ranges::input_range<Generator<int>>);
+	static_assert(std::ranges::view<Generator<const std::string&>>);
+	// 无限生成器只计算需要的部分
+	std::vector<int> values;
+	for (int value : iota(1)
+			| std::views::filter([](int i) { return i % 2 == 1; })
+			| std::views::transform([](int i) { return i * i; })
+			| std::views::take(4)) {
+		values.push_back(value);
+	}
+	assert((values == std::vector<int>{ 1, 9, 25, 49 }));
+	std::println("Test 3 passed!\n");
+}
+
+auto repeat(std::string text, int count) -> Generator<std::string> {
+	const std::string copy = text;
+	for (int i = 0; i < count; ++i) {
+		co_yield copy;
+	}
+}
+
+auto names() -> Generator<const std::string&> {
+	const std::string name = "beta";
+	co_yield name;
+	co_yield std::string{ "gamma" };
+}
+
+void test_const_lvalue() {
+	std::println("=== Test 4: co_yield const lvalues ===");
+	// reference为std::string&时得到副本, 修改不影响下一个值
+	std::string joined;
+	for (std::string& value : repeat("alpha", 3)) {
+		joined += std::exchange(value, "");
+	}
+	assert(joined == "alphaalphaalpha");
+
+	// reference为const引用时直接引用协程中的对象
+	std::vector<std::string> values;
+	for (const std::string& value : names()) {
+		values.push_back(value);
+	}
+	assert((values == std::vector<std::string>{ "beta", "gamma" }));
+	std::println("Test 4 passed!\n");
+}
+
+} // namespace
+
+auto main() -> int {
+	test_iteration_order();
+	test_exception();
+	test_views_pipeline();
+	test_const_lvalue();
+	std::println("=== All tests passed! ===");
+}
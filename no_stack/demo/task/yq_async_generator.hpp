@@ -0,0 +1,233 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "yq_task.hpp"
+
+namespace yq
+{
+
+/**
+ * 异步生成器, 协程中可以co_await(例如Loop上的IO和定时器), 每次co_yield把一个值交给消费者
+ *   for (auto it = co_await gen.begin(); it != gen.end(); co_await ++it) { ... *it ... }
+ * begin和++都要co_await: 消费者挂起, 切换到生成器运行到下一个co_yield或结束, 再切换回消费者
+ * 生成器只在消费者请求下一个值时运行, 没有内部缓冲, 消费者处理不过来时生产者自然停下(背压)
+ * co_yield的值只把地址交给消费者, 与Generator相同, 引用在下一次co_await ++it之前有效;
+ * reference不是const引用时co_yield const左值会拷贝一份, 副本保存在co_yield的awaiter中
+ * 批量传递时使用AsyncGenerator<std::span<T>>, 例如一次读取解析出的所有记录, 每批只切换一次;
+ * 生成器恢复后才会复用span指向的缓冲区
+ * 帧, 异常和无异常模式下的失败与Task相同: 生成器失败时错误在消费者的co_await处抛出或向上传递
+ */
+template <typename Ty>
+class AsyncGenerator {
+public:
+	using value_type = std::remove_cvref_t<Ty>;
+	using reference = std::conditional_t<std::is_reference_v<Ty>, Ty, Ty&>;
+	using pointer = std::add_pointer_t<reference>;
+
+	struct promise_type;
+
+	// co_yield后切换回消费者
+	struct YieldAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<promise_type> coroutine) const noexcept {
+			detail::symmetric_transfer(coroutine, coroutine.promise().m_previous);
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	// co_yield const左值时的副本, awaiter在协程挂起期间一直存在
+	struct CopyAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<promise_type> coroutine) noexcept {
+			coroutine.promise().m_value = std::addressof(m_copy);
+			detail::symmetric_transfer(coroutine, coroutine.promise().m_previous);
+		}
+
+		void await_resume() const noexcept {}
+
+		std::remove_cvref_t<reference> m_copy;
+	};
+
+	struct promise_type : public BasePromise<promise_type> {
+		auto get_return_object() noexcept -> AsyncGenerator {
+			return AsyncGenerator{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+
+		auto yield_value(std::remove_reference_t<reference>& value) noexcept {
+			m_value = std::addressof(value);
+			return yield();
+		}
+
+		auto yield_value(std::remove_reference_t<reference>&& value) noexcept {
+			m_value = std::addressof(value);
+			return yield();
+		}
+
+		auto yield_value(const std::remove_reference_t<reference>& value)
+			requires (!std::is_const_v<std::remove_reference_t<reference>>) &&
+				std::is_constructible_v<std::remove_cvref_t<reference>,
+										const std::remove_reference_t<reference>&>
+		{
+#ifdef CO_ENABLE_STATS
+			return stats::timed(this->m_stats, CopyAwaiter{ value });
+#else
+			return CopyAwaiter{ value };
+#endif
+		}
+
+		void return_void() noexcept {}
+
+		auto yield() noexcept {
+#ifdef CO_ENABLE_STATS
+			// 与co_await相同, 挂起和恢复时记录时间片
+			return stats::timed(this->m_stats, YieldAwaiter{});
+#else
+			return YieldAwaiter{};
+#endif
+		}
+
+		pointer m_value{ nullptr };
+	};
+
+	class iterator;
+
+private:
+	/**
+	 * 记录消费者后切换到生成器, 与Task::Awaiter相同
+	 * 生成器结束时重新抛出它的异常, 之后iterator等于end()
+	 */
+	template <typename Result>
+	struct NextAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return !m_handle || iterator::finished(m_handle);
+		}
+
+		template <typename ConsumerPromise>
+		void await_suspend(std::coroutine_handle<ConsumerPromise> consumer) const noexcept {
+			m_handle.promise().m_previous = consumer;
+#ifdef CO_NO_EXCEPTIONS
+			if constexpr (std::is_base_of_v<detail::PromiseLinks, ConsumerPromise>) {
+				m_handle.promise().m_parent = &consumer.promise();
+			}
+#endif
+			detail::symmetric_transfer(consumer, m_handle);
+		}
+
+		auto await_resume() const -> Result {
+			if (m_handle && m_handle.done()) {
+				m_handle.promise().rethrow_if_exception();
+			}
+			if constexpr (std::is_same_v<Result, iterator&>) {
+				return *m_iterator;
+			} else {
+				return iterator{ m_handle };
+			}
+		}
+
+		std::coroutine_handle<promise_type> m_handle;
+		iterator* m_iterator;
+	};
+
+public:
+	class iterator {
+	public:
+		using iterator_concept = std::input_iterator_tag;
+		using value_type = AsyncGenerator::value_type;
+		using difference_type = std::ptrdiff_t;
+
+		iterator() noexcept = default;
+
+		auto operator*() const noexcept -> reference {
+			return static_cast<reference>(*m_handle.promise().m_value);
+		}
+
+		auto operator->() const noexcept -> pointer {
+			return m_handle.promise().m_value;
+		}
+
+		// co_await ++it
+		auto operator++() noexcept -> NextAwaiter<iterator&> {
+			return NextAwaiter<iterator&>{ m_handle, this };
+		}
+
+		friend auto operator==(const iterator& it, std::default_sentinel_t) noexcept
+			-> bool {
+			return !it.m_handle || finished(it.m_handle);
+		}
+
+	private:
+		friend AsyncGenerator;
+
+		// 无异常模式下以失败结束的生成器停在fail处, 也算作结束
+		static auto finished(std::coroutine_handle<promise_type> handle) noexcept -> bool {
+#ifdef CO_NO_EXCEPTIONS
+			return handle.done() || handle.promise().failed();
+#else
+			return handle.done();
+#endif
+		}
+
+		explicit iterator(std::coroutine_handle<promise_type> handle) noexcept:
+			m_handle{ handle }
+		{}
+
+		std::coroutine_handle<promise_type> m_handle{ nullptr };
+	};
+
+	AsyncGenerator() noexcept = default;
+
+	AsyncGenerator(AsyncGenerator&& other) noexcept:
+		m_handle{ std::exchange(other.m_handle, nullptr) }
+	{}
+
+	auto operator=(AsyncGenerator&& other) noexcept -> AsyncGenerator& {
+		if (this != &other) {
+			if (m_handle) {
+				m_handle.destroy();
+			}
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	AsyncGenerator(const AsyncGenerator&) = delete;
+	auto operator=(const AsyncGenerator&) -> AsyncGenerator& = delete;
+
+	// 挂起在co_await上时不能销毁, 与Task相同
+	~AsyncGenerator() {
+		if (m_handle) {
+			m_handle.destroy();
+		}
+	}
+
+	// co_await gen.begin() 第一次恢复协程, 运行到第一个co_yield
+	auto begin() noexcept -> NextAwaiter<iterator> {
+		return NextAwaiter<iterator>{ m_handle, nullptr };
+	}
+
+	auto end() const noexcept -> std::default_sentinel_t {
+		return std::default_sentinel;
+	}
+
+private:
+	explicit AsyncGenerator(std::coroutine_handle<promise_type> handle) noexcept:
+		m_handle{ handle }
+	{}
+
+	std::coroutine_handle<promise_type> m_handle{ nullptr };
+};
+
+} // namespace yq
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "yq_coroutine.hpp"
+#include "yq_loop.hpp"
+#include "yq_task.hpp"
+
+namespace yq
+{
+
+namespace detail {
+
+/**
+ * run_stackful的驱动任务与它运行的有栈协程之间的交接
+ * await记录要等待的任务后yield回驱动任务, 驱动任务co_await这个任务, 结束后再切回有栈协程
+ */
+struct StackfulBridge {
+	std::coroutine_handle<> m_task{ nullptr };
+	// 把waiter设置为任务的等待者, 任务的类型在await中确定
+	void (*m_attach)(std::coroutine_handle<> task, std::coroutine_handle<> waiter) noexcept { nullptr };
+};
+
+// 正在由驱动任务resume的有栈协程对应的交接状态
+inline thread_local StackfulBridge* t_bridge{ nullptr };
+
+struct BridgeScope {
+	explicit BridgeScope(StackfulBridge& bridge) noexcept:
+		m_saved{ std::exchange(t_bridge, &bridge) } {}
+
+	~BridgeScope() {
+		t_bridge = m_saved;
+	}
+
+	StackfulBridge* m_saved;
+};
+
+// 与Task::Awaiter相同, 结果由有栈协程在await中取出
+struct BridgeAwaiter {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> driver) const noexcept {
+		auto task = std::exchange(m_bridge.m_task, nullptr);
+		m_bridge.m_attach(task, driver);
+		symmetric_transfer(driver, task);
+	}
+
+	void await_resume() const noexcept {}
+
+	StackfulBridge& m_bridge;
+};
+
+template <typename Ty>
+void attach_previous(std::coroutine_handle<> task, std::coroutine_handle<> waiter) noexcept {
+	std::coroutine_handle<Promise<Ty>>::from_address(task.address()).promise().m_previous = waiter;
+}
+
+} // namespace detail
+
+
+/**
+ * 在run_stackful运行的有栈协程中等待task结束, 返回它的结果或重新抛出它的异常
+ * 无异常模式下task失败时abort, 需要处理失败时等待try_await(std::move(task))
+ * 有栈协程yield回驱动任务, 任务结束时PreviousAwaiter恢复驱动任务, 驱动任务再切回这里
+ * 只能在run_stackful的函数中直接调用, 不能在其中嵌套创建的Coroutine里调用
+ */
+template <typename Ty>
+auto await(Task<Ty>& task) -> Ty {
+	detail::StackfulBridge* bridge = detail::t_bridge;
+	if (!bridge || !BaseCoroutine::in_coroutine()) {
+		CO_THROW(std::logic_error{ "await outside of run_stackful" });
+	}
+	bridge->m_task = task.m_coroutine;
+	bridge->m_attach = &detail::attach_previous<Ty>;
+	Coroutine::yield();
+	return task.result();
+}
+
+template <typename Ty>
+auto await(Task<Ty>&& task) -> Ty {
+	Task<Ty> owned = std::move(task);
+	return await(owned);
+}
+
+// 其他awaitable(例如loop.sleep_for)先包装成Task
+template <typename Awaitable>
+	requires (!requires { typename std::remove_cvref_t<Awaitable>::promise_type; })
+decltype(auto) await(Awaitable&& awaitable) {
+	using Result = decltype(std::declval<Awaitable>().await_resume());
+	return await([](std::remove_cvref_t<Awaitable> inner) -> Task<Result> {
+		co_return co_await inner;
+	}(std::forward<Awaitable>(awaitable)));
+}
+
+
+/**
+ * 在Loop上运行有栈协程, 返回的Task在函数返回时结束, 结果和异常都通过它传递
+ * 函数中可以await其他Task; 直接调用Coroutine::yield时驱动任务在Loop的下一轮再切回
+ * 因此旧的基于yield的代码(例如CoMutex)和无栈协程在同一个Loop上交替运行, 不需要切换线程
+ * 驱动任务需要在loop的线程上运行; 协程没有结束就销毁Task时, 有栈协程中的局部变量不会析构
+ */
+template <typename TimerQueue, typename Poller, typename Fn>
+	requires std::is_invocable_v<Fn&>
+auto run_stackful(BasicLoop<TimerQueue, Poller>& loop, Fn fn,
+				  std::size_t stack_size = 2 * 1024 * 1024) -> Task<std::invoke_result_t<Fn&>> {
+	using Result = std::invoke_result_t<Fn&>;
+	static_assert(!std::is_reference_v<Result>, "run_stackful cannot return a reference");
+	struct Reschedule {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		// Loop每轮只运行开始时就绪的协程, 反复yield的协程不会让定时器和IO饿死
+		void await_suspend(std::coroutine_handle<> driver) const {
+			m_loop.schedule(driver);
+		}
+
+		void await_resume() const noexcept {}
+
+		BasicLoop<TimerQueue, Poller>& m_loop;
+	};
+
+	detail::StackfulBridge bridge;
+	std::optional<std::conditional_t<std::is_void_v<Result>, bool, Result>> result;
+	Coroutine co(stack_size, [&fn, &result]() {
+		if constexpr (std::is_void_v<Result>) {
+			fn();
+			result.emplace(true);
+		} else {
+			result.emplace(fn());
+		}
+	});
+	for (;;) {
+		{
+			detail::BridgeScope scope{ bridge };
+			co.resume();
+		}
+		// 协程中未捕获的异常在这里重新抛出
+		if (co.is_finished()) {
+			break;
+		}
+		if (bridge.m_task) {
+			co_await detail::BridgeAwaiter{ bridge };
+		} else {
+			co_await Reschedule{ loop };
+		}
+	}
+	if constexpr (!std::is_void_v<Result>) {
+		co_return std::move(*result);
+	}
+}
+
+} // namespace yq
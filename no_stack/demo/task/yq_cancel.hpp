@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <optional>
+#include <stop_token>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "yq_error.hpp"
+#include "yq_post_queue.hpp"
+#include "yq_task.hpp"
+
+/**
+ * 协作式取消, 由std::stop_source发起, 接受std::stop_token的等待操作在取消时立即结束:
+ *   Loop::sleep_for/sleep_until 从定时器队列中移除
+ *   AsyncSemaphore::acquire, AsyncMutex::lock/scoped_lock, Channel::send/recv 从等待队列中移除, 占用的计数交还
+ *   IoContext::cancellable 内核中的操作被取消, 结果为-ECANCELED(与其他IO错误一致)
+ * 除IO外被取消的co_await以std::errc::operation_canceled失败: 有异常时抛出std::system_error,
+ * 无异常时与fail相同, 当前任务不再恢复, 错误沿着co_await链向上传递(见try_await)
+ * 已经完成的操作不受影响; 取消前已经请求停止时不挂起
+ */
+namespace yq
+{
+
+namespace detail {
+
+/**
+ * 被取消的等待者, 保存在awaiter中
+ * 无异常模式下需要知道等待者的promise才能以失败结束它, 因此只支持在Task中等待
+ */
+class CancelTarget {
+public:
+	template <typename PromiseType>
+	void set(std::coroutine_handle<PromiseType> coroutine) noexcept {
+		m_coroutine = coroutine;
+#ifdef CO_NO_EXCEPTIONS
+		static_assert(std::is_base_of_v<PromiseLinks, PromiseType>,
+					  "cancellation without exceptions needs to be awaited in a Task");
+		m_links = &coroutine.promise();
+#endif
+	}
+
+	// 在await_suspend中发现已经请求取消, 返回值作为await_suspend的结果
+	auto suspend_cancelled() noexcept -> bool {
+#ifdef CO_NO_EXCEPTIONS
+		fail_coroutine();
+		return true;
+#else
+		m_cancelled = true;
+		return false;
+#endif
+	}
+
+	// 已经挂起的等待者被取消, 在当前线程上恢复; 之后不能再访问awaiter
+	void resume_cancelled() noexcept {
+#ifdef CO_NO_EXCEPTIONS
+		fail_coroutine();
+#else
+		m_cancelled = true;
+		m_coroutine.resume();
+#endif
+	}
+
+	// 在await_resume中调用
+	void check() const {
+#ifndef CO_NO_EXCEPTIONS
+		if (m_cancelled) [[unlikely]] {
+			throw std::system_error{ std::make_error_code(std::errc::operation_canceled) };
+		}
+#endif
+	}
+
+private:
+#ifdef CO_NO_EXCEPTIONS
+	// fail中可能已经销毁了等待者, 之后只使用局部变量
+	void fail_coroutine() noexcept {
+		auto coroutine = m_coroutine;
+		auto next = m_links->fail(coroutine, std::make_error_code(std::errc::operation_canceled));
+		symmetric_transfer(coroutine, next);
+	}
+
+	PromiseLinks* m_links{ nullptr };
+#else
+	bool m_cancelled{ false };
+#endif
+	std::coroutine_handle<> m_coroutine;
+};
+
+
+/**
+ * 等待开始时才注册的std::stop_callback
+ * 注册之前可以移动, awaiter可能被await_transform(例如stats::timed)移动到包装中
+ */
+template <typename Callback>
+class StopCallbackSlot {
+public:
+	StopCallbackSlot() = default;
+
+	StopCallbackSlot([[maybe_unused]] StopCallbackSlot&& other) noexcept {
+		assert(!other.m_callback);
+	}
+
+	StopCallbackSlot& operator=(StopCallbackSlot&&) = delete;
+
+	// 已经请求停止时callback在这里执行
+	void emplace(const std::stop_token& token, Callback callback) {
+		m_callback.emplace(token, std::move(callback));
+	}
+
+	// 正在其他线程上执行的callback结束后才返回
+	void reset() noexcept {
+		m_callback.reset();
+	}
+
+private:
+	std::optional<std::stop_callback<Callback>> m_callback;
+};
+
+
+/**
+ * 把stop_callback转交给事件循环的线程, 用于只能在该线程上访问的等待(定时器, IO)
+ * 回调可能在任意线程上执行, 这里分配一个节点交给Poster::post, 事件循环在自己的线程上调用Target::on_cancel
+ * 等待先正常结束时由disarm解除节点与awaiter的关联, 之后节点只被释放; disarm和节点都在事件循环的线程上执行,
+ * 因此on_cancel被调用时等待一定还没有结束
+ */
+template <typename Target, typename Poster>
+class StopRelay {
+public:
+	StopRelay() = default;
+
+	// 只能在arm之前移动
+	StopRelay(StopRelay&& other) noexcept: m_callback{ std::move(other.m_callback) } {}
+
+	StopRelay& operator=(StopRelay&&) = delete;
+
+	~StopRelay() {
+		disarm();
+	}
+
+	// 等待开始之后调用, 已经请求停止时回调在这里执行
+	void arm(Poster& poster, const std::stop_token& token, Target& target) {
+		m_poster = &poster;
+		m_target = &target;
+		m_callback.emplace(token, Request{ this });
+	}
+
+	// 在事件循环的线程上调用, 返回后不会再调用on_cancel
+	void disarm() noexcept {
+		m_callback.reset();
+		if (Node* node = m_node.exchange(nullptr, std::memory_order_acquire)) {
+			node->relay = nullptr;
+		}
+	}
+
+private:
+	struct Node : PostNode {
+		StopRelay* relay{ nullptr };
+	};
+
+	struct Request {
+		void operator()() const {
+			auto* node = new Node{};
+			node->callback = &run;
+			node->relay = m_relay;
+			m_relay->m_node.store(node, std::memory_order_release);
+			m_relay->m_poster->post(*node);
+		}
+
+		StopRelay* m_relay;
+	};
+
+	static void run(PostNode* base) noexcept {
+		auto* node = static_cast<Node*>(base);
+		StopRelay* relay = node->relay;
+		delete node;
+		if (relay) {
+			relay->m_node.store(nullptr, std::memory_order_relaxed);
+			relay->m_target->on_cancel();
+		}
+	}
+
+	Poster* m_poster{ nullptr };
+	Target* m_target{ nullptr };
+	std::atomic<Node*> m_node{ nullptr };
+	StopCallbackSlot<Request> m_callback;
+};
+
+} // namespace detail
+
+} // namespace yq
@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+ * 无异常模式的CO_NO_EXCEPTIONS/CO_THROW与有栈协程共用, 定义在stack/demo/2/yq_config.hpp中(同属yq::coro)
+ * Task的失败通过std::error_code传递(见yq::fail和yq::try_await), 未处理的失败沿着co_await链向上传递;
+ * 原来抛出的错误(例如系统调用失败)改为输出原因后abort
+ */
+#include "yq_config.hpp"
@@ -0,0 +1,476 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "yq_numa.hpp"
+#include "yq_task.hpp"
+#include "yq_work_steal_deque.hpp"
+
+namespace yq
+{
+
+/**
+ * 多线程执行器, 在N个工作线程上恢复std::coroutine_handle<>
+ * 每个工作线程有一个Chase-Lev队列(见stack/demo/2/yq_work_steal_deque.hpp)和一个LIFO槽
+ * 工作线程中post的协程放入LIFO槽, 下一个就运行, 被唤醒的协程通常与唤醒者共享刚写入的数据
+ * 槽中原来的协程移入队列, 槽不能被窃取; 连续从槽运行lifo_budget次后槽中的协程排到本线程的让出队列末尾,
+ * 避免互相唤醒的协程饿死其他协程. 本地队列由所有者从LIFO端取, 为空时依次尝试让出队列, 全局注入队列和其他线程的队列
+ * 工作线程中schedule()让出的协程同样排到让出队列末尾, 反复让出的协程不会饿死本地队列中的协程
+ * 让出队列也是Chase-Lev队列, 所有者和窃取者都从FIFO端(steal)取, 不经过全局锁
+ */
+class ThreadPoolExecutor final : private detail::CompletionHandler {
+	struct alignas(64) Worker {
+		WorkStealingDeque<std::coroutine_handle<>> m_deque;
+		// 让出的协程, 只从FIFO端取
+		WorkStealingDeque<std::coroutine_handle<>> m_yielded;
+		std::coroutine_handle<> m_next{ nullptr };
+		unsigned m_lifo_runs{ 0 };
+		unsigned m_ticks{ 0 };
+		std::thread m_thread;
+		std::uint64_t m_rng{ 0 };
+		unsigned m_node{ numa::unknown_node };
+		numa::VictimList m_victims;
+	};
+
+public:
+	static constexpr unsigned lifo_budget = 3;
+	// 每运行这么多次先检查一次全局注入队列和让出队列, 本地队列一直非空时外部提交和让出的协程也能运行
+	static constexpr unsigned inject_interval = 61;
+
+	struct ScheduleAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		// 挂起后协程可能立即在其他线程恢复, yield之后不再访问this
+		void await_suspend(std::coroutine_handle<> coroutine) const {
+			m_executor.yield(coroutine);
+		}
+
+		void await_resume() const noexcept {}
+
+		ThreadPoolExecutor& m_executor;
+	};
+
+	/**
+	 * worker_count 工作线程数量
+	 * pin_workers 把第i个工作线程绑定到第i个CPU(按CPU数量取模), 只支持Linux和Windows
+	 */
+	explicit ThreadPoolExecutor(std::size_t worker_count = std::thread::hardware_concurrency(),
+								bool pin_workers = false) {
+		start(worker_count, pin_workers);
+	}
+
+	/**
+	 * 按topology把工作线程平均分到各个NUMA节点, 每个工作线程绑定到所在节点的CPU上, 窃取时先尝试同一节点
+	 * 协程帧来自创建它的线程的FramePool: 在工作线程中创建的任务(例如co_await的子任务)的帧在本节点上,
+	 * 外部线程spawn的任务的帧在外部线程分配; 在其他节点上销毁的帧不进入那个节点的缓存(见FramePool)
+	 *   ThreadPoolExecutor executor{ n, numa::Topology::system() };
+	 */
+	ThreadPoolExecutor(std::size_t worker_count, const numa::Topology& topology):
+		m_topology{ topology }
+	{
+		start(worker_count, false);
+	}
+
+	// 等待所有spawn的任务结束后停止工作线程
+	~ThreadPoolExecutor() {
+#ifdef CO_NO_EXCEPTIONS
+		wait();
+#else
+		try {
+			wait();
+		} catch (...) {
+		}
+#endif
+		{
+			std::lock_guard lock{ m_mutex };
+			m_stop = true;
+		}
+		m_idle_cv.notify_all();
+		for (auto& worker : m_workers) {
+			worker->m_thread.join();
+		}
+	}
+
+	ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+	ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+
+	/**
+	 * 在工作线程中恢复协程, 用于唤醒等待者
+	 * 在本执行器的工作线程中调用时放入LIFO槽, 否则放入全局注入队列
+	 */
+	void post(std::coroutine_handle<> coroutine) {
+		Worker* worker = current_worker();
+		if (!worker) {
+			inject(coroutine);
+			return;
+		}
+		if (auto previous = std::exchange(worker->m_next, coroutine)) {
+			worker->m_deque.push(previous);
+			notify_sleeping();
+		}
+	}
+
+	// co_await executor.schedule() 切换到工作线程; 已经在工作线程中时让出, 排到本线程让出队列末尾
+	auto schedule() noexcept -> ScheduleAwaiter {
+		return ScheduleAwaiter{ *this };
+	}
+
+	/**
+	 * 在工作线程中运行任务, 执行器接管任务的所有权, 结束后销毁协程帧
+	 * 任务中未捕获的异常由wait重新抛出, 无异常模式下的失败由error()取出
+	 * 空的Task(已被移走)直接忽略, 不计入wait等待的任务
+	 */
+	void spawn(Task<> task) {
+		auto coroutine = std::exchange(task.m_coroutine, nullptr);
+		if (!coroutine) {
+			return;
+		}
+		coroutine.promise().m_handler = this;
+		m_pending.fetch_add(1, std::memory_order_relaxed);
+		enqueue(coroutine);
+	}
+
+	/**
+	 * 一次提交一组任务, 与逐个spawn相同, 但只加锁一次放入队列; tasks中的Task被移走
+	 * 协程帧在调用协程函数时已经分配(FramePool), 这里不再分配; 与spawn相同, 空的Task被跳过
+	 */
+	template <std::ranges::input_range Range>
+		requires std::same_as<std::ranges::range_value_t<Range>, Task<>>
+	void spawn_all(Range&& tasks) {
+		std::vector<std::coroutine_handle<>> coroutines;
+		if constexpr (std::ranges::sized_range<Range>) {
+			coroutines.reserve(std::ranges::size(tasks));
+		}
+		for (auto&& task : tasks) {
+			auto coroutine = std::exchange(task.m_coroutine, nullptr);
+			if (!coroutine) {
+				continue;
+			}
+			coroutine.promise().m_handler = this;
+			coroutines.push_back(coroutine);
+		}
+		if (coroutines.empty()) {
+			return;
+		}
+		m_pending.fetch_add(coroutines.size(), std::memory_order_relaxed);
+		if (Worker* worker = current_worker()) {
+			for (auto coroutine : coroutines) {
+				worker->m_deque.push(coroutine);
+			}
+			if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+				m_idle_cv.notify_all();
+			}
+			return;
+		}
+		{
+			std::lock_guard lock{ m_mutex };
+			m_injected.insert(m_injected.end(), coroutines.begin(), coroutines.end());
+			m_injected_size.store(m_injected.size(), std::memory_order_relaxed);
+		}
+		m_idle_cv.notify_all();
+	}
+
+	/**
+	 * 阻塞直到所有spawn的任务结束, 重新抛出第一个未捕获的异常
+	 * 不能在工作线程中调用
+	 */
+	void wait() {
+		std::unique_lock lock{ m_mutex };
+		m_done_cv.wait(lock, [this]() {
+			return m_pending.load(std::memory_order_acquire) == 0;
+		});
+#ifndef CO_NO_EXCEPTIONS
+		if (m_exception) {
+			std::rethrow_exception(std::exchange(m_exception, nullptr));
+		}
+#endif
+	}
+
+#ifdef CO_NO_EXCEPTIONS
+	// 第一个失败的任务的错误, 取出后清空
+	[[nodiscard]]
+	auto error() -> std::error_code {
+		std::lock_guard lock{ m_mutex };
+		return std::exchange(m_error, std::error_code{});
+	}
+#endif
+
+	[[nodiscard]]
+	auto worker_count() const noexcept -> std::size_t {
+		return m_workers.size();
+	}
+
+	// 当前线程是否是本执行器的工作线程
+	[[nodiscard]]
+	auto running_in_this_thread() const noexcept -> bool {
+		return current_worker() != nullptr;
+	}
+
+private:
+	void enqueue(std::coroutine_handle<> coroutine) {
+		if (Worker* worker = current_worker()) {
+			worker->m_deque.push(coroutine);
+			notify_sleeping();
+		} else {
+			inject(coroutine);
+		}
+	}
+
+	// 工作线程中放入让出队列, 外部线程放入全局注入队列
+	void yield(std::coroutine_handle<> coroutine) {
+		if (Worker* worker = current_worker()) {
+			worker->m_yielded.push(coroutine);
+			notify_sleeping();
+		} else {
+			inject(coroutine);
+		}
+	}
+
+	void inject(std::coroutine_handle<> coroutine) {
+		{
+			std::lock_guard lock{ m_mutex };
+			m_injected.push_back(coroutine);
+			m_injected_size.store(m_injected.size(), std::memory_order_relaxed);
+		}
+		m_idle_cv.notify_one();
+	}
+
+	void notify_sleeping() {
+		if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+			m_idle_cv.notify_one();
+		}
+	}
+
+	// spawn的任务结束时在完成它的工作线程上调用
+	auto on_complete(std::coroutine_handle<> task, bool failed) noexcept
+		-> std::coroutine_handle<> override {
+		if (failed) {
+			auto& promise = std::coroutine_handle<Promise<>>::from_address(task.address()).promise();
+			std::lock_guard lock{ m_mutex };
+#ifdef CO_NO_EXCEPTIONS
+			if (!m_error) {
+				m_error = promise.m_error;
+			}
+#else
+			if (!m_exception) {
+				m_exception = promise.m_exception;
+			}
+#endif
+		}
+		task.destroy();
+		if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::lock_guard lock{ m_mutex };
+			m_done_cv.notify_all();
+		}
+		return nullptr;
+	}
+
+	void start(std::size_t worker_count, bool pin_workers) {
+		if (worker_count == 0) {
+			worker_count = 1;
+		}
+		std::vector<unsigned> nodes(worker_count, numa::unknown_node);
+		m_workers.reserve(worker_count);
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			m_workers.push_back(std::make_unique<Worker>());
+			m_workers.back()->m_rng = 0x9E3779B97F4A7C15ull * (i + 1);
+			if (m_topology) {
+				nodes[i] = m_topology->node_for_worker(i, worker_count);
+				m_workers.back()->m_node = nodes[i];
+			}
+		}
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			m_workers[i]->m_victims = numa::VictimList{ nodes, i };
+		}
+		// 所有Worker构造完成后再启动线程, 窃取时会访问其他Worker
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			m_workers[i]->m_thread = std::thread([this, i, pin_workers]() {
+				if (pin_workers) {
+					pin_current_thread(i);
+				}
+				run_worker(i);
+			});
+		}
+	}
+
+	void run_worker(std::size_t index) {
+		Worker& self = *m_workers[index];
+		if (m_topology) {
+			numa::bind_current_thread(*m_topology, self.m_node);
+		}
+		set_current(this, &self);
+		for (;;) {
+			if (auto coroutine = find_work(self)) {
+				coroutine.resume();
+			} else if (!idle_wait()) {
+				break;
+			}
+		}
+		set_current(nullptr, nullptr);
+	}
+
+	// 依次尝试: LIFO槽, 本地队列, 让出队列, 全局注入队列, 窃取其他线程(同一节点的优先, 见numa::VictimList)
+	auto find_work(Worker& self) -> std::coroutine_handle<> {
+		if (++self.m_ticks % inject_interval == 0) {
+			if (auto coroutine = take_injected()) {
+				return coroutine;
+			}
+			if (auto coroutine = self.m_yielded.steal()) {
+				return *coroutine;
+			}
+		}
+		if (self.m_next) {
+			if (self.m_lifo_runs < lifo_budget) {
+				++self.m_lifo_runs;
+				return std::exchange(self.m_next, nullptr);
+			}
+			// 用完预算, 槽中的协程排到让出队列末尾; 放回本地队列会被LIFO端立即取回
+			self.m_yielded.push(std::exchange(self.m_next, nullptr));
+			notify_sleeping();
+		}
+		self.m_lifo_runs = 0;
+		if (auto coroutine = self.m_deque.pop()) {
+			return *coroutine;
+		}
+		if (auto coroutine = self.m_yielded.steal()) {
+			return *coroutine;
+		}
+		if (auto coroutine = take_injected()) {
+			return coroutine;
+		}
+		if (m_workers.size() > 1) {
+			auto coroutine = self.m_victims.visit(next_random(self), [this](std::size_t victim) {
+				auto& worker = *m_workers[victim];
+				auto stolen = worker.m_deque.steal();
+				return stolen ? stolen : worker.m_yielded.steal();
+			});
+			if (coroutine) {
+				return *coroutine;
+			}
+		}
+		return nullptr;
+	}
+
+	auto take_injected() -> std::coroutine_handle<> {
+		if (m_injected_size.load(std::memory_order_relaxed) == 0) {
+			return nullptr;
+		}
+		std::lock_guard lock{ m_mutex };
+		if (m_injected.empty()) {
+			return nullptr;
+		}
+		auto coroutine = m_injected.front();
+		m_injected.pop_front();
+		m_injected_size.store(m_injected.size(), std::memory_order_relaxed);
+		return coroutine;
+	}
+
+	/**
+	 * 没有可运行的协程时休眠
+	 * 其他线程的本地队列没有锁保护, 通知可能丢失, 用超时兜底
+	 * return false 表示执行器停止
+	 */
+	auto idle_wait() -> bool {
+		std::unique_lock lock{ m_mutex };
+		if (m_stop) {
+			return false;
+		}
+		if (!m_injected.empty()) {
+			return true;
+		}
+		m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+		m_idle_cv.wait_for(lock, std::chrono::milliseconds{ 1 });
+		m_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+		return !m_stop;
+	}
+
+	static void pin_current_thread(std::size_t index) noexcept {
+		unsigned cpus = std::thread::hardware_concurrency();
+		if (cpus == 0) {
+			cpus = 1;
+		}
+		const std::size_t cpu = index % cpus;
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+		if (cpu < sizeof(DWORD_PTR) * 8) {
+			SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{ 1 } << cpu);
+		}
+#else
+		(void)cpu;
+#endif
+	}
+
+	static auto next_random(Worker& worker) noexcept -> std::uint64_t {
+		// xorshift64
+		std::uint64_t x = worker.m_rng;
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		worker.m_rng = x;
+		return x;
+	}
+
+	// 工作线程只属于一个执行器, 其他执行器的工作线程按外部线程处理
+	auto current_worker() const noexcept -> Worker* {
+		return tl_executor == this ? tl_worker : nullptr;
+	}
+
+	static void set_current(ThreadPoolExecutor* executor, Worker* worker) noexcept {
+		tl_executor = executor;
+		tl_worker = worker;
+	}
+
+	static inline thread_local const ThreadPoolExecutor* tl_executor{ nullptr };
+	static inline thread_local Worker* tl_worker{ nullptr };
+
+	// 不按NUMA节点放置时为空
+	std::optional<numa::Topology> m_topology;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	// 以下由m_mutex保护
+	std::mutex m_mutex;
+	std::condition_variable m_idle_cv;
+	std::condition_variable m_done_cv;
+	std::deque<std::coroutine_handle<>> m_injected;
+#ifdef CO_NO_EXCEPTIONS
+	std::error_code m_error;
+#else
+	std::exception_ptr m_exception;
+#endif
+	bool m_stop{ false };
+
+	std::atomic<std::size_t> m_injected_size{ 0 };
+	// 已spawn未结束的任务数量
+	std::atomic<std::size_t> m_pending{ 0 };
+	std::atomic<int> m_sleeping{ 0 };
+};
+
+} // namespace yq
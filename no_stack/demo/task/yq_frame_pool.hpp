@@ -0,0 +1,226 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include "yq_numa.hpp"
+
+namespace yq
+{
+
+/**
+ * 每个线程一个的协程帧缓存, 按64字节分级
+ * 释放的帧挂到对应级别的空闲链表上, 下一次同级别的分配直接取出, 稳定后不再调用全局operator new
+ * 加上节点标记超过max_pooled的帧直接使用全局operator new
+ * 帧可以在其他线程释放, 此时进入释放线程的缓存; 每个级别最多缓存max_cached块, 多出的还给全局operator delete,
+ * 一个线程分配, 另一个线程销毁时释放线程的缓存不会无限增长
+ * 块的末尾记录分配线程所在的NUMA节点(见numa::current_thread_node), 只缓存本节点分配的块,
+ * 在其他节点的工作线程上销毁的帧还给全局operator delete, 工作线程不会反复复用其他节点的内存
+ */
+class FramePool {
+public:
+	static constexpr std::size_t granularity = 64;
+	static constexpr std::size_t class_count = 32;
+	static constexpr std::size_t max_pooled = granularity * class_count;
+	static constexpr std::size_t max_cached = 64;
+
+	struct Stats {
+		// 调用全局operator new/delete的次数
+		std::size_t upstream_allocations;
+		std::size_t upstream_deallocations;
+		// 从空闲链表取出的次数
+		std::size_t reused;
+		// 当前缓存的块数
+		std::size_t cached;
+		// 其他节点分配, 释放时直接还给全局operator delete的块数
+		std::size_t remote;
+	};
+
+	FramePool() = default;
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+
+	~FramePool() {
+		release();
+		s_destroyed = true;
+	}
+
+	// 线程退出过程中缓存已经析构时返回nullptr
+	static auto local() noexcept -> FramePool* {
+		if (s_destroyed) {
+			return nullptr;
+		}
+		thread_local FramePool pool;
+		return &pool;
+	}
+
+	auto allocate(std::size_t size) -> void* {
+		if (size <= max_frame) {
+			const std::size_t index = class_of(size);
+			if (FreeBlock* block = m_free[index]) {
+				m_free[index] = block->next;
+				--m_counts[index];
+				++m_stats.reused;
+				--m_stats.cached;
+				return block;
+			}
+		}
+		++m_stats.upstream_allocations;
+		return allocate_upstream(size);
+	}
+
+	void deallocate(void* ptr, std::size_t size) noexcept {
+		if (size > max_frame) {
+			++m_stats.upstream_deallocations;
+			deallocate_upstream(ptr, size);
+			return;
+		}
+		const std::size_t index = class_of(size);
+		if (node_of(ptr, index) != numa::current_thread_node()) {
+			++m_stats.remote;
+			++m_stats.upstream_deallocations;
+			deallocate_upstream(ptr, size);
+			return;
+		}
+		if (m_counts[index] >= max_cached) {
+			++m_stats.upstream_deallocations;
+			deallocate_upstream(ptr, size);
+			return;
+		}
+		m_free[index] = ::new (ptr) FreeBlock{ m_free[index] };
+		++m_counts[index];
+		++m_stats.cached;
+	}
+
+	// 把缓存的块全部还给全局operator delete
+	void release() noexcept {
+		for (std::size_t index = 0; index < class_count; ++index) {
+			while (FreeBlock* block = m_free[index]) {
+				m_free[index] = block->next;
+				::operator delete(block, block_size(index));
+				++m_stats.upstream_deallocations;
+			}
+			m_counts[index] = 0;
+		}
+		m_stats.cached = 0;
+	}
+
+	[[nodiscard]]
+	auto stats() const noexcept -> Stats {
+		return m_stats;
+	}
+
+	/**
+	 * 不经过缓存分配和释放, 块的大小和节点标记与缓存的块相同, 可以交给任意线程的缓存释放
+	 * 线程退出过程中缓存已经析构时使用
+	 */
+	static auto allocate_upstream(std::size_t size) -> void* {
+		if (size > max_frame) {
+			return ::operator new(size);
+		}
+		const std::size_t index = class_of(size);
+		void* ptr = ::operator new(block_size(index));
+		::new (node_slot(ptr, index)) unsigned{ numa::current_thread_node() };
+		return ptr;
+	}
+
+	static void deallocate_upstream(void* ptr, std::size_t size) noexcept {
+		::operator delete(ptr, size > max_frame ? size : block_size(class_of(size)));
+	}
+
+private:
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	// 节点标记放在块的末尾, 帧不超过max_frame时块中一定留有它的位置
+	static constexpr std::size_t max_frame = max_pooled - sizeof(unsigned);
+
+	static constexpr auto class_of(std::size_t size) noexcept -> std::size_t {
+		return (size + sizeof(unsigned) - 1) / granularity;
+	}
+
+	static constexpr auto block_size(std::size_t index) noexcept -> std::size_t {
+		return (index + 1) * granularity;
+	}
+
+	static auto node_slot(void* ptr, std::size_t index) noexcept -> void* {
+		return static_cast<std::byte*>(ptr) + block_size(index) - sizeof(unsigned);
+	}
+
+	static auto node_of(void* ptr, std::size_t index) noexcept -> unsigned {
+		return *static_cast<unsigned*>(node_slot(ptr, index));
+	}
+
+	std::array<FreeBlock*, class_count> m_free{};
+	std::array<std::size_t, class_count> m_counts{};
+	Stats m_stats{};
+
+	static inline thread_local bool s_destroyed = false;
+};
+
+
+namespace detail {
+
+constexpr auto align_up(std::size_t size, std::size_t align) noexcept -> std::size_t {
+	return (size + align - 1) & ~(align - 1);
+}
+
+// 从线程的FramePool分配, 线程退出过程中缓存已经析构时不经过缓存
+inline auto allocate_frame(std::size_t size) -> void* {
+	FramePool* pool = FramePool::local();
+	return pool ? pool->allocate(size) : FramePool::allocate_upstream(size);
+}
+
+inline void deallocate_frame(void* frame, std::size_t size) noexcept {
+	if (FramePool* pool = FramePool::local()) {
+		pool->deallocate(frame, size);
+	} else {
+		FramePool::deallocate_upstream(frame, size);
+	}
+}
+
+/**
+ * 用分配器分配协程帧, 分配器的副本放在帧之后
+ * 释放时只有帧的地址和大小, 从副本取出分配器再释放整个块
+ */
+template <typename Alloc>
+struct AllocatorFrame {
+	using allocator_type = typename std::allocator_traits<Alloc>::template rebind_alloc<std::byte>;
+	using traits = std::allocator_traits<allocator_type>;
+
+	static_assert(alignof(allocator_type) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+	static constexpr auto allocator_offset(std::size_t size) noexcept -> std::size_t {
+		return align_up(size, alignof(allocator_type));
+	}
+
+	static constexpr auto total(std::size_t size) noexcept -> std::size_t {
+		return allocator_offset(size) + sizeof(allocator_type);
+	}
+
+	static auto allocator_of(void* frame, std::size_t size) noexcept -> allocator_type* {
+		return reinterpret_cast<allocator_type*>(static_cast<std::byte*>(frame) + allocator_offset(size));
+	}
+
+	static auto allocate(std::size_t size, const Alloc& alloc) -> void* {
+		allocator_type allocator{ alloc };
+		void* frame = std::to_address(traits::allocate(allocator, total(size)));
+		::new (allocator_of(frame, size)) allocator_type{ std::move(allocator) };
+		return frame;
+	}
+
+	static void deallocate(void* frame, std::size_t size) noexcept {
+		allocator_type* stored = allocator_of(frame, size);
+		allocator_type allocator{ std::move(*stored) };
+		stored->~allocator_type();
+		traits::deallocate(allocator, static_cast<std::byte*>(frame), total(size));
+	}
+};
+
+} // namespace detail
+
+} // namespace yq
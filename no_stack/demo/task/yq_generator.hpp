@@ -0,0 +1,205 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+
+#include "yq_error.hpp"
+
+namespace yq
+{
+
+/**
+ * 惰性生成器, 每次++恢复协程直到下一个co_yield
+ * co_yield的值只把地址交给调用者, 不拷贝, 也不要求默认构造
+ * co_yield临时对象时, 临时对象活到协程下一次恢复, 解引用得到的引用在此之前有效
+ * reference不是const引用时co_yield const左值会拷贝一份, 副本保存在co_yield的awaiter中, 同样活到下一次恢复
+ * 满足std::ranges::input_range和std::ranges::view, 可以直接用于range-for和std::views管道
+ * 只能移动, 接入管道时需要传右值, 例如 make_gen() | std::views::take(3)
+ */
+template <typename Ty>
+class Generator : public std::ranges::view_interface<Generator<Ty>> {
+public:
+	using value_type = std::remove_cvref_t<Ty>;
+	using reference = std::conditional_t<std::is_reference_v<Ty>, Ty, Ty&>;
+	using pointer = std::add_pointer_t<reference>;
+
+	struct promise_type;
+
+	// co_yield const左值时的副本, awaiter在协程挂起期间一直存在
+	struct CopyAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<promise_type> coroutine) noexcept {
+			coroutine.promise().m_value = std::addressof(m_copy);
+		}
+
+		void await_resume() const noexcept {}
+
+		std::remove_cvref_t<reference> m_copy;
+	};
+
+	struct promise_type {
+		auto get_return_object() noexcept -> Generator {
+			return Generator{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+
+		auto initial_suspend() const noexcept {
+			return std::suspend_always{};
+		}
+
+		auto final_suspend() const noexcept {
+			return std::suspend_always{};
+		}
+
+		auto yield_value(std::remove_reference_t<reference>& value) noexcept {
+			m_value = std::addressof(value);
+			return std::suspend_always{};
+		}
+
+		auto yield_value(std::remove_reference_t<reference>&& value) noexcept {
+			m_value = std::addressof(value);
+			return std::suspend_always{};
+		}
+
+		auto yield_value(const std::remove_reference_t<reference>& value) -> CopyAwaiter
+			requires (!std::is_const_v<std::remove_reference_t<reference>>) &&
+				std::is_constructible_v<std::remove_cvref_t<reference>,
+										const std::remove_reference_t<reference>&>
+		{
+			return CopyAwaiter{ value };
+		}
+
+		void return_void() const noexcept {}
+
+#ifdef CO_NO_EXCEPTIONS
+		// 没有异常时不会被调用
+		void unhandled_exception() noexcept {
+			std::terminate();
+		}
+
+		void rethrow_if_exception() const noexcept {}
+#else
+		// 异常保存下来, 在调用者的begin/++中重新抛出
+		void unhandled_exception() noexcept {
+			m_exception = std::current_exception();
+		}
+#endif
+
+		// 生成器由调用者驱动, 不能在其中co_await
+		template <typename Awaitable>
+		auto await_transform(Awaitable&&) -> std::suspend_never = delete;
+
+#ifndef CO_NO_EXCEPTIONS
+		void rethrow_if_exception() {
+			if (m_exception) {
+				std::rethrow_exception(std::exchange(m_exception, nullptr));
+			}
+		}
+#endif
+
+		pointer m_value{ nullptr };
+#ifndef CO_NO_EXCEPTIONS
+		std::exception_ptr m_exception{ nullptr };
+#endif
+	};
+
+	class iterator {
+	public:
+		using iterator_concept = std::input_iterator_tag;
+		using value_type = Generator::value_type;
+		using difference_type = std::ptrdiff_t;
+
+		iterator() noexcept = default;
+
+		auto operator*() const noexcept -> reference {
+			return static_cast<reference>(*m_handle.promise().m_value);
+		}
+
+		auto operator->() const noexcept -> pointer {
+			return m_handle.promise().m_value;
+		}
+
+		auto operator++() -> iterator& {
+			m_handle.resume();
+			if (m_handle.done()) {
+				m_handle.promise().rethrow_if_exception();
+			}
+			return *this;
+		}
+
+		void operator++(int) {
+			++*this;
+		}
+
+		friend auto operator==(const iterator& it, std::default_sentinel_t) noexcept
+			-> bool {
+			return !it.m_handle || it.m_handle.done();
+		}
+
+	private:
+		friend Generator;
+
+		explicit iterator(std::coroutine_handle<promise_type> handle) noexcept:
+			m_handle{ handle }
+		{}
+
+		std::coroutine_handle<promise_type> m_handle{ nullptr };
+	};
+
+	Generator() noexcept = default;
+
+	Generator(Generator&& other) noexcept:
+		m_handle{ std::exchange(other.m_handle, nullptr) }
+	{}
+
+	auto operator=(Generator&& other) noexcept -> Generator& {
+		if (this != &other) {
+			if (m_handle) {
+				m_handle.destroy();
+			}
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	Generator(const Generator&) = delete;
+	auto operator=(const Generator&) -> Generator& = delete;
+
+	~Generator() {
+		if (m_handle) {
+			m_handle.destroy();
+		}
+	}
+
+	// 第一次恢复协程, 运行到第一个co_yield
+	auto begin() -> iterator {
+		if (m_handle) {
+			m_handle.resume();
+			if (m_handle.done()) {
+				m_handle.promise().rethrow_if_exception();
+			}
+		}
+		return iterator{ m_handle };
+	}
+
+	auto end() const noexcept -> std::default_sentinel_t {
+		return std::default_sentinel;
+	}
+
+private:
+	explicit Generator(std::coroutine_handle<promise_type> handle) noexcept:
+		m_handle{ handle }
+	{}
+
+	std::coroutine_handle<promise_type> m_handle{ nullptr };
+};
+
+} // namespace yq
@@ -0,0 +1,900 @@
+#pragma once
+
+#if !defined(__linux__)
+#error "yq_io.hpp requires Linux (io_uring or epoll)"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <csignal>
+#include <unistd.h>
+
+#include "yq_loop.hpp"
+
+namespace yq
+{
+
+// register_files注册的文件下标
+struct FixedFile {
+	unsigned index;
+};
+
+// 操作的目标, 普通fd或注册过的文件
+struct FileRef {
+	FileRef(int fd) noexcept: m_value{ fd }, m_fixed{ false } {}
+	FileRef(FixedFile file) noexcept: m_value{ static_cast<int>(file.index) }, m_fixed{ true } {}
+
+	int m_value;
+	bool m_fixed;
+};
+
+/**
+ * 一次IO操作, 保存在awaiter中(即协程帧中), 提交和完成都不需要额外分配
+ * result与io_uring一致: 成功时为非负的返回值, 失败时为-errno
+ */
+struct IoOperation {
+	enum class Kind : std::uint8_t {
+		read, write, read_fixed, write_fixed, recv, send, accept, connect,
+	};
+
+	Kind kind;
+	FileRef file;
+	void* buffer{ nullptr };
+	std::size_t length{ 0 };
+	// 文件偏移, current_position表示使用当前位置(管道/套接字)
+	std::uint64_t offset{ current_position };
+	int flags{ 0 };
+	std::uint16_t buffer_index{ 0 };
+	// accept/connect的地址
+	sockaddr* address{ nullptr };
+	socklen_t* address_length{ nullptr };
+	socklen_t connect_length{ 0 };
+
+	std::coroutine_handle<> coroutine{ nullptr };
+	int result{ 0 };
+	// epoll: connect已经发起, 等待可写后读取SO_ERROR
+	bool started{ false };
+
+	static constexpr std::uint64_t current_position = UINT64_MAX;
+};
+
+
+/**
+ * IO后端接口
+ * submit返回false表示操作已经同步完成, 协程不需要挂起
+ */
+class IoBackend {
+public:
+	using clock = std::chrono::steady_clock;
+
+	virtual ~IoBackend() = default;
+	virtual auto submit(IoOperation& op) -> bool = 0;
+	virtual void poll(std::optional<clock::time_point> deadline) = 0;
+	virtual auto pending() const noexcept -> std::size_t = 0;
+	virtual void register_buffers(std::span<const iovec> buffers) = 0;
+	virtual void register_files(std::span<const int> fds) = 0;
+	// fd即将被关闭, 清除后端记录的状态
+	virtual void forget(int fd) noexcept = 0;
+	/**
+	 * 取消等待中的op, op之后以-ECANCELED完成; 已经在内核中完成的操作保留原来的结果
+	 * op需要还没有恢复协程, 只能在Loop的线程上调用
+	 */
+	virtual void cancel(IoOperation& op) = 0;
+	// poll同时等待waker的通知, 通知到达后poll返回; 等待waker不计入pending
+	virtual void watch(Waker& waker) = 0;
+	virtual auto name() const noexcept -> const char* = 0;
+};
+
+namespace detail {
+
+[[noreturn]] inline void throw_errno(const char* what) {
+	CO_THROW(std::system_error{ errno, std::generic_category(), what });
+}
+
+// deadline之前剩余的时间, 已过期时为0
+inline auto remaining(std::chrono::steady_clock::time_point deadline) noexcept
+	-> std::chrono::nanoseconds {
+	auto now = std::chrono::steady_clock::now();
+	return deadline > now ? std::chrono::nanoseconds{ deadline - now } : std::chrono::nanoseconds{ 0 };
+}
+
+} // namespace detail
+
+
+/**
+ * io_uring后端, 直接使用系统调用, 不依赖liburing
+ * 提交只写入SQ, 在poll中通过一次io_uring_enter同时提交并等待完成
+ * 完成时直接恢复user_data中保存的协程, user_data为0的是waker的eventfd上的POLL_ADD, 为1的是取消请求
+ * 需要IORING_FEAT_EXT_ARG(Linux 5.11)以支持带超时的等待, 否则构造失败
+ */
+class IoUringBackend final : public IoBackend {
+public:
+	explicit IoUringBackend(unsigned entries = 256) {
+		io_uring_params params{};
+		m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+		if (m_ring_fd < 0) {
+			detail::throw_errno("io_uring_setup");
+		}
+		if (!(params.features & IORING_FEAT_EXT_ARG)) {
+			::close(m_ring_fd);
+			CO_THROW(std::system_error{ ENOSYS, std::generic_category(), "io_uring without IORING_FEAT_EXT_ARG" });
+		}
+#ifdef CO_NO_EXCEPTIONS
+		map_rings(params);
+#else
+		try {
+			map_rings(params);
+		} catch (...) {
+			unmap_rings();
+			::close(m_ring_fd);
+			throw;
+		}
+#endif
+	}
+
+	~IoUringBackend() override {
+		unmap_rings();
+		::close(m_ring_fd);
+	}
+
+	// 内核是否支持io_uring和IORING_FEAT_EXT_ARG, 用于不能通过异常回退的场合
+	static auto supported() noexcept -> bool {
+		io_uring_params params{};
+		int fd = static_cast<int>(::syscall(__NR_io_uring_setup, 1, &params));
+		if (fd < 0) {
+			return false;
+		}
+		::close(fd);
+		return (params.features & IORING_FEAT_EXT_ARG) != 0;
+	}
+
+	IoUringBackend(const IoUringBackend&) = delete;
+	IoUringBackend& operator=(const IoUringBackend&) = delete;
+
+	auto submit(IoOperation& op) -> bool override {
+		io_uring_sqe* sqe = next_sqe();
+		prepare(*sqe, op);
+		++m_in_flight;
+		return true;
+	}
+
+	// 本轮提交的所有SQE与等待完成合并为一次io_uring_enter
+	void poll(std::optional<clock::time_point> deadline) override {
+		if (m_waker && !m_wake_armed) {
+			io_uring_sqe* sqe = next_sqe();
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = m_waker->fd();
+			sqe->poll32_events = POLLIN;
+			sqe->user_data = 0;
+			m_wake_armed = true;
+		}
+		const unsigned to_submit = publish();
+		unsigned min_complete = 0;
+		unsigned flags = 0;
+		__kernel_timespec ts{};
+		io_uring_getevents_arg arg{};
+		arg.sigmask_sz = _NSIG / 8;
+		// 已经有完成事件时不等待
+		if (cq_ready() == 0) {
+			flags |= IORING_ENTER_GETEVENTS;
+			min_complete = 1;
+			if (deadline) {
+				auto wait = detail::remaining(*deadline);
+				ts.tv_sec = static_cast<long long>(wait.count() / 1'000'000'000);
+				ts.tv_nsec = static_cast<long long>(wait.count() % 1'000'000'000);
+				arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+				flags |= IORING_ENTER_EXT_ARG;
+			}
+		}
+		if (to_submit > 0 || min_complete > 0) {
+			enter(to_submit, min_complete, flags, flags & IORING_ENTER_EXT_ARG ? &arg : nullptr);
+		}
+		reap();
+	}
+
+	auto pending() const noexcept -> std::size_t override {
+		return m_in_flight;
+	}
+
+	void register_buffers(std::span<const iovec> buffers) override {
+		register_resource(IORING_REGISTER_BUFFERS, buffers.data(),
+						  static_cast<unsigned>(buffers.size()));
+	}
+
+	void register_files(std::span<const int> fds) override {
+		register_resource(IORING_REGISTER_FILES, fds.data(),
+						  static_cast<unsigned>(fds.size()));
+	}
+
+	void forget(int) noexcept override {}
+
+	// 按user_data匹配, 与下一批SQE一起提交; 被取消的操作照常产生CQE
+	void cancel(IoOperation& op) override {
+		io_uring_sqe* sqe = next_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = reinterpret_cast<std::uint64_t>(&op);
+		sqe->user_data = cancel_user_data;
+	}
+
+	void watch(Waker& waker) override {
+		m_waker = &waker;
+	}
+
+	auto name() const noexcept -> const char* override {
+		return "io_uring";
+	}
+
+private:
+	// IoOperation按指针对齐, 不会与之冲突
+	static constexpr std::uint64_t cancel_user_data = 1;
+
+	template <typename Ty>
+	static auto at(void* base, std::uint32_t offset) noexcept -> Ty* {
+		return reinterpret_cast<Ty*>(static_cast<char*>(base) + offset);
+	}
+
+	void map_rings(const io_uring_params& params) {
+		m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) {
+			m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+		}
+		m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING);
+		m_cq_ring = single ? m_sq_ring : map(m_cq_ring_size, IORING_OFF_CQ_RING);
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = static_cast<io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+
+		m_sq_head = at<unsigned>(m_sq_ring, params.sq_off.head);
+		m_sq_tail = at<unsigned>(m_sq_ring, params.sq_off.tail);
+		m_sq_mask = *at<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+		m_sq_array = at<unsigned>(m_sq_ring, params.sq_off.array);
+		m_sq_entries = params.sq_entries;
+		m_cq_head = at<unsigned>(m_cq_ring, params.cq_off.head);
+		m_cq_tail = at<unsigned>(m_cq_ring, params.cq_off.tail);
+		m_cq_mask = *at<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+		m_cqes = at<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+		m_local_tail = *m_sq_tail;
+	}
+
+	auto map(std::size_t size, off_t offset) -> void* {
+		void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+						   MAP_SHARED | MAP_POPULATE, m_ring_fd, offset);
+		if (ptr == MAP_FAILED) {
+			detail::throw_errno("io_uring mmap");
+		}
+		return ptr;
+	}
+
+	void unmap_rings() noexcept {
+		if (m_sqes) {
+			::munmap(m_sqes, m_sqes_size);
+		}
+		if (m_cq_ring && m_cq_ring != m_sq_ring) {
+			::munmap(m_cq_ring, m_cq_ring_size);
+		}
+		if (m_sq_ring) {
+			::munmap(m_sq_ring, m_sq_ring_size);
+		}
+		m_sqes = nullptr;
+		m_sq_ring = m_cq_ring = nullptr;
+	}
+
+	// SQ满时先把已有的提交给内核
+	auto next_sqe() -> io_uring_sqe* {
+		unsigned head = std::atomic_ref{ *m_sq_head }.load(std::memory_order_acquire);
+		if (m_local_tail - head >= m_sq_entries) {
+			enter(publish(), 0, 0, nullptr);
+			head = std::atomic_ref{ *m_sq_head }.load(std::memory_order_acquire);
+			if (m_local_tail - head >= m_sq_entries) {
+				CO_THROW(std::system_error{ EBUSY, std::generic_category(), "io_uring SQ full" });
+			}
+		}
+		unsigned index = m_local_tail & m_sq_mask;
+		m_sq_array[index] = index;
+		++m_local_tail;
+		io_uring_sqe* sqe = &m_sqes[index];
+		std::memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	// 把本地的tail写回共享的SQ, 返回内核还没有取走的数量
+	auto publish() noexcept -> unsigned {
+		std::atomic_ref{ *m_sq_tail }.store(m_local_tail, std::memory_order_release);
+		return m_local_tail - std::atomic_ref{ *m_sq_head }.load(std::memory_order_acquire);
+	}
+
+	auto cq_ready() const noexcept -> unsigned {
+		return std::atomic_ref{ *m_cq_tail }.load(std::memory_order_acquire) - *m_cq_head;
+	}
+
+	void enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+			   io_uring_getevents_arg* arg) {
+		long ret = ::syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags,
+							 arg, arg ? sizeof(*arg) : _NSIG / 8);
+		// 超时或被信号打断都只是没有新的完成事件, 未取走的SQE下一轮再提交
+		if (ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			detail::throw_errno("io_uring_enter");
+		}
+	}
+
+	// 每次只取一个完成事件, 恢复的协程可以继续提交, 不影响CQ
+	void reap() {
+		for (;;) {
+			unsigned head = *m_cq_head;
+			if (head == std::atomic_ref{ *m_cq_tail }.load(std::memory_order_acquire)) {
+				break;
+			}
+			const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+			if (cqe.user_data == 0) {
+				// POLL_ADD只触发一次, 下一次poll重新提交
+				std::atomic_ref{ *m_cq_head }.store(head + 1, std::memory_order_release);
+				m_wake_armed = false;
+				m_waker->consume();
+				continue;
+			}
+			if (cqe.user_data == cancel_user_data) {
+				// 结果只表示是否找到了操作, 操作本身另有CQE
+				std::atomic_ref{ *m_cq_head }.store(head + 1, std::memory_order_release);
+				continue;
+			}
+			auto* op = reinterpret_cast<IoOperation*>(cqe.user_data);
+			op->result = cqe.res;
+			std::atomic_ref{ *m_cq_head }.store(head + 1, std::memory_order_release);
+			--m_in_flight;
+			op->coroutine.resume();
+		}
+	}
+
+	static void prepare(io_uring_sqe& sqe, IoOperation& op) noexcept {
+		using Kind = IoOperation::Kind;
+		sqe.fd = op.file.m_value;
+		if (op.file.m_fixed) {
+			sqe.flags |= IOSQE_FIXED_FILE;
+		}
+		sqe.user_data = reinterpret_cast<std::uint64_t>(&op);
+		switch (op.kind) {
+		case Kind::read:
+		case Kind::write:
+		case Kind::read_fixed:
+		case Kind::write_fixed:
+			sqe.opcode = op.kind == Kind::read ? IORING_OP_READ
+				: op.kind == Kind::write ? IORING_OP_WRITE
+				: op.kind == Kind::read_fixed ? IORING_OP_READ_FIXED
+				: IORING_OP_WRITE_FIXED;
+			sqe.addr = reinterpret_cast<std::uint64_t>(op.buffer);
+			sqe.len = static_cast<std::uint32_t>(op.length);
+			sqe.off = op.offset;
+			sqe.buf_index = op.buffer_index;
+			break;
+		case Kind::recv:
+		case Kind::send:
+			sqe.opcode = op.kind == Kind::recv ? IORING_OP_RECV : IORING_OP_SEND;
+			sqe.addr = reinterpret_cast<std::uint64_t>(op.buffer);
+			sqe.len = static_cast<std::uint32_t>(op.length);
+			sqe.msg_flags = static_cast<std::uint32_t>(op.flags);
+			break;
+		case Kind::accept:
+			sqe.opcode = IORING_OP_ACCEPT;
+			sqe.addr = reinterpret_cast<std::uint64_t>(op.address);
+			sqe.addr2 = reinterpret_cast<std::uint64_t>(op.address_length);
+			sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+			break;
+		case Kind::connect:
+			sqe.opcode = IORING_OP_CONNECT;
+			sqe.addr = reinterpret_cast<std::uint64_t>(op.address);
+			sqe.off = op.connect_length;
+			break;
+		}
+	}
+
+	void register_resource(unsigned opcode, const void* data, unsigned count) {
+		if (::syscall(__NR_io_uring_register, m_ring_fd, opcode, data, count) < 0) {
+			detail::throw_errno("io_uring_register");
+		}
+	}
+
+	int m_ring_fd{ -1 };
+	void* m_sq_ring{ nullptr };
+	void* m_cq_ring{ nullptr };
+	io_uring_sqe* m_sqes{ nullptr };
+	std::size_t m_sq_ring_size{ 0 };
+	std::size_t m_cq_ring_size{ 0 };
+	std::size_t m_sqes_size{ 0 };
+
+	unsigned* m_sq_head{ nullptr };
+	unsigned* m_sq_tail{ nullptr };
+	unsigned* m_sq_array{ nullptr };
+	unsigned m_sq_mask{ 0 };
+	unsigned m_sq_entries{ 0 };
+	unsigned* m_cq_head{ nullptr };
+	unsigned* m_cq_tail{ nullptr };
+	unsigned m_cq_mask{ 0 };
+	io_uring_cqe* m_cqes{ nullptr };
+
+	// 已写入但还没有写回共享tail的SQE
+	unsigned m_local_tail{ 0 };
+	std::size_t m_in_flight{ 0 };
+	Waker* m_waker{ nullptr };
+	bool m_wake_armed{ false };
+};
+
+
+/**
+ * epoll后端, 用于不支持io_uring的内核
+ * 提交时先以非阻塞方式直接执行, 返回EAGAIN时才挂起, 等fd就绪后重试
+ * fd使用边沿触发, 第一次挂起时注册, 之后不再修改; 套接字需要是非阻塞的
+ * 同一个fd同时最多一个读和一个写; 注册的缓冲区和文件只做记录, 在这里退化为普通读写
+ */
+class EpollBackend final : public IoBackend {
+public:
+	EpollBackend() {
+		m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (m_epoll_fd < 0) {
+			detail::throw_errno("epoll_create1");
+		}
+	}
+
+	~EpollBackend() override {
+		::close(m_epoll_fd);
+	}
+
+	EpollBackend(const EpollBackend&) = delete;
+	EpollBackend& operator=(const EpollBackend&) = delete;
+
+	auto submit(IoOperation& op) -> bool override {
+		int result = perform(op);
+		if (result != -EAGAIN) {
+			op.result = result;
+			return false;
+		}
+		const int fd = resolve(op.file);
+		FdState& state = m_fds[fd];
+		if (!state.registered) {
+			epoll_event event{};
+			event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+			event.data.fd = fd;
+			if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0 && errno != EEXIST) {
+				detail::throw_errno("epoll_ctl");
+			}
+			state.registered = true;
+		}
+		IoOperation*& slot = waits_for_write(op.kind) ? state.writer : state.reader;
+		slot = &op;
+		++m_pending;
+		return true;
+	}
+
+	void poll(std::optional<clock::time_point> deadline) override {
+		int timeout = -1;
+		if (deadline) {
+			// 向上取整到毫秒, 避免提前醒来后空转; 超过INT_MAX毫秒(约24.8天)时截断, 醒来后循环会重新计算
+			auto wait = std::chrono::ceil<std::chrono::milliseconds>(detail::remaining(*deadline));
+			timeout = static_cast<int>(std::min<std::chrono::milliseconds::rep>(wait.count(), INT_MAX));
+		}
+		epoll_event events[128];
+		int count = ::epoll_wait(m_epoll_fd, events, std::size(events), timeout);
+		if (count < 0) {
+			if (errno == EINTR) {
+				return;
+			}
+			detail::throw_errno("epoll_wait");
+		}
+		for (int i = 0; i < count; ++i) {
+			if (m_waker && events[i].data.fd == m_waker->fd()) {
+				m_waker->consume();
+				continue;
+			}
+			auto it = m_fds.find(events[i].data.fd);
+			if (it == m_fds.end()) {
+				continue;
+			}
+			const std::uint32_t ready = events[i].events;
+			if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				retry(it->second.reader);
+			}
+			// 恢复的协程可能关闭fd并forget
+			it = m_fds.find(events[i].data.fd);
+			if (it != m_fds.end() && (ready & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+				retry(it->second.writer);
+			}
+		}
+	}
+
+	auto pending() const noexcept -> std::size_t override {
+		return m_pending;
+	}
+
+	void register_buffers(std::span<const iovec>) override {}
+
+	void register_files(std::span<const int> fds) override {
+		m_files.assign(fds.begin(), fds.end());
+	}
+
+	void forget(int fd) noexcept override {
+		m_fds.erase(fd);
+	}
+
+	// 直接从等待的位置移除并恢复
+	void cancel(IoOperation& op) override {
+		auto it = m_fds.find(resolve(op.file));
+		if (it == m_fds.end()) {
+			return;
+		}
+		IoOperation*& slot = waits_for_write(op.kind) ? it->second.writer : it->second.reader;
+		if (slot != &op) {
+			return;
+		}
+		slot = nullptr;
+		--m_pending;
+		op.result = -ECANCELED;
+		op.coroutine.resume();
+	}
+
+	// eventfd使用水平触发, consume之前一直就绪
+	void watch(Waker& waker) override {
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.fd = waker.fd();
+		if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, waker.fd(), &event) < 0) {
+			detail::throw_errno("epoll_ctl");
+		}
+		m_waker = &waker;
+	}
+
+	auto name() const noexcept -> const char* override {
+		return "epoll";
+	}
+
+private:
+	struct FdState {
+		IoOperation* reader{ nullptr };
+		IoOperation* writer{ nullptr };
+		bool registered{ false };
+	};
+
+	static auto waits_for_write(IoOperation::Kind kind) noexcept -> bool {
+		using Kind = IoOperation::Kind;
+		return kind == Kind::write || kind == Kind::write_fixed ||
+			kind == Kind::send || kind == Kind::connect;
+	}
+
+	auto resolve(FileRef file) const noexcept -> int {
+		return file.m_fixed ? m_files[static_cast<std::size_t>(file.m_value)] : file.m_value;
+	}
+
+	// 重试等待中的操作, 仍然EAGAIN时继续等待
+	void retry(IoOperation*& slot) {
+		IoOperation* op = slot;
+		if (!op) {
+			return;
+		}
+		int result = perform(*op);
+		if (result == -EAGAIN) {
+			return;
+		}
+		slot = nullptr;
+		--m_pending;
+		op->result = result;
+		op->coroutine.resume();
+	}
+
+	// 以非阻塞方式执行, 返回值与io_uring的cqe.res一致
+	auto perform(IoOperation& op) -> int {
+		using Kind = IoOperation::Kind;
+		const int fd = resolve(op.file);
+		ssize_t ret = 0;
+		switch (op.kind) {
+		case Kind::read:
+		case Kind::read_fixed:
+			ret = op.offset == IoOperation::current_position
+				? ::read(fd, op.buffer, op.length)
+				: ::pread(fd, op.buffer, op.length, static_cast<off_t>(op.offset));
+			break;
+		case Kind::write:
+		case Kind::write_fixed:
+			ret = op.offset == IoOperation::current_position
+				? ::write(fd, op.buffer, op.length)
+				: ::pwrite(fd, op.buffer, op.length, static_cast<off_t>(op.offset));
+			break;
+		case Kind::recv:
+			ret = ::recv(fd, op.buffer, op.length, op.flags);
+			break;
+		case Kind::send:
+			ret = ::send(fd, op.buffer, op.length, op.flags);
+			break;
+		case Kind::accept:
+			ret = ::accept4(fd, op.address, op.address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			break;
+		case Kind::connect:
+			if (!op.started) {
+				op.started = true;
+				ret = ::connect(fd, op.address, op.connect_length);
+				if (ret < 0 && errno == EINPROGRESS) {
+					return -EAGAIN;
+				}
+			} else {
+				int error = 0;
+				socklen_t length = sizeof(error);
+				if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+					return -errno;
+				}
+				return -error;
+			}
+			break;
+		}
+		if (ret < 0) {
+			return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+		}
+		return static_cast<int>(ret);
+	}
+
+	int m_epoll_fd{ -1 };
+	std::unordered_map<int, FdState> m_fds;
+	std::vector<int> m_files;
+	std::size_t m_pending{ 0 };
+	Waker* m_waker{ nullptr };
+};
+
+
+enum class IoBackendKind {
+	// 优先io_uring, 不可用时回退到epoll; 定义CO_USE_EPOLL时总是使用epoll
+	automatic,
+	io_uring,
+	epoll,
+};
+
+/**
+ * 作为BasicLoop的Poller使用, 提供co_await的IO操作
+ * 每个awaiter的结果为int, 成功时为非负的返回值, 失败时为-errno
+ * 传入的缓冲区和地址需要在co_await结束前保持有效
+ */
+class IoContext {
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct Awaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		auto await_suspend(std::coroutine_handle<> coroutine) -> bool {
+			m_op.coroutine = coroutine;
+			return m_backend.submit(m_op);
+		}
+
+		auto await_resume() const noexcept -> int {
+			return m_op.result;
+		}
+
+		IoBackend& m_backend;
+		IoOperation m_op;
+	};
+
+	/**
+	 * 可以取消的IO, 见cancellable
+	 * 请求停止后操作在运行Loop的线程上被取消, 结果为-ECANCELED; 已经请求停止时不提交
+	 */
+	struct CancellableAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		auto await_suspend(std::coroutine_handle<> coroutine) -> bool {
+			if (m_token.stop_requested()) {
+				m_op.result = -ECANCELED;
+				return false;
+			}
+			m_op.coroutine = coroutine;
+			if (!m_context.m_backend->submit(m_op)) {
+				return false;
+			}
+			m_relay.arm(m_context, m_token, *this);
+			return true;
+		}
+
+		auto await_resume() noexcept -> int {
+			m_relay.disarm();
+			return m_op.result;
+		}
+
+		void on_cancel() {
+			m_context.m_backend->cancel(m_op);
+		}
+
+		IoContext& m_context;
+		IoOperation m_op;
+		std::stop_token m_token;
+		detail::StopRelay<CancellableAwaiter, IoContext> m_relay{};
+	};
+
+	explicit IoContext(IoBackendKind kind = IoBackendKind::automatic, unsigned entries = 256):
+		m_backend{ make_backend(kind, entries) }
+	{
+		m_backend->watch(m_waker);
+	}
+
+	auto read(FileRef file, void* buffer, std::size_t length,
+			  std::uint64_t offset = IoOperation::current_position) -> Awaiter {
+		return make(IoOperation::Kind::read, file, buffer, length, offset);
+	}
+
+	auto write(FileRef file, const void* buffer, std::size_t length,
+			   std::uint64_t offset = IoOperation::current_position) -> Awaiter {
+		return make(IoOperation::Kind::write, file, const_cast<void*>(buffer), length, offset);
+	}
+
+	// buffer需要位于register_buffers注册的第buffer_index个缓冲区内, io_uring下不需要再拷贝页面
+	auto read_fixed(FileRef file, void* buffer, std::size_t length, std::uint16_t buffer_index,
+					std::uint64_t offset = IoOperation::current_position) -> Awaiter {
+		Awaiter awaiter = make(IoOperation::Kind::read_fixed, file, buffer, length, offset);
+		awaiter.m_op.buffer_index = buffer_index;
+		return awaiter;
+	}
+
+	auto write_fixed(FileRef file, const void* buffer, std::size_t length, std::uint16_t buffer_index,
+					 std::uint64_t offset = IoOperation::current_position) -> Awaiter {
+		Awaiter awaiter = make(IoOperation::Kind::write_fixed, file, const_cast<void*>(buffer),
+							   length, offset);
+		awaiter.m_op.buffer_index = buffer_index;
+		return awaiter;
+	}
+
+	auto recv(FileRef file, void* buffer, std::size_t length, int flags = 0) -> Awaiter {
+		Awaiter awaiter = make(IoOperation::Kind::recv, file, buffer, length);
+		awaiter.m_op.flags = flags;
+		return awaiter;
+	}
+
+	// 默认带MSG_NOSIGNAL, 对端关闭时返回-EPIPE而不是触发SIGPIPE
+	auto send(FileRef file, const void* buffer, std::size_t length, int flags = MSG_NOSIGNAL)
+		-> Awaiter {
+		Awaiter awaiter = make(IoOperation::Kind::send, file, const_cast<void*>(buffer), length);
+		awaiter.m_op.flags = flags;
+		return awaiter;
+	}
+
+	// 返回的新连接是非阻塞的
+	auto accept(FileRef file, sockaddr* address = nullptr, socklen_t* length = nullptr)
+		-> Awaiter {
+		Awaiter awaiter = make(IoOperation::Kind::accept, file);
+		awaiter.m_op.address = address;
+		awaiter.m_op.address_length = length;
+		return awaiter;
+	}
+
+	auto connect(FileRef file, const sockaddr* address, socklen_t length) -> Awaiter {
+		Awaiter awaiter = make(IoOperation::Kind::connect, file);
+		awaiter.m_op.address = const_cast<sockaddr*>(address);
+		awaiter.m_op.connect_length = length;
+		return awaiter;
+	}
+
+	/**
+	 * 在token被请求停止时取消awaiter的操作, 例如请求超时后放弃仍在等待的读
+	 *   int n = co_await io.cancellable(io.recv(fd, buffer, size), token);
+	 */
+	auto cancellable(Awaiter awaiter, std::stop_token token) noexcept -> CancellableAwaiter {
+		return CancellableAwaiter{ *this, awaiter.m_op, std::move(token) };
+	}
+
+	void register_buffers(std::span<const iovec> buffers) {
+		m_backend->register_buffers(buffers);
+	}
+
+	void register_files(std::span<const int> fds) {
+		m_backend->register_files(fds);
+	}
+
+	// 关闭fd, 不能有等待中的操作
+	void close(int fd) noexcept {
+		m_backend->forget(fd);
+		::close(fd);
+	}
+
+	[[nodiscard]]
+	auto backend_name() const noexcept -> const char* {
+		return m_backend->name();
+	}
+
+	// 以下由BasicLoop调用
+	auto pending() const noexcept -> bool {
+		return m_backend->pending() > 0;
+	}
+
+	// 完成的协程和取消请求都在这里处理
+	void poll(std::optional<clock::time_point> deadline) {
+		m_backend->poll(deadline);
+		PostNode* node = m_cancels.take_all();
+		while (node) {
+			PostNode* next = node->next;
+			node->callback(node);
+			node = next;
+		}
+	}
+
+	void wake() {
+		m_waker.notify();
+	}
+
+	// 可以在任意线程调用, 节点需要带callback, 在下一次poll中执行; 用于转交取消请求(见yq_cancel.hpp)
+	void post(PostNode& node) {
+		assert(node.callback);
+		if (m_cancels.push(&node)) {
+			m_waker.notify();
+		}
+	}
+
+private:
+	auto make(IoOperation::Kind kind, FileRef file, void* buffer = nullptr, std::size_t length = 0,
+			  std::uint64_t offset = IoOperation::current_position) -> Awaiter {
+		Awaiter awaiter{ *m_backend, IoOperation{ .kind = kind, .file = file } };
+		awaiter.m_op.buffer = buffer;
+		awaiter.m_op.length = length;
+		awaiter.m_op.offset = offset;
+		return awaiter;
+	}
+
+	static auto make_backend(IoBackendKind kind, unsigned entries) -> std::unique_ptr<IoBackend> {
+#ifdef CO_USE_EPOLL
+		if (kind == IoBackendKind::automatic) {
+			kind = IoBackendKind::epoll;
+		}
+#endif
+		switch (kind) {
+		case IoBackendKind::io_uring:
+			return std::make_unique<IoUringBackend>(entries);
+		case IoBackendKind::epoll:
+			return std::make_unique<EpollBackend>();
+		case IoBackendKind::automatic:
+			break;
+		}
+#ifdef CO_NO_EXCEPTIONS
+		// 构造失败时不能回退, 先探测
+		if (IoUringBackend::supported()) {
+			return std::make_unique<IoUringBackend>(entries);
+		}
+		return std::make_unique<EpollBackend>();
+#else
+		try {
+			return std::make_unique<IoUringBackend>(entries);
+		} catch (const std::system_error&) {
+			// 内核不支持或被seccomp禁止
+			return std::make_unique<EpollBackend>();
+		}
+#endif
+	}
+
+	// 在m_backend之后析构
+	Waker m_waker;
+	std::unique_ptr<IoBackend> m_backend;
+	PostQueue m_cancels;
+};
+
+using IoLoop = BasicLoop<DefaultTimerQueue, IoContext>;
+
+} // namespace yq
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <stop_token>
+#include <utility>
+
+#include "yq_cancel.hpp"
+#include "yq_post_queue.hpp"
+#include "yq_timer.hpp"
+
+namespace yq
+{
+
+/**
+ * 没有IO时使用的Poller, 只负责睡到下一个定时器或者被其他线程唤醒
+ * Poller需要提供:
+ *   pending() 是否还有等待中的操作, 有时run不会退出
+ *   poll(deadline) 等待直到有操作完成, 被wake唤醒或到达deadline, deadline为空时一直等待. 完成的协程在poll中直接恢复
+ *   wake() 可以在任意线程调用, 让正在或下一次poll尽快返回
+ */
+struct NullPoller {
+	auto pending() const noexcept -> bool {
+		return false;
+	}
+
+	void poll(std::optional<std::chrono::steady_clock::time_point> deadline) {
+		m_waker.wait(deadline);
+	}
+
+	void wake() {
+		m_waker.notify();
+	}
+
+	Waker m_waker;
+};
+
+/**
+ * 单线程事件循环
+ * 就绪队列按FIFO恢复协程, 每轮只运行这一轮开始时已经就绪的协程, 运行中schedule的协程排到下一轮,
+ * 反复schedule自己的协程不会让定时器, IO和post的协程饿死. 定时器由TimerQueue管理(见yq_timer.hpp), IO由Poller管理(见yq_io.hpp)
+ * 每轮只读取一次时钟, 把所有已到期的定时器一起放入就绪队列
+ * 默认使用最小堆, 定义CO_USE_TIMING_WHEEL时使用分层时间轮
+ * 除post和WorkGuard外都只能在运行run的线程中调用; 其他线程中的post和WorkGuard析构返回前Loop不能被销毁
+ */
+template <typename TimerQueue = DefaultTimerQueue, typename Poller = NullPoller>
+class BasicLoop {
+public:
+	using clock = std::chrono::steady_clock;
+	using timer_queue_type = TimerQueue;
+	using poller_type = Poller;
+
+	struct SleepAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> coroutine) const {
+			m_loop.add_timer(m_expire_tp, coroutine);
+		}
+
+		void await_resume() const noexcept {}
+
+		BasicLoop& m_loop;
+		clock::time_point m_expire_tp;
+	};
+
+	/**
+	 * 可以取消的sleep, 请求停止后定时器被移除, 协程以std::errc::operation_canceled失败(见yq_cancel.hpp)
+	 * 停止可以在任意线程上请求, 取消在运行run的线程上执行
+	 */
+	struct CancellableSleepAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		template <typename PromiseType>
+		auto await_suspend(std::coroutine_handle<PromiseType> coroutine) -> bool {
+			m_target.set(coroutine);
+			if (m_token.stop_requested()) {
+				return m_target.suspend_cancelled();
+			}
+			m_timer = m_loop.add_timer(m_expire_tp, coroutine);
+			m_relay.arm(m_loop, m_token, *this);
+			return true;
+		}
+
+		void await_resume() {
+			m_relay.disarm();
+			m_target.check();
+		}
+
+		// 定时器还没有到期时才取消, 已经到期的照常恢复
+		void on_cancel() noexcept {
+			if (m_loop.cancel_timer(m_timer)) {
+				m_target.resume_cancelled();
+			}
+		}
+
+		BasicLoop& m_loop;
+		clock::time_point m_expire_tp;
+		std::stop_token m_token;
+		TimerHandle m_timer{};
+		detail::CancelTarget m_target{};
+		detail::StopRelay<CancellableSleepAwaiter, BasicLoop> m_relay{};
+	};
+
+	// co_await loop.post() 从任意线程切换到运行run的线程, 节点保存在协程帧中
+	struct PostAwaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> coroutine) noexcept {
+			m_node.coroutine = coroutine;
+			m_loop.post(m_node);
+		}
+
+		void await_resume() const noexcept {}
+
+		BasicLoop& m_loop;
+		PostNode m_node;
+	};
+
+	/**
+	 * 持有期间没有其他工作时run也不退出, 用于等待其他线程post
+	 * 可以在任意线程析构, 析构时唤醒Loop
+	 */
+	class WorkGuard {
+	public:
+		explicit WorkGuard(BasicLoop& loop) noexcept: m_loop{ &loop } {
+			m_loop->m_guards.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		WorkGuard(WorkGuard&& other) noexcept: m_loop{ std::exchange(other.m_loop, nullptr) } {}
+
+		WorkGuard& operator=(WorkGuard&& other) noexcept {
+			if (this != &other) {
+				reset();
+				m_loop = std::exchange(other.m_loop, nullptr);
+			}
+			return *this;
+		}
+
+		~WorkGuard() {
+			reset();
+		}
+
+		void reset() noexcept {
+			if (auto* loop = std::exchange(m_loop, nullptr)) {
+				loop->m_guards.fetch_sub(1, std::memory_order_release);
+				loop->m_poller.wake();
+			}
+		}
+
+	private:
+		BasicLoop* m_loop;
+	};
+
+	template <typename... PollerArgs>
+	explicit BasicLoop(PollerArgs&&... args):
+		m_poller{ std::forward<PollerArgs>(args)... }
+	{}
+
+	BasicLoop(const BasicLoop&) = delete;
+	BasicLoop& operator=(const BasicLoop&) = delete;
+
+	// 把协程放入就绪队列, 在run中恢复
+	void schedule(std::coroutine_handle<> coroutine) {
+		m_ready_queue.push_back(coroutine);
+	}
+
+	/**
+	 * 可以在任意线程调用, 在run中恢复coroutine
+	 * 节点放入无锁队列, 只有队列原来为空时才唤醒Loop, 同一批提交只有一次系统调用
+	 * Loop每轮取走整个队列, 按提交顺序放到就绪队列末尾
+	 * node需要保持有效直到协程被恢复, 返回后不再访问node
+	 * 带callback的节点在take_posted中调用callback, 不进入就绪队列
+	 */
+	void post(PostNode& node) {
+		if (m_posted.push(&node)) {
+			m_poller.wake();
+		}
+	}
+
+	// 节点在这里分配, 由Loop释放
+	void post(std::coroutine_handle<> coroutine) {
+		post(*new PostNode{ .next = nullptr, .coroutine = coroutine, .owned = true });
+	}
+
+	auto post() noexcept -> PostAwaiter {
+		return PostAwaiter{ *this, PostNode{} };
+	}
+
+	[[nodiscard]]
+	auto work_guard() noexcept -> WorkGuard {
+		return WorkGuard{ *this };
+	}
+
+	// 挂起当前协程直到tp, 已经过期的时间点在下一轮恢复
+	auto sleep_until(clock::time_point tp) -> SleepAwaiter {
+		return SleepAwaiter{ *this, tp };
+	}
+
+	auto sleep_for(clock::duration duration) -> SleepAwaiter {
+		return SleepAwaiter{ *this, clock::now() + duration };
+	}
+
+	auto sleep_until(clock::time_point tp, std::stop_token token) -> CancellableSleepAwaiter {
+		return CancellableSleepAwaiter{ *this, tp, std::move(token) };
+	}
+
+	auto sleep_for(clock::duration duration, std::stop_token token) -> CancellableSleepAwaiter {
+		return CancellableSleepAwaiter{ *this, clock::now() + duration, std::move(token) };
+	}
+
+	// tp到期时把coroutine放入就绪队列
+	auto add_timer(clock::time_point tp, std::coroutine_handle<> coroutine) -> TimerHandle {
+		return m_timers.add(tp, coroutine);
+	}
+
+	// 取消后协程不会被恢复, 由调用者负责处理; 已到期或已取消时返回false
+	auto cancel_timer(TimerHandle handle) noexcept -> bool {
+		return m_timers.cancel(handle);
+	}
+
+	// 运行直到没有就绪的协程, 未到期的定时器, 等待中的IO, post的协程和WorkGuard
+	void run() {
+		for (;;) {
+			take_posted();
+			run_ready();
+			auto next = m_timers.next_expiry();
+			if (!m_ready_queue.empty()) {
+				// 还有留到下一轮的协程, 只检查IO不等待
+				next = clock::time_point::min();
+			} else if (!next && !m_poller.pending()
+				// WorkGuard在post之后释放, 先检查计数再检查队列
+				&& m_guards.load(std::memory_order_acquire) == 0 && m_posted.empty()) {
+				break;
+			}
+			m_poller.poll(next);
+			expire_timers(clock::now());
+		}
+	}
+
+	auto poller() noexcept -> Poller& {
+		return m_poller;
+	}
+
+	[[nodiscard]]
+	auto pending_timers() const noexcept -> std::size_t {
+		return m_timers.size();
+	}
+
+private:
+
+	// 取出当前的就绪队列作为这一轮的批次, 两个队列交替使用, 不重新分配
+	void run_ready() {
+		std::swap(m_ready_queue, m_ready_batch);
+		while (!m_ready_batch.empty()) {
+			auto coroutine = m_ready_batch.front();
+			m_ready_batch.pop_front();
+			coroutine.resume();
+		}
+	}
+
+	void take_posted() {
+		PostNode* node = m_posted.take_all();
+		while (node) {
+			PostNode* next = node->next;
+			if (node->callback) {
+				node->callback(node);
+			} else {
+				m_ready_queue.push_back(node->coroutine);
+				if (node->owned) {
+					delete node;
+				}
+			}
+			node = next;
+		}
+	}
+
+	// 到期的定时器全部移入就绪队列
+	void expire_timers(clock::time_point now) {
+		m_timers.expire(now, [this](std::coroutine_handle<> coroutine) {
+			m_ready_queue.push_back(coroutine);
+		});
+	}
+
+	std::deque<std::coroutine_handle<>> m_ready_queue;
+	std::deque<std::coroutine_handle<>> m_ready_batch;
+	TimerQueue m_timers;
+	Poller m_poller;
+	PostQueue m_posted;
+	std::atomic<std::size_t> m_guards{ 0 };
+};
+
+using Loop = BasicLoop<>;
+
+} // namespace yq
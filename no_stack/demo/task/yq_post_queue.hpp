@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <optional>
+#include <system_error>
+
+#include "yq_error.hpp"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace yq
+{
+
+/**
+ * 跨线程提交的一个协程, 侵入式节点
+ * 通常保存在awaiter中(即协程帧中), 提交不需要额外分配
+ * owned为true时由取出的一方delete
+ * callback不为空时取出的一方在自己的线程上调用callback(node)代替恢复coroutine, 节点由callback释放(见yq_cancel.hpp)
+ */
+struct PostNode {
+	PostNode* next{ nullptr };
+	std::coroutine_handle<> coroutine{ nullptr };
+	bool owned{ false };
+	void (*callback)(PostNode*) noexcept { nullptr };
+};
+
+/**
+ * 无锁的多生产者单消费者队列
+ * 生产者用CAS把节点压到链表头, 消费者一次取走整个链表再反转成提交顺序
+ * push返回true表示队列原来为空, 这一批中只有第一个生产者需要唤醒消费者
+ */
+class PostQueue {
+public:
+	PostQueue() = default;
+	PostQueue(const PostQueue&) = delete;
+	PostQueue& operator=(const PostQueue&) = delete;
+
+	// 成功后不再访问node, 消费者可能已经恢复了协程并销毁了节点所在的帧
+	auto push(PostNode* node) noexcept -> bool {
+		PostNode* head = m_head.load(std::memory_order_relaxed);
+		do {
+			node->next = head;
+		} while (!m_head.compare_exchange_weak(head, node, std::memory_order_release,
+											   std::memory_order_relaxed));
+		return head == nullptr;
+	}
+
+	// 只能由消费者调用, 按提交顺序返回取走的节点
+	auto take_all() noexcept -> PostNode* {
+		PostNode* node = m_head.exchange(nullptr, std::memory_order_acquire);
+		PostNode* reversed = nullptr;
+		while (node) {
+			PostNode* next = node->next;
+			node->next = reversed;
+			reversed = node;
+			node = next;
+		}
+		return reversed;
+	}
+
+	[[nodiscard]]
+	auto empty() const noexcept -> bool {
+		return m_head.load(std::memory_order_acquire) == nullptr;
+	}
+
+private:
+	std::atomic<PostNode*> m_head{ nullptr };
+};
+
+
+/**
+ * 唤醒在poll中等待的线程
+ * Linux上是eventfd, 可以交给epoll/io_uring一起等待; Windows上是完成端口; 其他平台退化为条件变量
+ * notify可以在任意线程调用, wait和consume只能由等待的线程调用
+ */
+class Waker {
+public:
+	using clock = std::chrono::steady_clock;
+
+#if defined(__linux__)
+	Waker() {
+		m_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_fd < 0) {
+			CO_THROW(std::system_error{ errno, std::generic_category(), "eventfd" });
+		}
+	}
+
+	~Waker() {
+		::close(m_fd);
+	}
+
+	void notify() noexcept {
+		std::uint64_t one = 1;
+		// 计数器溢出前一定已经可读, EAGAIN可以忽略
+		[[maybe_unused]] auto ret = ::write(m_fd, &one, sizeof(one));
+	}
+
+	// 清除已经到达的通知
+	void consume() noexcept {
+		std::uint64_t value;
+		[[maybe_unused]] auto ret = ::read(m_fd, &value, sizeof(value));
+	}
+
+	// 等待通知或者到达deadline, deadline为空时一直等待
+	void wait(std::optional<clock::time_point> deadline) noexcept {
+		pollfd fd{ .fd = m_fd, .events = POLLIN, .revents = 0 };
+		timespec ts{};
+		if (deadline) {
+			auto now = clock::now();
+			auto wait = *deadline > now ? std::chrono::nanoseconds{ *deadline - now }
+										: std::chrono::nanoseconds{ 0 };
+			ts.tv_sec = static_cast<time_t>(wait.count() / 1'000'000'000);
+			ts.tv_nsec = static_cast<long>(wait.count() % 1'000'000'000);
+		}
+		if (::ppoll(&fd, 1, deadline ? &ts : nullptr, nullptr) > 0) {
+			consume();
+		}
+	}
+
+	[[nodiscard]]
+	auto fd() const noexcept -> int {
+		return m_fd;
+	}
+
+private:
+	int m_fd{ -1 };
+
+#elif defined(_WIN32)
+	Waker() {
+		m_port = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+		if (!m_port) {
+			CO_THROW(std::system_error{ static_cast<int>(::GetLastError()), std::system_category(),
+										"CreateIoCompletionPort" });
+		}
+	}
+
+	~Waker() {
+		::CloseHandle(m_port);
+	}
+
+	void notify() noexcept {
+		::PostQueuedCompletionStatus(m_port, 0, 0, nullptr);
+	}
+
+	void consume() noexcept {
+		DWORD bytes;
+		ULONG_PTR key;
+		OVERLAPPED* overlapped;
+		while (::GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped, 0)) {
+		}
+	}
+
+	void wait(std::optional<clock::time_point> deadline) noexcept {
+		DWORD timeout = INFINITE;
+		if (deadline) {
+			auto now = clock::now();
+			// 向上取整到毫秒, 避免提前醒来后空转
+			auto wait = *deadline > now ? *deadline - now : clock::duration{ 0 };
+			timeout = static_cast<DWORD>(
+				std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+		}
+		DWORD bytes;
+		ULONG_PTR key;
+		OVERLAPPED* overlapped;
+		if (::GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped, timeout)) {
+			consume();
+		}
+	}
+
+	[[nodiscard]]
+	auto port() const noexcept -> HANDLE {
+		return m_port;
+	}
+
+private:
+	HANDLE m_port{ nullptr };
+
+#else
+	Waker() = default;
+
+	void notify() {
+		{
+			std::lock_guard lock{ m_mutex };
+			m_notified = true;
+		}
+		m_cv.notify_one();
+	}
+
+	void consume() noexcept {
+		std::lock_guard lock{ m_mutex };
+		m_notified = false;
+	}
+
+	void wait(std::optional<clock::time_point> deadline) {
+		std::unique_lock lock{ m_mutex };
+		if (deadline) {
+			m_cv.wait_until(lock, *deadline, [this]() { return m_notified; });
+		} else {
+			m_cv.wait(lock, [this]() { return m_notified; });
+		}
+		m_notified = false;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_notified{ false };
+#endif
+
+public:
+	Waker(const Waker&) = delete;
+	Waker& operator=(const Waker&) = delete;
+};
+
+} // namespace yq
@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <stop_token>
+#include <utility>
+
+#include "yq_bounded_ring.hpp"
+#include "yq_cancel.hpp"
+
+namespace yq
+{
+
+namespace detail {
+
+// 等待中的协程, 保存在awaiter中(即协程帧中); prev, queued和cancelled由信号量的锁保护
+struct SyncWaiter {
+	SyncWaiter* next{ nullptr };
+	SyncWaiter* prev{ nullptr };
+	std::coroutine_handle<> coroutine{ nullptr };
+	bool queued{ false };
+	// 入队之前已经被取消
+	bool cancelled{ false };
+};
+
+/**
+ * 在释放者的线程上恢复等待者
+ * 被恢复的协程中再次释放唤醒的等待者排在当前线程的队列中, 由最外层依次恢复,
+ * 一串互相交接的协程不会不断加深原生栈
+ */
+inline void resume_waiter(SyncWaiter* waiter) {
+	thread_local SyncWaiter* t_head = nullptr;
+	thread_local SyncWaiter* t_tail = nullptr;
+	thread_local bool t_resuming = false;
+	waiter->next = nullptr;
+	if (t_resuming) {
+		(t_tail ? t_tail->next : t_head) = waiter;
+		t_tail = waiter;
+		return;
+	}
+	t_resuming = true;
+	while (waiter) {
+		// 恢复后waiter所在的帧可能已经销毁
+		waiter->coroutine.resume();
+		waiter = t_head;
+		if (waiter) {
+			t_head = waiter->next;
+			if (!t_head) {
+				t_tail = nullptr;
+			}
+		}
+	}
+	t_resuming = false;
+}
+
+} // namespace detail
+
+
+/**
+ * 计数信号量, 许可不足时挂起协程而不是阻塞线程
+ * 计数为负时表示排队的等待者数量. acquire和release在不需要排队或唤醒时只有一次原子操作, 不加锁
+ * 需要排队或唤醒时在m_mutex下操作侵入式的FIFO链表, 节点在awaiter中, 不额外分配
+ * 释放者先于等待者入队到达时留下一次唤醒, 等待者入队前取走
+ * 等待者在调用release的线程上恢复, 需要回到原来的Loop时在之后co_await loop.post()
+ * 带std::stop_token的acquire可以取消(见yq_cancel.hpp), 等待者在请求停止的线程上恢复
+ */
+class AsyncSemaphore {
+public:
+	struct Awaiter {
+		auto await_ready() noexcept -> bool {
+			return m_semaphore.try_acquire();
+		}
+
+		// 返回false表示已经得到许可, 不需要挂起
+		auto await_suspend(std::coroutine_handle<> coroutine) -> bool {
+			m_waiter.coroutine = coroutine;
+			return m_semaphore.enqueue(m_waiter) == Enqueued::queued;
+		}
+
+		void await_resume() const noexcept {}
+
+		AsyncSemaphore& m_semaphore;
+		detail::SyncWaiter m_waiter;
+	};
+
+	struct CancellableAwaiter {
+		// 已经请求停止时也进入await_suspend, 以取消结束
+		auto await_ready() noexcept -> bool {
+			return !m_token.stop_requested() && m_semaphore.try_acquire();
+		}
+
+		template <typename PromiseType>
+		auto await_suspend(std::coroutine_handle<PromiseType> coroutine) -> bool {
+			m_target.set(coroutine);
+			if (m_token.stop_requested()) {
+				return m_target.suspend_cancelled();
+			}
+			m_waiter.coroutine = coroutine;
+			// 先注册回调, 它在入队前执行时只留下标记; 入队后不再访问成员
+			m_callback.emplace(m_token, Cancel{ this });
+			switch (m_semaphore.enqueue(m_waiter)) {
+			case Enqueued::acquired:
+				return false;
+			case Enqueued::queued:
+				return true;
+			case Enqueued::cancelled:
+				break;
+			}
+			return m_target.suspend_cancelled();
+		}
+
+		void await_resume() {
+			m_callback.reset();
+			m_target.check();
+		}
+
+		struct Cancel {
+			void operator()() const noexcept {
+				if (m_awaiter->m_semaphore.cancel(m_awaiter->m_waiter)) {
+					m_awaiter->m_target.resume_cancelled();
+				}
+			}
+
+			CancellableAwaiter* m_awaiter;
+		};
+
+		AsyncSemaphore& m_semaphore;
+		std::stop_token m_token;
+		detail::SyncWaiter m_waiter{};
+		detail::CancelTarget m_target{};
+		detail::StopCallbackSlot<Cancel> m_callback{};
+	};
+
+	explicit AsyncSemaphore(std::ptrdiff_t initial = 0) noexcept: m_count{ initial } {
+		assert(initial >= 0);
+	}
+
+	AsyncSemaphore(const AsyncSemaphore&) = delete;
+	AsyncSemaphore& operator=(const AsyncSemaphore&) = delete;
+
+	// co_await sem.acquire()
+	auto acquire() noexcept -> Awaiter {
+		return Awaiter{ *this, detail::SyncWaiter{} };
+	}
+
+	// co_await sem.acquire(token), 取消时以std::errc::operation_canceled失败
+	auto acquire(std::stop_token token) noexcept -> CancellableAwaiter {
+		return CancellableAwaiter{ *this, std::move(token) };
+	}
+
+	auto try_acquire() noexcept -> bool {
+		std::ptrdiff_t count = m_count.load(std::memory_order_relaxed);
+		while (count > 0) {
+			if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire,
+											  std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 有等待者时在这里恢复它
+	void release() {
+		while (m_count.fetch_add(1, std::memory_order_acq_rel) < 0) {
+			detail::SyncWaiter* waiter = nullptr;
+			{
+				std::lock_guard lock{ m_mutex };
+				waiter = m_head;
+				if (!waiter) {
+					if (m_cancelled == 0) {
+						++m_wakeups;
+						return;
+					}
+					// 取消的等待者还占着一次计数, 这次释放抵消它, 许可继续释放
+					--m_cancelled;
+					continue;
+				}
+				unlink(*waiter);
+			}
+			detail::resume_waiter(waiter);
+			return;
+		}
+	}
+
+	void release(std::size_t count) {
+		while (count-- > 0) {
+			release();
+		}
+	}
+
+	// 当前可用的许可数量, 只用于观察
+	[[nodiscard]]
+	auto available() const noexcept -> std::ptrdiff_t {
+		return std::max<std::ptrdiff_t>(m_count.load(std::memory_order_relaxed), 0);
+	}
+
+private:
+	enum class Enqueued {
+		acquired,
+		queued,
+		cancelled,
+	};
+
+	// 占用一个许可, 没有时入队; queued表示需要挂起
+	auto enqueue(detail::SyncWaiter& waiter) -> Enqueued {
+		if (m_count.fetch_sub(1, std::memory_order_acq_rel) > 0) {
+			return Enqueued::acquired;
+		}
+		std::lock_guard lock{ m_mutex };
+		if (m_wakeups > 0) {
+			--m_wakeups;
+			return Enqueued::acquired;
+		}
+		if (waiter.cancelled) {
+			++m_cancelled;
+			return Enqueued::cancelled;
+		}
+		waiter.next = nullptr;
+		waiter.prev = m_tail;
+		waiter.queued = true;
+		(m_tail ? m_tail->next : m_head) = &waiter;
+		m_tail = &waiter;
+		return Enqueued::queued;
+	}
+
+	void unlink(detail::SyncWaiter& waiter) noexcept {
+		(waiter.prev ? waiter.prev->next : m_head) = waiter.next;
+		(waiter.next ? waiter.next->prev : m_tail) = waiter.prev;
+		waiter.queued = false;
+	}
+
+	/**
+	 * 取消waiter的等待, 返回true表示把它移出了队列, 由调用者恢复
+	 * 还没有入队时只留下标记, 已经被release取走时不做任何事
+	 */
+	auto cancel(detail::SyncWaiter& waiter) noexcept -> bool {
+		std::lock_guard lock{ m_mutex };
+		if (!waiter.queued) {
+			waiter.cancelled = true;
+			return false;
+		}
+		unlink(waiter);
+		++m_cancelled;
+		return true;
+	}
+
+	std::atomic<std::ptrdiff_t> m_count;
+	// 以下由m_mutex保护
+	std::mutex m_mutex;
+	detail::SyncWaiter* m_head{ nullptr };
+	detail::SyncWaiter* m_tail{ nullptr };
+	std::size_t m_wakeups{ 0 };
+	// 被取消的等待者留下的计数
+	std::size_t m_cancelled{ 0 };
+};
+
+
+/**
+ * 协程互斥锁, 即只有一个许可的AsyncSemaphore
+ * 等待者按FIFO得到锁, unlock直接把锁交给第一个等待者
+ *   auto lock = co_await mutex.scoped_lock();
+ * 带std::stop_token的版本取消时没有得到锁, 以std::errc::operation_canceled失败
+ */
+class AsyncMutex {
+public:
+	template <typename Acquire>
+	struct BasicScopedLockAwaiter {
+		auto await_ready() noexcept -> bool {
+			return m_awaiter.await_ready();
+		}
+
+		template <typename PromiseType>
+		auto await_suspend(std::coroutine_handle<PromiseType> coroutine) -> bool {
+			return m_awaiter.await_suspend(coroutine);
+		}
+
+		auto await_resume() -> std::unique_lock<AsyncMutex> {
+			m_awaiter.await_resume();
+			return std::unique_lock<AsyncMutex>{ m_mutex, std::adopt_lock };
+		}
+
+		AsyncMutex& m_mutex;
+		Acquire m_awaiter;
+	};
+
+	using ScopedLockAwaiter = BasicScopedLockAwaiter<AsyncSemaphore::Awaiter>;
+	using CancellableScopedLockAwaiter = BasicScopedLockAwaiter<AsyncSemaphore::CancellableAwaiter>;
+
+	AsyncMutex() noexcept = default;
+
+	// co_await mutex.lock(), 之后需要调用unlock
+	auto lock() noexcept -> AsyncSemaphore::Awaiter {
+		return m_semaphore.acquire();
+	}
+
+	auto lock(std::stop_token token) noexcept -> AsyncSemaphore::CancellableAwaiter {
+		return m_semaphore.acquire(std::move(token));
+	}
+
+	// 得到锁后返回持有它的std::unique_lock
+	auto scoped_lock() noexcept -> ScopedLockAwaiter {
+		return ScopedLockAwaiter{ *this, m_semaphore.acquire() };
+	}
+
+	auto scoped_lock(std::stop_token token) noexcept -> CancellableScopedLockAwaiter {
+		return CancellableScopedLockAwaiter{ *this, m_semaphore.acquire(std::move(token)) };
+	}
+
+	auto try_lock() noexcept -> bool {
+		return m_semaphore.try_acquire();
+	}
+
+	void unlock() {
+		m_semaphore.release();
+	}
+
+private:
+	AsyncSemaphore m_semaphore{ 1 };
+};
+
+
+/**
+ * 有界的多生产者多消费者通道
+ * 空位和元素各用一个AsyncSemaphore计数, 得到许可后在BoundedRing上读写, 满时send挂起, 空时recv挂起
+ *   co_await channel.send(value);
+ *   auto value = co_await channel.recv();
+ * 带std::stop_token的版本取消时不读写缓冲区, 未发送的值随awaiter销毁
+ */
+template <typename Ty>
+class Channel {
+public:
+	template <typename Acquire>
+	struct BasicSendAwaiter {
+		auto await_ready() noexcept -> bool {
+			return m_awaiter.await_ready();
+		}
+
+		template <typename PromiseType>
+		auto await_suspend(std::coroutine_handle<PromiseType> coroutine) -> bool {
+			return m_awaiter.await_suspend(coroutine);
+		}
+
+		void await_resume() {
+			m_awaiter.await_resume();
+			m_channel.m_ring.push(std::move(m_value));
+			m_channel.m_items.release();
+		}
+
+		Channel& m_channel;
+		Ty m_value;
+		Acquire m_awaiter;
+	};
+
+	template <typename Acquire>
+	struct BasicRecvAwaiter {
+		auto await_ready() noexcept -> bool {
+			return m_awaiter.await_ready();
+		}
+
+		template <typename PromiseType>
+		auto await_suspend(std::coroutine_handle<PromiseType> coroutine) -> bool {
+			return m_awaiter.await_suspend(coroutine);
+		}
+
+		auto await_resume() -> Ty {
+			m_awaiter.await_resume();
+			Ty value = m_channel.m_ring.pop();
+			m_channel.m_slots.release();
+			return value;
+		}
+
+		Channel& m_channel;
+		Acquire m_awaiter;
+	};
+
+	using SendAwaiter = BasicSendAwaiter<AsyncSemaphore::Awaiter>;
+	using RecvAwaiter = BasicRecvAwaiter<AsyncSemaphore::Awaiter>;
+	using CancellableSendAwaiter = BasicSendAwaiter<AsyncSemaphore::CancellableAwaiter>;
+	using CancellableRecvAwaiter = BasicRecvAwaiter<AsyncSemaphore::CancellableAwaiter>;
+
+	// capacity为0时抛出std::invalid_argument
+	explicit Channel(std::size_t capacity):
+		m_ring{ capacity },
+		m_slots{ static_cast<std::ptrdiff_t>(capacity) }
+	{}
+
+	Channel(const Channel&) = delete;
+	Channel& operator=(const Channel&) = delete;
+
+	// value先移入awaiter, 有空位后再移入缓冲区
+	auto send(Ty value) -> SendAwaiter {
+		return SendAwaiter{ *this, std::move(value), m_slots.acquire() };
+	}
+
+	auto recv() noexcept -> RecvAwaiter {
+		return RecvAwaiter{ *this, m_items.acquire() };
+	}
+
+	auto send(Ty value, std::stop_token token) -> CancellableSendAwaiter {
+		return CancellableSendAwaiter{ *this, std::move(value), m_slots.acquire(std::move(token)) };
+	}
+
+	auto recv(std::stop_token token) noexcept -> CancellableRecvAwaiter {
+		return CancellableRecvAwaiter{ *this, m_items.acquire(std::move(token)) };
+	}
+
+	[[nodiscard]]
+	auto capacity() const noexcept -> std::size_t {
+		return m_ring.capacity();
+	}
+
+private:
+	BoundedRing<Ty> m_ring;
+	AsyncSemaphore m_slots;
+	AsyncSemaphore m_items{ 0 };
+};
+
+} // namespace yq
@@ -0,0 +1,501 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "yq_error.hpp"
+#include "yq_frame_pool.hpp"
+
+// 需要stack/demo/2在包含路径中
+#ifdef CO_ENABLE_STATS
+#include "yq_stats.hpp"
+#endif
+
+namespace yq
+{
+
+namespace detail {
+
+// 由symmetric_transfer的循环恢复的协程, 以及它挂起后要切换到的协程
+inline thread_local std::coroutine_handle<> t_running{ nullptr };
+inline thread_local std::coroutine_handle<> t_next{ nullptr };
+
+/**
+ * from挂起后切换到to, to为空时只挂起
+ * 编译器只在开启优化且没有ASan时把返回句柄的await_suspend编译成尾调用, 否则每次切换都会加深原生栈
+ * 这里改为由循环依次恢复: from正是循环恢复的协程时只记录to并返回循环, 否则在这里开始一个新的循环
+ * 返回时from可能已经被恢复甚至销毁, 调用者不能再访问awaiter的成员
+ */
+inline void symmetric_transfer(std::coroutine_handle<> from, std::coroutine_handle<> to) noexcept {
+	if (from == t_running) {
+		t_next = to;
+		return;
+	}
+	auto saved = t_running;
+	while (to) {
+		t_running = to;
+		t_next = nullptr;
+		to.resume();
+		to = t_next;
+	}
+	t_running = saved;
+	t_next = nullptr;
+}
+
+/**
+ * 代替等待者接收任务结束的通知, 用于when_all/when_any(见yq_when.hpp)
+ * on_complete在任务挂起后调用, 返回接下来要切换到的协程; 其中可以销毁已结束的任务
+ */
+struct CompletionHandler {
+	virtual auto on_complete(std::coroutine_handle<> task, bool failed) noexcept
+		-> std::coroutine_handle<> = 0;
+
+protected:
+	~CompletionHandler() = default;
+};
+
+// 与PromiseType无关的部分, 无异常模式下失败沿着m_parent向上传递时只访问这些成员
+struct PromiseLinks {
+	std::coroutine_handle<> m_previous;
+	CompletionHandler* m_handler{ nullptr };
+#ifdef CO_NO_EXCEPTIONS
+	std::error_code m_error;
+	// 等待者也是Task, 并且通过co_await task等待时指向它的promise
+	PromiseLinks* m_parent{ nullptr };
+
+	/**
+	 * self以error结束, 等待它的Task依次以同样的错误结束, 直到try_await的等待者, CompletionHandler或顶层
+	 * 这些任务停在各自的挂起点上, 局部变量在所有者销毁任务时析构
+	 * 返回接下来要切换到的协程, 与PreviousAwaiter相同
+	 */
+	auto fail(std::coroutine_handle<> self, std::error_code error) noexcept
+		-> std::coroutine_handle<> {
+		PromiseLinks* promise = this;
+		for (;;) {
+			promise->m_error = error;
+			if (promise->m_handler) {
+				return promise->m_handler->on_complete(self, true);
+			}
+			if (!promise->m_parent) {
+				return promise->m_previous;
+			}
+			self = promise->m_previous;
+			promise = promise->m_parent;
+		}
+	}
+#endif
+};
+
+} // namespace detail
+
+
+// 协程结束时切换回等待它的协程或交给CompletionHandler, 都没有时挂起
+struct PreviousAwaiter {
+	PreviousAwaiter(std::coroutine_handle<> handle, detail::CompletionHandler* handler = nullptr,
+					bool failed = false):
+		m_previous{ handle }, m_handler{ handler }, m_failed{ failed }
+	{}
+
+	auto await_ready()  const noexcept -> bool {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> coroutine) const noexcept {
+		// on_complete可能已经销毁了当前协程, 之后只使用局部变量
+		auto next = m_handler ? m_handler->on_complete(coroutine, m_failed) : m_previous;
+		detail::symmetric_transfer(coroutine, next);
+	}
+
+	void await_resume() const noexcept {}
+
+	std::coroutine_handle<> m_previous;
+	detail::CompletionHandler* m_handler;
+	bool m_failed;
+};
+
+
+// 协程帧从当前线程的FramePool分配(见yq_frame_pool.hpp)
+template<typename PromiseType>
+struct BasePromise: public detail::PromiseLinks {
+	static auto operator new(std::size_t size) -> void* {
+		return detail::allocate_frame(size);
+	}
+
+	static void operator delete(void* ptr, std::size_t size) noexcept {
+		detail::deallocate_frame(ptr, size);
+	}
+
+#ifdef CO_ENABLE_STATS
+	// 每个co_await都经过stats::TimedAwaiter, 挂起和恢复时记录时间片
+	auto initial_suspend() {
+		return stats::StartAwaiter{ m_stats };
+	}
+
+	template <typename Awaitable>
+	auto await_transform(Awaitable&& awaitable) {
+		return stats::timed(m_stats, std::forward<Awaitable>(awaitable));
+	}
+
+	auto final_suspend() noexcept {
+		m_stats.end_slice(stats::now());
+		return PreviousAwaiter(m_previous, m_handler, failed());
+	}
+#else
+	auto initial_suspend() {
+		return std::suspend_always{};
+	}
+
+	auto final_suspend() noexcept {
+		return PreviousAwaiter(m_previous, m_handler, failed());
+	}
+#endif
+
+#ifdef CO_NO_EXCEPTIONS
+	// 没有异常时不会被调用, 失败通过fail设置m_error
+	void unhandled_exception() noexcept {
+		std::terminate();
+	}
+
+	auto failed() const noexcept -> bool {
+		return static_cast<bool>(m_error);
+	}
+
+	// 失败的任务没有结果, 需要先检查error()或使用try_await
+	void rethrow_if_exception() {
+		if (m_error) {
+			CO_THROW(std::system_error{ m_error });
+		}
+	}
+#else
+	// 异常保存下来, 在等待者的co_await处重新抛出
+	void unhandled_exception() noexcept {
+		m_exception = std::current_exception();
+	}
+
+	auto failed() const noexcept -> bool {
+		return m_exception != nullptr;
+	}
+
+	void rethrow_if_exception() {
+		if (m_exception) {
+			std::rethrow_exception(std::exchange(m_exception, nullptr));
+		}
+	}
+#endif
+
+	auto get_return_object() -> std::coroutine_handle<PromiseType> {
+		return std::coroutine_handle<PromiseType>::from_promise(*static_cast<PromiseType*>(this));
+	};
+
+#ifndef CO_NO_EXCEPTIONS
+	std::exception_ptr m_exception{ nullptr };
+#endif
+#ifdef CO_ENABLE_STATS
+	stats::CoStats m_stats;
+#endif
+};
+
+
+/**
+ * 结果在co_return时才构造, Ty不需要默认构造
+ * Ty为引用时只保存地址
+ */
+template<typename Ty = void>
+struct Promise: public BasePromise<Promise<Ty>> {
+	using storage_type = std::conditional_t<std::is_reference_v<Ty>, std::add_pointer_t<Ty>, Ty>;
+
+	template<typename TyRef>
+		requires std::is_convertible_v<TyRef&&, Ty>
+	void return_value(TyRef&& value) {
+		if constexpr (std::is_reference_v<Ty>) {
+			Ty ref = std::forward<TyRef>(value);
+			m_value.emplace(std::addressof(ref));
+		} else {
+			m_value.emplace(std::forward<TyRef>(value));
+		}
+	}
+
+	// 取出结果, 协程以异常结束时重新抛出, 无异常模式下失败时abort
+	auto result() -> Ty {
+		this->rethrow_if_exception();
+		if constexpr (std::is_reference_v<Ty>) {
+			return static_cast<Ty>(**m_value);
+		} else {
+			return std::move(*m_value);
+		}
+	}
+
+	std::optional<storage_type> m_value;
+};
+
+
+template <>
+struct Promise<void> : public BasePromise<Promise<void>> {
+	void return_void() noexcept {}
+
+	void result() {
+		rethrow_if_exception();
+	}
+};
+
+
+/**
+ * 第一个参数(成员函数为*this之后的第一个)是std::allocator_arg时使用的promise
+ * 协程帧由紧随其后的分配器分配, 不经过FramePool
+ *   auto handler(std::allocator_arg_t, const Alloc& alloc, Request& req) -> Task<int>;
+ * 只添加分配函数, 布局与Promise<Ty>相同, Task仍然通过Promise<Ty>访问
+ */
+template <typename Ty, typename Alloc, typename... Args>
+struct AllocatorPromise: public Promise<Ty> {
+	using frame_type = detail::AllocatorFrame<std::remove_cvref_t<Alloc>>;
+
+	static auto operator new(std::size_t size, std::allocator_arg_t,
+							 const std::remove_cvref_t<Alloc>& alloc,
+							 const std::remove_reference_t<Args>&...) -> void* {
+		return frame_type::allocate(size, alloc);
+	}
+
+	static void operator delete(void* ptr, std::size_t size) noexcept {
+		frame_type::deallocate(ptr, size);
+	}
+};
+
+template <typename Ty, typename Self, typename Alloc, typename... Args>
+struct MemberAllocatorPromise: public Promise<Ty> {
+	using frame_type = detail::AllocatorFrame<std::remove_cvref_t<Alloc>>;
+
+	static auto operator new(std::size_t size, const std::remove_reference_t<Self>&,
+							 std::allocator_arg_t, const std::remove_cvref_t<Alloc>& alloc,
+							 const std::remove_reference_t<Args>&...) -> void* {
+		return frame_type::allocate(size, alloc);
+	}
+
+	static void operator delete(void* ptr, std::size_t size) noexcept {
+		frame_type::deallocate(ptr, size);
+	}
+};
+
+
+/**
+ * 惰性任务, co_await时才开始执行, 结束后回到等待者
+ * 开始和结束都通过symmetric_transfer切换, 任意深度的co_await链只使用常数的原生栈
+ * 顶层任务可以交给Loop::schedule启动, 结束后通过result取出结果或异常
+ */
+template<typename Ty = void>
+struct Task {
+	using promise_type = Promise<Ty>;
+
+	Task(std::coroutine_handle<promise_type> coroutine) noexcept:
+		m_coroutine { coroutine } {}
+	
+	Task(Task&& other) noexcept:
+		m_coroutine { std::exchange(other.m_coroutine, nullptr) } {}
+
+	Task& operator=(Task&& other) noexcept {
+		if (this != &other) {
+			if (m_coroutine) {
+				m_coroutine.destroy();
+			}
+			m_coroutine = std::exchange(other.m_coroutine, nullptr);
+		}
+		return *this;
+	}
+
+	// 协程帧只能有一个所有者
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task() {
+		if (m_coroutine) {
+			m_coroutine.destroy();
+		}
+	}
+
+	struct Awaiter {
+		auto await_ready() const noexcept -> bool {
+			return false;
+		}
+		
+		// 记录等待者后直接切换到任务
+		template <typename AwaiterPromise>
+		void await_suspend(std::coroutine_handle<AwaiterPromise> coroutine) const noexcept {
+			m_coroutine.promise().m_previous = coroutine;
+#ifdef CO_NO_EXCEPTIONS
+			// 任务失败时等待者不再恢复, 以同样的错误结束
+			if constexpr (std::is_base_of_v<detail::PromiseLinks, AwaiterPromise>) {
+				m_coroutine.promise().m_parent = &coroutine.promise();
+			}
+#endif
+			detail::symmetric_transfer(coroutine, m_coroutine);
+		}
+
+		auto await_resume() const -> Ty {
+			return m_coroutine.promise().result();
+		}
+		
+		std::coroutine_handle<promise_type> m_coroutine;
+	};
+
+	auto operator co_await() const noexcept {
+		return Awaiter { m_coroutine };
+	}
+
+	// 无异常模式下以失败结束的任务停在fail处, 也算作结束
+	[[nodiscard]]
+	auto done() const noexcept -> bool {
+#ifdef CO_NO_EXCEPTIONS
+		return m_coroutine.done() || m_coroutine.promise().failed();
+#else
+		return m_coroutine.done();
+#endif
+	}
+
+#ifdef CO_NO_EXCEPTIONS
+	// 任务失败的错误, 成功或还没有结束时为空
+	[[nodiscard]]
+	auto error() const noexcept -> std::error_code {
+		return m_coroutine.promise().m_error;
+	}
+#endif
+
+	// 只能在任务结束后调用一次
+	auto result() -> Ty {
+		return m_coroutine.promise().result();
+	}
+
+#ifdef CO_ENABLE_STATS
+	// 切入次数, 累计运行时间和最长的一次运行, 不包括它co_await的其他任务
+	[[nodiscard]]
+	auto stats() const noexcept -> stats::CoroutineSnapshot {
+		return m_coroutine.promise().m_stats.snapshot();
+	}
+
+	void set_name(const char* name) noexcept {
+		m_coroutine.promise().m_stats.set_name(name);
+	}
+#endif
+
+	operator std::coroutine_handle<>() const noexcept {
+		return m_coroutine;
+	}
+
+	std::coroutine_handle<promise_type> m_coroutine;
+};
+
+
+// try_await的结果
+template <typename Ty = void>
+using Expected = std::expected<Ty, std::error_code>;
+
+/**
+ * co_await fail(error) 以error结束当前任务
+ * 有异常时抛出std::system_error; 无异常时当前任务不再恢复, 错误沿着co_await链向上传递,
+ * 等待者的co_await task处同样不再返回, 直到try_await的等待者或顶层(见Task::error)
+ */
+struct FailAwaiter {
+	auto await_ready() const noexcept -> bool {
+#ifdef CO_NO_EXCEPTIONS
+		return false;
+#else
+		return true;
+#endif
+	}
+
+	template <typename PromiseType>
+		requires std::is_base_of_v<detail::PromiseLinks, PromiseType>
+	void await_suspend([[maybe_unused]] std::coroutine_handle<PromiseType> coroutine) const noexcept {
+#ifdef CO_NO_EXCEPTIONS
+		// fail中可能已经销毁了当前协程, 之后只使用局部变量
+		auto next = coroutine.promise().fail(coroutine, m_error);
+		detail::symmetric_transfer(coroutine, next);
+#endif
+	}
+
+	// 无异常模式下不会恢复
+	void await_resume() const {
+		CO_THROW(std::system_error{ m_error });
+	}
+
+	std::error_code m_error;
+};
+
+[[nodiscard]]
+inline auto fail(std::error_code error) noexcept -> FailAwaiter {
+	return FailAwaiter{ error };
+}
+
+
+/**
+ * 与Task::Awaiter相同, 但任务的失败不再向上传递, 在co_await处以Expected返回
+ * 有异常时只转换std::system_error(包括fail抛出的), 其他异常照常抛出
+ */
+template <typename Ty>
+struct TryAwaiter {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> coroutine) const noexcept {
+		m_task.m_coroutine.promise().m_previous = coroutine;
+		detail::symmetric_transfer(coroutine, m_task.m_coroutine);
+	}
+
+	auto await_resume() -> Expected<Ty> {
+#ifdef CO_NO_EXCEPTIONS
+		if (auto error = m_task.error()) {
+			return std::unexpected{ error };
+		}
+		return take();
+#else
+		try {
+			return take();
+		} catch (const std::system_error& e) {
+			return std::unexpected{ e.code() };
+		}
+#endif
+	}
+
+	auto take() -> Expected<Ty> {
+		if constexpr (std::is_void_v<Ty>) {
+			m_task.result();
+			return {};
+		} else {
+			return m_task.result();
+		}
+	}
+
+	Task<Ty> m_task;
+};
+
+/**
+ * co_await try_await(task) 等待task并检查是否失败, 例如
+ *   auto value = co_await try_await(load(key));
+ *   if (!value) { ... value.error() ... }
+ * 接管task的所有权, 引用类型的结果不支持
+ */
+template <typename Ty>
+	requires (!std::is_reference_v<Ty>)
+auto try_await(Task<Ty> task) -> TryAwaiter<Ty> {
+	return TryAwaiter<Ty>{ std::move(task) };
+}
+
+} // namespace yq
+
+
+template <typename Ty, typename Alloc, typename... Args>
+struct std::coroutine_traits<yq::Task<Ty>, std::allocator_arg_t, Alloc, Args...> {
+	using promise_type = yq::AllocatorPromise<Ty, Alloc, Args...>;
+};
+
+template <typename Ty, typename Self, typename Alloc, typename... Args>
+	requires (!std::is_same_v<std::remove_cvref_t<Self>, std::allocator_arg_t>)
+struct std::coroutine_traits<yq::Task<Ty>, Self, std::allocator_arg_t, Alloc, Args...> {
+	using promise_type = yq::MemberAllocatorPromise<Ty, Self, Alloc, Args...>;
+};
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace yq
+{
+
+/**
+ * 定时器句柄, 用于取消
+ * 定时器到期或被取消后句柄失效, 对失效的句柄调用cancel返回false
+ */
+struct TimerHandle {
+	std::uint32_t index{ invalid_index };
+	std::uint32_t generation{ 0 };
+
+	static constexpr std::uint32_t invalid_index = UINT32_MAX;
+};
+
+namespace detail {
+
+/**
+ * 定时器节点池, 节点通过下标引用, 释放的节点放入空闲链表复用
+ * generation在每次释放时递增, 用来识别过期的句柄
+ */
+template <typename Node>
+class TimerSlab {
+public:
+	auto allocate() -> std::uint32_t {
+		if (m_free != TimerHandle::invalid_index) {
+			std::uint32_t index = m_free;
+			m_free = m_nodes[index].next;
+			return index;
+		}
+		m_nodes.emplace_back();
+		return static_cast<std::uint32_t>(m_nodes.size() - 1);
+	}
+
+	void release(std::uint32_t index) noexcept {
+		Node& node = m_nodes[index];
+		++node.generation;
+		node.coroutine = nullptr;
+		node.next = m_free;
+		m_free = index;
+	}
+
+	auto valid(TimerHandle handle) const noexcept -> bool {
+		return handle.index < m_nodes.size() &&
+			m_nodes[handle.index].generation == handle.generation &&
+			m_nodes[handle.index].coroutine;
+	}
+
+	auto operator[](std::uint32_t index) noexcept -> Node& {
+		return m_nodes[index];
+	}
+
+	auto operator[](std::uint32_t index) const noexcept -> const Node& {
+		return m_nodes[index];
+	}
+
+private:
+	std::vector<Node> m_nodes;
+	std::uint32_t m_free{ TimerHandle::invalid_index };
+};
+
+} // namespace detail
+
+
+/**
+ * 二叉最小堆, 插入和取消O(log n)
+ * 节点记录自己在堆中的位置, 取消时直接从中间删除
+ */
+class HeapTimerQueue {
+public:
+	using clock = std::chrono::steady_clock;
+
+	auto add(clock::time_point tp, std::coroutine_handle<> coroutine) -> TimerHandle {
+		std::uint32_t index = m_slab.allocate();
+		Node& node = m_slab[index];
+		node.expire_tp = tp;
+		node.sequence = m_sequence++;
+		node.coroutine = coroutine;
+		node.heap_index = m_heap.size();
+		m_heap.push_back(index);
+		sift_up(node.heap_index);
+		return TimerHandle{ index, node.generation };
+	}
+
+	auto cancel(TimerHandle handle) noexcept -> bool {
+		if (!m_slab.valid(handle)) {
+			return false;
+		}
+		remove_at(m_slab[handle.index].heap_index);
+		m_slab.release(handle.index);
+		return true;
+	}
+
+	[[nodiscard]]
+	auto next_expiry() const -> std::optional<clock::time_point> {
+		if (m_heap.empty()) {
+			return std::nullopt;
+		}
+		return m_slab[m_heap.front()].expire_tp;
+	}
+
+	// 对所有到期的定时器按到期顺序调用fn(coroutine)
+	template <typename Fn>
+	void expire(clock::time_point now, Fn&& fn) {
+		while (!m_heap.empty() && m_slab[m_heap.front()].expire_tp <= now) {
+			std::uint32_t index = m_heap.front();
+			auto coroutine = m_slab[index].coroutine;
+			remove_at(0);
+			m_slab.release(index);
+			fn(coroutine);
+		}
+	}
+
+	[[nodiscard]]
+	auto size() const noexcept -> std::size_t {
+		return m_heap.size();
+	}
+
+	[[nodiscard]]
+	auto empty() const noexcept -> bool {
+		return m_heap.empty();
+	}
+
+private:
+	struct Node {
+		clock::time_point expire_tp;
+		// 到期时间相同时按加入顺序
+		std::uint64_t sequence{ 0 };
+		std::coroutine_handle<> coroutine;
+		std::size_t heap_index{ 0 };
+		std::uint32_t generation{ 0 };
+		// 空闲链表
+		std::uint32_t next{ TimerHandle::invalid_index };
+	};
+
+	auto less(std::size_t lhs, std::size_t rhs) const noexcept -> bool {
+		const Node& a = m_slab[m_heap[lhs]];
+		const Node& b = m_slab[m_heap[rhs]];
+		if (a.expire_tp != b.expire_tp) {
+			return a.expire_tp < b.expire_tp;
+		}
+		return a.sequence < b.sequence;
+	}
+
+	void swap_at(std::size_t lhs, std::size_t rhs) noexcept {
+		std::swap(m_heap[lhs], m_heap[rhs]);
+		m_slab[m_heap[lhs]].heap_index = lhs;
+		m_slab[m_heap[rhs]].heap_index = rhs;
+	}
+
+	void sift_up(std::size_t pos) noexcept {
+		while (pos > 0) {
+			std::size_t parent = (pos - 1) / 2;
+			if (!less(pos, parent)) {
+				break;
+			}
+			swap_at(pos, parent);
+			pos = parent;
+		}
+	}
+
+	void sift_down(std::size_t pos) noexcept {
+		for (;;) {
+			std::size_t smallest = pos;
+			std::size_t left = pos * 2 + 1;
+			std::size_t right = left + 1;
+			if (left < m_heap.size() && less(left, smallest)) {
+				smallest = left;
+			}
+			if (right < m_heap.size() && less(right, smallest)) {
+				smallest = right;
+			}
+			if (smallest == pos) {
+				break;
+			}
+			swap_at(pos, smallest);
+			pos = smallest;
+		}
+	}
+
+	void remove_at(std::size_t pos) noexcept {
+		std::size_t last = m_heap.size() - 1;
+		if (pos != last) {
+			swap_at(pos, last);
+		}
+		m_heap.pop_back();
+		if (pos < m_heap.size()) {
+			sift_down(pos);
+			sift_up(pos);
+		}
+	}
+
+	detail::TimerSlab<Node> m_slab;
+	// 保存节点下标
+	std::vector<std::uint32_t> m_heap;
+	std::uint64_t m_sequence{ 0 };
+};
+
+
+/**
+ * 分层时间轮, 4层每层256个槽, 覆盖2^32个tick(tick为1ms时约49天), 更远的定时器到时再重新分层
+ * 插入和取消O(1), 槽内是双向链表, 按加入顺序到期
+ * 到期时间向上取整到tick, 同一个tick内到期的定时器一起处理, 不会提前到期
+ * 每经过256个tick把上一层对应的槽重新插入下一层
+ */
+class TimingWheel {
+public:
+	using clock = std::chrono::steady_clock;
+
+	explicit TimingWheel(clock::duration tick = std::chrono::milliseconds{ 1 },
+						 clock::time_point epoch = clock::now()) noexcept:
+		m_tick{ tick }, m_epoch{ epoch }
+	{}
+
+	auto add(clock::time_point tp, std::coroutine_handle<> coroutine) -> TimerHandle {
+		std::uint32_t index = m_slab.allocate();
+		Node& node = m_slab[index];
+		node.expire_tick = to_tick_ceil(tp);
+		node.coroutine = coroutine;
+		link(index);
+		++m_size;
+		return TimerHandle{ index, node.generation };
+	}
+
+	auto cancel(TimerHandle handle) noexcept -> bool {
+		if (!m_slab.valid(handle)) {
+			return false;
+		}
+		unlink(handle.index);
+		m_slab.release(handle.index);
+		--m_size;
+		return true;
+	}
+
+	/**
+	 * 下一次需要处理的时间, 可能早于实际的到期时间(上层槽需要重新分层时)
+	 */
+	[[nodiscard]]
+	auto next_expiry() const -> std::optional<clock::time_point> {
+		if (m_size == 0) {
+			return std::nullopt;
+		}
+		if ((m_current & slot_mask) == 0) {
+			// 当前tick要先重新分层
+			return tick_time(m_current);
+		}
+		for (std::uint64_t tick = m_current; tick < (m_current | slot_mask) + 1; ++tick) {
+			if (m_slots[0][tick & slot_mask].head != TimerHandle::invalid_index) {
+				return tick_time(tick);
+			}
+		}
+		// 第0层剩下的槽都是空的, 下一次变化发生在重新分层时
+		return tick_time((m_current | slot_mask) + 1);
+	}
+
+	// 推进到now, 对所有到期的定时器按到期顺序调用fn(coroutine)
+	template <typename Fn>
+	void expire(clock::time_point now, Fn&& fn) {
+		const std::uint64_t target = to_tick_floor(now);
+		while (m_current <= target) {
+			if (m_size == 0) {
+				// 没有定时器, 直接跳到目标
+				m_current = target + 1;
+				break;
+			}
+			std::size_t slot = m_current & slot_mask;
+			if (slot == 0) {
+				cascade();
+			}
+			// 先推进当前tick, 回调中新加入的已到期定时器进入下一个槽
+			// 每次从槽头取下一个节点, 回调中可以取消同一个槽中的定时器
+			++m_current;
+			Slot& expired = m_slots[0][slot];
+			while (expired.head != TimerHandle::invalid_index) {
+				std::uint32_t index = expired.head;
+				auto coroutine = m_slab[index].coroutine;
+				unlink(index);
+				m_slab.release(index);
+				--m_size;
+				fn(coroutine);
+			}
+		}
+	}
+
+	[[nodiscard]]
+	auto size() const noexcept -> std::size_t {
+		return m_size;
+	}
+
+	[[nodiscard]]
+	auto empty() const noexcept -> bool {
+		return m_size == 0;
+	}
+
+private:
+	static constexpr std::size_t slot_bits = 8;
+	static constexpr std::size_t slot_count = std::size_t{ 1 } << slot_bits;
+	static constexpr std::uint64_t slot_mask = slot_count - 1;
+	static constexpr std::size_t level_count = 4;
+	static constexpr std::uint64_t max_delta = (std::uint64_t{ 1 } << (slot_bits * level_count)) - 1;
+
+	struct Node {
+		std::uint64_t expire_tick{ 0 };
+		std::coroutine_handle<> coroutine;
+		std::uint32_t generation{ 0 };
+		std::uint32_t prev{ TimerHandle::invalid_index };
+		// 槽内链表, 空闲时作为空闲链表
+		std::uint32_t next{ TimerHandle::invalid_index };
+		std::uint16_t level{ 0 };
+		std::uint16_t slot{ 0 };
+	};
+
+	struct Slot {
+		std::uint32_t head{ TimerHandle::invalid_index };
+		std::uint32_t tail{ TimerHandle::invalid_index };
+	};
+
+	auto to_tick_ceil(clock::time_point tp) const noexcept -> std::uint64_t {
+		if (tp <= m_epoch) {
+			return 0;
+		}
+		return static_cast<std::uint64_t>((tp - m_epoch + m_tick - clock::duration{ 1 }) / m_tick);
+	}
+
+	auto to_tick_floor(clock::time_point tp) const noexcept -> std::uint64_t {
+		if (tp <= m_epoch) {
+			return 0;
+		}
+		return static_cast<std::uint64_t>((tp - m_epoch) / m_tick);
+	}
+
+	auto tick_time(std::uint64_t tick) const noexcept -> clock::time_point {
+		return m_epoch + m_tick * static_cast<clock::rep>(tick);
+	}
+
+	// 根据与当前tick的距离选择层和槽, 挂到槽的末尾
+	void link(std::uint32_t index) noexcept {
+		Node& node = m_slab[index];
+		std::uint64_t expire = std::max(node.expire_tick, m_current);
+		std::uint64_t delta = expire - m_current;
+		if (delta > max_delta) {
+			// 超出范围, 放在最高层, 重新分层时再计算
+			delta = max_delta;
+			expire = m_current + max_delta;
+		}
+		std::size_t level = 0;
+		while (level + 1 < level_count && delta >= (std::uint64_t{ 1 } << (slot_bits * (level + 1)))) {
+			++level;
+		}
+		node.level = static_cast<std::uint16_t>(level);
+		node.slot = static_cast<std::uint16_t>((expire >> (slot_bits * level)) & slot_mask);
+
+		Slot& slot = m_slots[level][node.slot];
+		node.prev = slot.tail;
+		node.next = TimerHandle::invalid_index;
+		if (slot.tail != TimerHandle::invalid_index) {
+			m_slab[slot.tail].next = index;
+		} else {
+			slot.head = index;
+		}
+		slot.tail = index;
+	}
+
+	void unlink(std::uint32_t index) noexcept {
+		Node& node = m_slab[index];
+		Slot& slot = m_slots[node.level][node.slot];
+		if (node.prev != TimerHandle::invalid_index) {
+			m_slab[node.prev].next = node.next;
+		} else {
+			slot.head = node.next;
+		}
+		if (node.next != TimerHandle::invalid_index) {
+			m_slab[node.next].prev = node.prev;
+		} else {
+			slot.tail = node.prev;
+		}
+	}
+
+	// 第0层转完一圈, 把上层的当前槽重新插入, 槽按顺序处理保持加入顺序
+	void cascade() noexcept {
+		for (std::size_t level = 1; level < level_count; ++level) {
+			std::size_t slot = (m_current >> (slot_bits * level)) & slot_mask;
+			std::uint32_t index = std::exchange(m_slots[level][slot].head, TimerHandle::invalid_index);
+			m_slots[level][slot].tail = TimerHandle::invalid_index;
+			while (index != TimerHandle::invalid_index) {
+				std::uint32_t next = m_slab[index].next;
+				link(index);
+				index = next;
+			}
+			if (slot != 0) {
+				break;
+			}
+		}
+	}
+
+	clock::duration m_tick;
+	clock::time_point m_epoch;
+	// 下一个要处理的tick
+	std::uint64_t m_current{ 0 };
+	std::size_t m_size{ 0 };
+	std::array<std::array<Slot, slot_count>, level_count> m_slots;
+	detail::TimerSlab<Node> m_slab;
+};
+
+
+#ifdef CO_USE_TIMING_WHEEL
+using DefaultTimerQueue = TimingWheel;
+#else
+using DefaultTimerQueue = HeapTimerQueue;
+#endif
+
+} // namespace yq
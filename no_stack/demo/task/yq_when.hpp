@@ -0,0 +1,314 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "yq_task.hpp"
+
+namespace yq
+{
+
+namespace detail {
+
+// Task<void>的结果在tuple/variant中用std::monostate表示
+template <typename Ty>
+using non_void_t = std::conditional_t<std::is_void_v<Ty>, std::monostate, Ty>;
+
+#ifdef CO_NO_EXCEPTIONS
+// 按参数顺序第一个失败的子任务的错误
+template <typename... Ts>
+auto first_error(const Task<Ts>&... tasks) noexcept -> std::error_code {
+	std::error_code error;
+	((error = error ? error : tasks.error()), ...);
+	return error;
+}
+#endif
+
+template <typename Ty>
+auto take_result(Task<Ty>& task) -> non_void_t<Ty> {
+	if constexpr (std::is_void_v<Ty>) {
+		task.result();
+		return std::monostate{};
+	} else {
+		return task.result();
+	}
+}
+
+/**
+ * when_all的计数, 保存在when_all协程的帧中, 不需要额外分配
+ * 计数从子任务数+1开始, 多出的1由启动子任务的等待者持有,
+ * 子任务在启动过程中同步结束时不会提前恢复等待者
+ */
+class WhenAllState final : public CompletionHandler {
+public:
+	explicit WhenAllState(std::size_t count) noexcept: m_remaining{ count + 1 } {}
+
+	auto on_complete(std::coroutine_handle<>, bool) noexcept -> std::coroutine_handle<> override {
+		return arrive();
+	}
+
+	// 最后一个到达的返回等待者
+	auto arrive() noexcept -> std::coroutine_handle<> {
+		return m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 ? m_parent : nullptr;
+	}
+
+	std::coroutine_handle<> m_parent{ nullptr };
+
+private:
+	std::atomic<std::size_t> m_remaining;
+};
+
+// 依次启动子任务, 全部结束后恢复等待者
+template <typename ForEach>
+struct WhenAllAwaiter {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	auto await_suspend(std::coroutine_handle<> parent) noexcept -> bool {
+		m_state.m_parent = parent;
+		m_for_each([this](auto& task) {
+			task.m_coroutine.promise().m_handler = &m_state;
+			task.m_coroutine.resume();
+		});
+		// 子任务都已同步结束时直接继续
+		return m_state.arrive() == nullptr;
+	}
+
+	void await_resume() const noexcept {}
+
+	WhenAllState& m_state;
+	ForEach m_for_each;
+};
+
+template <typename ForEach>
+WhenAllAwaiter(WhenAllState&, ForEach) -> WhenAllAwaiter<ForEach>;
+
+
+/**
+ * when_any的共享状态, 与子任务一起只分配一次
+ * 等待者恢复后其余的子任务继续运行, 状态由子任务和等待者共同持有, 最后一个释放
+ * 第一个成功结束的子任务胜出; 全部失败时最后一个失败的胜出, 等待者得到它的异常
+ */
+template <typename Tasks>
+class WhenAnyState final : public CompletionHandler {
+public:
+	WhenAnyState(Tasks&& tasks, std::size_t count) noexcept:
+		m_tasks{ std::move(tasks) }, m_count{ count }, m_refs{ count + 1 }
+	{}
+
+	auto on_complete(std::coroutine_handle<> task, bool failed) noexcept
+		-> std::coroutine_handle<> override {
+		std::coroutine_handle<> next = nullptr;
+		bool wins = !failed || m_failures.fetch_add(1, std::memory_order_acq_rel) + 1 == m_count;
+		if (wins && !m_decided.exchange(true, std::memory_order_acq_rel)) {
+			m_winner = task;
+			next = open_gate();
+		}
+		release();
+		return next;
+	}
+
+	// 与启动子任务的等待者各持有一次, 第二个到达的恢复等待者
+	auto open_gate() noexcept -> std::coroutine_handle<> {
+		return m_gate.fetch_sub(1, std::memory_order_acq_rel) == 1 ? m_parent : nullptr;
+	}
+
+	auto decided() const noexcept -> bool {
+		return m_decided.load(std::memory_order_acquire);
+	}
+
+	void release(std::size_t count = 1) noexcept {
+		if (m_refs.fetch_sub(count, std::memory_order_acq_rel) == count) {
+			delete this;
+		}
+	}
+
+	Tasks m_tasks;
+	std::coroutine_handle<> m_parent{ nullptr };
+	std::coroutine_handle<> m_winner{ nullptr };
+
+private:
+	std::size_t m_count;
+	std::atomic<std::size_t> m_refs;
+	std::atomic<std::size_t> m_failures{ 0 };
+	std::atomic<std::size_t> m_gate{ 2 };
+	std::atomic<bool> m_decided{ false };
+};
+
+// 依次启动子任务直到有一个胜出, 未启动的子任务不再运行
+template <typename State, typename ForEach>
+struct WhenAnyAwaiter {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	auto await_suspend(std::coroutine_handle<> parent) noexcept -> bool {
+		m_state.m_parent = parent;
+		std::size_t skipped = 0;
+		m_for_each([this, &skipped](auto& task) {
+			if (m_state.decided()) {
+				++skipped;
+				return;
+			}
+			task.m_coroutine.promise().m_handler = &m_state;
+			task.m_coroutine.resume();
+		});
+		if (skipped > 0) {
+			m_state.release(skipped);
+		}
+		return m_state.open_gate() == nullptr;
+	}
+
+	void await_resume() const noexcept {}
+
+	State& m_state;
+	ForEach m_for_each;
+};
+
+template <typename State, typename ForEach>
+WhenAnyAwaiter(State&, ForEach) -> WhenAnyAwaiter<State, ForEach>;
+
+// 等待者取出结果后释放自己持有的引用
+template <typename State>
+struct WhenAnyGuard {
+	~WhenAnyGuard() {
+		m_state->release();
+	}
+
+	State* m_state;
+};
+
+} // namespace detail
+
+
+/**
+ * 等待所有任务结束, 按参数顺序返回结果; 有任务失败时重新抛出第一个失败任务的异常
+ * 无异常模式下when_all以第一个失败任务的错误结束
+ * 子任务在当前线程依次启动, 遇到挂起时启动下一个, 因此可以在Loop上交替运行
+ * 最后一个结束的子任务直接切换回等待者, 计数保存在when_all的协程帧中
+ */
+template <typename... Ts>
+auto when_all(Task<Ts>... tasks) -> Task<std::tuple<detail::non_void_t<Ts>...>> {
+	detail::WhenAllState state{ sizeof...(Ts) };
+	co_await detail::WhenAllAwaiter{ state, [&tasks...](auto&& start) { (start(tasks), ...); } };
+#ifdef CO_NO_EXCEPTIONS
+	if (auto error = detail::first_error(tasks...)) {
+		co_await fail(error);
+	}
+#endif
+	co_return std::tuple<detail::non_void_t<Ts>...>{ detail::take_result(tasks)... };
+}
+
+template <typename Ty>
+auto when_all(std::vector<Task<Ty>> tasks)
+	-> Task<std::conditional_t<std::is_void_v<Ty>, void, std::vector<detail::non_void_t<Ty>>>> {
+	detail::WhenAllState state{ tasks.size() };
+	co_await detail::WhenAllAwaiter{ state, [&tasks](auto&& start) {
+		for (auto& task : tasks) {
+			start(task);
+		}
+	} };
+#ifdef CO_NO_EXCEPTIONS
+	for (auto& task : tasks) {
+		if (auto error = task.error()) {
+			co_await fail(error);
+		}
+	}
+#endif
+	if constexpr (std::is_void_v<Ty>) {
+		for (auto& task : tasks) {
+			task.result();
+		}
+	} else {
+		std::vector<Ty> results;
+		results.reserve(tasks.size());
+		for (auto& task : tasks) {
+			results.push_back(task.result());
+		}
+		co_return results;
+	}
+}
+
+
+/**
+ * 等待第一个成功结束的任务, 返回它的下标和结果; 全部失败时抛出最后一个异常
+ * 其余已经启动的任务没有取消, 会继续在原来的调度上运行到结束, 之后释放共享状态
+ * 胜出时还没有启动的任务不会再运行
+ * 空的任务列表以std::invalid_argument结束
+ */
+template <typename... Ts>
+	requires (sizeof...(Ts) > 0)
+auto when_any(Task<Ts>... tasks) -> Task<std::variant<detail::non_void_t<Ts>...>> {
+	using Tasks = std::tuple<Task<Ts>...>;
+	using Result = std::variant<detail::non_void_t<Ts>...>;
+	using State = detail::WhenAnyState<Tasks>;
+	auto* state = new State{ Tasks{ std::move(tasks)... }, sizeof...(Ts) };
+	detail::WhenAnyGuard<State> guard{ state };
+	co_await detail::WhenAnyAwaiter{ *state, [state](auto&& start) {
+		std::apply([&start](auto&... children) { (start(children), ...); }, state->m_tasks);
+	} };
+#ifdef CO_NO_EXCEPTIONS
+	// 全部失败时胜出的是最后一个失败的子任务
+	std::error_code error;
+	std::apply([&](auto&... children) {
+		((error = children.m_coroutine == state->m_winner ? children.error() : error), ...);
+	}, state->m_tasks);
+	if (error) {
+		co_await fail(error);
+	}
+#endif
+	// 找到胜出的任务, 在variant中用下标区分相同的类型
+	auto take = [&]<std::size_t... Is>(std::index_sequence<Is...>) -> Result {
+		std::optional<Result> result;
+		((std::get<Is>(state->m_tasks).m_coroutine == state->m_winner
+		  && (result.emplace(std::in_place_index<Is>,
+							 detail::take_result(std::get<Is>(state->m_tasks))), true)) || ...);
+		return std::move(*result);
+	};
+	co_return take(std::index_sequence_for<Ts...>{});
+}
+
+template <typename Ty>
+auto when_any(std::vector<Task<Ty>> tasks)
+	-> Task<std::conditional_t<std::is_void_v<Ty>, std::size_t, std::pair<std::size_t, Ty>>> {
+	using State = detail::WhenAnyState<std::vector<Task<Ty>>>;
+	const std::size_t count = tasks.size();
+	if (count == 0) {
+		CO_THROW(std::invalid_argument{ "when_any on an empty task list" });
+	}
+	auto* state = new State{ std::move(tasks), count };
+	detail::WhenAnyGuard<State> guard{ state };
+	co_await detail::WhenAnyAwaiter{ *state, [state](auto&& start) {
+		for (auto& task : state->m_tasks) {
+			start(task);
+		}
+	} };
+	std::size_t index = 0;
+	while (state->m_tasks[index].m_coroutine != state->m_winner) {
+		++index;
+	}
+#ifdef CO_NO_EXCEPTIONS
+	if (auto error = state->m_tasks[index].error()) {
+		co_await fail(error);
+	}
+#endif
+	if constexpr (std::is_void_v<Ty>) {
+		state->m_tasks[index].result();
+		co_return index;
+	} else {
+		co_return std::pair<std::size_t, Ty>{ index, state->m_tasks[index].result() };
+	}
+}
+
+} // namespace yq
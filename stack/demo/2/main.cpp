@@ -1,6 +1,26 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <optional>
 #include <print>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "yq_co_sync.hpp"
 #include "yq_coroutine.hpp"
+#include "yq_numa.hpp"
+#include "yq_scheduler.hpp"
+
+#if defined(__unix__)
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace yq;
 
@@ -206,7 +226,998 @@ void test_nested_variable_parameters() {
     }
     std::println("Test 5 passed\n");
 }
+
+// 测试6: 反复resume/yield, 每次resume恰好运行到下一个yield; 切换开销见bench/coroutine_bench
+void test_round_trips() {
+    std::println("=== Test 6: resume/yield round trips ===");
+    constexpr int rounds = 10'000;
+    int count = 0;
+    Coroutine co([&count]() {
+        for (int i = 0; i < rounds; ++i) {
+            ++count;
+            Coroutine::yield();
+        }
+    });
+
+    for (int i = 0; i < rounds; ++i) {
+        co.resume();
+        assert(count == i + 1);
+    }
+    assert(!co.is_finished());
+    co.resume();
+    assert(count == rounds);
+    assert(co.is_finished());
+    std::println("Test 6 passed!\n");
+}
+
+// 测试7: 栈池复用
+struct CountingUpstream {
+    static inline int allocations = 0;
+
+    auto allocate(std::size_t size) -> Stack {
+        ++allocations;
+        return upstream.allocate(size);
+    }
+
+    void deallocate(Stack stack) noexcept {
+        upstream.deallocate(stack);
+    }
+
+    HeapStackAllocator upstream;
+};
+
+void test_stack_pool() {
+    std::println("=== Test 7: pooled stack reuse ===");
+    PooledStackAllocator<CountingUpstream> allocator;
+    int finished = 0;
+    for (int i = 0; i < 1000; ++i) {
+        Coroutine co(allocator, 64 * 1024, [&finished]() {
+            Coroutine::yield();
+            ++finished;
+        });
+        while (!co.is_finished()) {
+            co.resume();
+        }
+    }
+    assert(finished == 1000);
+    // 结束的协程归还栈, 之后的协程全部复用同一块栈
+    assert(CountingUpstream::allocations == 1);
+
+    {
+        // 同时运行的协程需要各自的栈, 栈在第一次resume时分配
+        Coroutine a(allocator, 64 * 1024, []() { Coroutine::yield(); });
+        Coroutine b(allocator, 64 * 1024, []() { Coroutine::yield(); });
+        a.resume();
+        b.resume();
+        assert(CountingUpstream::allocations == 2);
+        // 不同大小的栈不会混用
+        Coroutine c(allocator, 128 * 1024, []() {});
+        c.resume();
+        assert(CountingUpstream::allocations == 3);
+    }
+    std::println("upstream allocations: {}", CountingUpstream::allocations);
+    std::println("Test 7 passed!\n");
+}
+
+#if defined(__unix__)
+// 当前进程常驻内存, 单位KiB
+auto resident_kib() -> long {
+    long pages = 0;
+    long resident = 0;
+    std::ifstream statm{"/proc/self/statm"};
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void deep_recursion(int depth) {
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    // 64KiB的栈远远不够1GiB的递归
+    if (depth < 1024 * 1024) {
+        deep_recursion(depth + 1);
+    }
+    frame[1] = frame[0];
+}
+
+// 测试8: mmap栈按需提交, 保护页捕获栈溢出
+void test_guarded_stack() {
+    std::println("=== Test 8: mmap guarded stack ===");
+    MmapStackAllocator allocator;
+    constexpr int count = 10'000;
+    constexpr std::size_t stack_size = 1024 * 1024;
+
+    long before = resident_kib();
+    std::vector<std::unique_ptr<Coroutine>> coroutines;
+    coroutines.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        coroutines.push_back(std::make_unique<Coroutine>(
+            allocator, stack_size, []() { Coroutine::yield(); }));
+        // 栈在第一次resume时才分配
+        coroutines.back()->resume();
+    }
+    long used = resident_kib() - before;
+    std::println("{} coroutines with {} KiB stacks, resident +{} KiB",
+                 count, stack_size / 1024, used);
+    // 名义上是10GiB, 实际只提交了栈顶用到的页面
+    assert(used < static_cast<long>(count * stack_size / 1024 / 16));
+    coroutines.clear();
+
+    // 在子进程中溢出, 应该被保护页拦截
+    pid_t pid = fork();
+    if (pid == 0) {
+        Coroutine co(allocator, 64 * 1024, []() { deep_recursion(0); });
+        co.resume();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+#ifdef __SANITIZE_ADDRESS__
+    // ASan自己接管SIGSEGV并报告stack-overflow
+    assert(!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+#else
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+#endif
+    std::println("stack overflow terminated child with SIGSEGV");
+    std::println("Test 8 passed!\n");
+}
+#endif
+
+#ifdef CO_USE_ASM
+// 在栈上填充数据, 切出再切回后校验, 共享栈被其他协程覆盖过也必须恢复
+void fill_and_check(int seed, int rounds) {
+    int local[256];
+    for (int i = 0; i < 256; ++i) {
+        local[i] = seed + i;
+    }
+    for (int r = 0; r < rounds; ++r) {
+        Coroutine::yield();
+        for (int i = 0; i < 256; ++i) {
+            assert(local[i] == seed + i);
+        }
+    }
+}
+
+// 测试9: 共享栈
+void test_shared_stack() {
+    std::println("=== Test 9: shared stack ===");
+    SharedStack stack{256 * 1024};
+    int inner_done = 0;
+
+    // 内外层协程都运行在同一块共享栈上, 栈帧地址互相重叠
+    // 子协程对象不能放在外层协程的栈上
+    {
+        Coroutine outer(stack, [&stack, &inner_done]() {
+            auto inner = std::make_unique<Coroutine>(stack, [&inner_done]() {
+                fill_and_check(1000, 3);
+                ++inner_done;
+            });
+            int local[256];
+            for (int i = 0; i < 256; ++i) {
+                local[i] = i;
+            }
+            while (!inner->is_finished()) {
+                inner->resume();
+                for (int i = 0; i < 256; ++i) {
+                    assert(local[i] == i);
+                }
+                Coroutine::yield();
+            }
+            inner.reset();
+            fill_and_check(2000, 2);
+        });
+        while (!outer.is_finished()) {
+            outer.resume();
+        }
+    }
+    assert(inner_done == 1);
+
+    // 共享栈与独立栈互相嵌套
+    SharedStack other{64 * 1024};
+    for (int i = 0; i < 100; ++i) {
+        Coroutine shared(stack, [&other, i]() {
+            Coroutine dedicated(64 * 1024, [&other, i]() {
+                Coroutine nested(other, [i]() { fill_and_check(i * 2, 2); });
+                while (!nested.is_finished()) {
+                    nested.resume();
+                    Coroutine::yield();
+                }
+            });
+            while (!dedicated.is_finished()) {
+                dedicated.resume();
+                Coroutine::yield();
+            }
+            fill_and_check(i, 2);
+        });
+        while (!shared.is_finished()) {
+            shared.resume();
+        }
+    }
+
+    // 大量兄弟协程同时挂起在同一块共享栈上, 每个只保存自己用到的部分
+    std::vector<std::unique_ptr<Coroutine>> fan_out;
+    for (int i = 0; i < 1000; ++i) {
+        fan_out.push_back(std::make_unique<Coroutine>(
+            stack, [i]() { fill_and_check(i, 3); }));
+    }
+    for (int round = 0; round < 4; ++round) {
+        for (auto& co : fan_out) {
+            co->resume();
+        }
+    }
+    for (auto& co : fan_out) {
+        assert(co->is_finished());
+    }
+    std::println("Test 9 passed!\n");
+}
+#endif
+
+// 测试10: 对称切换和乱序析构
+void test_transfer_to() {
+    std::println("=== Test 10: symmetric transfer ===");
+    std::vector<int> output;
+    int slot = 0;
+
+    // 生产者和消费者直接互相切换, 不经过main
+    auto consumer = std::make_unique<Coroutine>([&output, &slot]() {
+        for (;;) {
+            output.push_back(slot);
+            Coroutine::yield();
+        }
+    });
+    Coroutine producer([&consumer, &slot]() {
+        for (int i = 1; i <= 5; ++i) {
+            slot = i * 10;
+            Coroutine::transfer_to(*consumer);
+        }
+    });
+
+    // consumer接替producer在调用链中的位置, consumer yield时回到main
+    for (int i = 1; i <= 5; ++i) {
+        producer.resume();
+        assert(output.size() == static_cast<std::size_t>(i));
+        assert(output.back() == i * 10);
+    }
+    producer.resume();
+    assert(producer.is_finished());
+    // consumer挂起在死循环中, 先于producer析构
+    consumer.reset();
+
+    // 多个兄弟协程同时挂起, 按任意顺序resume和析构
+    int sum = 0;
+    auto a = std::make_unique<Coroutine>([&sum]() { sum += 1; Coroutine::yield(); sum += 10; });
+    auto b = std::make_unique<Coroutine>([&sum]() { sum += 100; Coroutine::yield(); sum += 1000; });
+    a->resume();
+    b->resume();
+    a->resume();
+    assert(a->is_finished() && !b->is_finished());
+    a.reset();
+    b->resume();
+    assert(sum == 1111);
+    b.reset();
+
+    bool caught = false;
+    try {
+        Coroutine::transfer_to(producer);
+    } catch (const std::logic_error&) {
+        caught = true;
+    }
+    assert(caught);
+    std::println("Test 10 passed!\n");
+}
+
+// 测试11: M:N调度器
+void test_scheduler() {
+    std::println("=== Test 11: work-stealing scheduler ===");
+    constexpr int count = 1000;
+    constexpr int yields = 20;
+    std::atomic<int> steps{0};
+    std::atomic<int> migrated{0};
+    {
+        Scheduler scheduler{4};
+        for (int i = 0; i < count; ++i) {
+            scheduler.spawn([&steps, &migrated, &scheduler]() {
+                auto first = std::this_thread::get_id();
+                bool moved = false;
+                // 嵌套的子协程随父协程一起迁移
+                Coroutine child([&steps]() {
+                    for (int j = 0; j < yields; ++j) {
+                        steps.fetch_add(1, std::memory_order_relaxed);
+                        Coroutine::yield();
+                    }
+                });
+                while (!child.is_finished()) {
+                    child.resume();
+                    Coroutine::yield();
+                    moved = moved || std::this_thread::get_id() != first;
+                }
+                if (moved) {
+                    migrated.fetch_add(1, std::memory_order_relaxed);
+                }
+            }, 64 * 1024);
+        }
+        // 协程中也可以继续提交
+        scheduler.spawn([&scheduler, &steps]() {
+            scheduler.spawn([&steps]() { steps.fetch_add(1); }, 64 * 1024);
+        }, 64 * 1024);
+        scheduler.wait();
+        assert(steps.load() == count * yields + 1);
+
+        scheduler.spawn([]() { Coroutine::yield(); throw std::runtime_error{"task failed"}; });
+        bool caught = false;
+        try {
+            scheduler.wait();
+        } catch (const std::runtime_error&) {
+            caught = true;
+        }
+        assert(caught);
+    }
+    std::println("{} of {} coroutines migrated between workers", migrated.load(), count);
+    std::println("Test 11 passed!\n");
+}
+
+// 测试12: 带值通道的协程
+void test_typed_channel() {
+    std::println("=== Test 12: typed yield/resume ===");
+    // 生成器: 每次resume得到一个值
+    VarCoroutine<long()> fib([]() -> long {
+        long a = 0, b = 1;
+        for (int i = 0; i < 10; ++i) {
+            VarCoroutine<long()>::yield(a);
+            a = std::exchange(b, a + b);
+        }
+        return -1;
+    });
+    std::vector<long> values;
+    for (long v = fib.resume(); v >= 0; v = fib.resume()) {
+        values.push_back(v);
+    }
+    assert(fib.is_finished());
+    assert((values == std::vector<long>{0, 1, 1, 2, 3, 5, 8, 13, 21, 34}));
+
+    // 累加器: 第一次resume的参数作为函数参数, 之后的作为yield的返回值
+    using Acc = VarCoroutine<int(int)>;
+    Acc acc([](int first) {
+        int sum = first;
+        while (sum < 100) {
+            sum += Acc::yield(sum);
+        }
+        return -sum;
+    });
+    assert(acc.resume(1) == 1);
+    assert(acc.resume(2) == 3);
+    assert(acc.resume(40) == 43);
+    assert(acc.resume(60) == -103);
+    assert(acc.is_finished());
+
+    // 只传入值, 支持只能移动的类型和多个参数
+    std::vector<std::string> received;
+    using Sink = VarCoroutine<void(std::unique_ptr<std::string>, int)>;
+    Sink sink([&received](std::unique_ptr<std::string> str, int n) {
+        while (str) {
+            received.push_back(*str + std::to_string(n));
+            std::tie(str, n) = Sink::yield();
+        }
+    });
+    sink.resume(std::make_unique<std::string>("a"), 1);
+    sink.resume(std::make_unique<std::string>("b"), 2);
+    // 挂起的协程析构时栈帧不会展开, 让它正常结束以释放str
+    sink.resume(nullptr, 0);
+    assert(sink.is_finished());
+    assert((received == std::vector<std::string>{"a1", "b2"}));
+
+    // 异常从resume中抛出
+    VarCoroutine<int()> failing([]() -> int {
+        VarCoroutine<int()>::yield(7);
+        throw std::runtime_error{"typed failure"};
+    });
+    assert(failing.resume() == 7);
+    bool caught = false;
+    try {
+        failing.resume();
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    assert(caught);
+    std::println("Test 12 passed!\n");
+}
+
+// 记录最近一次分配的栈
+struct RecordingAllocator final : StackAllocator {
+    auto allocate(std::size_t size) -> Stack override {
+        ++allocations;
+        last = upstream.allocate(size);
+        return last;
+    }
+
+    void deallocate(Stack stack) noexcept override {
+        upstream.deallocate(stack);
+    }
+
+    HeapStackAllocator upstream;
+    Stack last;
+    int allocations = 0;
+};
+
+// 测试13: 任务函数保存在协程对象内, 类型推导
+void test_inplace_task() {
+    std::println("=== Test 13: in-place task storage and CTAD ===");
+    // 推导为VarCoroutine<int, std::string>
+    std::string joined;
+    VarCoroutine deduced([&joined](int n, std::string& str) {
+        for (int i = 0; i < n; ++i) {
+            joined += str;
+            Coroutine::yield();
+        }
+    }, 3, std::string{"ab"});
+    static_assert(std::is_same_v<decltype(deduced), VarCoroutine<int, std::string>>);
+    while (!deduced.is_finished()) {
+        deduced.resume();
+    }
+    assert(joined == "ababab");
+
+    // 引用类型的参数
+    int value = 0;
+    VarCoroutine<int&> by_ref([](int& v) { v = 42; }, value);
+    by_ref.resume();
+    assert(value == 42);
+
+    // 只能移动的任务函数, 小的捕获状态保存在协程对象内
+    RecordingAllocator allocator;
+    const void* captured = nullptr;
+    auto owned = std::make_unique<int>(7);
+    {
+        Coroutine co(allocator, 64 * 1024,
+            [&captured, owned = std::move(owned)]() mutable {
+                captured = &owned;
+                assert(*owned == 7);
+            });
+        co.resume();
+        assert(co.is_finished());
+        const auto* object = reinterpret_cast<const char*>(&co);
+        assert(captured >= object && captured < object + sizeof(co));
+    }
+    // 放不下时放在堆上, 不占用栈
+    {
+        Coroutine co(allocator, 64 * 1024,
+            [&captured, buffer = std::array<char, 256>{}]() mutable { captured = buffer.data(); });
+        co.resume();
+        const auto* base = static_cast<const char*>(captured);
+        assert(base < allocator.last.base || base >= allocator.last.base + allocator.last.size);
+    }
+    std::println("Test 13 passed!\n");
+}
+ 
+// 测试14: 有栈协程的互斥锁, 信号量和通道
+void test_co_sync() {
+    std::println("=== Test 14: CoMutex, CoSemaphore and CoChannel ===");
+    // 手动轮流resume, 持有锁时让出, 其他协程在锁上让出等待
+    {
+        CoMutex mutex;
+        int inside = 0;
+        int max_inside = 0;
+        std::vector<int> order;
+        std::vector<std::unique_ptr<Coroutine>> cos;
+        for (int i = 0; i < 5; ++i) {
+            cos.push_back(std::make_unique<Coroutine>(64 * 1024, [&, i]() {
+                std::lock_guard lock{mutex};
+                order.push_back(i);
+                max_inside = std::max(max_inside, ++inside);
+                Coroutine::yield();
+                Coroutine::yield();
+                --inside;
+            }));
+        }
+        bool running = true;
+        while (running) {
+            running = false;
+            for (auto& co : cos) {
+                if (!co->is_finished()) {
+                    co->resume();
+                    running = true;
+                }
+            }
+        }
+        assert(max_inside == 1);
+        assert((order == std::vector<int>{0, 1, 2, 3, 4}));
+    }
+
+    {
+        CoSemaphore semaphore{2};
+        std::atomic<int> inside{0};
+        std::atomic<int> max_inside{0};
+        Scheduler scheduler{4};
+        for (int i = 0; i < 50; ++i) {
+            scheduler.spawn([&]() {
+                semaphore.acquire();
+                int now = inside.fetch_add(1) + 1;
+                int seen = max_inside.load();
+                while (now > seen && !max_inside.compare_exchange_weak(seen, now)) {
+                }
+                Coroutine::yield();
+                inside.fetch_sub(1);
+                semaphore.release();
+            }, 64 * 1024);
+        }
+        scheduler.wait();
+        assert(max_inside.load() <= 2);
+        assert(semaphore.available() == 2);
+    }
+
+    {
+        CoChannel<long> channel{8};
+        std::atomic<long> sum{0};
+        constexpr long per_task = 5000;
+        Scheduler scheduler{4};
+        for (long i = 0; i < 4; ++i) {
+            scheduler.spawn([&channel, &sum]() {
+                long local = 0;
+                for (long j = 0; j < per_task; ++j) {
+                    local += channel.recv();
+                }
+                sum += local;
+            }, 64 * 1024);
+            scheduler.spawn([&channel, i]() {
+                for (long j = i * per_task; j < (i + 1) * per_task; ++j) {
+                    channel.send(j);
+                }
+            }, 64 * 1024);
+        }
+        scheduler.wait();
+        constexpr long total = 4 * per_task;
+        assert(sum.load() == total * (total - 1) / 2);
+    }
+
+    // 协程外的线程也可以使用, 等待时让出线程
+    {
+        CoChannel<int> channel{1};
+        std::thread producer([&channel]() {
+            for (int i = 0; i < 100; ++i) {
+                channel.send(i);
+            }
+        });
+        int expected = 0;
+        for (int i = 0; i < 100; ++i) {
+            assert(channel.recv() == expected++);
+        }
+        producer.join();
+    }
+    std::println("Test 14 passed!\n");
+}
  
+// 测试15: 栈和上下文在第一次resume时才构造
+void test_lazy_context() {
+    std::println("=== Test 15: lazy stack and context ===");
+    RecordingAllocator allocator;
+    auto state = std::make_shared<int>(0);
+    {
+        // 创建后取消的协程不分配栈, 只析构任务函数
+        std::vector<std::unique_ptr<Coroutine>> pending;
+        for (int i = 0; i < 1000; ++i) {
+            pending.push_back(std::make_unique<Coroutine>(allocator, 256 * 1024,
+                [state]() { ++*state; }));
+        }
+        assert(state.use_count() == 1001);
+        assert(allocator.allocations == 0);
+        pending[10]->resume();
+        assert(allocator.allocations == 1);
+        assert(pending[10]->is_finished() && *state == 1);
+    }
+    assert(state.use_count() == 1);
+
+    // transfer_to也会构造目标的上下文
+    int order = 0;
+    Coroutine second(allocator, 64 * 1024, [&order]() { order = order * 10 + 2; });
+    Coroutine first(allocator, 64 * 1024, [&order, &second]() {
+        order = 1;
+        Coroutine::transfer_to(second);
+        order = order * 10 + 3;
+    });
+    first.resume();
+    assert(order == 12);
+    assert(second.is_finished() && !first.is_finished());
+    first.resume();
+    assert(order == 123);
+    assert(allocator.allocations == 3);
+
+#ifdef CO_USE_ASM
+    HeapStackAllocator heap;
+    SharedStack shared{64 * 1024, heap};
+    int runs = 0;
+    {
+        Coroutine never(shared, [&runs]() { ++runs; });
+    }
+    Coroutine once(shared, [&runs]() { ++runs; Coroutine::yield(); ++runs; });
+    once.resume();
+    once.resume();
+    assert(runs == 2 && once.is_finished());
+#endif
+    std::println("Test 15 passed!\n");
+}
+
+// 测试16: 通过std::stop_token协作式取消
+void test_cancellation() {
+    std::println("=== Test 16: cooperative cancellation ===");
+    // 下一次yield展开协程栈, 栈上的对象照常析构, 取消不传给resume的调用者
+    {
+        std::stop_source source;
+        auto state = std::make_shared<int>(0);
+        int unwound = 0;
+        Coroutine co(64 * 1024, [state, &unwound]() {
+            auto guard = std::shared_ptr<int>(state.get(), [&unwound](int*) { ++unwound; });
+            while (true) {
+                ++*state;
+                Coroutine::yield();
+            }
+        });
+        co.set_stop_token(source.get_token());
+        co.resume();
+        co.resume();
+        source.request_stop();
+        co.resume();
+        assert(co.is_finished() && co.cancelled());
+        assert(*state == 2 && unwound == 1);
+
+        // 没有取消的协程照常结束
+        Coroutine normal(64 * 1024, []() { Coroutine::yield(); });
+        normal.set_stop_token(std::stop_source{}.get_token());
+        normal.resume();
+        normal.resume();
+        assert(normal.is_finished() && !normal.cancelled());
+    }
+
+    // 排队期间取消的协程不会开始, 也不分配栈
+    {
+        std::stop_source source;
+        std::atomic<bool> open{false};
+        std::atomic<int> started{0};
+        Scheduler scheduler{1};
+        // 占住唯一的工作线程直到全部提交并取消
+        scheduler.spawn([&open]() {
+            while (!open.load()) {
+                std::this_thread::yield();
+            }
+        }, 64 * 1024);
+        for (int i = 0; i < 1000; ++i) {
+            scheduler.spawn(source.get_token(), [&started]() {
+                ++started;
+                while (true) {
+                    Coroutine::yield();
+                }
+            }, 64 * 1024);
+        }
+        source.request_stop();
+        open.store(true);
+        scheduler.wait();
+        assert(started.load() == 0);
+    }
+
+    // 在信号量上等待时取消, 节点移除, 之后的许可不会丢失
+    {
+        std::stop_source source;
+        CoSemaphore semaphore{0};
+        Coroutine waiter(64 * 1024, [&semaphore]() { semaphore.acquire(); });
+        waiter.set_stop_token(source.get_token());
+        waiter.resume();
+        assert(!waiter.is_finished());
+        source.request_stop();
+        waiter.resume();
+        assert(waiter.is_finished() && waiter.cancelled());
+        semaphore.release();
+        assert(semaphore.available() == 1);
+        assert(semaphore.try_acquire() && semaphore.available() == 0);
+    }
+
+    // 调度器中挂起的等待者被取消时唤醒, 节点同样移除
+    {
+        std::stop_source source;
+        CoSemaphore semaphore{0};
+        std::atomic<bool> waiting{false};
+        Scheduler scheduler{2};
+        for (int i = 0; i < 4; ++i) {
+            scheduler.spawn(source.get_token(), [&semaphore, &waiting]() {
+                waiting.store(true);
+                semaphore.acquire();
+            }, 64 * 1024);
+        }
+        while (!waiting.load()) {
+            std::this_thread::yield();
+        }
+        source.request_stop();
+        scheduler.wait();
+        semaphore.release();
+        assert(semaphore.available() == 1);
+    }
+
+    // 有返回值的协程被取消后resume抛出Cancelled
+    {
+        std::stop_source source;
+        using Doubler = VarCoroutine<int(int)>;
+        Doubler doubler([](int value) {
+            while (true) {
+                value = Doubler::yield(value * 2);
+            }
+            return 0;
+        });
+        doubler.set_stop_token(source.get_token());
+        assert(doubler.resume(1) == 2);
+        source.request_stop();
+        bool thrown = false;
+        try {
+            doubler.resume(2);
+        } catch (const Cancelled&) {
+            thrown = true;
+        }
+        assert(thrown && doubler.cancelled());
+    }
+    std::println("Test 16 passed!\n");
+}
+
+// 测试17: spawn_n批量创建协程
+void test_spawn_n() {
+    std::println("=== Test 17: spawn_n from one stack slab ===");
+    // 同一块映射中的栈依次相邻
+    {
+        StackSlab slab{3, 64 * 1024};
+        Stack first = slab.allocate(64 * 1024);
+        Stack second = slab.allocate(32 * 1024);
+        assert(first.base + first.size + 32 * 1024 == second.base);
+        assert(slab.capacity() == 3);
+    }
+
+    {
+        constexpr std::size_t count = 10000;
+        std::vector<std::atomic<int>> seen(count);
+        std::atomic<long> sum{0};
+        Scheduler scheduler{4};
+        scheduler.spawn_n(count, 64 * 1024, [&](std::size_t index) {
+            seen[index].fetch_add(1);
+            Coroutine::yield();
+            sum += static_cast<long>(index);
+        });
+        scheduler.wait();
+        assert(std::all_of(seen.begin(), seen.end(), [](const auto& n) { return n.load() == 1; }));
+        assert(sum.load() == static_cast<long>(count * (count - 1) / 2));
+    }
+
+    // 任务函数只有一份, 所有协程结束后析构; 在协程中提交时放入本地队列
+    {
+        auto state = std::make_shared<int>(0);
+        std::atomic<int> children{0};
+        Scheduler scheduler{2};
+        scheduler.spawn([&scheduler, &children, state]() {
+            scheduler.spawn_n(100, 64 * 1024, [&children, state]() {
+                Coroutine::yield();
+                ++children;
+            }, true);
+        }, 64 * 1024);
+        scheduler.wait();
+        assert(children.load() == 100);
+        assert(state.use_count() == 1);
+    }
+    std::println("Test 17 passed!\n");
+}
+
+// 测试18: 调用链上的协程不能重入
+void test_reentrancy() {
+    std::println("=== Test 18: re-entrancy guard and caller links ===");
+    auto rejected = [](auto&& fn) {
+        try {
+            fn();
+        } catch (const std::logic_error&) {
+            return true;
+        }
+        return false;
+    };
+
+    // 正在运行的协程和它的调用者都不能被切入
+    {
+        int checks = 0;
+        std::unique_ptr<Coroutine> outer;
+        Coroutine inner(64 * 1024, [&]() {
+            checks += rejected([&]() { outer->resume(); });
+            checks += rejected([&]() { Coroutine::transfer_to(*outer); });
+            Coroutine::yield();
+        });
+        outer = std::make_unique<Coroutine>(64 * 1024, [&]() {
+            checks += rejected([&]() { outer->resume(); });
+            inner.resume();
+        });
+        outer->resume();
+        assert(checks == 3);
+        assert(outer->is_finished() && !inner.is_finished());
+        // 切出之后可以在任何地方恢复
+        inner.resume();
+        assert(inner.is_finished());
+    }
+
+    // 在协程中创建的协程可以比创建者活得更久
+    {
+        std::unique_ptr<Coroutine> escaped;
+        int steps = 0;
+        Coroutine creator(64 * 1024, [&]() {
+            escaped = std::make_unique<Coroutine>(64 * 1024, [&steps]() {
+                ++steps;
+                Coroutine::yield();
+                ++steps;
+            });
+            escaped->resume();
+        });
+        creator.resume();
+        assert(creator.is_finished() && steps == 1);
+        escaped->resume();
+        assert(escaped->is_finished() && steps == 2);
+    }
+
+    // 深的嵌套resume按相反的顺序返回
+    {
+        constexpr int depth = 200;
+        std::vector<std::unique_ptr<Coroutine>> cos(depth);
+        std::vector<int> order;
+        for (int i = depth - 1; i >= 0; --i) {
+            cos[i] = std::make_unique<Coroutine>(64 * 1024, [&cos, &order, i]() {
+                if (i + 1 < depth) {
+                    cos[i + 1]->resume();
+                }
+                order.push_back(i);
+            });
+        }
+        cos[0]->resume();
+        assert(static_cast<int>(order.size()) == depth);
+        assert(order.front() == depth - 1 && order.back() == 0);
+        assert(!Coroutine::in_coroutine());
+    }
+    std::println("Test 18 passed!\n");
+}
+
+// 测试19: NUMA节点的工作线程放置, 窃取顺序和栈池
+void test_numa_placement() {
+    std::println("=== Test 19: NUMA-aware placement ===");
+    {
+        numa::Topology topology{{{0, 1}, {2, 3}}};
+        assert(topology.node_count() == 2);
+        assert(topology.node_of_cpu(3) == 1 && topology.node_of_cpu(7) == numa::unknown_node);
+        std::vector<unsigned> nodes;
+        for (std::size_t i = 0; i < 4; ++i) {
+            nodes.push_back(topology.node_for_worker(i, 4));
+        }
+        assert((nodes == std::vector<unsigned>{0, 0, 1, 1}));
+        assert(numa::Topology::system().node_count() >= 1);
+    }
+
+    // 同一节点的工作线程都失败后才跨节点
+    {
+        numa::VictimList victims{{0, 1, 0, 1, 0}, 2};
+        assert(victims.near_count() == 2);
+        assert((victims.victims() == std::vector<std::size_t>{0, 4, 1, 3}));
+        for (std::uint64_t random = 0; random < 8; ++random) {
+            std::vector<std::size_t> tried;
+            auto found = victims.visit(random, [&tried](std::size_t victim) -> std::optional<int> {
+                tried.push_back(victim);
+                return victim == 3 ? std::optional<int>{3} : std::nullopt;
+            });
+            assert(found == 3);
+            assert(tried.size() >= 3 && tried.size() <= 4);
+            assert(tried[0] != 1 && tried[0] != 3 && tried[1] != 1 && tried[1] != 3);
+        }
+        numa::VictimList alone{{0}, 0};
+        assert(!alone.visit(1, [](std::size_t) { return std::optional<int>{1}; }));
+    }
+
+    // 栈池只缓存本节点的栈; 用同一组CPU模拟两个节点
+    const auto& cpus = numa::Topology::system().cpus_of(0);
+    const numa::Topology two_nodes{{cpus, cpus}};
+    {
+        PooledStackAllocator<CountingUpstream> allocator;
+        CountingUpstream::allocations = 0;
+        Stack remote;
+        std::thread([&]() {
+            numa::bind_current_thread(two_nodes, 0);
+            remote = allocator.allocate(64 * 1024);
+        }).join();
+        assert(remote.node == 0);
+        std::thread([&]() {
+            numa::bind_current_thread(two_nodes, 1);
+            // 其他节点的栈交还upstream, 之后重新分配
+            allocator.deallocate(remote);
+            Stack local = allocator.allocate(64 * 1024);
+            assert(local.node == 1 && CountingUpstream::allocations == 2);
+            allocator.deallocate(local);
+            Stack reused = allocator.allocate(64 * 1024);
+            assert(reused.base == local.base && CountingUpstream::allocations == 2);
+            allocator.deallocate(reused);
+        }).join();
+        // 没有绑定节点的线程照常复用
+        Stack first = allocator.allocate(64 * 1024);
+        assert(first.node == numa::unknown_node);
+        allocator.deallocate(first);
+        Stack second = allocator.allocate(64 * 1024);
+        assert(second.base == first.base);
+        allocator.deallocate(second);
+    }
+
+    // 工作线程在运行协程之前绑定到各自的节点
+    {
+        std::atomic<int> unbound{0};
+        std::atomic<int> steps{0};
+        Scheduler scheduler{4, two_nodes};
+        for (int i = 0; i < 200; ++i) {
+            scheduler.spawn([&]() {
+                for (int j = 0; j < 3; ++j) {
+                    if (numa::current_thread_node() > 1) {
+                        ++unbound;
+                    }
+                    ++steps;
+                    Coroutine::yield();
+                }
+            }, 64 * 1024);
+        }
+        scheduler.wait();
+        assert(unbound.load() == 0 && steps.load() == 600);
+    }
+    assert(numa::current_thread_node() == numa::unknown_node);
+    std::println("Test 19 passed!\n");
+}
+
+// 测试20: 单个工作线程上自旋yield的协程不会饿死其他协程
+void test_yield_fairness() {
+    std::println("=== Test 20: yield spinning on a single worker ===");
+    // 等待的协程从外部提交, 在注入队列中
+    {
+        std::atomic<bool> flag{false};
+        Scheduler scheduler{1};
+        scheduler.spawn([&flag]() {
+            while (!flag.load()) {
+                Coroutine::yield();
+            }
+        }, 64 * 1024);
+        scheduler.spawn([&flag]() { flag.store(true); }, 64 * 1024);
+        scheduler.wait();
+        assert(flag.load());
+    }
+
+    // 等待的协程由自旋的协程提交, 在同一个本地队列中
+    {
+        std::atomic<int> order{0};
+        Scheduler scheduler{1};
+        scheduler.spawn([&scheduler, &order]() {
+            std::atomic<bool> flag{false};
+            scheduler.spawn([&flag, &order]() {
+                order.store(1);
+                flag.store(true);
+            }, 64 * 1024);
+            while (!flag.load()) {
+                Coroutine::yield();
+            }
+            assert(order.load() == 1);
+            order.store(2);
+        }, 64 * 1024);
+        scheduler.wait();
+        assert(order.load() == 2);
+    }
+
+    // 本地队列一直非空时外部提交的协程也会运行
+    {
+        std::atomic<bool> stop{false};
+        std::atomic<int> spins{0};
+        Scheduler scheduler{1};
+        for (int i = 0; i < 4; ++i) {
+            scheduler.spawn([&stop, &spins]() {
+                while (!stop.load()) {
+                    spins.fetch_add(1, std::memory_order_relaxed);
+                    Coroutine::yield();
+                }
+            }, 64 * 1024);
+        }
+        while (spins.load() == 0) {
+            std::this_thread::yield();
+        }
+        scheduler.spawn([&stop]() { stop.store(true); }, 64 * 1024);
+        scheduler.wait();
+        assert(stop.load());
+    }
+    std::println("Test 20 passed!\n");
+}
+
 // 主测试函数
 void run_all_tests() {
     test_basic_and_exception();
@@ -214,6 +1225,25 @@ void run_all_tests() {
     test_nested_yield_different_coroutines();
     test_variable_parameters();
     test_nested_variable_parameters();
+    test_round_trips();
+    test_stack_pool();
+#if defined(__unix__)
+    test_guarded_stack();
+#endif
+#ifdef CO_USE_ASM
+    test_shared_stack();
+#endif
+    test_transfer_to();
+    test_scheduler();
+    test_typed_channel();
+    test_inplace_task();
+    test_co_sync();
+    test_lazy_context();
+    test_cancellation();
+    test_spawn_n();
+    test_reentrancy();
+    test_numa_placement();
+    test_yield_fairness();
     std::println("=== All tests passed! ===");
 }
  
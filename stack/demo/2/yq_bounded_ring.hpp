@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "yq_config.hpp"
+
+namespace yq
+{
+
+/**
+ * 定长的多生产者多消费者环形缓冲区, 每一格带有序号(Vyukov bounded queue)
+ * 不检查满和空: 调用者先通过计数(例如信号量)保证push时有空位, pop时有元素, 之后不需要重试
+ * 同一格上一轮的读写者还没有完成时短暂让出等待, 只会发生在多个线程同时访问时
+ */
+template <typename Ty>
+class BoundedRing {
+	static_assert(std::is_nothrow_move_constructible_v<Ty>,
+				  "BoundedRing elements must be nothrow move constructible");
+
+	struct Cell {
+		std::atomic<std::size_t> m_sequence;
+		alignas(Ty) std::byte m_storage[sizeof(Ty)];
+	};
+
+public:
+	explicit BoundedRing(std::size_t capacity):
+		m_capacity{ capacity }
+	{
+		if (capacity == 0) {
+			CO_THROW(std::invalid_argument{ "BoundedRing capacity must be positive" });
+		}
+		m_cells = std::make_unique<Cell[]>(capacity);
+		for (std::size_t i = 0; i < capacity; ++i) {
+			m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~BoundedRing() {
+		std::size_t head = m_head.load(std::memory_order_relaxed);
+		const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		for (; head != tail; ++head) {
+			value_at(m_cells[head % m_capacity])->~Ty();
+		}
+	}
+
+	BoundedRing(const BoundedRing&) = delete;
+	BoundedRing& operator=(const BoundedRing&) = delete;
+
+	// 调用者保证有空位; 构造不能抛出异常, 否则这一格永远不会就绪
+	template <typename TyRef>
+		requires std::is_nothrow_constructible_v<Ty, TyRef&&>
+	void push(TyRef&& value) noexcept {
+		const std::size_t position = m_tail.fetch_add(1, std::memory_order_relaxed);
+		Cell& cell = m_cells[position % m_capacity];
+		while (cell.m_sequence.load(std::memory_order_acquire) != position) {
+			std::this_thread::yield();
+		}
+		::new (static_cast<void*>(cell.m_storage)) Ty(std::forward<TyRef>(value));
+		cell.m_sequence.store(position + 1, std::memory_order_release);
+	}
+
+	// 调用者保证有元素
+	auto pop() noexcept -> Ty {
+		const std::size_t position = m_head.fetch_add(1, std::memory_order_relaxed);
+		Cell& cell = m_cells[position % m_capacity];
+		while (cell.m_sequence.load(std::memory_order_acquire) != position + 1) {
+			std::this_thread::yield();
+		}
+		Ty* stored = value_at(cell);
+		Ty value{ std::move(*stored) };
+		stored->~Ty();
+		// 下一轮写入这一格的位置
+		cell.m_sequence.store(position + m_capacity, std::memory_order_release);
+		return value;
+	}
+
+	[[nodiscard]]
+	auto capacity() const noexcept -> std::size_t {
+		return m_capacity;
+	}
+
+private:
+	static auto value_at(Cell& cell) noexcept -> Ty* {
+		return std::launder(reinterpret_cast<Ty*>(cell.m_storage));
+	}
+
+	std::size_t m_capacity;
+	std::unique_ptr<Cell[]> m_cells;
+	alignas(64) std::atomic<std::size_t> m_head{ 0 };
+	alignas(64) std::atomic<std::size_t> m_tail{ 0 };
+};
+
+} // namespace yq
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+
+#include "yq_bounded_ring.hpp"
+#include "yq_coroutine.hpp"
+#include "yq_scheduler.hpp"
+
+namespace yq
+{
+
+namespace detail {
+
+// 等待中的协程, 保存在它自己的栈上
+struct CoWaiter {
+	CoWaiter* next{ nullptr };
+	CoWaiter* prev{ nullptr };
+	std::atomic<bool> ready{ false };
+	// Scheduler直接运行的协程在这里挂起, 由release唤醒; 为空时反复yield检查ready
+	Parker* parker{ nullptr };
+};
+
+} // namespace detail
+
+
+/**
+ * 有栈协程的计数信号量, 结构与AsyncSemaphore(no_stack/demo/task/yq_sync.hpp)相同
+ * 不需要排队时只有一次原子操作; 排队时把栈上的节点放入FIFO链表, 等待release交接许可:
+ * Scheduler直接运行的协程通过Parker挂起, 不放回队列, release把它交还给调度器;
+ * 手动resume的协程反复Coroutine::yield, 由resume它的一方继续切入; 在协程外调用时以std::this_thread::yield等待
+ * release不会切换协程, 也不分配内存(Parker作为侵入式节点重新入队), 因此是noexcept
+ * 节点在协程栈上, 不能用于SharedStack上的协程
+ * 等待中的协程被取消时(见BaseCoroutine::set_stop_token)抛出Cancelled, 挂起的协程由stop_callback唤醒,
+ * 节点先从链表中移除再继续展开; 无异常模式下等待不响应取消
+ */
+class CoSemaphore {
+public:
+	explicit CoSemaphore(std::ptrdiff_t initial = 0) noexcept: m_count{ initial } {
+		assert(initial >= 0);
+	}
+
+	CoSemaphore(const CoSemaphore&) = delete;
+	CoSemaphore& operator=(const CoSemaphore&) = delete;
+
+	void acquire() {
+		if (try_acquire()) {
+			return;
+		}
+		std::optional<Parker> parker;
+		detail::CoWaiter waiter;
+		if (Parker::available()) {
+			waiter.parker = &parker.emplace();
+		}
+		if (!enqueue(waiter)) {
+			return;
+		}
+#ifdef CO_NO_EXCEPTIONS
+		wait(waiter);
+#else
+		try {
+			wait(waiter);
+		} catch (...) {
+			abandon(waiter);
+			throw;
+		}
+#endif
+	}
+
+	auto try_acquire() noexcept -> bool {
+		std::ptrdiff_t count = m_count.load(std::memory_order_relaxed);
+		while (count > 0) {
+			if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire,
+											  std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void release() noexcept {
+		while (m_count.fetch_add(1, std::memory_order_acq_rel) < 0) {
+			std::lock_guard lock{ m_mutex };
+			if (detail::CoWaiter* waiter = m_head) {
+				unlink(*waiter);
+				Parker* parker = waiter->parker;
+				// 之后等待者可能立即返回, 不再访问waiter
+				waiter->ready.store(true, std::memory_order_release);
+				// 挂起的等待者只有unpark之后才会恢复; 被取消唤醒时在abandon中等待这把锁
+				if (parker) {
+					parker->unpark();
+				}
+				return;
+			}
+			if (m_cancelled == 0) {
+				++m_wakeups;
+				return;
+			}
+			// 放弃的等待者还占着一次计数, 这次释放抵消它, 许可继续释放
+			--m_cancelled;
+		}
+	}
+
+	void release(std::size_t count) noexcept {
+		while (count-- > 0) {
+			release();
+		}
+	}
+
+	[[nodiscard]]
+	auto available() const noexcept -> std::ptrdiff_t {
+		return std::max<std::ptrdiff_t>(m_count.load(std::memory_order_relaxed), 0);
+	}
+
+private:
+	void wait(detail::CoWaiter& waiter) {
+		if (waiter.parker) {
+#ifndef CO_NO_EXCEPTIONS
+			// 挂起期间不经过yield, 取消时唤醒, 恢复后park抛出Cancelled
+			std::stop_callback on_stop{ BaseCoroutine::current_coroutine()->get_stop_token(),
+				[parker = waiter.parker]() { parker->unpark(); } };
+#endif
+			waiter.parker->park();
+			assert(waiter.ready.load(std::memory_order_acquire));
+			return;
+		}
+		const bool yield_coroutine = BaseCoroutine::in_coroutine();
+		while (!waiter.ready.load(std::memory_order_acquire)) {
+			if (yield_coroutine) {
+				Coroutine::yield();
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// 占用一个许可, 没有时入队; 返回true表示需要等待
+	auto enqueue(detail::CoWaiter& waiter) -> bool {
+		if (m_count.fetch_sub(1, std::memory_order_acq_rel) > 0) {
+			return false;
+		}
+		std::lock_guard lock{ m_mutex };
+		if (m_wakeups > 0) {
+			--m_wakeups;
+			return false;
+		}
+		waiter.prev = m_tail;
+		(m_tail ? m_tail->next : m_head) = &waiter;
+		m_tail = &waiter;
+		return true;
+	}
+
+	void unlink(detail::CoWaiter& waiter) noexcept {
+		(waiter.prev ? waiter.prev->next : m_head) = waiter.next;
+		(waiter.next ? waiter.next->prev : m_tail) = waiter.prev;
+	}
+
+	/**
+	 * 等待的协程被取消, 节点即将随栈展开销毁
+	 * 还在链表中时移除, 它占用的计数留给下一次release抵消; 已经得到许可时还回去
+	 */
+	void abandon(detail::CoWaiter& waiter) noexcept {
+		{
+			std::lock_guard lock{ m_mutex };
+			// ready在release的锁内设置
+			if (!waiter.ready.load(std::memory_order_relaxed)) {
+				unlink(waiter);
+				++m_cancelled;
+				return;
+			}
+		}
+		release();
+	}
+
+	std::atomic<std::ptrdiff_t> m_count;
+	// 以下由m_mutex保护
+	std::mutex m_mutex;
+	detail::CoWaiter* m_head{ nullptr };
+	detail::CoWaiter* m_tail{ nullptr };
+	std::size_t m_wakeups{ 0 };
+	std::size_t m_cancelled{ 0 };
+};
+
+
+// 有栈协程的互斥锁, 满足Lockable, 可以配合std::lock_guard使用
+class CoMutex {
+public:
+	CoMutex() noexcept = default;
+
+	void lock() {
+		m_semaphore.acquire();
+	}
+
+	auto try_lock() noexcept -> bool {
+		return m_semaphore.try_acquire();
+	}
+
+	void unlock() noexcept {
+		m_semaphore.release();
+	}
+
+private:
+	CoSemaphore m_semaphore{ 1 };
+};
+
+
+/**
+ * 有栈协程的有界通道, 与Channel(no_stack/demo/task/yq_sync.hpp)一样由两个信号量和BoundedRing组成
+ * 满时send, 空时recv让出直到对方交接
+ */
+template <typename Ty>
+class CoChannel {
+public:
+	// capacity为0时抛出std::invalid_argument
+	explicit CoChannel(std::size_t capacity):
+		m_ring{ capacity },
+		m_slots{ static_cast<std::ptrdiff_t>(capacity) }
+	{}
+
+	CoChannel(const CoChannel&) = delete;
+	CoChannel& operator=(const CoChannel&) = delete;
+
+	void send(Ty value) {
+		m_slots.acquire();
+		m_ring.push(std::move(value));
+		m_items.release();
+	}
+
+	auto recv() -> Ty {
+		m_items.acquire();
+		Ty value = m_ring.pop();
+		m_slots.release();
+		return value;
+	}
+
+	[[nodiscard]]
+	auto capacity() const noexcept -> std::size_t {
+		return m_ring.capacity();
+	}
+
+private:
+	BoundedRing<Ty> m_ring;
+	CoSemaphore m_slots;
+	CoSemaphore m_items{ 0 };
+};
+
+} // namespace yq
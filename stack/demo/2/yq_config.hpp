@@ -0,0 +1,39 @@
+#pragma once
+
+/**
+ * 协程可能在yield之后被其他线程resume, 而编译器会假设同一个函数内线程不变,
+ * 缓存线程局部变量的地址. 所有线程局部状态都通过CO_TLS_ACCESSOR修饰的访问函数获取,
+ * 保证每次调用都重新计算地址
+ * MSVC还需要使用/GT编译选项
+ */
+#if defined(_MSC_VER)
+#define CO_TLS_ACCESSOR __declspec(noinline)
+#define CO_TLS_BARRIER() _ReadWriteBarrier()
+#else
+#define CO_TLS_ACCESSOR __attribute__((noinline))
+#define CO_TLS_BARRIER() asm volatile("" ::: "memory")
+#endif
+
+/**
+ * 无异常模式, -fno-exceptions(MSVC不带/EHsc)时自动定义, 也可以手动定义
+ * 协程的错误通过std::error_code传递(见BaseCoroutine::error), resume不再检查异常;
+ * 原来抛出的逻辑错误(例如resume已结束的协程)改为输出原因后abort
+ * 无栈协程的头文件通过no_stack/demo/task/yq_error.hpp包含这里, 两边只有这一份定义
+ */
+#if !defined(CO_NO_EXCEPTIONS) && !defined(__cpp_exceptions) && !defined(_CPPUNWIND)
+#define CO_NO_EXCEPTIONS
+#endif
+
+#ifndef CO_THROW
+#ifdef CO_NO_EXCEPTIONS
+#include <cstdio>
+#include <cstdlib>
+#define CO_THROW(...) \
+	do { \
+		std::fprintf(stderr, "%s\n", (__VA_ARGS__).what()); \
+		std::abort(); \
+	} while (false)
+#else
+#define CO_THROW(...) throw __VA_ARGS__
+#endif
+#endif
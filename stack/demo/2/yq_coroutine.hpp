@@ -1,28 +1,148 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
-#include <functional>
 #include <memory>
+#include <new>
+#include <optional>
 #include <stdexcept>
+#include <stop_token>
+#include <system_error>
 #include <tuple>
-#include <vector>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "yq_config.hpp"
+#include "yq_stack.hpp"
+
+#ifdef CO_ENABLE_STATS
+#include "yq_stats.hpp"
+#endif
 
 #if defined(_WIN32)
 
 #include <windows.h>
 #define CO_USE_FIBER
-namespace yq {
+#define CO_ABI_NAMESPACE abi_fiber
+namespace yq::inline CO_ABI_NAMESPACE {
+using CoHandle = void*;
+}
+#elif defined(__unix__) && !defined(CO_USE_UCONTEXT) && \
+	(defined(__x86_64__) || defined(__aarch64__))
+
+// 手写汇编切换, 只保存callee-saved寄存器和浮点控制字, 不经过rt_sigprocmask
+// 定义CO_USE_UCONTEXT可以强制回退到ucontext
+#define CO_USE_ASM
+#define CO_ABI_NAMESPACE abi_asm
+namespace yq::inline CO_ABI_NAMESPACE {
+// 切出时保存的栈顶指针, 寄存器保存在协程自己的栈上
 using CoHandle = void*;
 }
+
+extern "C" {
+/**
+ * 保存当前寄存器到当前栈, 栈顶写入*from, 然后切换到to并恢复寄存器
+ * 只保存callee-saved寄存器和浮点控制字, 布局需要与detail::make_asm_context一致
+ */
+void yq_jump_context(void** from, void* to);
+}
+
+// 每个包含本头文件的翻译单元都输出一份, 放在同名的COMDAT组中, 链接时只保留一份
+// LTO可能把多个翻译单元的汇编合并到同一个文件中, 已经定义过时跳过
+#if defined(__x86_64__)
+asm(R"(
+	.ifndef yq_jump_context
+	.pushsection .text.yq_jump_context,"axG",@progbits,yq_jump_context,comdat
+	.weak yq_jump_context
+	.type yq_jump_context, @function
+	.align 16
+yq_jump_context:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size yq_jump_context, .-yq_jump_context
+	.popsection
+	.endif
+)");
+#elif defined(__aarch64__)
+asm(R"(
+	.ifndef yq_jump_context
+	.pushsection .text.yq_jump_context,"axG",%progbits,yq_jump_context,comdat
+	.weak yq_jump_context
+	.type yq_jump_context, %function
+	.align 4
+yq_jump_context:
+	sub sp, sp, #176
+	stp x19, x20, [sp, #0]
+	stp x21, x22, [sp, #16]
+	stp x23, x24, [sp, #32]
+	stp x25, x26, [sp, #48]
+	stp x27, x28, [sp, #64]
+	stp x29, x30, [sp, #80]
+	stp d8, d9, [sp, #96]
+	stp d10, d11, [sp, #112]
+	stp d12, d13, [sp, #128]
+	stp d14, d15, [sp, #144]
+	mrs x9, fpcr
+	str x9, [sp, #160]
+	mov x9, sp
+	str x9, [x0]
+
+	mov sp, x1
+	ldp x19, x20, [sp, #0]
+	ldp x21, x22, [sp, #16]
+	ldp x23, x24, [sp, #32]
+	ldp x25, x26, [sp, #48]
+	ldp x27, x28, [sp, #64]
+	ldp x29, x30, [sp, #80]
+	ldp d8, d9, [sp, #96]
+	ldp d10, d11, [sp, #112]
+	ldp d12, d13, [sp, #128]
+	ldp d14, d15, [sp, #144]
+	ldr x9, [sp, #160]
+	msr fpcr, x9
+	add sp, sp, #176
+	ret
+	.size yq_jump_context, .-yq_jump_context
+	.popsection
+	.endif
+)");
+#endif
+
 #elif defined(__unix__)
 
 #include <ucontext.h>
-namespace yq {
+#define CO_ABI_NAMESPACE abi_ucontext
+namespace yq::inline CO_ABI_NAMESPACE {
 using CoHandle = ucontext_t;
 }
+#ifndef CO_USE_UCONTEXT
 #define CO_USE_UCONTEXT
+#endif
 
 #else
 #error "Unsupported platform"
@@ -31,9 +151,143 @@ using CoHandle = ucontext_t;
 namespace yq
 {
 
+namespace detail {
+
+#ifdef CO_USE_ASM
+/**
+ * 在栈顶构造初始帧, 使第一次yq_jump_context切入时"返回"到entry
+ * param stack 栈空间起始地址
+ * param size 栈大小
+ * param entry 入口函数, 不能返回
+ * return 初始栈顶指针, 作为协程的句柄
+ */
+inline auto make_asm_context(char* stack, std::size_t size, void (*entry)())
+	-> void* {
+	auto top = reinterpret_cast<std::uintptr_t>(stack + size);
+	top &= ~static_cast<std::uintptr_t>(15);
+	auto* sp = reinterpret_cast<std::uint64_t*>(top);
+#if defined(__x86_64__)
+	// 低地址到高地址: mxcsr|x87控制字, r15, r14, r13, r12, rbx, rbp, 返回地址
+	// 最后一格是entry的伪返回地址, 使entry入口处rsp满足 rsp % 16 == 8
+	*--sp = 0;
+	*--sp = reinterpret_cast<std::uint64_t>(entry);
+	for (int i = 0; i < 6; ++i) {
+		*--sp = 0;
+	}
+	// mxcsr = 0x1F80, x87控制字 = 0x037F, 均为默认值
+	*--sp = (std::uint64_t{0x037F} << 32) | std::uint64_t{0x1F80};
+#elif defined(__aarch64__)
+	// x19-x28, x29, x30, d8-d15, fpcr, 共176字节, sp保持16字节对齐
+	sp -= 22;
+	for (int i = 0; i < 22; ++i) {
+		sp[i] = 0;
+	}
+	// x30(lr)
+	sp[11] = reinterpret_cast<std::uint64_t>(entry);
+#endif
+	return sp;
+}
+
+/**
+ * 拷贝共享栈的内容
+ * 栈上带有ASan为栈帧设置的标记, 开启ASan时逐字节拷贝并绕开检查
+ */
+#ifdef __SANITIZE_ADDRESS__
+__attribute__((no_sanitize_address))
+inline void copy_stack(char* dst, const char* src, std::size_t size) noexcept {
+	auto* volatile out = dst;
+	for (std::size_t i = 0; i < size; ++i) {
+		out[i] = src[i];
+	}
+}
+#else
+inline void copy_stack(char* dst, const char* src, std::size_t size) noexcept {
+	std::memcpy(dst, src, size);
+}
+#endif
+#endif
+
+// yield的返回值: 没有参数时为void, 一个参数时为该类型, 多个参数时为tuple
+template <typename... In>
+struct received {
+	using type = std::tuple<In...>;
+};
+
+template <>
+struct received<> {
+	using type = void;
+};
+
+template <typename In>
+struct received<In> {
+	using type = In;
+};
+
+} // namespace detail
+
+/**
+ * 协程被取消时yield抛出的异常(见BaseCoroutine::set_stop_token)
+ * 展开协程栈后在协程入口处吸收, 不会传给resume的调用者; 协程中捕获后应当重新抛出
+ */
+struct Cancelled : std::exception {
+	auto what() const noexcept -> const char* override {
+		return "coroutine cancelled";
+	}
+};
+
+
+/**
+ * 协程类的布局随切换方式变化, 放在按切换方式命名的内联命名空间中
+ * 同一程序中不同的翻译单元可以使用不同的切换方式(例如基准测试同时链接asm和ucontext),
+ * 不会违反ODR; 对使用者来说仍然是yq::Coroutine. 与切换方式无关的辅助函数在yq::detail中
+ */
+inline namespace CO_ABI_NAMESPACE
+{
+
 template <typename... Args>
 class VarCoroutine;
 
+class BaseCoroutine;
+
+#ifdef CO_USE_ASM
+/**
+ * 共享执行栈, 类似libco的copy-stack
+ * 同一线程上使用它的协程都在这块栈上运行, 换出时只把已使用的部分拷贝到协程自己的缓冲区
+ * 共享栈上的局部变量不能被别的协程通过指针访问, 换出后该地址上是其他协程的数据,
+ * 因此在共享栈协程内创建的子协程如果也使用同一块共享栈, 子协程对象需要放在堆上
+ * 需要比使用它的协程活得更久, 只能在一个线程内使用
+ */
+class SharedStack {
+	friend BaseCoroutine;
+	template<typename ...Args>
+	friend class VarCoroutine;
+public:
+	explicit SharedStack(std::size_t size,
+						 StackAllocator& allocator = default_stack_allocator()):
+		m_allocator{ &allocator },
+		m_stack{ allocator.allocate(size) }
+	{}
+
+	~SharedStack() {
+		m_allocator->deallocate(m_stack);
+	}
+
+	SharedStack(const SharedStack&) = delete;
+	SharedStack& operator=(const SharedStack&) = delete;
+
+private:
+	auto top() const noexcept -> char* {
+		auto top = reinterpret_cast<std::uintptr_t>(m_stack.base + m_stack.size);
+		return reinterpret_cast<char*>(top & ~static_cast<std::uintptr_t>(15));
+	}
+
+	StackAllocator* m_allocator;
+	Stack m_stack;
+	// 栈上当前是哪个协程的数据
+	BaseCoroutine* m_occupant{ nullptr };
+};
+#endif
+
 class BaseCoroutine {
 	template<typename ...Args>
 	friend class VarCoroutine;
@@ -43,29 +297,358 @@ public:
 	virtual void call_task() = 0;
 	[[nodiscard]]
 	auto is_finished() const -> bool {
+#ifndef CO_NO_EXCEPTIONS
 		check_exception();
+#endif
 		return m_finished;
 	}
 
+	/**
+	 * 任务函数返回的std::error_code, 返回其他类型或还没有结束时为空
+	 * 无异常模式下协程通过它报告失败
+	 */
+	[[nodiscard]]
+	auto error() const noexcept -> std::error_code {
+		return m_error;
+	}
+
+#ifndef CO_NO_EXCEPTIONS
 	virtual void check_exception() const {
-		if (m_excepted) {
+		if (m_excepted) [[unlikely]] {
 			std::rethrow_exception(m_excepted);
 		}
 	}
+#endif
+
+#ifdef CO_ENABLE_STATS
+	// 时间片的名字, 需要比导出活得更久(例如字符串字面量), 见yq_stats.hpp
+	void set_name(const char* name) noexcept {
+		m_stats.set_name(name);
+	}
+#endif
+
+	// 当前线程是否正在某个协程中运行, 即能否yield
+	[[nodiscard]]
+	static auto in_coroutine() noexcept -> bool {
+		return running() != root();
+	}
+
+	// 当前线程上正在运行的协程, 不在协程中时为nullptr
+	[[nodiscard]]
+	static auto current_coroutine() noexcept -> BaseCoroutine* {
+		BaseCoroutine* co = running();
+		return co == root() ? nullptr : co;
+	}
+
+	/**
+	 * 协作式取消: token被请求停止后, 协程中下一次yield抛出Cancelled, 栈上的对象照常析构, 协程以cancelled()结束
+	 * 无异常模式下yield照常返回, 协程通过stop_requested()检查后自行返回
+	 * 只能在协程没有运行时设置
+	 */
+	void set_stop_token(std::stop_token token) noexcept {
+		m_stop_token = std::move(token);
+	}
+
+	[[nodiscard]]
+	auto get_stop_token() const noexcept -> const std::stop_token& {
+		return m_stop_token;
+	}
+
+	// 当前协程是否被请求取消, 不在协程中时为false
+	[[nodiscard]]
+	static auto stop_requested() noexcept -> bool {
+		return running()->m_stop_token.stop_requested();
+	}
+
+	// 是否在请求取消之后结束
+	[[nodiscard]]
+	auto cancelled() const noexcept -> bool {
+		return m_cancelled;
+	}
+
+	// 是否已经切入过, 没有开始的协程还没有分配栈
+	[[nodiscard]]
+	auto is_started() const noexcept -> bool {
+		return m_context_ready;
+	}
+
+	/**
+	 * 对称切换: 当前协程挂起, 直接切换到target, 不经过调用者
+	 * target接替当前协程在调用链中的位置, target yield时回到当前协程的调用者
+	 * 当前协程之后可以被任何人resume或transfer_to
+	 */
+	static void transfer_to(BaseCoroutine& target) {
+		BaseCoroutine* current = running();
+		if (current == root()) {
+			CO_THROW(std::logic_error{"not in coroutine"});
+		}
+#ifndef CO_NO_EXCEPTIONS
+		target.check_exception();
+#endif
+		if (target.m_finished) {
+			CO_THROW(std::logic_error{"coroutine finished"});
+		}
+		if (&target == current) {
+			return;
+		}
+		target.check_not_running();
+		if (!target.m_context_ready) [[unlikely]] {
+			target.prepare_context();
+		}
+		target.m_caller = std::exchange(current->m_caller, nullptr);
+		set_running(&target);
+		switch_context(*current, target);
+	}
 
 protected:
-	// co_list第一个元素
+	// 第一次切入前分配栈并构造上下文
+	virtual void prepare_context() = 0;
+
+	// 不能切入正在运行的协程, 或者在调用链上等待它切入的协程返回的协程
+	void check_not_running() const {
+		if (m_caller) [[unlikely]] {
+			CO_THROW(std::logic_error{"coroutine already running"});
+		}
+	}
+
+	// 代表线程本身的上下文, 调用链的起点
 	static thread_local VarCoroutine<> co_root;
-	// 协程调用栈
-	static thread_local std::vector<BaseCoroutine*> co_list;
-	// 当前运行的context
-	static inline thread_local std::size_t co_cur_index{0};
+	/**
+	 * 正在运行的协程, 不在协程中时为co_root
+	 * 调用链由每个协程的m_caller串起来: resume时指向调用者, yield或结束时清空
+	 * 不在堆上分配, 协程可以按任意顺序创建和析构, 也可以在任何地方resume
+	 */
+	static thread_local BaseCoroutine* co_running;
+
+	// 线程局部变量只通过以下函数访问, 见CO_TLS_ACCESSOR
+	CO_TLS_ACCESSOR static auto running() noexcept -> BaseCoroutine* {
+		CO_TLS_BARRIER();
+		return co_running;
+	}
+
+	CO_TLS_ACCESSOR static void set_running(BaseCoroutine* co) noexcept {
+		CO_TLS_BARRIER();
+		co_running = co;
+	}
+
+	// co_root的类型在VarCoroutine之后才完整, 定义在后面
+	static auto root() noexcept -> BaseCoroutine*;
 
 	// 协程的句柄
 	CoHandle m_handle{};
+	// 切入它的协程, 只在调用链上时非空, 同时用于检查重入
+	BaseCoroutine* m_caller{ nullptr };
 	// 协程是否结束
 	bool m_finished { false };
+	// 栈和上下文是否已经构造, 见prepare_context
+	bool m_context_ready { false };
+	bool m_cancelled { false };
+	std::error_code m_error;
+	std::stop_token m_stop_token;
+#ifndef CO_NO_EXCEPTIONS
 	std::exception_ptr m_excepted { nullptr };
+#endif
+
+#ifdef CO_ENABLE_STATS
+	stats::CoStats m_stats;
+
+	// 离开from, 进入to; co_root不计数
+	static void record_switch(BaseCoroutine& from, BaseCoroutine& to) noexcept {
+		const BaseCoroutine* thread = root();
+		const std::uint64_t now = stats::now();
+		if (&from != thread) {
+			from.m_stats.end_slice(now);
+		}
+		if (&to != thread) {
+			to.m_stats.begin_slice(now);
+		}
+	}
+#endif
+
+#ifdef __SANITIZE_ADDRESS__
+	/**
+	 * 协程栈的范围, 切换时通过__sanitizer_start_switch_fiber告知ASan
+	 * 否则ASan不知道当前在哪个栈上, 协程中抛出异常时无法清除残留的栈帧标记
+	 * co_root的栈范围在线程第一次切换时得到
+	 */
+	const void* m_asan_bottom{ nullptr };
+	std::size_t m_asan_size{ 0 };
+
+	static void asan_start_switch(void** fake_stack, const void* bottom,
+								  std::size_t size) noexcept {
+		__sanitizer_start_switch_fiber(fake_stack, bottom, size);
+	}
+
+	static void asan_finish_switch(void* fake_stack) noexcept {
+		const void* bottom = nullptr;
+		std::size_t size = 0;
+		__sanitizer_finish_switch_fiber(fake_stack, &bottom, &size);
+		BaseCoroutine* thread = root();
+		if (!thread->m_asan_bottom) {
+			thread->m_asan_bottom = bottom;
+			thread->m_asan_size = size;
+		}
+	}
+#endif
+
+#ifndef CO_NO_EXCEPTIONS
+	// yield挂起前和恢复后检查, 没有设置token时只是一次空指针判断
+	static void throw_if_stop_requested() {
+		if (stop_requested()) [[unlikely]] {
+			throw Cancelled{};
+		}
+	}
+#endif
+
+	// 从当前协程回到调用链的上一级
+	static void switch_to_caller() {
+		BaseCoroutine* current = running();
+		BaseCoroutine* caller = std::exchange(current->m_caller, nullptr);
+		set_running(caller);
+		switch_context(*current, *caller);
+	}
+
+#ifndef CO_USE_ASM
+	static void switch_context([[maybe_unused]] BaseCoroutine& from,
+							   BaseCoroutine& to) {
+#ifdef CO_ENABLE_STATS
+		record_switch(from, to);
+#endif
+#ifdef CO_USE_FIBER
+		SwitchToFiber(to.m_handle);
+#else
+#ifdef __SANITIZE_ADDRESS__
+		void* fake_stack = nullptr;
+		asan_start_switch(&fake_stack, to.m_asan_bottom, to.m_asan_size);
+#endif
+		// 保存当前上下文到param1, 切换到协程上下文param2
+		swapcontext(&from.m_handle, &to.m_handle);
+#ifdef __SANITIZE_ADDRESS__
+		asan_finish_switch(fake_stack);
+#endif
+#endif
+	}
+#else
+	/**
+	 * 从from切换到to
+	 * 如果to使用共享栈且栈上不是它的内容, 先切到拷贝上下文, 在不使用共享栈的地方完成换出和换入
+	 */
+	static void switch_context(BaseCoroutine& from, BaseCoroutine& to) {
+#ifdef CO_ENABLE_STATS
+		record_switch(from, to);
+#endif
+#ifdef __SANITIZE_ADDRESS__
+		void* fake_stack = nullptr;
+#endif
+		if (to.m_shared && to.m_shared->m_occupant != &to) {
+			auto& copier = copier_context();
+			if (!copier.m_handle) {
+				copier.m_stack = HeapStackAllocator{}.allocate(copier_stack_size);
+				copier.m_handle = detail::make_asm_context(
+					copier.m_stack.base, copier.m_stack.size, copier_entry);
+			}
+			copier.m_target = &to;
+#ifdef __SANITIZE_ADDRESS__
+			asan_start_switch(&fake_stack, copier.m_stack.base, copier.m_stack.size);
+#endif
+			yq_jump_context(&from.m_handle, copier.m_handle);
+		} else {
+#ifdef __SANITIZE_ADDRESS__
+			asan_start_switch(&fake_stack, to.m_asan_bottom, to.m_asan_size);
+#endif
+			yq_jump_context(&from.m_handle, to.m_handle);
+		}
+#ifdef __SANITIZE_ADDRESS__
+		asan_finish_switch(fake_stack);
+#endif
+	}
+
+	// 把共享栈上[m_handle, top)的内容拷贝到自己的缓冲区
+	void save_shared_stack() {
+		char* sp = static_cast<char*>(m_handle);
+		std::size_t used = static_cast<std::size_t>(m_shared->top() - sp);
+		reserve_saved(used);
+		detail::copy_stack(m_saved.get(), sp, used);
+		m_saved_size = used;
+#ifdef CO_ENABLE_STATS
+		m_stats.note_stack(used);
+#endif
+	}
+
+	void restore_shared_stack() noexcept {
+		detail::copy_stack(static_cast<char*>(m_handle), m_saved.get(), m_saved_size);
+	}
+
+	// 缓冲区按实际使用量分配, 用量明显下降时收缩
+	void reserve_saved(std::size_t size) {
+		if (size > m_saved_capacity || size < m_saved_capacity / 4) {
+			m_saved = std::make_unique_for_overwrite<char[]>(size);
+			m_saved_capacity = size;
+		}
+	}
+
+	// 共享栈模式下使用的栈, 为空表示使用独立栈
+	SharedStack* m_shared{ nullptr };
+	// 换出时保存的栈内容
+	std::unique_ptr<char[]> m_saved;
+	std::size_t m_saved_size{ 0 };
+	std::size_t m_saved_capacity{ 0 };
+
+private:
+	// 共享栈的拷贝上下文, 运行在自己的小栈上
+	// 线程局部变量的析构顺序不确定, 不使用线程局部的栈池
+	// 嵌套类的默认成员初始化器在外层类结束前不可用, 这里使用构造函数初始化
+	struct Copier {
+		Copier() noexcept: m_stack{}, m_handle{ nullptr }, m_target{ nullptr } {}
+
+		~Copier() {
+			if (m_stack.base) {
+				HeapStackAllocator{}.deallocate(m_stack);
+			}
+		}
+
+		Stack m_stack;
+		void* m_handle;
+		BaseCoroutine* m_target;
+	};
+
+	static void copier_entry() {
+		// 拷贝上下文不会跨线程, 可以缓存
+		auto& copier = copier_context();
+		for (;;) {
+#ifdef __SANITIZE_ADDRESS__
+			asan_finish_switch(nullptr);
+#endif
+			BaseCoroutine* target = copier.m_target;
+			SharedStack& stack = *target->m_shared;
+			// 此时占用者已经切出, m_handle就是它最终的栈顶
+			if (stack.m_occupant) {
+				stack.m_occupant->save_shared_stack();
+			}
+			target->restore_shared_stack();
+#ifdef __SANITIZE_ADDRESS__
+			// 栈上残留的是其他协程栈帧的标记
+			__asan_unpoison_memory_region(stack.m_stack.base,
+				static_cast<std::size_t>(stack.top() - stack.m_stack.base));
+#endif
+			stack.m_occupant = target;
+#ifdef __SANITIZE_ADDRESS__
+			void* fake_stack = nullptr;
+			asan_start_switch(&fake_stack, target->m_asan_bottom, target->m_asan_size);
+#endif
+			yq_jump_context(&copier.m_handle, target->m_handle);
+		}
+	}
+
+	static constexpr std::size_t copier_stack_size = 64 * 1024;
+	// 拷贝上下文, 每个线程一个
+	static inline thread_local Copier co_copier;
+
+	CO_TLS_ACCESSOR static auto copier_context() noexcept -> Copier& {
+		CO_TLS_BARRIER();
+		return co_copier;
+	}
+#endif
 };
 
 
@@ -73,16 +656,58 @@ template <typename... Args>
 class VarCoroutine : public BaseCoroutine {
 	friend BaseCoroutine;
 
+	/**
+	 * 任务函数和参数保存在一起, 类型在构造时确定, 通过函数指针调用和析构
+	 * 不超过inline_task_size时放在协程对象内, 创建协程不分配内存; 否则放在堆上
+	 * 栈在第一次resume时才分配, 没有运行过的协程不会访问栈
+	 */
+	template <typename Fn>
+	struct TaskStorage {
+		template <typename FnRef, typename... ArgsRef>
+		explicit TaskStorage(FnRef&& fn, ArgsRef&&... args):
+			m_fn{std::forward<FnRef>(fn)},
+			m_args{std::forward<ArgsRef>(args)...}
+		{}
+
+		// 任务函数的返回值可以转换为std::error_code时作为协程的error()
+		static auto invoke(void* self) -> std::error_code {
+			auto* storage = static_cast<TaskStorage*>(self);
+			using Result = std::invoke_result_t<Fn&, Args&...>;
+			if constexpr (std::is_convertible_v<Result, std::error_code>) {
+				return std::apply(storage->m_fn, storage->m_args);
+			} else {
+				std::apply(storage->m_fn, storage->m_args);
+				return {};
+			}
+		}
+
+		static void destroy(void* self) noexcept {
+			static_cast<TaskStorage*>(self)->~TaskStorage();
+		}
+
+		static void destroy_heap(void* self) noexcept {
+			delete static_cast<TaskStorage*>(self);
+		}
+
+		Fn m_fn;
+		std::tuple<Args...> m_args;
+	};
+
+	// fn可以用保存的参数(左值)调用, 参数可以由args构造, 未给出的参数值初始化
+	// conjunction短路求值, 避免在检查拷贝/移动构造时递归
+	template <typename Fn, typename... ArgsRef>
+	static constexpr bool valid_task = std::conjunction_v<
+		std::is_invocable<std::decay_t<Fn>&, Args&...>,
+		std::is_constructible<std::decay_t<Fn>, Fn&&>,
+		std::is_constructible<std::tuple<Args...>, ArgsRef&&...>>;
+
 private:
-	// 提供给co_list使用
+	// 提供给co_root使用
 	VarCoroutine():
 		BaseCoroutine(),
-		m_cur_index{0}, m_stack_size{0}, m_task{}
-#ifdef CO_USE_UCONTEXT
-		  ,
-		  m_stack{nullptr}
-#endif
+		m_stack_size{0}, m_allocator{nullptr}
 	{
+		m_context_ready = true;
 		// 对于ucontext, 不在这里初始化. swap时会接受上下文
 #ifdef CO_USE_FIBER
 		m_handle = ConvertThreadToFiber(nullptr);
@@ -93,52 +718,68 @@ private:
 	}
 
 public:
-	template <typename... ArgsRef>
-	VarCoroutine(std::size_t stack_size, std::function<void(Args...)> task,
-			  ArgsRef&&... args)
-		: BaseCoroutine(), m_cur_index{co_list.size()}, m_stack_size{stack_size},
-		  m_task{std::move(task)},
-		  m_func_args{std::forward<ArgsRef>(args)...}
-#ifdef CO_USE_UCONTEXT
-		  ,
-		  m_stack{std::make_unique<char[]>(m_stack_size)}
-#endif
+	/**
+	 * 只保存任务函数, 栈和上下文在第一次resume(或transfer_to)时构造, 分配失败在那时抛出
+	 * param allocator 栈分配器, 需要比协程活得更久. Fiber由系统分配栈, 忽略此参数
+	 */
+	template <typename Fn, typename... ArgsRef>
+		requires valid_task<Fn, ArgsRef...>
+	VarCoroutine(StackAllocator& allocator, std::size_t stack_size,
+			  Fn&& task, ArgsRef&&... args)
+		: BaseCoroutine(), m_stack_size{stack_size},
+		  m_allocator{&allocator}
 	{
-		assert(co_list.size() >= 1);
-#ifdef CO_USE_FIBER
-		m_handle = CreateFiber(m_stack_size, context_entry, this);
-#else
-		// 当前上下文作为初始化模版
-		getcontext(&m_handle);
-		// 设置栈空间
-		m_handle.uc_stack.ss_size = m_stack_size;
-		m_handle.uc_stack.ss_sp = m_stack.get();
-		// 设置执行结束后返回的上下文
-		assert(m_cur_index > 0);
-		m_handle.uc_link = &co_list[m_cur_index-1]->m_handle;
-		// 设置入口函数, 函数无参数
-		makecontext(&m_handle, context_entry, 0);
+		emplace_task(std::forward<Fn>(task), std::forward<ArgsRef>(args)...);
+#ifdef CO_STACK_WATERMARK
+		m_site = &stack_site_of<std::decay_t<Fn>>;
 #endif
-		co_list.push_back(this);
-		co_cur_index = m_cur_index - 1;
 	}
 
-	template <typename... ArgsRef>
-	VarCoroutine(std::function<void(Args...)> task, 
-			  ArgsRef&&... args):
-		VarCoroutine(2 * 1024 * 1024, task, std::forward<ArgsRef>(args)...) {}
+#ifdef CO_USE_ASM
+	/**
+	 * 共享栈模式, 协程运行在stack上, 切出时只保存实际使用的部分
+	 */
+	template <typename Fn, typename... ArgsRef>
+		requires valid_task<Fn, ArgsRef...>
+	VarCoroutine(SharedStack& stack, Fn&& task, ArgsRef&&... args)
+		: BaseCoroutine(), m_stack_size{0},
+		  m_allocator{nullptr}
+	{
+		emplace_task(std::forward<Fn>(task), std::forward<ArgsRef>(args)...);
+		m_shared = &stack;
+	}
+#endif
+
+	template <typename Fn, typename... ArgsRef>
+		requires valid_task<Fn, ArgsRef...>
+	VarCoroutine(std::size_t stack_size, Fn&& task, ArgsRef&&... args):
+		VarCoroutine(default_stack_allocator(), stack_size, std::forward<Fn>(task),
+					 std::forward<ArgsRef>(args)...) {}
+
+	template <typename Fn, typename... ArgsRef>
+		requires valid_task<Fn, ArgsRef...>
+	VarCoroutine(Fn&& task, ArgsRef&&... args):
+		VarCoroutine(2 * 1024 * 1024, std::forward<Fn>(task),
+					 std::forward<ArgsRef>(args)...) {}
 
 	~VarCoroutine() {
-		// co_list比co_root早析构，所以需要判断是否为co_root
+		// 线程退出时co_root也会析构
 		if (this != static_cast<void*>(&co_root)) {
+			// 不能析构调用链上的协程
+			assert(!m_caller);
 #ifdef CO_USE_FIBER
-			DeleteFiber(m_handle);
+			destroy_task();
+			if (m_handle) {
+				DeleteFiber(m_handle);
+			}
+#else
+			release_stack();
+#endif
+#ifdef CO_USE_ASM
+			if (m_shared && m_shared->m_occupant == this) {
+				m_shared->m_occupant = nullptr;
+			}
 #endif
-			assert(co_list.size() >= 1);
-			assert(co_list.back() == this);
-			co_list.pop_back();
-			assert(!co_list.empty());
-			co_cur_index = m_cur_index - 1;
 		}
 	}
 
@@ -146,101 +787,452 @@ public:
 	VarCoroutine& operator=(const VarCoroutine&) = delete;
 
 	void resume() override {
+#ifndef CO_NO_EXCEPTIONS
 		check_exception();
+#endif
 		if (m_finished) {
-			throw std::logic_error{"coroutine finished"};
+			CO_THROW(std::logic_error{"coroutine finished"});
 			return;
 		}
-		assert(co_list[m_cur_index] == this);
+		check_not_running();
+		if (!m_context_ready) [[unlikely]] {
+			prepare_context();
+		}
+		BaseCoroutine* caller = running();
+		m_caller = caller;
+		set_running(this);
+		switch_context(*caller, *this);
+#ifndef CO_USE_FIBER
+		// 协程已经切换出自己的栈, 结束后立即归还, 不必等到析构
+		if (m_finished) {
+			release_stack();
+		}
+#endif
+	}
 
-		co_cur_index = m_cur_index;
-#ifdef CO_USE_FIBER
-		SwitchToFiber(m_handle);
-#else
-		// 保存当前上下文到param1, 切换到协程上下文param2
-		swapcontext(&co_list[m_cur_index-1]->m_handle, &m_handle);
+#ifdef CO_ENABLE_STATS
+	/**
+	 * 切入次数, 累计运行时间和最长的一次运行(TSC计数, 见stats::ticks_to_ns), 以及栈的最大深度
+	 * 独立栈的深度即stack_high_water(), 共享栈为换出时保存的最大长度
+	 */
+	[[nodiscard]]
+	auto stats() const noexcept -> stats::CoroutineSnapshot {
+		return m_stats.snapshot(stack_high_water());
+	}
+#endif
+
+#ifdef CO_STACK_WATERMARK
+	/**
+	 * 栈的最大使用量(字节), 最多为CO_STACK_PAINT_BYTES
+	 * 运行中扫描当前的栈; 结束后栈已经归还, 返回归还时的结果. 没有运行过的协程, Fiber和共享栈为0
+	 */
+	[[nodiscard]]
+	auto stack_high_water() const noexcept -> std::size_t {
+#ifndef CO_USE_FIBER
+		if (m_stack.base) {
+			return yq::stack_high_water(m_stack);
+		}
 #endif
+		return m_high_water;
 	}
 
-	// 通过current访问当前协程
+	// 创建位置的汇总, Fiber和共享栈为空
+	[[nodiscard]]
+	auto stack_site() const noexcept -> const StackSite* {
+		return m_site;
+	}
+#endif
+
+	// 回到当前协程的调用者
 	static void yield() {
 		// 检查是否在一个协程上下文中
-		if (co_list.size() <= 1 || co_cur_index == 0) {
-			throw std::logic_error{"not in coroutine or coroutine finished"};
+		if (!in_coroutine()) {
+			CO_THROW(std::logic_error{"not in coroutine or coroutine finished"});
 		}
-
-		std::size_t ori_index = co_cur_index;
-		co_cur_index -= 1;
-#ifdef CO_USE_FIBER
-		// 切换到当前fiber上一层的fiber
-		SwitchToFiber(co_list[ori_index - 1]->m_handle);
+#ifdef CO_NO_EXCEPTIONS
+		switch_to_caller();
 #else
-		// 保存当前上下文到param1, 切换到协程上下文param2
-		swapcontext(&co_list[ori_index]->m_handle,
-					&co_list[ori_index - 1]->m_handle);
+		throw_if_stop_requested();
+		switch_to_caller();
+		throw_if_stop_requested();
 #endif
 	}
 
 private:
 
 	virtual void call_task() override {
-		std::apply(m_task, m_func_args);
+		m_error = m_invoke(m_task);
+	}
+
+	template <typename Fn, typename... ArgsRef>
+	void emplace_task(Fn&& task, ArgsRef&&... args) {
+		using Storage = TaskStorage<std::decay_t<Fn>>;
+		if constexpr (sizeof(Storage) <= inline_task_size &&
+					  alignof(Storage) <= alignof(std::max_align_t)) {
+			m_task = ::new (static_cast<void*>(m_inline_task))
+				Storage(std::forward<Fn>(task), std::forward<ArgsRef>(args)...);
+			m_destroy = &Storage::destroy;
+		} else {
+			m_task = new Storage(std::forward<Fn>(task), std::forward<ArgsRef>(args)...);
+			m_destroy = &Storage::destroy_heap;
+		}
+		m_invoke = &Storage::invoke;
 	}
 
+	void prepare_context() override {
+#ifdef CO_USE_FIBER
+		// 只保留stack_size的地址空间, 按需提交, 系统负责设置保护页
+		m_handle = CreateFiberEx(0, m_stack_size, 0, context_entry, this);
+		if (!m_handle) {
+			CO_THROW(std::bad_alloc{});
+		}
+#else
+#ifdef CO_USE_ASM
+		if (m_shared) {
+#ifdef __SANITIZE_ADDRESS__
+			m_asan_bottom = m_shared->m_stack.base;
+			m_asan_size = m_shared->m_stack.size;
+#endif
+			// 初始帧先构造在临时缓冲区, 切入时由拷贝上下文换入共享栈顶
+			alignas(16) char frame[256];
+			char* sp = static_cast<char*>(
+				detail::make_asm_context(frame, sizeof(frame), context_entry));
+			std::size_t used = static_cast<std::size_t>(frame + sizeof(frame) - sp);
+			reserve_saved(used);
+			std::memcpy(m_saved.get(), sp, used);
+			m_saved_size = used;
+			m_handle = m_shared->top() - used;
+			m_context_ready = true;
+			return;
+		}
+#endif
+#ifdef CO_STACK_WATERMARK
+		m_stack = m_allocator->allocate_for(*m_site, m_stack_size);
+		paint_stack(m_stack);
+#else
+		m_stack = m_allocator->allocate(m_stack_size);
+#endif
+#ifdef __SANITIZE_ADDRESS__
+		m_asan_bottom = m_stack.base;
+		m_asan_size = m_stack.size;
+#endif
+#ifdef CO_USE_ASM
+		m_handle = detail::make_asm_context(m_stack.base, m_stack.size, context_entry);
+#elif defined(CO_USE_UCONTEXT)
+		// 当前上下文作为初始化模版
+		getcontext(&m_handle);
+		// 设置栈空间
+		m_handle.uc_stack.ss_size = m_stack.size;
+		m_handle.uc_stack.ss_sp = m_stack.base;
+		// 调用者在resume时才确定, 结束时在context_entry中手动切换, 不使用uc_link
+		m_handle.uc_link = nullptr;
+		// 设置入口函数, 函数无参数
+		makecontext(&m_handle, context_entry, 0);
+#endif
+#endif
+		m_context_ready = true;
+	}
+
+	void destroy_task() noexcept {
+		if (m_task) {
+			m_destroy(m_task);
+			m_task = nullptr;
+		}
+	}
+
+#ifndef CO_USE_FIBER
+	// 先归还栈再析构任务函数, 任务函数可能持有栈分配器(见Scheduler::spawn_n)
+	void release_stack() noexcept {
+		if (m_stack.base) {
+#ifdef CO_STACK_WATERMARK
+			// 栈归还之后无法再扫描
+			m_high_water = yq::stack_high_water(m_stack);
+			m_site->record(m_high_water);
+#endif
+			m_allocator->deallocate(m_stack);
+			m_stack = Stack{};
+		}
+		destroy_task();
+#ifdef CO_USE_ASM
+		m_saved.reset();
+		m_saved_size = 0;
+		m_saved_capacity = 0;
+#endif
+	}
+#endif
+
 #ifdef CO_USE_FIBER
 	/**
 	 * param param 创建Fiber时传入的参数(this指针), 也可以用m_current访问
 	 */
 	static void CALLBACK context_entry(void* param) {
 		auto* co_current = static_cast<BaseCoroutine*>(param);
-		assert(!co_list.empty());
-		assert(co_cur_index == co_list.size() - 1);
-		assert(co_list.back() == param);
+		assert(in_coroutine());
+#ifdef CO_NO_EXCEPTIONS
+		co_current->call_task();
+#else
 		try {
 			co_current->call_task();
+		} catch (const Cancelled&) {
+			// 取消展开了协程栈, 不算作失败; 没有请求取消时照常保存
+			if (!co_current->m_stop_token.stop_requested()) {
+				co_current->m_excepted = std::current_exception();
+			}
 		} catch (...) {
 			co_current->m_excepted = std::current_exception();
 			co_current->m_finished = true;
 		}
+#endif
+		co_current->m_cancelled = co_current->m_stop_token.stop_requested();
 		co_current->m_finished = true;
 		// 切换回上一级
-		SwitchToFiber(co_list[co_current->co_cur_index - 1]->m_handle);
-		// co_cur_index 已经在析构函数中更新
+		switch_to_caller();
 	}
 
 #else
 	static void context_entry(){
-		assert(co_list.size() > 1);
-		assert(co_cur_index == co_list.size() - 1);
-		auto* co_current = co_list.back();
+#ifdef __SANITIZE_ADDRESS__
+		asan_finish_switch(nullptr);
+#endif
+		assert(in_coroutine());
+		auto* co_current = running();
+#ifdef CO_NO_EXCEPTIONS
+		co_current->call_task();
+#else
 		try {
 			co_current->call_task();
+		} catch (const Cancelled&) {
+			// 取消展开了协程栈, 不算作失败; 没有请求取消时照常保存
+			if (!co_current->m_stop_token.stop_requested()) {
+				co_current->m_excepted = std::current_exception();
+			}
 		} catch (...) {
 			co_current->m_excepted = std::current_exception();
 			co_current->m_finished = true;
 		}
+#endif
+		co_current->m_cancelled = co_current->m_stop_token.stop_requested();
 		co_current->m_finished = true;
-		// 函数返回时， 使用uc_link中设置的上下文，切换回主函数
-		// co_cur_index 已经在析构函数中更新
+#ifdef CO_USE_ASM
+		// 当前栈上的内容不再需要保存
+		if (co_current->m_shared) {
+			co_current->m_shared->m_occupant = nullptr;
+		}
+#endif
+		// 手动切换回上一级
+		switch_to_caller();
+		// 已结束的协程不会再被切换回来
+		std::abort();
 	}
 
 #endif
 
 private:
-	// 当前协程在co_list中的索引
-	std::size_t m_cur_index;
+	// 放在协程对象内的任务函数的最大大小, 覆盖常见的lambda和VarCoroutine<Out(In...)>的包装
+	static constexpr std::size_t inline_task_size = 64;
+
 	// 栈大小
 	std::size_t m_stack_size;
-	// 任务函数
-	std::function<void(Args...)> m_task;
-	// 回调函数参数
-	std::tuple<Args...> m_func_args;
-#ifdef CO_USE_UCONTEXT
+	// 任务函数和参数, 见TaskStorage
+	void* m_task{ nullptr };
+	auto (*m_invoke)(void*) -> std::error_code { nullptr };
+	void (*m_destroy)(void*) noexcept { nullptr };
+	// 栈分配器
+	StackAllocator* m_allocator;
+#ifndef CO_USE_FIBER
 	// 栈空间
-	std::unique_ptr<char[]> m_stack;
+	Stack m_stack;
+#endif
+#ifdef CO_STACK_WATERMARK
+	StackSite* m_site{ nullptr };
+	std::size_t m_high_water{ 0 };
 #endif
+	alignas(std::max_align_t) std::byte m_inline_task[inline_task_size];
 };
 
+// 类型推导, 例如VarCoroutine co(func, 1, std::string{"a"})推导为VarCoroutine<int, std::string>
+template <typename Fn, typename... ArgsRef>
+	requires std::is_invocable_v<std::decay_t<Fn>&, std::decay_t<ArgsRef>&...>
+VarCoroutine(Fn&&, ArgsRef&&...) -> VarCoroutine<std::decay_t<ArgsRef>...>;
+
+template <typename Fn, typename... ArgsRef>
+	requires std::is_invocable_v<std::decay_t<Fn>&, std::decay_t<ArgsRef>&...>
+VarCoroutine(std::size_t, Fn&&, ArgsRef&&...) -> VarCoroutine<std::decay_t<ArgsRef>...>;
+
+template <typename Fn, typename... ArgsRef>
+	requires std::is_invocable_v<std::decay_t<Fn>&, std::decay_t<ArgsRef>&...>
+VarCoroutine(StackAllocator&, std::size_t, Fn&&, ArgsRef&&...)
+	-> VarCoroutine<std::decay_t<ArgsRef>...>;
+
+#ifdef CO_USE_ASM
+template <typename Fn, typename... ArgsRef>
+	requires std::is_invocable_v<std::decay_t<Fn>&, std::decay_t<ArgsRef>&...>
+VarCoroutine(SharedStack&, Fn&&, ArgsRef&&...) -> VarCoroutine<std::decay_t<ArgsRef>...>;
+#endif
+
 using Coroutine = VarCoroutine<>;
 
-} //namespace yq
\ No newline at end of file
+// 声明时VarCoroutine<>还不完整, 在这里定义为inline变量, 库只需要头文件
+inline thread_local VarCoroutine<> BaseCoroutine::co_root{};
+inline thread_local BaseCoroutine* BaseCoroutine::co_running = &BaseCoroutine::co_root;
+
+CO_TLS_ACCESSOR inline auto BaseCoroutine::root() noexcept -> BaseCoroutine* {
+	CO_TLS_BARRIER();
+	return &co_root;
+}
+
+
+/**
+ * 带值通道的协程, 例如VarCoroutine<int(int)>
+ * resume(in...)返回Out, 协程内yield(out)返回下一次resume传入的in
+ * 第一次resume的参数作为任务函数的参数, 任务函数的返回值作为最后一次resume的结果
+ * 值通过协程对象内的槽传递, 交接过程没有额外的分配和类型擦除
+ * yield必须在该类型的协程内直接调用; 通过BaseCoroutine&调用resume()时不传入值, 产生的值被丢弃
+ */
+template <typename Out, typename... In>
+class VarCoroutine<Out(In...)> : public VarCoroutine<> {
+	static_assert(!std::is_reference_v<Out> && (!std::is_reference_v<In> && ...),
+				  "values are moved through the coroutine object, use pointers or std::reference_wrapper");
+
+public:
+	using received_type = typename detail::received<In...>::type;
+
+	// 任务函数和this一起保存在VarCoroutine<>的TaskStorage中
+	template <typename Fn>
+		requires std::is_invocable_r_v<Out, std::decay_t<Fn>&, In&&...>
+	VarCoroutine(StackAllocator& allocator, std::size_t stack_size, Fn&& task):
+		VarCoroutine<>(allocator, stack_size,
+			[this, body = std::forward<Fn>(task)]() mutable { run(body); })
+	{}
+
+#ifdef CO_USE_ASM
+	template <typename Fn>
+		requires std::is_invocable_r_v<Out, std::decay_t<Fn>&, In&&...>
+	VarCoroutine(SharedStack& stack, Fn&& task):
+		VarCoroutine<>(stack,
+			[this, body = std::forward<Fn>(task)]() mutable { run(body); })
+	{}
+#endif
+
+	template <typename Fn>
+		requires std::is_invocable_r_v<Out, std::decay_t<Fn>&, In&&...>
+	VarCoroutine(std::size_t stack_size, Fn&& task):
+		VarCoroutine(default_stack_allocator(), stack_size, std::forward<Fn>(task)) {}
+
+	template <typename Fn>
+		requires std::is_invocable_r_v<Out, std::decay_t<Fn>&, In&&...>
+	explicit VarCoroutine(Fn&& task):
+		VarCoroutine(2 * 1024 * 1024, std::forward<Fn>(task)) {}
+
+	/**
+	 * 切入协程并传入in, 返回协程yield或return的值
+	 * 协程中的异常在这里重新抛出
+	 * 模版函数不会覆盖BaseCoroutine::resume()
+	 */
+	template <typename... InRef>
+		requires (sizeof...(InRef) == sizeof...(In)) &&
+				 (std::is_constructible_v<In, InRef&&> && ...)
+	auto resume(InRef&&... in) -> Out {
+		// 先检查再写入, 不覆盖正在运行的协程的输入
+		check_not_running();
+		m_in.emplace(std::forward<InRef>(in)...);
+		VarCoroutine<>::resume();
+#ifndef CO_NO_EXCEPTIONS
+		check_exception();
+#endif
+		if constexpr (!std::is_void_v<Out>) {
+#ifndef CO_NO_EXCEPTIONS
+			// 被取消的协程没有产生值
+			if (m_cancelled && !m_out) {
+				throw Cancelled{};
+			}
+#endif
+			assert(m_out);
+			Out out = std::move(*m_out);
+			m_out.reset();
+			return out;
+		}
+	}
+
+	// 把value交给resume的调用者并挂起, 返回下一次resume传入的值
+	template <typename Ty>
+		requires (!std::is_void_v<Out>) && std::is_constructible_v<Out, Ty&&>
+	static auto yield(Ty&& value) -> received_type {
+		auto& self = current();
+#ifndef CO_NO_EXCEPTIONS
+		throw_if_stop_requested();
+#endif
+		self.m_out.emplace(std::forward<Ty>(value));
+		switch_to_caller();
+#ifndef CO_NO_EXCEPTIONS
+		throw_if_stop_requested();
+#endif
+		return self.take_received();
+	}
+
+	static auto yield() -> received_type
+		requires std::is_void_v<Out>
+	{
+		auto& self = current();
+#ifndef CO_NO_EXCEPTIONS
+		throw_if_stop_requested();
+#endif
+		switch_to_caller();
+#ifndef CO_NO_EXCEPTIONS
+		throw_if_stop_requested();
+#endif
+		return self.take_received();
+	}
+
+private:
+	static auto current() -> VarCoroutine& {
+		if (!in_coroutine()) {
+			CO_THROW(std::logic_error{"not in coroutine or coroutine finished"});
+		}
+#if defined(__cpp_rtti) || defined(_CPPRTTI)
+		assert(dynamic_cast<VarCoroutine*>(running()));
+#endif
+		return *static_cast<VarCoroutine*>(running());
+	}
+
+	auto take_received() -> received_type {
+		if (!m_in) {
+			// 通过BaseCoroutine::resume()切入
+			m_in.emplace();
+		}
+		std::tuple<In...> in = std::move(*m_in);
+		m_in.reset();
+		if constexpr (sizeof...(In) == 1) {
+			return std::get<0>(std::move(in));
+		} else if constexpr (sizeof...(In) > 1) {
+			return in;
+		}
+	}
+
+	template <typename Fn>
+	void run(Fn& body) {
+		if constexpr (std::is_void_v<Out>) {
+			std::apply(body, take_tuple());
+		} else {
+			m_out.emplace(std::apply(body, take_tuple()));
+		}
+	}
+
+	auto take_tuple() -> std::tuple<In...> {
+		if (!m_in) {
+			m_in.emplace();
+		}
+		std::tuple<In...> in = std::move(*m_in);
+		m_in.reset();
+		return in;
+	}
+
+	// resume传入, 等待协程取走的值
+	std::optional<std::tuple<In...>> m_in;
+	// yield或return产生, 等待调用者取走的值
+	std::conditional_t<std::is_void_v<Out>, std::monostate, std::optional<Out>> m_out;
+};
+
+} // namespace CO_ABI_NAMESPACE
+
+} // namespace yq
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "yq_config.hpp"
+
+/**
+ * NUMA节点与工作线程的放置
+ * 调度器按Topology把工作线程分到各个节点并绑定到节点的CPU上, 窃取时先找同一节点的工作线程
+ * 内存不单独绑定节点, 依靠Linux的首次访问策略: 栈在协程第一次运行时才分配(见VarCoroutine::prepare_context),
+ * 页面由第一次运行它的工作线程触碰, 落在该线程的节点上; 栈池只缓存本节点的栈(见PooledStackAllocator)
+ */
+namespace yq::numa
+{
+
+// 线程没有绑定到节点
+inline constexpr unsigned unknown_node = ~0u;
+
+/**
+ * 每个节点的CPU列表, 节点编号是有CPU的节点按内核编号排列的序号
+ * 也可以直接构造, 例如在单节点的机器上模拟多个节点测试调度器
+ */
+class Topology {
+public:
+	explicit Topology(std::vector<std::vector<unsigned>> node_cpus):
+		m_node_cpus{ std::move(node_cpus) }
+	{
+		if (m_node_cpus.empty()) {
+			m_node_cpus.push_back(all_cpus());
+		}
+	}
+
+	/**
+	 * 当前机器的拓扑, 第一次调用时读取/sys/devices/system/node
+	 * 不是Linux或读取失败时只有一个包含所有CPU的节点
+	 */
+	static auto system() -> const Topology& {
+		static const Topology topology{ read_system() };
+		return topology;
+	}
+
+	[[nodiscard]]
+	auto node_count() const noexcept -> std::size_t {
+		return m_node_cpus.size();
+	}
+
+	[[nodiscard]]
+	auto cpus_of(unsigned node) const noexcept -> const std::vector<unsigned>& {
+		return m_node_cpus[node];
+	}
+
+	// 不在任何节点中的CPU返回unknown_node
+	[[nodiscard]]
+	auto node_of_cpu(unsigned cpu) const noexcept -> unsigned {
+		for (std::size_t node = 0; node < m_node_cpus.size(); ++node) {
+			for (unsigned c : m_node_cpus[node]) {
+				if (c == cpu) {
+					return static_cast<unsigned>(node);
+				}
+			}
+		}
+		return unknown_node;
+	}
+
+	// count个工作线程按编号连续地平均分到各个节点, 相邻编号的工作线程通常在同一节点
+	[[nodiscard]]
+	auto node_for_worker(std::size_t index, std::size_t count) const noexcept -> unsigned {
+		return static_cast<unsigned>(index * node_count() / count);
+	}
+
+private:
+	static auto all_cpus() -> std::vector<unsigned> {
+		unsigned count = std::thread::hardware_concurrency();
+		std::vector<unsigned> cpus(count == 0 ? 1 : count);
+		for (unsigned cpu = 0; cpu < cpus.size(); ++cpu) {
+			cpus[cpu] = cpu;
+		}
+		return cpus;
+	}
+
+	// cpulist的格式为逗号分隔的CPU或区间, 例如"0-3,8-11"
+	static auto parse_cpu_list(const std::string& text) -> std::vector<unsigned> {
+		std::vector<unsigned> cpus;
+		std::size_t pos = 0;
+		while (pos < text.size()) {
+			std::size_t end = text.find(',', pos);
+			if (end == std::string::npos) {
+				end = text.size();
+			}
+			const std::string item = text.substr(pos, end - pos);
+			if (!item.empty()) {
+				const std::size_t dash = item.find('-');
+				const unsigned first = static_cast<unsigned>(std::stoul(item.substr(0, dash)));
+				const unsigned last = dash == std::string::npos
+					? first
+					: static_cast<unsigned>(std::stoul(item.substr(dash + 1)));
+				for (unsigned cpu = first; cpu <= last; ++cpu) {
+					cpus.push_back(cpu);
+				}
+			}
+			pos = end + 1;
+		}
+		return cpus;
+	}
+
+	static auto read_system() -> std::vector<std::vector<unsigned>> {
+		std::vector<std::vector<unsigned>> nodes;
+#if defined(__linux__)
+		// 节点编号可能不连续, 没有CPU的节点(例如只有内存的CXL节点)跳过
+		constexpr unsigned max_nodes = 1024;
+		for (unsigned node = 0; node < max_nodes; ++node) {
+			std::ifstream file{ "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist" };
+			if (!file) {
+				continue;
+			}
+			std::string text;
+			std::getline(file, text);
+#ifdef CO_NO_EXCEPTIONS
+			auto cpus = parse_cpu_list(text);
+#else
+			std::vector<unsigned> cpus;
+			try {
+				cpus = parse_cpu_list(text);
+			} catch (...) {
+				return {};
+			}
+#endif
+			if (!cpus.empty()) {
+				nodes.push_back(std::move(cpus));
+			}
+		}
+#endif
+		return nodes;
+	}
+
+	std::vector<std::vector<unsigned>> m_node_cpus;
+};
+
+
+namespace detail {
+
+inline thread_local unsigned t_node = unknown_node;
+
+} // namespace detail
+
+// 当前线程通过bind_current_thread绑定的节点, 没有绑定时为unknown_node
+CO_TLS_ACCESSOR inline auto current_thread_node() noexcept -> unsigned {
+	CO_TLS_BARRIER();
+	return detail::t_node;
+}
+
+/**
+ * 把当前线程限制在节点的CPU上运行, 之后current_thread_node返回node
+ * 设置亲和性失败(例如CPU不在进程允许的集合中)时仍然记录节点, 只影响内存的位置
+ */
+CO_TLS_ACCESSOR inline void bind_current_thread(const Topology& topology, unsigned node) noexcept {
+	CO_TLS_BARRIER();
+	detail::t_node = node;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned cpu : topology.cpus_of(node)) {
+		if (cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for (unsigned cpu : topology.cpus_of(node)) {
+		if (cpu < sizeof(DWORD_PTR) * 8) {
+			mask |= DWORD_PTR{ 1 } << cpu;
+		}
+	}
+	if (mask != 0) {
+		SetThreadAffinityMask(GetCurrentThread(), mask);
+	}
+#else
+	(void)topology;
+#endif
+}
+
+
+/**
+ * 一个工作线程的窃取顺序: 同一节点的其他工作线程在前, 其他节点的在后
+ * 两组各自从随机的起点开始轮流尝试, 本节点都没有任务时才跨节点窃取
+ * 所有工作线程在同一节点时与在所有其他线程中随机选择起点相同
+ */
+class VictimList {
+public:
+	VictimList() = default;
+
+	// nodes[i]是第i个工作线程的节点
+	VictimList(const std::vector<unsigned>& nodes, std::size_t self) {
+		for (std::size_t i = 0; i < nodes.size(); ++i) {
+			if (i != self && nodes[i] == nodes[self]) {
+				m_victims.push_back(i);
+			}
+		}
+		m_near = m_victims.size();
+		for (std::size_t i = 0; i < nodes.size(); ++i) {
+			if (nodes[i] != nodes[self]) {
+				m_victims.push_back(i);
+			}
+		}
+	}
+
+	/**
+	 * 依次调用steal(victim), 返回第一个转换为true的结果, 都失败时返回值初始化的结果
+	 * random 选择起点, 低32位用于本节点, 高32位用于其他节点
+	 */
+	template <typename Steal>
+	auto visit(std::uint64_t random, Steal&& steal) const -> std::invoke_result_t<Steal&, std::size_t> {
+		if (auto result = visit_range(0, m_near, random & 0xFFFFFFFFu, steal)) {
+			return result;
+		}
+		return visit_range(m_near, m_victims.size(), random >> 32, steal);
+	}
+
+	[[nodiscard]]
+	auto near_count() const noexcept -> std::size_t {
+		return m_near;
+	}
+
+	[[nodiscard]]
+	auto victims() const noexcept -> const std::vector<std::size_t>& {
+		return m_victims;
+	}
+
+private:
+	template <typename Steal>
+	auto visit_range(std::size_t first, std::size_t last, std::uint64_t random, Steal& steal) const
+		-> std::invoke_result_t<Steal&, std::size_t> {
+		const std::size_t count = last - first;
+		if (count == 0) {
+			return {};
+		}
+		const std::size_t start = static_cast<std::size_t>(random % count);
+		for (std::size_t i = 0; i < count; ++i) {
+			if (auto result = steal(m_victims[first + (start + i) % count])) {
+				return result;
+			}
+		}
+		return {};
+	}
+
+	std::vector<std::size_t> m_victims;
+	std::size_t m_near{ 0 };
+};
+
+} // namespace yq::numa
@@ -0,0 +1,673 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "yq_config.hpp"
+#include "yq_coroutine.hpp"
+#include "yq_numa.hpp"
+#include "yq_stack.hpp"
+#include "yq_work_steal_deque.hpp"
+
+namespace yq
+{
+
+namespace detail {
+
+/**
+ * spawn_n创建的一批协程共享的栈和任务函数
+ * 每个协程的任务函数(Entry)持有一个引用, 协程先归还栈再析构任务函数, 最后一个引用释放时整批释放
+ */
+template <typename Fn>
+class SpawnBatch {
+public:
+	class Entry {
+	public:
+		Entry(SpawnBatch* batch, std::size_t index) noexcept: m_batch{ batch }, m_index{ index } {
+			m_batch->m_refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		Entry(Entry&& other) noexcept:
+			m_batch{ std::exchange(other.m_batch, nullptr) }, m_index{ other.m_index } {}
+
+		Entry& operator=(Entry&&) = delete;
+
+		~Entry() {
+			if (m_batch) {
+				m_batch->release();
+			}
+		}
+
+		decltype(auto) operator()() {
+			if constexpr (std::is_invocable_v<Fn&, std::size_t>) {
+				return m_batch->m_fn(m_index);
+			} else {
+				return m_batch->m_fn();
+			}
+		}
+
+	private:
+		SpawnBatch* m_batch;
+		std::size_t m_index;
+	};
+
+	// 创建者持有的引用, 创建完所有协程后释放
+	struct Release {
+		void operator()(SpawnBatch* batch) const noexcept {
+			batch->release();
+		}
+	};
+
+#ifdef CO_USE_FIBER
+	// Fiber由系统分配栈
+	template <typename FnRef>
+	SpawnBatch(std::size_t, std::size_t, bool, FnRef&& fn): m_fn{ std::forward<FnRef>(fn) } {}
+
+	auto slab() noexcept -> StackAllocator& {
+		return default_stack_allocator();
+	}
+#else
+	template <typename FnRef>
+	SpawnBatch(std::size_t count, std::size_t stack_size, bool guarded, FnRef&& fn):
+		m_slab{ count, stack_size, guarded }, m_fn{ std::forward<FnRef>(fn) } {}
+
+	auto slab() noexcept -> StackAllocator& {
+		return m_slab;
+	}
+#endif
+
+private:
+	void release() noexcept {
+		if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			delete this;
+		}
+	}
+
+#ifndef CO_USE_FIBER
+	StackSlab m_slab;
+#endif
+	Fn m_fn;
+	std::atomic<std::size_t> m_refs{ 1 };
+};
+
+} // namespace detail
+
+
+class Scheduler;
+
+/**
+ * 让Scheduler直接运行的协程挂起等待, 不放回队列, 等待期间不占用工作线程
+ * 由等待者构造在自己的栈上并登记到等待队列, 之后任意线程调用unpark()把协程交还给原来的调度器
+ * 协程切出和unpark()都完成后才重新入队, 因此unpark()可以早于协程真正切出
+ * 重新入队时Parker自身作为侵入式链表的节点, 不分配内存, unpark()因此可以是noexcept
+ * 用法见CoSemaphore(yq_co_sync.hpp)
+ */
+class Parker {
+public:
+	// 当前协程是否由Scheduler直接运行(不是它resume的子协程), 只有这时可以构造Parker
+	[[nodiscard]]
+	static auto available() noexcept -> bool;
+
+	Parker() noexcept;
+
+	Parker(const Parker&) = delete;
+	Parker& operator=(const Parker&) = delete;
+
+	/**
+	 * 挂起当前协程直到unpark(), 只能调用一次
+	 * 与Coroutine::yield()一样在切出前和恢复后检查取消, 抛出Cancelled; 切出前抛出时unpark()仍然可以调用
+	 */
+	void park();
+
+	// 任意线程都可以调用, 只有第一次调用有作用
+	void unpark() noexcept;
+
+private:
+	friend Scheduler;
+
+	// 协程切出和unpark()各到达一次, 第二个到达的一方把this挂到调度器的唤醒链表; 第一个到达的一方之后不再访问this
+	void arrive() noexcept;
+
+	Scheduler* m_scheduler;
+	BaseCoroutine* m_co;
+	// 在Scheduler的唤醒链表中的下一个
+	Parker* m_next{ nullptr };
+	std::atomic<bool> m_woken{ false };
+	std::atomic<int> m_arrivals{ 0 };
+};
+
+
+/**
+ * M:N调度器, N个工作线程运行任意数量的Coroutine
+ * 新提交的协程放入本地队列(所有者LIFO), 空闲的工作线程从其他线程的队列中窃取;
+ * 协程中调用Coroutine::yield()回到工作线程, 工作线程把它排到本线程让出队列的末尾, 让其他协程先运行
+ * 协程之后可能在另一个线程上恢复, 协程中不要持有线程绑定的资源(线程局部变量的引用, SharedStack等)
+ */
+class Scheduler {
+	friend Parker;
+
+	// 被唤醒的Parker组成的FIFO链表, 节点在协程恢复之前一直有效
+	struct WakeList {
+		void push(Parker* parker) noexcept {
+			parker->m_next = nullptr;
+			if (m_tail) {
+				m_tail->m_next = parker;
+			} else {
+				m_head = parker;
+			}
+			m_tail = parker;
+		}
+
+		// 取出节点后先读m_co再放入队列, 协程恢复后节点随栈帧一起失效
+		auto pop() noexcept -> BaseCoroutine* {
+			Parker* parker = m_head;
+			if (!parker) {
+				return nullptr;
+			}
+			m_head = parker->m_next;
+			if (!m_head) {
+				m_tail = nullptr;
+			}
+			return parker->m_co;
+		}
+
+		[[nodiscard]]
+		auto empty() const noexcept -> bool {
+			return m_head == nullptr;
+		}
+
+		Parker* m_head{ nullptr };
+		Parker* m_tail{ nullptr };
+	};
+
+	// 每个工作线程的状态, 队列被窃取者频繁访问, 单独对齐
+	struct alignas(64) Worker {
+		WorkStealingDeque<BaseCoroutine*> m_deque;
+		// yield的协程, 所有者和窃取者都只从FIFO端(steal)取
+		WorkStealingDeque<BaseCoroutine*> m_yielded;
+		std::thread m_thread;
+		std::uint64_t m_rng;
+		unsigned m_ticks{ 0 };
+		unsigned m_node{ numa::unknown_node };
+		numa::VictimList m_victims;
+		// 正在运行的协程, 以及它在这次运行中挂起时登记的Parker
+		BaseCoroutine* m_current{ nullptr };
+		Parker* m_parked{ nullptr };
+		// 本线程唤醒的协程, 只有所有者访问, find_work时移入m_deque
+		WakeList m_woken;
+	};
+
+public:
+	static constexpr std::size_t default_stack_size = 2 * 1024 * 1024;
+	// 每运行这么多次先检查一次全局注入队列和让出队列, 本地队列一直非空时外部提交和yield的协程也能运行
+	static constexpr unsigned inject_interval = 61;
+
+	explicit Scheduler(std::size_t worker_count = std::thread::hardware_concurrency()) {
+		start(worker_count);
+	}
+
+	/**
+	 * 按topology把工作线程平均分到各个NUMA节点, 每个工作线程绑定到所在节点的CPU上
+	 * 协程的栈在第一次运行时由所在的工作线程分配和首次访问, 落在该节点上;
+	 * 窃取时先尝试同一节点的工作线程, 减少已经开始的协程连同栈一起跨节点迁移
+	 *   Scheduler scheduler{ n, numa::Topology::system() };
+	 */
+	Scheduler(std::size_t worker_count, const numa::Topology& topology):
+		m_topology{ topology }
+	{
+		start(worker_count);
+	}
+
+	// 等待所有协程结束后停止工作线程
+	~Scheduler() {
+#ifdef CO_NO_EXCEPTIONS
+		wait();
+#else
+		try {
+			wait();
+		} catch (...) {
+		}
+#endif
+		{
+			std::lock_guard lock{ m_mutex };
+			m_stop = true;
+		}
+		m_idle_cv.notify_all();
+		for (auto& worker : m_workers) {
+			worker->m_thread.join();
+		}
+	}
+
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+
+	/**
+	 * 提交一个协程, 在工作线程中调用时放入本地队列, 否则放入全局注入队列
+	 */
+	template <typename Fn>
+	void spawn(Fn&& task, std::size_t stack_size = default_stack_size) {
+		submit(std::make_unique<Coroutine>(stack_size, std::forward<Fn>(task)));
+	}
+
+	/**
+	 * 提交一个可以取消的协程, token被请求停止后:
+	 * 还没有开始的协程直接丢弃, 不分配栈; 已经开始的协程在下一次yield时抛出Cancelled并展开栈
+	 * 丢弃和取消的协程不算作失败
+	 */
+	template <typename Fn>
+	void spawn(std::stop_token token, Fn&& task, std::size_t stack_size = default_stack_size) {
+		auto co = std::make_unique<Coroutine>(stack_size, std::forward<Fn>(task));
+		co->set_stop_token(std::move(token));
+		submit(std::move(co));
+	}
+
+	/**
+	 * 一次提交count个协程, 第i个运行fn(i), fn不接受参数时运行fn()
+	 * 所有的栈来自同一块连续的映射(StackSlab), guarded为true时相邻的栈之间有保护页;
+	 * fn只保存一份, 在多个工作线程上同时调用. 所有协程结束后栈和fn一起释放
+	 * 协程一次放入队列, 只加锁一次
+	 */
+	template <typename Fn>
+	void spawn_n(std::size_t count, std::size_t stack_size, Fn&& fn, bool guarded = false) {
+		if (count == 0) {
+			return;
+		}
+		using Batch = detail::SpawnBatch<std::decay_t<Fn>>;
+		std::unique_ptr<Batch, typename Batch::Release> batch{
+			new Batch(count, stack_size, guarded, std::forward<Fn>(fn)) };
+		std::vector<std::unique_ptr<Coroutine>> cos;
+		cos.reserve(count);
+		for (std::size_t i = 0; i < count; ++i) {
+			cos.push_back(std::make_unique<Coroutine>(batch->slab(), stack_size,
+				typename Batch::Entry{ batch.get(), i }));
+		}
+		submit_all(cos);
+	}
+
+	/**
+	 * 阻塞直到所有已提交的协程结束, 重新抛出协程中第一个未捕获的异常
+	 * 无异常模式下第一个失败的协程的错误由error()取出
+	 * 不能在调度器的协程中调用
+	 */
+	void wait() {
+		std::unique_lock lock{ m_mutex };
+		m_done_cv.wait(lock, [this]() {
+			return m_pending.load(std::memory_order_acquire) == 0;
+		});
+#ifndef CO_NO_EXCEPTIONS
+		if (m_exception) {
+			std::rethrow_exception(std::exchange(m_exception, nullptr));
+		}
+#endif
+	}
+
+#ifdef CO_NO_EXCEPTIONS
+	// 第一个以非空error()结束的协程的错误, 取出后清空
+	[[nodiscard]]
+	auto error() -> std::error_code {
+		std::lock_guard lock{ m_mutex };
+		return std::exchange(m_error, std::error_code{});
+	}
+#endif
+
+	[[nodiscard]]
+	auto worker_count() const noexcept -> std::size_t {
+		return m_workers.size();
+	}
+
+private:
+	// 在工作线程中调用时放入本地队列, 否则放入全局注入队列
+	void submit(std::unique_ptr<Coroutine> co) {
+		m_pending.fetch_add(1, std::memory_order_relaxed);
+		BaseCoroutine* raw = co.get();
+		Worker* worker = current_worker();
+		if (worker && current_scheduler() == this) {
+			worker->m_deque.push(raw);
+			co.release();
+			if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+				m_idle_cv.notify_one();
+			}
+		} else {
+			{
+				std::lock_guard lock{ m_mutex };
+				m_injected.push_back(raw);
+				co.release();
+				update_injected_size();
+			}
+			m_idle_cv.notify_one();
+		}
+	}
+
+	/**
+	 * Parker唤醒的协程重新入队, 只修改侵入式链表, 不分配内存
+	 * 在本调度器的工作线程中调用时放入该线程的唤醒链表, 下一次find_work时移入本地队列; 否则放入全局唤醒链表
+	 */
+	void wake(Parker* parker) noexcept {
+		Worker* worker = current_worker();
+		if (worker && current_scheduler() == this) {
+			worker->m_woken.push(parker);
+			return;
+		}
+		{
+			std::lock_guard lock{ m_mutex };
+			m_woken.push(parker);
+			++m_woken_count;
+			update_injected_size();
+		}
+		m_idle_cv.notify_one();
+	}
+
+	// 调用者持有m_mutex
+	void update_injected_size() noexcept {
+		m_injected_size.store(m_injected.size() + m_woken_count, std::memory_order_relaxed);
+	}
+
+	void submit_all(std::vector<std::unique_ptr<Coroutine>>& cos) {
+		m_pending.fetch_add(cos.size(), std::memory_order_relaxed);
+		Worker* worker = current_worker();
+		if (worker && current_scheduler() == this) {
+			for (auto& co : cos) {
+				worker->m_deque.push(co.release());
+			}
+			if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+				m_idle_cv.notify_all();
+			}
+		} else {
+			{
+				std::lock_guard lock{ m_mutex };
+				for (auto& co : cos) {
+					m_injected.push_back(co.release());
+				}
+				update_injected_size();
+			}
+			m_idle_cv.notify_all();
+		}
+	}
+
+	void start(std::size_t worker_count) {
+		if (worker_count == 0) {
+			worker_count = 1;
+		}
+		std::vector<unsigned> nodes(worker_count, numa::unknown_node);
+		m_workers.reserve(worker_count);
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			m_workers.push_back(std::make_unique<Worker>());
+			m_workers.back()->m_rng = 0x9E3779B97F4A7C15ull * (i + 1);
+			if (m_topology) {
+				nodes[i] = m_topology->node_for_worker(i, worker_count);
+				m_workers.back()->m_node = nodes[i];
+			}
+		}
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			m_workers[i]->m_victims = numa::VictimList{ nodes, i };
+		}
+		// 所有Worker构造完成后再启动线程, 窃取时会访问其他Worker
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			m_workers[i]->m_thread = std::thread([this, i]() { run_worker(i); });
+		}
+	}
+
+	void run_worker(std::size_t index) {
+		Worker& self = *m_workers[index];
+		// 在运行任何协程之前绑定, 之后的栈都在这个节点上分配
+		if (m_topology) {
+			numa::bind_current_thread(*m_topology, self.m_node);
+		}
+		set_current(this, &self);
+		for (;;) {
+			if (BaseCoroutine* co = find_work(self)) {
+				run(self, co);
+			} else if (!idle_wait()) {
+				break;
+			}
+		}
+		set_current(nullptr, nullptr);
+	}
+
+	void run(Worker& self, BaseCoroutine* co) {
+		// 排队期间被取消, 栈还没有分配, 直接回收
+		if (!co->is_started() && co->get_stop_token().stop_requested()) [[unlikely]] {
+			finish(co);
+			return;
+		}
+		bool finished = true;
+		self.m_current = co;
+		self.m_parked = nullptr;
+#ifdef CO_NO_EXCEPTIONS
+		co->resume();
+		finished = co->is_finished();
+		if (finished && co->error()) {
+			std::lock_guard lock{ m_mutex };
+			if (!m_error) {
+				m_error = co->error();
+			}
+		}
+#else
+		try {
+			co->resume();
+			finished = co->is_finished();
+		} catch (...) {
+			std::lock_guard lock{ m_mutex };
+			if (!m_exception) {
+				m_exception = std::current_exception();
+			}
+		}
+#endif
+		self.m_current = nullptr;
+
+		if (!finished) {
+			if (Parker* parker = std::exchange(self.m_parked, nullptr)) {
+				// 已经切出, 由Parker决定何时放回队列
+				parker->arrive();
+				return;
+			}
+			// yield的协程排到让出队列的末尾(FIFO), 本地队列的LIFO端留给新提交和唤醒的协程,
+			// 反复yield等待的协程不会饿死其他协程, 空闲的线程也可以窃取它; 不经过全局锁
+			self.m_yielded.push(co);
+			if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+				m_idle_cv.notify_one();
+			}
+			return;
+		}
+		finish(co);
+	}
+
+	void finish(BaseCoroutine* co) {
+		delete co;
+		if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::lock_guard lock{ m_mutex };
+			m_done_cv.notify_all();
+		}
+	}
+
+	// 依次尝试: 本地队列, 让出队列, 全局注入队列, 窃取其他线程(同一节点的优先, 见numa::VictimList)
+	auto find_work(Worker& self) -> BaseCoroutine* {
+		// 本线程唤醒的协程移入本地队列, 之后可以被窃取
+		if (!self.m_woken.empty()) {
+			while (BaseCoroutine* co = self.m_woken.pop()) {
+				self.m_deque.push(co);
+			}
+			if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+				m_idle_cv.notify_one();
+			}
+		}
+		if (++self.m_ticks % inject_interval == 0) {
+			if (BaseCoroutine* co = take_injected()) {
+				return co;
+			}
+			if (auto co = self.m_yielded.steal()) {
+				return *co;
+			}
+		}
+		if (auto co = self.m_deque.pop()) {
+			return *co;
+		}
+		if (auto co = self.m_yielded.steal()) {
+			return *co;
+		}
+		if (BaseCoroutine* co = take_injected()) {
+			return co;
+		}
+		if (m_workers.size() > 1) {
+			auto co = self.m_victims.visit(next_random(self), [this](std::size_t victim) {
+				auto& worker = *m_workers[victim];
+				auto stolen = worker.m_deque.steal();
+				return stolen ? stolen : worker.m_yielded.steal();
+			});
+			if (co) {
+				return *co;
+			}
+		}
+		return nullptr;
+	}
+
+	auto take_injected() -> BaseCoroutine* {
+		if (m_injected_size.load(std::memory_order_relaxed) == 0) {
+			return nullptr;
+		}
+		std::lock_guard lock{ m_mutex };
+		BaseCoroutine* co = m_woken.pop();
+		if (co) {
+			--m_woken_count;
+		} else if (!m_injected.empty()) {
+			co = m_injected.front();
+			m_injected.pop_front();
+		} else {
+			return nullptr;
+		}
+		update_injected_size();
+		return co;
+	}
+
+	/**
+	 * 没有可运行的协程时休眠
+	 * 其他线程的本地队列没有锁保护, 通知可能丢失, 用超时兜底
+	 * return false 表示调度器停止
+	 */
+	auto idle_wait() -> bool {
+		std::unique_lock lock{ m_mutex };
+		if (m_stop) {
+			return false;
+		}
+		if (!m_injected.empty() || !m_woken.empty()) {
+			return true;
+		}
+		m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+		m_idle_cv.wait_for(lock, std::chrono::milliseconds{ 1 });
+		m_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+		return !m_stop;
+	}
+
+	static auto next_random(Worker& worker) noexcept -> std::uint64_t {
+		// xorshift64
+		std::uint64_t x = worker.m_rng;
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		worker.m_rng = x;
+		return x;
+	}
+
+	// 协程可能跨线程, 通过CO_TLS_ACCESSOR访问线程局部状态
+	CO_TLS_ACCESSOR static auto current_worker() noexcept -> Worker* {
+		CO_TLS_BARRIER();
+		return tl_worker;
+	}
+
+	CO_TLS_ACCESSOR static auto current_scheduler() noexcept -> Scheduler* {
+		CO_TLS_BARRIER();
+		return tl_scheduler;
+	}
+
+	CO_TLS_ACCESSOR static void set_current(Scheduler* scheduler, Worker* worker) noexcept {
+		CO_TLS_BARRIER();
+		tl_scheduler = scheduler;
+		tl_worker = worker;
+	}
+
+	static inline thread_local Scheduler* tl_scheduler{ nullptr };
+	static inline thread_local Worker* tl_worker{ nullptr };
+
+	// 不按NUMA节点放置时为空
+	std::optional<numa::Topology> m_topology;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	// 以下由m_mutex保护
+	std::mutex m_mutex;
+	std::condition_variable m_idle_cv;
+	std::condition_variable m_done_cv;
+	std::deque<BaseCoroutine*> m_injected;
+	// 外部线程(或其他调度器的工作线程)唤醒的协程
+	WakeList m_woken;
+	std::size_t m_woken_count{ 0 };
+#ifdef CO_NO_EXCEPTIONS
+	std::error_code m_error;
+#else
+	std::exception_ptr m_exception;
+#endif
+	bool m_stop{ false };
+
+	// m_injected和m_woken中的协程总数, 不加锁检查是否为空
+	std::atomic<std::size_t> m_injected_size{ 0 };
+	// 已提交未结束的协程数量
+	std::atomic<std::size_t> m_pending{ 0 };
+	std::atomic<int> m_sleeping{ 0 };
+};
+
+
+inline auto Parker::available() noexcept -> bool {
+	Scheduler::Worker* worker = Scheduler::current_worker();
+	return worker && worker->m_current &&
+		worker->m_current == BaseCoroutine::current_coroutine();
+}
+
+inline Parker::Parker() noexcept:
+	m_scheduler{ Scheduler::current_scheduler() },
+	m_co{ Scheduler::current_worker()->m_current }
+{
+	assert(available());
+}
+
+inline void Parker::park() {
+	Scheduler::current_worker()->m_parked = this;
+#ifdef CO_NO_EXCEPTIONS
+	Coroutine::yield();
+#else
+	try {
+		Coroutine::yield();
+	} catch (...) {
+		// 切出前抛出时工作线程还没有取走登记; 恢复后抛出时所在工作线程的登记已经清空
+		Scheduler::current_worker()->m_parked = nullptr;
+		throw;
+	}
+#endif
+}
+
+inline void Parker::unpark() noexcept {
+	if (!m_woken.exchange(true, std::memory_order_acq_rel)) {
+		arrive();
+	}
+}
+
+inline void Parker::arrive() noexcept {
+	if (m_arrivals.fetch_add(1, std::memory_order_acq_rel) == 1) {
+		m_scheduler->wake(this);
+	}
+}
+
+} // namespace yq
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "yq_config.hpp"
+#include "yq_numa.hpp"
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#endif
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * 定义CO_STACK_WATERMARK时, 创建协程时用固定的字节填充栈顶的CO_STACK_PAINT_BYTES,
+ * 归还栈之前扫描得到最大使用量(水位), 并按创建位置汇总到StackSite, 供AdaptiveStackAllocator选择栈大小
+ * 会改变StackAllocator和协程的布局, 需要对整个程序统一定义. 填充会提交这部分页面
+ */
+#if defined(CO_ENABLE_STATS) && !defined(CO_STACK_WATERMARK)
+#define CO_STACK_WATERMARK
+#endif
+
+#ifndef CO_STACK_PAINT_BYTES
+// 更深的使用只知道下限, 报告为这个值
+#define CO_STACK_PAINT_BYTES (256 * 1024)
+#endif
+
+namespace yq
+{
+
+/**
+ * 协程栈空间 [base, base + size), 栈从高地址向低地址增长
+ * node是分配它的线程绑定的NUMA节点(见numa::bind_current_thread), 只有PooledStackAllocator记录
+ */
+struct Stack {
+	char* base { nullptr };
+	std::size_t size { 0 };
+	unsigned node { numa::unknown_node };
+};
+
+#ifdef CO_STACK_WATERMARK
+namespace detail {
+
+inline constexpr unsigned char stack_paint = 0xA5;
+
+inline auto paint_window(std::size_t size) noexcept -> std::size_t {
+	return std::min<std::size_t>(size, CO_STACK_PAINT_BYTES);
+}
+
+} // namespace detail
+
+inline void paint_stack(Stack stack) noexcept {
+	const std::size_t window = detail::paint_window(stack.size);
+	std::memset(stack.base + stack.size - window, detail::stack_paint, window);
+}
+
+/**
+ * 从填充范围的底部找到第一个被改写的字节, 返回它到栈顶的距离
+ * 栈上带有ASan为栈帧设置的标记, 开启ASan时绕开检查
+ */
+#ifdef __SANITIZE_ADDRESS__
+__attribute__((no_sanitize_address))
+#endif
+inline auto stack_high_water(Stack stack) noexcept -> std::size_t {
+	const std::size_t window = detail::paint_window(stack.size);
+	const auto* volatile bytes =
+		reinterpret_cast<const unsigned char*>(stack.base + stack.size - window);
+	std::size_t untouched = 0;
+	while (untouched < window && bytes[untouched] == detail::stack_paint) {
+		++untouched;
+	}
+	return window - untouched;
+}
+
+
+/**
+ * 一个创建位置上的协程的栈使用量
+ * 创建位置以任务函数的类型区分, 每个lambda表达式的类型都不同, 因此通常对应源码中的一处
+ */
+class StackSite {
+public:
+	void record(std::size_t used) noexcept {
+		std::size_t high = m_high_water.load(std::memory_order_relaxed);
+		while (used > high &&
+			   !m_high_water.compare_exchange_weak(high, used, std::memory_order_relaxed)) {
+		}
+		m_samples.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// 已结束(或析构)的协程中最大的使用量
+	[[nodiscard]]
+	auto high_water() const noexcept -> std::size_t {
+		return m_high_water.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]]
+	auto samples() const noexcept -> std::size_t {
+		return m_samples.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * 使用量接近填充范围, 只知道下限
+	 * 栈帧中没有写入的填充字节恰好保持原值时, 越过填充范围的栈也可能比范围小几个字节, 因此留出1/16的余量
+	 */
+	[[nodiscard]]
+	auto saturated() const noexcept -> bool {
+		return high_water() >= CO_STACK_PAINT_BYTES - CO_STACK_PAINT_BYTES / 16;
+	}
+
+private:
+	std::atomic<std::size_t> m_high_water{ 0 };
+	std::atomic<std::size_t> m_samples{ 0 };
+};
+
+// 任务函数类型为Fn的协程共用的StackSite
+template <typename Fn>
+inline StackSite stack_site_of{};
+#endif
+
+/**
+ * 协程栈分配策略
+ * 实现需要保证deallocate可以在任意线程调用
+ */
+class StackAllocator {
+public:
+	virtual ~StackAllocator() = default;
+	virtual auto allocate(std::size_t size) -> Stack = 0;
+	virtual void deallocate(Stack stack) noexcept = 0;
+#ifdef CO_STACK_WATERMARK
+	// 为site上的协程分配, size是请求的大小; 返回的栈可以更小
+	virtual auto allocate_for(const StackSite&, std::size_t size) -> Stack {
+		return allocate(size);
+	}
+#endif
+};
+
+
+// 直接从堆上分配, 不做值初始化, 页面在第一次访问时才会被操作系统提交
+class HeapStackAllocator final : public StackAllocator {
+public:
+	auto allocate(std::size_t size) -> Stack override {
+		auto* base = static_cast<char*>(
+			::operator new(size, std::align_val_t{ alignment }));
+		return Stack { base, size };
+	}
+
+	void deallocate(Stack stack) noexcept override {
+		::operator delete(stack.base, std::align_val_t{ alignment });
+	}
+
+private:
+	static constexpr std::size_t alignment = 16;
+};
+
+
+#if defined(__unix__)
+namespace detail {
+
+inline auto page_size() noexcept -> std::size_t {
+	static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+inline auto round_to_page(std::size_t size) noexcept -> std::size_t {
+	const std::size_t page = page_size();
+	return (size + page - 1) / page * page;
+}
+
+} // namespace detail
+
+/**
+ * mmap保留虚拟内存, 栈底下方放一个PROT_NONE保护页
+ * 物理页面只在被访问时提交, 常驻内存与实际使用的栈深度一致, 栈溢出会触发SIGSEGV
+ * 每个栈占用两个VMA, 大量协程时需要相应调大vm.max_map_count
+ * Fiber没有自定义栈的接口, 对应的保留/提交和保护页由CreateFiberEx完成
+ */
+class MmapStackAllocator final : public StackAllocator {
+public:
+	auto allocate(std::size_t size) -> Stack override {
+		const std::size_t page = detail::page_size();
+		const std::size_t length = detail::round_to_page(size) + page;
+		void* mapping = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (mapping == MAP_FAILED) {
+			CO_THROW(std::bad_alloc{});
+		}
+		if (::mprotect(mapping, page, PROT_NONE) != 0) {
+			::munmap(mapping, length);
+			CO_THROW(std::bad_alloc{});
+		}
+		// 栈顶与映射末尾对齐, 向上取整多出的部分留在保护页与base之间
+		auto* top = static_cast<char*>(mapping) + length;
+		return Stack { top - size, size };
+	}
+
+	void deallocate(Stack stack) noexcept override {
+		const std::size_t length = detail::round_to_page(stack.size) + detail::page_size();
+		::munmap(stack.base + stack.size - length, length);
+	}
+};
+#endif
+
+
+/**
+ * 一次映射count个大小相同的栈, 供一批同时创建的协程使用(见Scheduler::spawn_n)
+ * 相邻的协程的栈在地址上连续, 只需要一次mmap; Linux下按需提交
+ * guarded为true时每个栈底下方放一个PROT_NONE保护页, 每个保护页各占一个VMA
+ * 每个槽只分配一次, 按allocate的顺序取出; 归还的栈不再复用, 整块映射在析构时释放
+ * 非Unix平台从堆上分配, 不支持保护页
+ */
+class StackSlab final : public StackAllocator {
+public:
+	StackSlab(std::size_t count, std::size_t stack_size, bool guarded = false):
+		m_count{ count }, m_stack_size{ stack_size }
+	{
+#if defined(__unix__)
+		const std::size_t guard = guarded ? detail::page_size() : 0;
+		m_stride = detail::round_to_page(stack_size) + guard;
+		m_length = m_stride * count;
+		void* mapping = ::mmap(nullptr, m_length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (mapping == MAP_FAILED) {
+			CO_THROW(std::bad_alloc{});
+		}
+		m_base = static_cast<char*>(mapping);
+		for (std::size_t i = 0; guard && i < count; ++i) {
+			if (::mprotect(m_base + i * m_stride, guard, PROT_NONE) != 0) {
+				::munmap(m_base, m_length);
+				CO_THROW(std::bad_alloc{});
+			}
+		}
+#else
+		(void)guarded;
+		m_stride = (stack_size + alignment - 1) / alignment * alignment;
+		m_length = m_stride * count;
+		m_base = static_cast<char*>(::operator new(m_length, std::align_val_t{ alignment }));
+#endif
+#ifdef __SANITIZE_ADDRESS__
+		// 地址可能来自之前释放的协程栈, 上面没有正常返回的栈帧标记还留着
+		__asan_unpoison_memory_region(m_base, m_length);
+#endif
+	}
+
+	~StackSlab() override {
+#if defined(__unix__)
+		::munmap(m_base, m_length);
+#else
+		::operator delete(m_base, std::align_val_t{ alignment });
+#endif
+	}
+
+	StackSlab(const StackSlab&) = delete;
+	StackSlab& operator=(const StackSlab&) = delete;
+
+	// 可以在多个线程上同时调用, size不能超过stack_size
+	auto allocate(std::size_t size) -> Stack override {
+		assert(size <= m_stack_size);
+		const std::size_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+		if (index >= m_count) {
+			CO_THROW(std::bad_alloc{});
+		}
+		// 栈顶与槽的末尾对齐
+		char* top = m_base + (index + 1) * m_stride;
+		return Stack { top - size, size };
+	}
+
+	void deallocate(Stack) noexcept override {}
+
+	[[nodiscard]]
+	auto capacity() const noexcept -> std::size_t {
+		return m_count;
+	}
+
+private:
+	static constexpr std::size_t alignment = 16;
+
+	char* m_base{ nullptr };
+	std::size_t m_length{ 0 };
+	std::size_t m_stride{ 0 };
+	std::size_t m_count;
+	std::size_t m_stack_size;
+	std::atomic<std::size_t> m_next{ 0 };
+};
+
+
+/**
+ * 按栈大小分桶的线程局部空闲链表
+ * 归还的栈不清零直接复用, 每个桶最多缓存max_cached个栈, 多出的交还Upstream
+ * 只缓存在同一NUMA节点的线程上分配的栈, 在其他节点上结束的协程的栈交还Upstream,
+ * 之后本节点重新分配的栈由本节点的线程首次访问; 线程都没有绑定节点时不受影响
+ * Upstream需要可默认构造, 并提供与StackAllocator相同的allocate/deallocate
+ */
+template <typename Upstream = HeapStackAllocator>
+class PooledStackAllocator final : public StackAllocator {
+public:
+	explicit PooledStackAllocator(std::size_t max_cached = 64) noexcept:
+		m_max_cached { max_cached }
+	{}
+
+	auto allocate(std::size_t size) -> Stack override {
+		auto& pool = local_pool();
+		if (auto* bucket = pool.find(size); bucket && bucket->head) {
+			FreeNode* node = bucket->head;
+			bucket->head = node->next;
+			--bucket->count;
+			return Stack { node_to_base(node, size), size, numa::current_thread_node() };
+		}
+		Stack stack = pool.upstream.allocate(size);
+		stack.node = numa::current_thread_node();
+		return stack;
+	}
+
+	void deallocate(Stack stack) noexcept override {
+		auto& pool = local_pool();
+		if (stack.node != numa::current_thread_node()) {
+			pool.upstream.deallocate(stack);
+			return;
+		}
+		auto* bucket = pool.find(stack.size);
+		if (!bucket) {
+#ifdef CO_NO_EXCEPTIONS
+			bucket = &pool.buckets.emplace_back(Bucket { stack.size });
+#else
+			try {
+				bucket = &pool.buckets.emplace_back(Bucket { stack.size });
+			} catch (...) {
+				pool.upstream.deallocate(stack);
+				return;
+			}
+#endif
+		}
+		if (bucket->count >= m_max_cached) {
+			pool.upstream.deallocate(stack);
+			return;
+		}
+#ifdef __SANITIZE_ADDRESS__
+		// 协程切走后栈帧不会正常返回, 留下的栈帧标记需要在复用前清除
+		__asan_unpoison_memory_region(stack.base, stack.size);
+#endif
+		// 链表节点放在栈顶, 栈顶的页面已经被使用过, 不会额外提交内存
+		auto* node = ::new (stack.base + stack.size - sizeof(FreeNode)) FreeNode {
+			bucket->head
+		};
+		bucket->head = node;
+		++bucket->count;
+	}
+
+private:
+	struct FreeNode {
+		FreeNode* next;
+	};
+
+	struct Bucket {
+		std::size_t size;
+		FreeNode* head { nullptr };
+		std::size_t count { 0 };
+	};
+
+	struct Pool {
+		~Pool() {
+			for (auto& bucket : buckets) {
+				while (bucket.head) {
+					FreeNode* node = bucket.head;
+					bucket.head = node->next;
+					upstream.deallocate(
+						Stack { node_to_base(node, bucket.size), bucket.size });
+				}
+			}
+		}
+
+		auto find(std::size_t size) noexcept -> Bucket* {
+			for (auto& bucket : buckets) {
+				if (bucket.size == size) {
+					return &bucket;
+				}
+			}
+			return nullptr;
+		}
+
+		// 栈大小的种类通常很少, 线性查找即可
+		std::vector<Bucket> buckets;
+		Upstream upstream;
+	};
+
+	static auto node_to_base(FreeNode* node, std::size_t size) noexcept -> char* {
+		return reinterpret_cast<char*>(node) + sizeof(FreeNode) - size;
+	}
+
+	// 池是线程局部的, 分配器对象本身无状态, 可以在线程间共享
+	CO_TLS_ACCESSOR static auto local_pool() -> Pool& {
+		CO_TLS_BARRIER();
+		static thread_local Pool pool;
+		return pool;
+	}
+
+	std::size_t m_max_cached;
+};
+
+
+// 未指定分配器时使用的默认分配器
+inline auto default_stack_allocator() -> StackAllocator& {
+	static PooledStackAllocator<> allocator;
+	return allocator;
+}
+
+#if defined(__unix__)
+// 带保护页, 按需提交的栈池
+inline auto guarded_stack_allocator() -> StackAllocator& {
+	static PooledStackAllocator<MmapStackAllocator> allocator;
+	return allocator;
+}
+#endif
+
+#ifdef CO_STACK_WATERMARK
+/**
+ * 按创建位置自适应的栈大小, 从upstream分配
+ * 每个位置先以请求的大小运行warmup个协程, 之后使用观测到的水位的两倍向上取整到2的幂,
+ * 不小于min_size, 不超过请求的大小; 水位达到填充范围时使用请求的大小
+ * 之后的协程继续测量, 使用量上升时栈随之增大. 比之前所有协程都深的调用仍然会溢出, upstream应带保护页
+ */
+class AdaptiveStackAllocator final : public StackAllocator {
+public:
+	explicit AdaptiveStackAllocator(StackAllocator& upstream, std::size_t min_size = 16 * 1024,
+									std::size_t warmup = 8) noexcept:
+		m_upstream{ &upstream },
+		m_min_size{ min_size },
+		m_warmup{ warmup }
+	{}
+
+	auto allocate(std::size_t size) -> Stack override {
+		return m_upstream->allocate(size);
+	}
+
+	void deallocate(Stack stack) noexcept override {
+		m_upstream->deallocate(stack);
+	}
+
+	auto allocate_for(const StackSite& site, std::size_t size) -> Stack override {
+		return m_upstream->allocate(choose_size(site, size));
+	}
+
+	[[nodiscard]]
+	auto choose_size(const StackSite& site, std::size_t size) const noexcept -> std::size_t {
+		if (site.samples() < m_warmup || site.saturated()) {
+			return size;
+		}
+		const std::size_t wanted = std::bit_ceil(std::max(site.high_water() * 2, m_min_size));
+		return std::min(wanted, size);
+	}
+
+private:
+	StackAllocator* m_upstream;
+	std::size_t m_min_size;
+	std::size_t m_warmup;
+};
+
+// 默认的自适应分配器, Linux下从带保护页的栈池分配
+inline auto adaptive_stack_allocator() -> StackAllocator& {
+#if defined(__unix__)
+	static AdaptiveStackAllocator allocator{ guarded_stack_allocator() };
+#else
+	static AdaptiveStackAllocator allocator{ default_stack_allocator() };
+#endif
+	return allocator;
+}
+#endif
+
+} // namespace yq
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "yq_config.hpp"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * 协程切换统计, 定义CO_ENABLE_STATS时启用, 需要对整个程序统一定义
+ * 有栈协程在每次切换(resume/yield/transfer_to)时, 无栈协程Task在每次co_await挂起和恢复时记录一个时间片:
+ *   每个协程: 切入次数, 累计运行时间, 最长的一次运行, 栈的最大深度
+ *   每个线程: 同样的计数, 以及最近的时间片, 用于导出Chrome trace(Perfetto可以直接打开)
+ * 时间以TSC(AArch64为cntvct_el0)计数, 只在导出时换算
+ * 计数只由运行协程的线程写入, 用relaxed的load/store代替原子读改写, 其他线程可以随时读取快照
+ * 栈深度来自栈水位(见yq_stack.hpp), CO_ENABLE_STATS同时启用CO_STACK_WATERMARK
+ * 未定义CO_ENABLE_STATS时协程的布局和切换路径都不变, 本文件不会被包含
+ */
+
+#ifndef CO_STATS_TRACE_EVENTS
+// 每个线程保留的最近时间片数量, 为0时不记录
+#define CO_STATS_TRACE_EVENTS 4096
+#endif
+
+namespace yq::stats
+{
+
+inline auto now() noexcept -> std::uint64_t {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	std::uint64_t value;
+	asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+	return value;
+#else
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// 计数频率, x86上第一次调用时对照steady_clock校准约10ms
+inline auto ticks_per_second() -> double {
+	static const double frequency = []() {
+#if defined(__aarch64__) && !defined(_MSC_VER)
+		std::uint64_t value;
+		asm volatile("mrs %0, cntfrq_el0" : "=r"(value));
+		return static_cast<double>(value);
+#elif defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+		using clock = std::chrono::steady_clock;
+		const auto begin_time = clock::now();
+		const auto begin = now();
+		while (clock::now() - begin_time < std::chrono::milliseconds{ 10 }) {
+		}
+		const auto elapsed = std::chrono::duration<double>(clock::now() - begin_time).count();
+		return static_cast<double>(now() - begin) / elapsed;
+#else
+		return 1e9;
+#endif
+	}();
+	return frequency;
+}
+
+inline auto ticks_to_ns(std::uint64_t ticks) -> double {
+	return static_cast<double>(ticks) * 1e9 / ticks_per_second();
+}
+
+
+namespace detail {
+
+// 单写者计数, 不需要原子读改写
+inline void bump(std::atomic<std::uint64_t>& counter, std::uint64_t value) noexcept {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void raise(std::atomic<std::uint64_t>& counter, std::uint64_t value) noexcept {
+	if (value > counter.load(std::memory_order_relaxed)) {
+		counter.store(value, std::memory_order_relaxed);
+	}
+}
+
+} // namespace detail
+
+
+struct CoroutineSnapshot {
+	const char* name;
+	std::uint64_t resumes;
+	std::uint64_t busy_ticks;
+	std::uint64_t max_slice_ticks;
+	// 有栈协程使用过的最大栈空间(字节), Fiber和无栈协程为0
+	std::size_t peak_stack;
+};
+
+struct ThreadSnapshot {
+	std::size_t index;
+	std::thread::id id;
+	std::uint64_t resumes;
+	std::uint64_t busy_ticks;
+	std::uint64_t max_slice_ticks;
+};
+
+// 一次运行, 保存在线程的环形缓冲区中
+struct SliceEvent {
+	const void* coroutine;
+	const char* name;
+	std::uint64_t begin;
+	std::uint64_t end;
+};
+
+
+/**
+ * 线程的计数, 按缓存行对齐, 不同线程的计数不会互相干扰
+ * 线程退出后仍然保留, 可以出现在之后的快照中
+ */
+struct alignas(64) ThreadCounters {
+	void add_slice(const void* coroutine, const char* name, std::uint64_t begin,
+				   std::uint64_t end) noexcept {
+		const std::uint64_t slice = end - begin;
+		detail::bump(m_resumes, 1);
+		detail::bump(m_busy_ticks, slice);
+		detail::raise(m_max_slice_ticks, slice);
+#if CO_STATS_TRACE_EVENTS > 0
+		const std::uint64_t count = m_trace_count.load(std::memory_order_relaxed);
+		m_trace[count % m_trace.size()] = SliceEvent{ coroutine, name, begin, end };
+		m_trace_count.store(count + 1, std::memory_order_release);
+#endif
+	}
+
+	std::atomic<std::uint64_t> m_resumes{ 0 };
+	std::atomic<std::uint64_t> m_busy_ticks{ 0 };
+	std::atomic<std::uint64_t> m_max_slice_ticks{ 0 };
+	std::size_t m_index{ 0 };
+	std::thread::id m_id{ std::this_thread::get_id() };
+#if CO_STATS_TRACE_EVENTS > 0
+	alignas(64) std::atomic<std::uint64_t> m_trace_count{ 0 };
+	std::array<SliceEvent, CO_STATS_TRACE_EVENTS> m_trace{};
+#endif
+};
+
+namespace detail {
+
+struct Registry {
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<ThreadCounters>> m_threads;
+};
+
+// 不析构, 退出时仍在运行的线程可以继续访问
+inline auto registry() -> Registry& {
+	static Registry* instance = new Registry;
+	return *instance;
+}
+
+} // namespace detail
+
+CO_TLS_ACCESSOR inline auto local_thread() -> ThreadCounters& {
+	CO_TLS_BARRIER();
+	static thread_local ThreadCounters* counters = nullptr;
+	if (!counters) {
+		auto owned = std::make_unique<ThreadCounters>();
+		auto& registry = detail::registry();
+		std::lock_guard lock{ registry.m_mutex };
+		owned->m_index = registry.m_threads.size();
+		counters = registry.m_threads.emplace_back(std::move(owned)).get();
+	}
+	return *counters;
+}
+
+
+/**
+ * 一个协程的计数, 由协程对象或Task的promise持有
+ * begin_slice和end_slice成对地在同一个线程上调用, 协程迁移只发生在两次运行之间
+ */
+class CoStats {
+public:
+	void begin_slice(std::uint64_t begin) noexcept {
+		m_slice_begin = begin;
+		detail::bump(m_resumes, 1);
+	}
+
+	// await_suspend决定不挂起时继续运行, 不算一次切入
+	void restart_slice(std::uint64_t begin) noexcept {
+		m_slice_begin = begin;
+	}
+
+	void end_slice(std::uint64_t end) noexcept {
+		const std::uint64_t slice = end - m_slice_begin;
+		detail::bump(m_busy_ticks, slice);
+		detail::raise(m_max_slice_ticks, slice);
+		local_thread().add_slice(this, m_name.load(std::memory_order_relaxed), m_slice_begin, end);
+	}
+
+	void note_stack(std::size_t bytes) noexcept {
+		detail::raise(m_peak_stack, bytes);
+	}
+
+	// 名字只保存指针, 出现在快照和trace中, 需要比导出活得更久(例如字符串字面量)
+	void set_name(const char* name) noexcept {
+		m_name.store(name, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]]
+	auto snapshot(std::size_t peak_stack = 0) const noexcept -> CoroutineSnapshot {
+		const auto peak = std::max<std::uint64_t>(m_peak_stack.load(std::memory_order_relaxed),
+												  peak_stack);
+		return CoroutineSnapshot{
+			m_name.load(std::memory_order_relaxed),
+			m_resumes.load(std::memory_order_relaxed),
+			m_busy_ticks.load(std::memory_order_relaxed),
+			m_max_slice_ticks.load(std::memory_order_relaxed),
+			static_cast<std::size_t>(peak),
+		};
+	}
+
+private:
+	std::uint64_t m_slice_begin{ 0 };
+	std::atomic<std::uint64_t> m_resumes{ 0 };
+	std::atomic<std::uint64_t> m_busy_ticks{ 0 };
+	std::atomic<std::uint64_t> m_max_slice_ticks{ 0 };
+	std::atomic<std::uint64_t> m_peak_stack{ 0 };
+	std::atomic<const char*> m_name{ nullptr };
+};
+
+
+// 所有出现过的线程的计数
+inline auto snapshot() -> std::vector<ThreadSnapshot> {
+	auto& registry = detail::registry();
+	std::lock_guard lock{ registry.m_mutex };
+	std::vector<ThreadSnapshot> result;
+	result.reserve(registry.m_threads.size());
+	for (const auto& thread : registry.m_threads) {
+		result.push_back(ThreadSnapshot{
+			thread->m_index,
+			thread->m_id,
+			thread->m_resumes.load(std::memory_order_relaxed),
+			thread->m_busy_ticks.load(std::memory_order_relaxed),
+			thread->m_max_slice_ticks.load(std::memory_order_relaxed),
+		});
+	}
+	return result;
+}
+
+
+namespace detail {
+
+inline void write_json_string(std::ostream& out, const char* text) {
+	out << '"';
+	for (; *text; ++text) {
+		const char c = *text;
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			out << ' ';
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+} // namespace detail
+
+/**
+ * 以Chrome trace的JSON格式导出每个线程最近的时间片, 可以用chrome://tracing或Perfetto打开
+ * 每个时间片是一个"X"事件, tid为线程的序号, 时间从最早的时间片开始
+ * 需要在协程停止运行时调用(例如Scheduler或ThreadPoolExecutor结束后), 否则可能读到正被改写的事件
+ */
+inline void write_chrome_trace(std::ostream& out) {
+	auto& registry = detail::registry();
+	std::lock_guard lock{ registry.m_mutex };
+	std::vector<std::pair<std::size_t, SliceEvent>> events;
+#if CO_STATS_TRACE_EVENTS > 0
+	for (const auto& thread : registry.m_threads) {
+		const std::uint64_t count = thread->m_trace_count.load(std::memory_order_acquire);
+		const std::uint64_t capacity = thread->m_trace.size();
+		for (std::uint64_t i = count > capacity ? count - capacity : 0; i < count; ++i) {
+			events.emplace_back(thread->m_index, thread->m_trace[i % capacity]);
+		}
+	}
+#endif
+	std::uint64_t origin = UINT64_MAX;
+	for (const auto& [thread, event] : events) {
+		origin = std::min(origin, event.begin);
+	}
+	const double us_per_tick = 1e6 / ticks_per_second();
+	const auto flags = out.flags();
+	out << std::fixed;
+	out.precision(3);
+	out << "{\"traceEvents\":[";
+	bool first = true;
+	for (const auto& thread : registry.m_threads) {
+		out << (first ? "\n" : ",\n");
+		first = false;
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->m_index
+			<< ",\"args\":{\"name\":\"thread " << thread->m_index << "\"}}";
+	}
+	for (const auto& [thread, event] : events) {
+		out << (first ? "\n" : ",\n");
+		first = false;
+		out << "{\"name\":";
+		detail::write_json_string(out, event.name ? event.name : "coroutine");
+		out << ",\"cat\":\"coroutine\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+			<< ",\"ts\":" << static_cast<double>(event.begin - origin) * us_per_tick
+			<< ",\"dur\":" << static_cast<double>(event.end - event.begin) * us_per_tick
+			<< ",\"args\":{\"id\":\"" << event.coroutine << "\"}}";
+	}
+	out << "\n]}\n";
+	out.flags(flags);
+}
+
+
+/**
+ * 无栈协程的co_await包装, 由Task的promise通过await_transform使用
+ * 挂起时结束当前的时间片, 恢复时开始新的时间片, 其余操作转发给原来的awaiter
+ */
+template <typename Awaiter>
+struct TimedAwaiter {
+	auto await_ready() -> bool {
+		return m_awaiter.await_ready();
+	}
+
+	// 转发之后协程可能已经在其他线程上恢复, 只在await_suspend返回false时继续访问成员
+	template <typename Promise>
+	auto await_suspend(std::coroutine_handle<Promise> coroutine) {
+		using Result = decltype(m_awaiter.await_suspend(coroutine));
+		m_suspended = true;
+		m_stats.end_slice(now());
+		if constexpr (std::is_same_v<Result, bool>) {
+			if (!m_awaiter.await_suspend(coroutine)) {
+				m_suspended = false;
+				m_stats.restart_slice(now());
+				return false;
+			}
+			return true;
+		} else {
+			return m_awaiter.await_suspend(coroutine);
+		}
+	}
+
+	decltype(auto) await_resume() {
+		if (m_suspended) {
+			m_stats.begin_slice(now());
+		}
+		return m_awaiter.await_resume();
+	}
+
+	CoStats& m_stats;
+	Awaiter m_awaiter;
+	bool m_suspended{ false };
+};
+
+// 用于initial_suspend, 挂起时协程还没有开始运行, 第一次恢复时开始时间片
+struct StartAwaiter {
+	auto await_ready() const noexcept -> bool {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<>) const noexcept {}
+
+	void await_resume() const noexcept {
+		m_stats.begin_slice(now());
+	}
+
+	CoStats& m_stats;
+};
+
+namespace detail {
+
+template <typename Awaitable>
+decltype(auto) get_awaiter(Awaitable&& awaitable) {
+	if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); }) {
+		return std::forward<Awaitable>(awaitable).operator co_await();
+	} else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); }) {
+		return operator co_await(std::forward<Awaitable>(awaitable));
+	} else {
+		return std::forward<Awaitable>(awaitable);
+	}
+}
+
+} // namespace detail
+
+// 左值awaiter按引用保存, 右值移入包装
+template <typename Awaitable>
+auto timed(CoStats& stats, Awaitable&& awaitable) {
+	using Awaiter = decltype(detail::get_awaiter(std::forward<Awaitable>(awaitable)));
+	using Stored = std::conditional_t<std::is_lvalue_reference_v<Awaiter>, Awaiter,
+									  std::remove_cvref_t<Awaiter>>;
+	return TimedAwaiter<Stored>{ stats, detail::get_awaiter(std::forward<Awaitable>(awaitable)) };
+}
+
+} // namespace yq::stats
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace yq
+{
+
+/**
+ * Chase-Lev工作窃取双端队列
+ * 所有者线程在bottom端push/pop(LIFO), 其他线程在top端steal(FIFO)
+ * 内存序参考 Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * 扩容后旧数组可能仍在被窃取者读取, 保留到队列析构时再释放
+ */
+template <typename Ty>
+class WorkStealingDeque {
+	static_assert(std::is_trivially_copyable_v<Ty>,
+				  "WorkStealingDeque elements must be trivially copyable");
+
+	struct Array {
+		explicit Array(std::size_t capacity):
+			m_mask{ capacity - 1 },
+			m_data{ std::make_unique<std::atomic<Ty>[]>(capacity) }
+		{}
+
+		auto capacity() const noexcept -> std::int64_t {
+			return static_cast<std::int64_t>(m_mask + 1);
+		}
+
+		auto get(std::int64_t index) const noexcept -> Ty {
+			return m_data[static_cast<std::size_t>(index) & m_mask]
+				.load(std::memory_order_relaxed);
+		}
+
+		void put(std::int64_t index, Ty value) noexcept {
+			m_data[static_cast<std::size_t>(index) & m_mask]
+				.store(value, std::memory_order_relaxed);
+		}
+
+		std::size_t m_mask;
+		std::unique_ptr<std::atomic<Ty>[]> m_data;
+	};
+
+public:
+	// capacity 初始容量, 需要是2的幂
+	explicit WorkStealingDeque(std::size_t capacity = 256) {
+		assert((capacity & (capacity - 1)) == 0);
+		m_arrays.push_back(std::make_unique<Array>(capacity));
+		m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+	}
+
+	WorkStealingDeque(const WorkStealingDeque&) = delete;
+	WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+	// 只能由所有者线程调用
+	void push(Ty value) {
+		std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		std::int64_t top = m_top.load(std::memory_order_acquire);
+		Array* array = m_array.load(std::memory_order_relaxed);
+		if (bottom - top > array->capacity() - 1) {
+			array = grow(array, top, bottom);
+		}
+		array->put(bottom, value);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	// 只能由所有者线程调用
+	auto pop() -> std::optional<Ty> {
+		std::int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		Array* array = m_array.load(std::memory_order_relaxed);
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t top = m_top.load(std::memory_order_relaxed);
+
+		if (top > bottom) {
+			// 队列为空
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return std::nullopt;
+		}
+		Ty value = array->get(bottom);
+		if (top == bottom) {
+			// 最后一个元素, 与窃取者竞争
+			bool won = m_top.compare_exchange_strong(top, top + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed);
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			if (!won) {
+				return std::nullopt;
+			}
+		}
+		return value;
+	}
+
+	// 任意线程都可以调用, 竞争失败时返回空
+	auto steal() -> std::optional<Ty> {
+		std::int64_t top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t bottom = m_bottom.load(std::memory_order_acquire);
+		if (top >= bottom) {
+			return std::nullopt;
+		}
+		Array* array = m_array.load(std::memory_order_acquire);
+		Ty value = array->get(top);
+		if (!m_top.compare_exchange_strong(top, top + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return std::nullopt;
+		}
+		return value;
+	}
+
+	// 近似值, 只用于判断是否值得窃取
+	auto size() const noexcept -> std::size_t {
+		std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		std::int64_t top = m_top.load(std::memory_order_relaxed);
+		return bottom > top ? static_cast<std::size_t>(bottom - top) : 0;
+	}
+
+	auto empty() const noexcept -> bool {
+		return size() == 0;
+	}
+
+private:
+	auto grow(Array* old, std::int64_t top, std::int64_t bottom) -> Array* {
+		auto bigger = std::make_unique<Array>(old->m_mask * 2 + 2);
+		for (std::int64_t i = top; i < bottom; ++i) {
+			bigger->put(i, old->get(i));
+		}
+		Array* array = bigger.get();
+		m_arrays.push_back(std::move(bigger));
+		m_array.store(array, std::memory_order_release);
+		return array;
+	}
+
+	// top和bottom分别被窃取者和所有者频繁修改, 分开缓存行避免伪共享
+	alignas(64) std::atomic<std::int64_t> m_top{ 0 };
+	alignas(64) std::atomic<std::int64_t> m_bottom{ 0 };
+	alignas(64) std::atomic<Array*> m_array{ nullptr };
+	// 所有分配过的数组, 只由所有者线程修改
+	std::vector<std::unique_ptr<Array>> m_arrays;
+};
+
+} // namespace yq